@@ -24,6 +24,8 @@
 #include <stdlib.h>
 
 #define KEY_USAGE (127)
+#define KEY_REPLAY (128)
+#define KEY_REPLAY_RAW (129)
 
 static int parsePosInt(char* arg, unsigned long long* i,
                        unsigned long long limit);
@@ -35,6 +37,16 @@ const struct argp_option opts[] = {
      "from the library. If not specified, the default chip for a new "
      "connection will be used.",
      0},
+    {"replay", KEY_REPLAY, "FILE", 0,
+     "Run inferences on the frames of a recording instead of the camera. "
+     "FILE is a raw NV12 file or a directory of frame files at the stream "
+     "resolution chosen for WIDTH x HEIGHT. Needs --replay-raw. Every frame "
+     "is analyzed, as fast as possible.",
+     0},
+    {"replay-raw", KEY_REPLAY_RAW, "FILE", 0,
+     "Crop detections from the frames of a recording of RAW_WIDTH x "
+     "RAW_HEIGHT made together with the one given to --replay.",
+     0},
     {"help", 'h', NULL, 0, "Print this help text and exit.", 0},
     {"usage", KEY_USAGE, NULL, 0, "Print short usage message and exit.", 0},
     {0}};
@@ -78,6 +90,12 @@ int parseOpt(int key, char* arg, struct argp_state* state) {
         args->chip = (larodChip) chip;
         break;
     }
+    case KEY_REPLAY:
+        args->replayFile = arg;
+        break;
+    case KEY_REPLAY_RAW:
+        args->replayRawFile = arg;
+        break;
     case 'h':
         argp_state_help(state, stdout, ARGP_HELP_STD_HELP);
         break;
@@ -145,11 +163,16 @@ int parseOpt(int key, char* arg, struct argp_state* state) {
         args->chip = 0;
         args->modelFile = NULL;
         args->labelsFile = NULL;
+        args->replayFile = NULL;
+        args->replayRawFile = NULL;
         break;
     case ARGP_KEY_END:
         if (state->arg_num != 8) {
             argp_error(state, "Invalid number of arguments given");
         }
+        if (!args->replayFile != !args->replayRawFile) {
+            argp_error(state, "--replay and --replay-raw must be given together");
+        }
         break;
     default:
         return ARGP_ERR_UNKNOWN;
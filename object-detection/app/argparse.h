@@ -34,6 +34,8 @@ typedef struct args_t {
     unsigned raw_height;
     unsigned threshold;
     larodChip chip;
+    char* replayFile;
+    char* replayRawFile;
 } args_t;
 
 bool parseArgs(int argc, char** argv, args_t* args);
@@ -0,0 +1,207 @@
+/**
+ * Copyright (C) 2021, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file handles pairing frames of two streams by capture time.
+ */
+
+#include "framepair.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+struct ImgFramePair {
+    ImgConsumer_t* low;
+    ImgConsumer_t* high;
+    uint64_t toleranceUs;
+    /// Set if both providers replay recordings, which hold no capture times.
+    /// Frames are then matched by their position in the recordings.
+    bool bySequence;
+};
+
+/**
+ * brief Time of a frame held by a consumer, as compared when matching.
+ *
+ * param pair Pointer to an ImgFramePair.
+ * param consumer Pointer to the ImgConsumer holding the frame.
+ * param buffer Frame to look up.
+ * return Capture time in microseconds, or the sequence number if matching
+ *        by sequence, 0 if unknown.
+ */
+static uint64_t frameTime(ImgFramePair_t* pair, ImgConsumer_t* consumer,
+                          VdoBuffer* buffer) {
+    ImgFrameInfo_t info;
+    if (!getConsumerFrameInfo(consumer, buffer, &info)) {
+        return 0;
+    }
+
+    return pair->bySequence ? info.sequenceNbr : info.captureTimeUs;
+}
+
+static uint64_t timeDiff(uint64_t a, uint64_t b) {
+    return a > b ? a - b : b - a;
+}
+
+/**
+ * brief Milliseconds left until a deadline.
+ *
+ * param deadlineMs Deadline in CLOCK_MONOTONIC milliseconds, or negative
+ *                  for no deadline.
+ * return Milliseconds left, at least 0, or -1 if there is no deadline.
+ */
+static int remainingMs(int64_t deadlineMs) {
+    if (deadlineMs < 0) {
+        return -1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t left = deadlineMs - ((int64_t) now.tv_sec * 1000 +
+                                 now.tv_nsec / 1000000);
+
+    return left > 0 ? (int) left : 0;
+}
+
+/**
+ * brief Keep a high resolution frame if it is closer to the low resolution
+ * frame than the one kept so far, and hand the other one back.
+ *
+ * param pair Pointer to an ImgFramePair.
+ * param candidate High resolution frame to consider.
+ * param lowTime Capture time of the low resolution frame.
+ * param high Kept high resolution frame, or NULL.
+ * param highTime Capture time of the kept frame.
+ */
+static void considerHighFrame(ImgFramePair_t* pair, VdoBuffer* candidate,
+                              uint64_t lowTime, VdoBuffer** high,
+                              uint64_t* highTime) {
+    uint64_t candidateTime = frameTime(pair, pair->high, candidate);
+
+    if (*high &&
+        timeDiff(candidateTime, lowTime) >= timeDiff(*highTime, lowTime)) {
+        returnConsumerFrame(pair->high, candidate);
+        return;
+    }
+
+    if (*high) {
+        returnConsumerFrame(pair->high, *high);
+    }
+    *high = candidate;
+    *highTime = candidateTime;
+}
+
+ImgFramePair_t* createImgFramePair(ImgProvider_t* low, ImgProvider_t* high,
+                                   unsigned int toleranceUs) {
+    ImgFramePair_t* pair = calloc(1, sizeof(ImgFramePair_t));
+    if (!pair) {
+        syslog(LOG_ERR, "%s: Unable to allocate ImgFramePair: %s", __func__,
+               strerror(errno));
+        return NULL;
+    }
+
+    // Frames recorded together are at the same position in both recordings.
+    pair->bySequence = low->replay && high->replay;
+    pair->toleranceUs = pair->bySequence ? 0 : toleranceUs;
+
+    // Only the newest low resolution frame is interesting, a second one
+    // would be older than one already passed over.
+    pair->low = subscribeImgProvider(low, 1, IMG_DROP_OLDEST);
+    pair->high = subscribeImgProvider(high, 2, IMG_DROP_OLDEST);
+    if (!pair->low || !pair->high) {
+        syslog(LOG_ERR, "%s: Unable to subscribe to providers", __func__);
+        free(pair);
+        return NULL;
+    }
+
+    return pair;
+}
+
+void destroyImgFramePair(ImgFramePair_t* pair) {
+    free(pair);
+}
+
+bool getFramePair(ImgFramePair_t* pair, int timeoutMs, VdoBuffer** lowBuffer,
+                  VdoBuffer** highBuffer) {
+    int64_t deadlineMs = -1;
+    if (timeoutMs >= 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        deadlineMs = (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000 +
+                     timeoutMs;
+    }
+
+    VdoBuffer* low = NULL;
+    VdoBuffer* high = NULL;
+    uint64_t lowTime = 0;
+    uint64_t highTime = 0;
+
+    while (true) {
+        if (!low) {
+            low = getConsumerFrameTimeout(pair->low, remainingMs(deadlineMs));
+            if (!low) {
+                break;
+            }
+            lowTime = frameTime(pair, pair->low, low);
+        }
+
+        // Keep the closest of the high resolution frames that have arrived,
+        // and hand the others back right away.
+        VdoBuffer* candidate;
+        while ((candidate = getConsumerFrameTimeout(pair->high, 0))) {
+            considerHighFrame(pair, candidate, lowTime, &high, &highTime);
+        }
+
+        if (high && timeDiff(highTime, lowTime) <= pair->toleranceUs) {
+            *lowBuffer = low;
+            *highBuffer = high;
+            return true;
+        }
+
+        if (high && highTime > lowTime) {
+            // The low resolution frame is too old to ever be matched, try
+            // the next one.
+            returnConsumerFrame(pair->low, low);
+            low = NULL;
+            continue;
+        }
+
+        // The matching high resolution frame has not arrived yet.
+        candidate = getConsumerFrameTimeout(pair->high, remainingMs(deadlineMs));
+        if (!candidate) {
+            break;
+        }
+        considerHighFrame(pair, candidate, lowTime, &high, &highTime);
+    }
+
+    if (low) {
+        returnConsumerFrame(pair->low, low);
+    }
+    if (high) {
+        returnConsumerFrame(pair->high, high);
+    }
+
+    return false;
+}
+
+void returnFramePair(ImgFramePair_t* pair, VdoBuffer* lowBuffer,
+                     VdoBuffer* highBuffer) {
+    returnConsumerFrame(pair->low, lowBuffer);
+    returnConsumerFrame(pair->high, highBuffer);
+}
@@ -0,0 +1,93 @@
+/**
+ * Copyright (C) 2021, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file handles pairing frames of two streams by capture time.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "imgprovider.h"
+
+/**
+ * brief A type representing frames of two ImgProviders delivered in pairs
+ * captured at the same time, e.g. a low resolution stream for inference and
+ * a high resolution stream to crop detections from.
+ *
+ * The pair subscribes one consumer to each provider. The low resolution
+ * consumer only keeps the latest frame, the high resolution one the latest
+ * two to match against. Matching is done in the thread asking for a pair,
+ * and high resolution frames that do not match are handed back at once.
+ * Recordings hold no capture times, so if both providers replay recordings
+ * frames are instead matched by their position in the recordings.
+ */
+typedef struct ImgFramePair ImgFramePair_t;
+
+/**
+ * brief Create a frame pair on two providers.
+ *
+ * Must be called before startFrameFetch() on either provider. The providers
+ * are typically created with numFrames 0, as the pair is their only user.
+ *
+ * param low Pointer to the ImgProvider whose frames drive the pairing.
+ * param high Pointer to the ImgProvider to match frames from.
+ * param toleranceUs Largest difference in capture time of a pair, in
+ *                   microseconds.
+ * return Pointer to new ImgFramePair, or NULL if failed.
+ */
+ImgFramePair_t* createImgFramePair(ImgProvider_t* low, ImgProvider_t* high,
+                                   unsigned int toleranceUs);
+
+/**
+ * brief Deallocate a frame pair.
+ *
+ * The consumers stay subscribed until the providers are destroyed.
+ *
+ * param pair Pointer to ImgFramePair to be destroyed. Can be NULL.
+ */
+void destroyImgFramePair(ImgFramePair_t* pair);
+
+/**
+ * brief Get the latest low resolution frame with a matching high resolution
+ * frame.
+ *
+ * Low resolution frames without a high resolution frame within the
+ * tolerance are skipped. Must only be called from one thread per pair.
+ *
+ * param pair Pointer to an ImgFramePair.
+ * param timeoutMs Longest time to wait in milliseconds, or negative to wait
+ *                 until a pair is found or fetching stops.
+ * param lowBuffer Frame of the low resolution provider.
+ * param highBuffer Frame of the high resolution provider.
+ * return False if no pair was found in time or fetching stopped, otherwise
+ *        true.
+ */
+bool getFramePair(ImgFramePair_t* pair, int timeoutMs, VdoBuffer** lowBuffer,
+                  VdoBuffer** highBuffer);
+
+/**
+ * brief Hand back both frames of a pair.
+ *
+ * Must be called from the thread calling getFramePair().
+ *
+ * param pair Pointer to an ImgFramePair.
+ * param lowBuffer Low resolution frame returned by getFramePair().
+ * param highBuffer High resolution frame returned by getFramePair().
+ */
+void returnFramePair(ImgFramePair_t* pair, VdoBuffer* lowBuffer,
+                     VdoBuffer* highBuffer);
@@ -0,0 +1,256 @@
+/**
+ * Copyright (C) 2021, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file handles the lock-free frame handoff.
+ *
+ * Each slot holds a frame pointer that is only ever swapped atomically, so a
+ * frame is owned by exactly one side at a time: the producer gets back
+ * whatever it overwrites and the consumer whatever it swaps out for NULL. The
+ * publish counter doubles as the futex word the consumer sleeps on.
+ */
+
+#define _GNU_SOURCE
+
+#include "framering.h"
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+struct FrameRing {
+    unsigned int numSlots;
+    _Atomic(void*)* slots;
+
+    /// Slot the producer writes next, only accessed by the producer.
+    unsigned int nextSlot;
+    /// Slot holding the most recently published frame.
+    atomic_uint newestSlot;
+    /// Number of frames published, also the futex word.
+    atomic_uint published;
+    /// Set by the consumer before sleeping on the futex, cleared by the
+    /// producer when waking it.
+    atomic_bool sleeping;
+    atomic_bool closed;
+
+    /// Returned frames, a single producer single consumer queue written by
+    /// the consumer. Capacity is a power of two.
+    void** returned;
+    unsigned int returnedMask;
+    atomic_uint returnedHead;
+    atomic_uint returnedTail;
+};
+
+static void futexWait(atomic_uint* word, unsigned int expected,
+                      const struct timespec* timeout) {
+    // Returns at once if the word no longer holds the expected value, and
+    // spurious wakeups are handled by the caller's loop.
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+}
+
+static int64_t monotonicTimeNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void futexWake(atomic_uint* word) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);
+}
+
+FrameRing_t* createFrameRing(unsigned int numSlots, unsigned int maxReturned) {
+    if (numSlots == 0 || maxReturned == 0) {
+        syslog(LOG_ERR, "%s: Invalid arguments", __func__);
+        return NULL;
+    }
+
+    FrameRing_t* ring = calloc(1, sizeof(FrameRing_t));
+    if (!ring) {
+        syslog(LOG_ERR, "%s: Unable to allocate FrameRing: %s", __func__,
+               strerror(errno));
+        return NULL;
+    }
+
+    unsigned int capacity = 1;
+    while (capacity < maxReturned) {
+        capacity *= 2;
+    }
+
+    ring->numSlots = numSlots;
+    ring->slots = calloc(numSlots, sizeof(*ring->slots));
+    ring->returnedMask = capacity - 1;
+    ring->returned = calloc(capacity, sizeof(*ring->returned));
+    if (!ring->slots || !ring->returned) {
+        syslog(LOG_ERR, "%s: Unable to allocate slots: %s", __func__,
+               strerror(errno));
+        destroyFrameRing(ring);
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < numSlots; i++) {
+        atomic_init(&ring->slots[i], NULL);
+    }
+    atomic_init(&ring->newestSlot, 0);
+    atomic_init(&ring->published, 0);
+    atomic_init(&ring->sleeping, false);
+    atomic_init(&ring->closed, false);
+    atomic_init(&ring->returnedHead, 0);
+    atomic_init(&ring->returnedTail, 0);
+
+    return ring;
+}
+
+void destroyFrameRing(FrameRing_t* ring) {
+    if (!ring) {
+        return;
+    }
+
+    free(ring->slots);
+    free(ring->returned);
+    free(ring);
+}
+
+/**
+ * brief Announce a frame just stored in a slot and wake the consumer.
+ *
+ * param ring Pointer to a FrameRing.
+ * param slot Slot holding the new frame.
+ */
+static void announceFrame(FrameRing_t* ring, unsigned int slot) {
+    ring->nextSlot = slot + 1 < ring->numSlots ? slot + 1 : 0;
+    atomic_store_explicit(&ring->newestSlot, slot, memory_order_relaxed);
+    // Sequentially consistent with the consumer's sleeping flag, so either
+    // the consumer sees the new count or the producer sees the flag. Only the
+    // first frame after the consumer went to sleep costs a system call.
+    atomic_fetch_add(&ring->published, 1);
+    if (atomic_exchange(&ring->sleeping, false)) {
+        futexWake(&ring->published);
+    }
+}
+
+void* pushFrameRing(FrameRing_t* ring, void* frame) {
+    unsigned int slot = ring->nextSlot;
+
+    void* displaced = atomic_exchange_explicit(&ring->slots[slot], frame,
+                                               memory_order_acq_rel);
+    announceFrame(ring, slot);
+
+    return displaced;
+}
+
+bool offerFrameRing(FrameRing_t* ring, void* frame) {
+    unsigned int slot = ring->nextSlot;
+    void* expected = NULL;
+
+    if (!atomic_compare_exchange_strong_explicit(&ring->slots[slot], &expected,
+                                                 frame, memory_order_acq_rel,
+                                                 memory_order_relaxed)) {
+        return false;
+    }
+    announceFrame(ring, slot);
+
+    return true;
+}
+
+void* reclaimFrameRing(FrameRing_t* ring) {
+    unsigned int head =
+        atomic_load_explicit(&ring->returnedHead, memory_order_relaxed);
+    unsigned int tail =
+        atomic_load_explicit(&ring->returnedTail, memory_order_acquire);
+
+    if (head == tail) {
+        return NULL;
+    }
+
+    void* frame = ring->returned[head & ring->returnedMask];
+    atomic_store_explicit(&ring->returnedHead, head + 1, memory_order_release);
+
+    return frame;
+}
+
+void* popFrameRing(FrameRing_t* ring) {
+    return popFrameRingTimeout(ring, -1);
+}
+
+void* popFrameRingTimeout(FrameRing_t* ring, int timeoutMs) {
+    int64_t deadline =
+        timeoutMs > 0 ? monotonicTimeNs() + (int64_t) timeoutMs * 1000000 : 0;
+
+    while (!atomic_load(&ring->closed)) {
+        unsigned int published = atomic_load(&ring->published);
+        unsigned int slot =
+            atomic_load_explicit(&ring->newestSlot, memory_order_relaxed);
+
+        // Newest first. A slot the producer overwrites while we scan holds
+        // an even newer frame, which is just as good.
+        for (unsigned int i = 0; i < ring->numSlots; i++) {
+            void* frame = atomic_exchange_explicit(&ring->slots[slot], NULL,
+                                                   memory_order_acq_rel);
+            if (frame) {
+                return frame;
+            }
+            slot = slot > 0 ? slot - 1 : ring->numSlots - 1;
+        }
+
+        struct timespec remaining;
+        struct timespec* timeout = NULL;
+        if (timeoutMs >= 0) {
+            int64_t left = deadline - monotonicTimeNs();
+            if (left <= 0) {
+                return NULL;
+            }
+            remaining.tv_sec = left / 1000000000;
+            remaining.tv_nsec = left % 1000000000;
+            timeout = &remaining;
+        }
+
+        atomic_store(&ring->sleeping, true);
+        futexWait(&ring->published, published, timeout);
+        atomic_store_explicit(&ring->sleeping, false, memory_order_relaxed);
+    }
+
+    return NULL;
+}
+
+bool returnFrameRing(FrameRing_t* ring, void* frame) {
+    unsigned int tail =
+        atomic_load_explicit(&ring->returnedTail, memory_order_relaxed);
+    unsigned int head =
+        atomic_load_explicit(&ring->returnedHead, memory_order_acquire);
+
+    if (tail - head > ring->returnedMask) {
+        return false;
+    }
+
+    ring->returned[tail & ring->returnedMask] = frame;
+    atomic_store_explicit(&ring->returnedTail, tail + 1, memory_order_release);
+
+    return true;
+}
+
+void closeFrameRing(FrameRing_t* ring) {
+    atomic_store(&ring->closed, true);
+    atomic_fetch_add(&ring->published, 1);
+    futexWake(&ring->published);
+}
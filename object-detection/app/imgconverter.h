@@ -20,11 +20,39 @@
 
 #pragma once
 
-#include <arm_neon.h>
 #include <stdbool.h>
+#include <stddef.h>
 
+#include "rowpool.h"
 #include "stdint.h"
 
+/**
+ * brief Memory layout of an NV12 image in its buffer.
+ *
+ * Hardware buffers are often allocated with rows padded to an aligned pitch,
+ * and the UV plane does not have to follow the Y plane directly. Functions
+ * taking a layout accept NULL for tightly packed planes, i.e. both pitches
+ * equal to the width and the UV plane directly after the Y plane.
+ */
+typedef struct {
+    /// Byte offsets of the Y and UV planes from the start of the buffer.
+    size_t yOffset;
+    size_t uvOffset;
+    /// Bytes between the starts of two consecutive rows of each plane.
+    unsigned int yPitch;
+    unsigned int uvPitch;
+} ImgNv12Layout_t;
+
+/**
+ * brief Initialize a layout for tightly packed NV12 planes.
+ *
+ * param layout Layout to initialize.
+ * param width Image width in pixels.
+ * param height Image height in pixels.
+ */
+void initImgNv12Layout(ImgNv12Layout_t* layout, unsigned int width,
+                       unsigned int height);
+
 /**
  * brief Converts an input NV12 image to float interleaved RGB.
  *
@@ -32,51 +60,511 @@
  * outCenter. Example: if output range should be -2.0 to -6.0 we
  * provide outSwing = 4.0 and outCenter = -4.0.
  *
+ * Color conversion is done in fixed-point and the RGB values are quantized
+ * to 8 bits before they are mapped to the output range.
+ *
  * param width Width of input image.
  * param height Height of input image.
  * param inBuffer Memory address to start of input image buffer.
+ * param layout Plane layout of the input buffer, or NULL if packed.
  * param outBuffer Memory address to start of output image buffer.
  * param outSwing Max per pixel distance from outCenter in output image.
  * param outCenter Conceptual mean of pixel values in output image.
+ * param pool Worker pool to split the rows over, or NULL to convert on the
+ *             calling thread only.
  */
 void convertU8yuvToFloat32RGB(unsigned int width, unsigned int height,
-                              uint8_t* inBuffer, float* outBuffer,
-                              float outSwing, float outCenter);
+                              uint8_t* inBuffer,
+                              const ImgNv12Layout_t* layout, float* outBuffer,
+                              float outSwing, float outCenter,
+                              RowPool_t* pool);
+
+/**
+ * brief Converts an input NV12 image to normalized float interleaved RGB.
+ *
+ * Each output channel is (rgb - mean[c]) / std[c], where rgb is the 8-bit
+ * (0..255) color value. Color conversion, normalization and clamping are
+ * done in a single pass, using NEON or SSE2 when available.
+ *
+ * param width Width of input image.
+ * param height Height of input image.
+ * param inBuffer Memory address to start of input image buffer.
+ * param layout Plane layout of the input buffer, or NULL if packed.
+ * param outBuffer Memory address to start of output image buffer.
+ * param mean Per channel (R, G, B) mean to subtract.
+ * param std Per channel (R, G, B) standard deviation to divide by.
+ * param pool Worker pool to split the rows over, or NULL to convert on the
+ *             calling thread only.
+ */
+void convertU8yuvToFloat32RGBNormalized(unsigned int width,
+                                        unsigned int height,
+                                        const uint8_t* inBuffer,
+                                        const ImgNv12Layout_t* layout,
+                                        float* outBuffer, const float mean[3],
+                                        const float std[3], RowPool_t* pool);
 
 /**
  * brief Converts an input NV12 image to uint8 RGB.
  *
  * There is one 'naive' implementation in unoptimized C code and one
- * more optimized implementation using libYuv.
+ * more optimized implementation using libYuv. The libYuv implementation
+ * can split the rows over a worker pool.
  * param width Width of input image.
  * param height Height of input image.
  * param yuvIn Memory address to start of input image buffer.
+ * param layout Plane layout of the input buffer, or NULL if packed.
  * param rgbOut Memory address to start of output image buffer.
+ * param pool Worker pool to split the rows over, or NULL (libYuv only).
  */
 void convertU8yuvToRGBlibYuv(unsigned int width, unsigned int height,
-                             uint8_t* yuvIn, uint8_t* rgbOut);
+                             uint8_t* yuvIn, const ImgNv12Layout_t* layout,
+                             uint8_t* rgbOut, RowPool_t* pool);
 void convertU8yuvToRGBnaive(unsigned int width, unsigned int height,
-                            uint8_t* yuvIn, uint8_t* rgbOut);
+                            uint8_t* yuvIn, const ImgNv12Layout_t* layout,
+                            uint8_t* rgbOut);
+
+/**
+ * brief YUV to RGB conversion matrix.
+ */
+typedef enum {
+    /// ITU-R BT.601, used for SD video and by libyuv NV12ToRAW().
+    IMG_MATRIX_BT601 = 0,
+    /// ITU-R BT.709, used for HD video.
+    IMG_MATRIX_BT709,
+} ImgColorMatrix;
+
+/**
+ * brief Value range of the YUV input.
+ */
+typedef enum {
+    /// Limited (video) range, Y in 16..235 and U/V in 16..240.
+    IMG_RANGE_LIMITED = 0,
+    /// Full range, Y, U and V in 0..255.
+    IMG_RANGE_FULL,
+} ImgColorRange;
+
+/**
+ * brief Converts an input NV12 image to uint8 RGB with a selectable matrix
+ * and range.
+ *
+ * Uses per component lookup tables, built once per matrix and range, so
+ * the scalar path is a few table lookups and adds per pixel. NEON is used
+ * where available.
+ *
+ * param width Width of input image.
+ * param height Height of input image.
+ * param yuvIn Memory address to start of input image buffer.
+ * param layout Plane layout of the input buffer, or NULL if packed.
+ * param rgbOut Memory address to start of output image buffer.
+ * param matrix Color matrix the camera encodes with.
+ * param range Value range of the input.
+ * param pool Worker pool to split the rows over, or NULL.
+ * return False if matrix or range is not supported, otherwise true.
+ */
+bool convertU8yuvToRGBlut(unsigned int width, unsigned int height,
+                          const uint8_t* yuvIn, const ImgNv12Layout_t* layout,
+                          uint8_t* rgbOut,
+                          ImgColorMatrix matrix, ImgColorRange range,
+                          RowPool_t* pool);
 
 /**
  * brief Convert, crop and scale image.
  *
- * 1. Converts the input NV12 image to BGRA format.
- * 2. Scale a region-of-interest to the destination size. The ROI will have
- *    same aspect ratio as dstWidht/dstHeight. While keeping this aspect ratio
- *    the ROI is expanded until it reaches srcHeight or srcWidth. Thus there
- *    will be some border cut off if the input aspect ratio is exactly the
- *    same as the output image.
- * 3. Convert the downscaled BGRA to RGB image.
+ * Scale a region-of-interest of the input NV12 image to the destination size
+ * and convert it to interleaved RGB. The ROI will have same aspect ratio as
+ * dstWidth/dstHeight. While keeping this aspect ratio the ROI is expanded
+ * until it reaches srcHeight or srcWidth. Thus there will be some border cut
+ * off if the input aspect ratio is not exactly the same as the output image.
+ *
+ * Crop, bilinear scaling and color conversion are done in a single pass:
+ * only the source pixels needed for the output are read and no full size
+ * intermediate image is produced.
  *
- * param nv12Data Pointer to start of NV12 data. UV plane is expected to be
- *                 placed directly after Y data.
+ * param nv12Data Pointer to start of NV12 data.
  * param srcWidth Source image width in pixels.
  * param srcHeight Source image height in pixels.
+ * param layout Plane layout of the source buffer, or NULL if packed.
  * param rgbData Start of output scaled RGB image.
  * param dstWidth Destination image width in pixels.
+ * param dstHeight Destination image height in pixels.
  * param False if any errors occur, otherwise true.
  */
 bool convertCropScaleU8yuvToRGB(const uint8_t* nv12Data, unsigned int srcWidth,
-                                unsigned int srcHeight, uint8_t* rgbData,
-                                unsigned int dstWidth, unsigned int dstHeight);
+                                unsigned int srcHeight,
+                                const ImgNv12Layout_t* layout,
+                                uint8_t* rgbData, unsigned int dstWidth,
+                                unsigned int dstHeight);
+
+/**
+ * brief How the source image is fitted into the destination size.
+ */
+typedef enum {
+    /// Crop the center of the source to the destination aspect ratio, as
+    /// large as possible. Borders are cut off if aspect ratios differ.
+    IMG_CROP_CENTER = 0,
+    /// Scale the full source image. The image is stretched if aspect ratios
+    /// differ.
+    IMG_CROP_FULL,
+    /// Scale the full source image keeping its aspect ratio, centered and
+    /// padded with the pad color. See getImgConverterGeometry().
+    IMG_CROP_LETTERBOX,
+} ImgCropPolicy;
+
+/**
+ * brief Memory layout of the output tensor.
+ */
+typedef enum {
+    /// Interleaved RGB, i.e. NHWC with N = 1.
+    IMG_LAYOUT_HWC = 0,
+    /// Planar RGB, i.e. NCHW with N = 1.
+    IMG_LAYOUT_CHW,
+} ImgTensorLayout;
+
+/**
+ * brief Data type of the output tensor elements.
+ */
+typedef enum {
+    IMG_DTYPE_UINT8 = 0,
+    IMG_DTYPE_INT8,
+    IMG_DTYPE_FLOAT32,
+} ImgTensorDataType;
+
+/**
+ * brief Description of the output tensor a converter writes.
+ *
+ * Each channel is first normalized from its 8-bit RGB value as
+ * (rgb - mean[c]) / std[c]. Float outputs store the normalized value, while
+ * integer outputs store round(normalized / quantScale) + quantZeroPoint,
+ * saturated to the range of the data type.
+ *
+ * Use initImgTensorDesc() to get the defaults: HWC uint8 RGB without
+ * normalization or padding.
+ */
+typedef struct ImgTensorDesc {
+    ImgTensorLayout layout;
+    ImgTensorDataType dataType;
+
+    /// Per channel (R, G, B) normalization.
+    float mean[3];
+    float std[3];
+
+    /// Quantization of integer outputs.
+    float quantScale;
+    int32_t quantZeroPoint;
+
+    /// Bytes between the start of two rows, e.g. as reported by
+    /// larodGetTensorPitches(). 0 means no padding.
+    size_t rowPitch;
+    /// Bytes between the start of two planes, only used by IMG_LAYOUT_CHW.
+    /// 0 means rowPitch * height.
+    size_t planePitch;
+} ImgTensorDesc_t;
+
+/**
+ * brief Initialize a tensor descriptor with the default output format.
+ *
+ * param desc Tensor descriptor to initialize.
+ */
+void initImgTensorDesc(ImgTensorDesc_t* desc);
+
+/**
+ * brief A type representing a converter set up for one stream geometry.
+ *
+ * Owns the precomputed crop rectangle and scaling coefficients as well as
+ * all scratch memory, so that converting a frame never allocates memory.
+ */
+typedef struct ImgConverter ImgConverter_t;
+
+/**
+ * brief Create a converter from NV12 frames to interleaved RGB.
+ *
+ * param srcWidth Source image width in pixels.
+ * param srcHeight Source image height in pixels.
+ * param dstWidth Destination image width in pixels.
+ * param dstHeight Destination image height in pixels.
+ * param cropPolicy How to fit the source into the destination size.
+ * return Pointer to new ImgConverter, or NULL if failed.
+ */
+ImgConverter_t* createImgConverter(unsigned int srcWidth,
+                                   unsigned int srcHeight,
+                                   unsigned int dstWidth,
+                                   unsigned int dstHeight,
+                                   ImgCropPolicy cropPolicy);
+
+/**
+ * brief Release scratch memory and deallocate converter.
+ *
+ * param converter Pointer to ImgConverter to be destroyed.
+ */
+void destroyImgConverter(ImgConverter_t* converter);
+
+/**
+ * brief Crop, scale and convert one frame.
+ *
+ * Does the same work as convertCropScaleU8yuvToRGB() using the geometry the
+ * converter was created for, without any memory allocation. The output is
+ * written in the format set by setImgConverterOutput(), interleaved uint8
+ * RGB by default.
+ *
+ * param converter Pointer to an ImgConverter.
+ * param nv12Data Pointer to start of NV12 data, laid out as set by
+ *                 setImgConverterSourceLayout().
+ * param outData Start of output tensor.
+ * return False if any errors occur, otherwise true.
+ */
+bool convertFrame(ImgConverter_t* converter, const uint8_t* nv12Data,
+                  uint8_t* outData);
+
+/**
+ * brief A region of interest in source pixels.
+ */
+typedef struct ImgRoi {
+    unsigned int x;
+    unsigned int y;
+    unsigned int width;
+    unsigned int height;
+} ImgRoi_t;
+
+/**
+ * brief Crop, scale and convert several regions of one frame into a batch.
+ *
+ * Each ROI is fitted into the converter's destination size using its crop
+ * policy, the same way convertFrame() fits the whole frame, and written to
+ * slot i of the batch, starting at outData + i * getImgConverterOutputSize().
+ * Only the source rows and columns each ROI touches are read, and the rows
+ * of all slots are split over the worker pool as one job. ROIs reaching
+ * outside the frame are clipped to it. ROIs that are smaller than 2x2
+ * pixels after clipping, including empty ROIs and ROIs entirely outside the
+ * frame, are grown to 2x2 pixels inside the frame, so every slot is
+ * written.
+ *
+ * Scaling taps are kept for the largest number of ROIs seen so far, so
+ * memory is only allocated when a frame has more ROIs than any before.
+ *
+ * param converter Pointer to an ImgConverter.
+ * param nv12Data Pointer to start of NV12 data, laid out as set by
+ *                 setImgConverterSourceLayout().
+ * param rois Regions to convert, numRois entries.
+ * param numRois Number of regions.
+ * param outData Start of the batched output tensor.
+ * return False if any errors occur, e.g. invalid arguments, otherwise true.
+ */
+bool convertFrameRois(ImgConverter_t* converter, const uint8_t* nv12Data,
+                      const ImgRoi_t* rois, unsigned int numRois,
+                      uint8_t* outData);
+
+/**
+ * brief Size in bytes of one output image in the converter's output format.
+ *
+ * This is the stride between slots written by convertFrameRois().
+ *
+ * param converter Pointer to an ImgConverter.
+ * return Size of one output image including pitch padding.
+ */
+size_t getImgConverterOutputSize(const ImgConverter_t* converter);
+
+/**
+ * brief Let the converter split frames into row bands over a worker pool.
+ *
+ * Allocates scratch rows for each band. The pool must outlive the converter
+ * or be replaced before it is destroyed. convertFrame() returns when all
+ * bands are done.
+ *
+ * param converter Pointer to an ImgConverter.
+ * param pool Worker pool, or NULL to convert on the calling thread only.
+ * return False if any errors occur, otherwise true. On failure the
+ *        converter keeps its previous pool.
+ */
+bool setImgConverterPool(ImgConverter_t* converter, RowPool_t* pool);
+
+/**
+ * brief Set the plane layout of the frames passed to a converter.
+ *
+ * Lets the converter read buffers with padded rows in place, e.g. VDO
+ * buffers allocated with an aligned pitch. Packed planes are assumed until
+ * this is called.
+ *
+ * param converter Pointer to an ImgConverter.
+ * param layout Plane layout of the source frames, or NULL for packed planes.
+ * return False if the pitches are smaller than the source width, otherwise
+ *        true. On failure the converter keeps its previous layout.
+ */
+bool setImgConverterSourceLayout(ImgConverter_t* converter,
+                                 const ImgNv12Layout_t* layout);
+
+/**
+ * brief Set the output tensor format of a converter.
+ *
+ * Layout, data type, normalization and quantization are all applied while
+ * writing the converted rows, so no extra pass over the tensor is needed.
+ *
+ * param converter Pointer to an ImgConverter.
+ * param desc Output tensor descriptor.
+ * return False if the descriptor is invalid or not supported, otherwise
+ *        true. On failure the converter keeps its previous output format.
+ */
+bool setImgConverterOutput(ImgConverter_t* converter,
+                           const ImgTensorDesc_t* desc);
+
+/**
+ * brief Set the YUV to RGB conversion of a converter.
+ *
+ * Pick the conversion the model was trained with to avoid a color
+ * correction pass. Default is BT.601 limited range, the same as libyuv.
+ *
+ * param converter Pointer to an ImgConverter.
+ * param matrix Color matrix.
+ * param range Value range of the input.
+ * return False if matrix or range is not supported, otherwise true.
+ */
+bool setImgConverterColor(ImgConverter_t* converter, ImgColorMatrix matrix,
+                          ImgColorRange range);
+
+/**
+ * brief Order of scaling and color conversion.
+ */
+typedef enum {
+    /// Scale Y, U and V to one sample per output pixel, then convert. Gives
+    /// the sharpest colors.
+    IMG_SCALE_FUSED = 0,
+    /// Scale to an NV12 image of the output size, then convert it. Chroma is
+    /// scaled to half the output resolution, so a quarter of the chroma
+    /// work is done. The NV12 image is not stored, rows are converted as
+    /// they are produced.
+    IMG_SCALE_NV12_FIRST,
+} ImgScalePath;
+
+/**
+ * brief Select the scaling path of a converter.
+ *
+ * param converter Pointer to an ImgConverter.
+ * param path Scaling path. Default is IMG_SCALE_FUSED.
+ * return False if any errors occur, otherwise true.
+ */
+bool setImgConverterScalePath(ImgConverter_t* converter, ImgScalePath path);
+
+/**
+ * brief Allow or forbid the fixed size kernels of a converter.
+ *
+ * The stream and model sizes listed in IMG_FIXED_KERNELS in imgconverter.c
+ * have horizontal filters with their taps fixed at compile time.
+ * convertFrame() uses them with IMG_SCALE_FUSED when the converter's taps
+ * match and the generic filters otherwise. The output is the same, so this
+ * is only useful for comparing them.
+ *
+ * param converter Pointer to an ImgConverter.
+ * param enable True to use a matching fixed kernel. Default is true.
+ * return True if convertFrame() uses a fixed kernel after the call,
+ *        otherwise false.
+ */
+bool setImgConverterFixedKernel(ImgConverter_t* converter, bool enable);
+
+/**
+ * brief Set the color used for padding with IMG_CROP_LETTERBOX.
+ *
+ * The color is given as 8-bit RGB and goes through the same normalization
+ * and quantization as the image. Default is black.
+ *
+ * param converter Pointer to an ImgConverter.
+ * param r Red value.
+ * param g Green value.
+ * param b Blue value.
+ */
+void setImgConverterPadColor(ImgConverter_t* converter, uint8_t r, uint8_t g,
+                             uint8_t b);
+
+/**
+ * brief Get the crop and padding used by a converter.
+ *
+ * The crop rectangle is scaled to the content rectangle of the output image.
+ * Everything outside the content rectangle is padding, which is only the
+ * case with IMG_CROP_LETTERBOX.
+ *
+ * param converter Pointer to an ImgConverter.
+ * param crop Output crop rectangle (x, y, w, h) in source pixels.
+ * param content Output content rectangle (x, y, w, h) in destination pixels.
+ */
+void getImgConverterGeometry(const ImgConverter_t* converter,
+                             unsigned int crop[4], unsigned int content[4]);
+
+/**
+ * brief Map a point in the output image back to the source image.
+ *
+ * Use to map e.g. detection boxes from model input coordinates to stream
+ * coordinates. Takes both crop and padding into account.
+ *
+ * param converter Pointer to an ImgConverter.
+ * param dstX X coordinate in destination pixels.
+ * param dstY Y coordinate in destination pixels.
+ * param srcX Output X coordinate in source pixels.
+ * param srcY Output Y coordinate in source pixels.
+ */
+void mapImgConverterPoint(const ImgConverter_t* converter, float dstX,
+                          float dstY, float* srcX, float* srcY);
+
+/**
+ * brief A type representing a scaler from NV12 frames to smaller NV12
+ * images, e.g. for motion detection or snapshots.
+ *
+ * Uses the same bilinear taps as the converter. Like the converter it owns
+ * all scratch memory, so scaling a frame never allocates memory.
+ */
+typedef struct ImgNv12Scaler ImgNv12Scaler_t;
+
+/**
+ * brief Create a scaler from NV12 frames to smaller NV12 images.
+ *
+ * param srcWidth Source image width in pixels.
+ * param srcHeight Source image height in pixels.
+ * param dstWidth Destination image width in pixels, must be even.
+ * param dstHeight Destination image height in pixels, must be even.
+ * param cropPolicy IMG_CROP_CENTER or IMG_CROP_FULL. Padding is not
+ *                   supported.
+ * return Pointer to new ImgNv12Scaler, or NULL if failed.
+ */
+ImgNv12Scaler_t* createImgNv12Scaler(unsigned int srcWidth,
+                                     unsigned int srcHeight,
+                                     unsigned int dstWidth,
+                                     unsigned int dstHeight,
+                                     ImgCropPolicy cropPolicy);
+
+/**
+ * brief Release scratch memory and deallocate scaler.
+ *
+ * param scaler Pointer to ImgNv12Scaler to be destroyed. Can be NULL.
+ */
+void destroyImgNv12Scaler(ImgNv12Scaler_t* scaler);
+
+/**
+ * brief Let the scaler split frames into row bands over a worker pool.
+ *
+ * param scaler Pointer to an ImgNv12Scaler.
+ * param pool Worker pool, or NULL to scale on the calling thread only.
+ * return False if any errors occur, otherwise true. On failure the scaler
+ *        keeps its previous pool.
+ */
+bool setImgNv12ScalerPool(ImgNv12Scaler_t* scaler, RowPool_t* pool);
+
+/**
+ * brief Set the plane layout of the frames passed to a scaler.
+ *
+ * param scaler Pointer to an ImgNv12Scaler.
+ * param layout Plane layout of the source frames, or NULL for packed planes.
+ * return False if the pitches are smaller than the source width, otherwise
+ *        true. On failure the scaler keeps its previous layout.
+ */
+bool setImgNv12ScalerSourceLayout(ImgNv12Scaler_t* scaler,
+                                  const ImgNv12Layout_t* layout);
+
+/**
+ * brief Crop and scale one NV12 frame to NV12.
+ *
+ * param scaler Pointer to an ImgNv12Scaler.
+ * param srcData Pointer to start of NV12 data, laid out as set by
+ *                setImgNv12ScalerSourceLayout().
+ * param dstData Output NV12 image, dstWidth x dstHeight Y samples followed
+ *                by the interleaved UV plane, without row padding.
+ * return False if any errors occur, otherwise true.
+ */
+bool scaleNv12Frame(ImgNv12Scaler_t* scaler, const uint8_t* srcData,
+                    uint8_t* dstData);
@@ -0,0 +1,280 @@
+/**
+ * Copyright (C) 2021, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file handles running a larod model on a set of tensors.
+ *
+ * Everything larod reports about a tensor is read once when the session is
+ * created, so nothing but the inference itself goes to larod per frame.
+ */
+
+#include "modelsession.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+struct ModelSession {
+    larodTensor** inputTensors;
+    size_t numInputs;
+    larodTensor** outputTensors;
+    size_t numOutputs;
+    larodInferenceRequest* infReq;
+    /// Buffers backing the tensors, inputs first.
+    TensorBuffer_t** buffers;
+    ModelTensorView_t* inputs;
+    ModelTensorView_t* outputs;
+    /// Pool the buffers came from.
+    TensorPool_t* pool;
+};
+
+/**
+ * brief Back a tensor by a buffer from the pool and describe it.
+ *
+ * param tensor Tensor to back.
+ * param pool Pool to take the buffer from.
+ * param buffer Output buffer backing the tensor.
+ * param view Output view of the tensor.
+ * return False if any errors occur, otherwise true.
+ */
+static bool setupTensor(larodTensor* tensor, TensorPool_t* pool,
+                        TensorBuffer_t** buffer, ModelTensorView_t* view) {
+    larodError* error = NULL;
+    bool ret = false;
+
+    view->dataType = larodGetTensorDataType(tensor, &error);
+    if (view->dataType == LAROD_TENSOR_DATA_TYPE_INVALID) {
+        syslog(LOG_ERR, "%s: Failed getting tensor data type: %s", __func__,
+               error ? error->msg : "invalid");
+        goto end;
+    }
+    view->layout = larodGetTensorLayout(tensor, &error);
+    if (view->layout == LAROD_TENSOR_LAYOUT_INVALID) {
+        syslog(LOG_ERR, "%s: Failed getting tensor layout: %s", __func__,
+               error ? error->msg : "invalid");
+        goto end;
+    }
+    const larodTensorDims* dims = larodGetTensorDims(tensor, &error);
+    if (!dims) {
+        syslog(LOG_ERR, "%s: Failed getting tensor dims: %s", __func__,
+               error->msg);
+        goto end;
+    }
+    view->dims = *dims;
+    const larodTensorPitches* pitches = larodGetTensorPitches(tensor, &error);
+    if (!pitches) {
+        syslog(LOG_ERR, "%s: Failed getting tensor pitches: %s", __func__,
+               error->msg);
+        goto end;
+    }
+    view->pitches = *pitches;
+
+    view->numElements = view->dims.len ? 1 : 0;
+    for (size_t i = 0; i < view->dims.len; i++) {
+        view->numElements *= view->dims.dims[i];
+    }
+
+    *buffer = getBoundTensorBuffer(pool, tensor);
+    if (!*buffer) {
+        goto end;
+    }
+    view->data = (*buffer)->addr;
+    view->size = (*buffer)->size;
+
+    ret = true;
+
+end:
+    larodClearError(&error);
+
+    return ret;
+}
+
+ModelSession_t* createModelSession(const larodModel* model, TensorPool_t* pool) {
+    larodError* error = NULL;
+
+    ModelSession_t* session = calloc(1, sizeof(ModelSession_t));
+    if (!session) {
+        syslog(LOG_ERR, "%s: Unable to allocate ModelSession: %s", __func__,
+               strerror(errno));
+        return NULL;
+    }
+    session->pool = pool;
+
+    session->inputTensors =
+        larodCreateModelInputs(model, &session->numInputs, &error);
+    if (!session->inputTensors) {
+        syslog(LOG_ERR, "%s: Failed retrieving input tensors: %s", __func__,
+               error->msg);
+        goto error;
+    }
+    session->outputTensors =
+        larodCreateModelOutputs(model, &session->numOutputs, &error);
+    if (!session->outputTensors) {
+        syslog(LOG_ERR, "%s: Failed retrieving output tensors: %s", __func__,
+               error->msg);
+        goto error;
+    }
+
+    if (session->numInputs == 0 || session->numOutputs == 0) {
+        syslog(LOG_ERR, "%s: Model has %zu inputs and %zu outputs", __func__,
+               session->numInputs, session->numOutputs);
+        goto error;
+    }
+
+    size_t numTensors = session->numInputs + session->numOutputs;
+    session->buffers = calloc(numTensors, sizeof(TensorBuffer_t*));
+    session->inputs = calloc(session->numInputs, sizeof(ModelTensorView_t));
+    session->outputs = calloc(session->numOutputs, sizeof(ModelTensorView_t));
+    if (!session->buffers || !session->inputs || !session->outputs) {
+        syslog(LOG_ERR, "%s: Unable to allocate tensor views: %s", __func__,
+               strerror(errno));
+        goto error;
+    }
+
+    for (size_t i = 0; i < session->numInputs; i++) {
+        if (!setupTensor(session->inputTensors[i], pool, &session->buffers[i],
+                         &session->inputs[i])) {
+            goto error;
+        }
+    }
+    for (size_t i = 0; i < session->numOutputs; i++) {
+        if (!setupTensor(session->outputTensors[i], pool,
+                         &session->buffers[session->numInputs + i],
+                         &session->outputs[i])) {
+            goto error;
+        }
+    }
+
+    session->infReq = larodCreateInferenceRequest(
+        model, session->inputTensors, session->numInputs,
+        session->outputTensors, session->numOutputs, &error);
+    if (!session->infReq) {
+        syslog(LOG_ERR, "%s: Failed creating inference request: %s", __func__,
+               error->msg);
+        goto error;
+    }
+
+    syslog(LOG_INFO, "%s: Model has %zu input and %zu output tensors",
+           __func__, session->numInputs, session->numOutputs);
+
+    return session;
+
+error:
+    larodClearError(&error);
+    destroyModelSession(session);
+
+    return NULL;
+}
+
+void destroyModelSession(ModelSession_t* session) {
+    if (!session) {
+        return;
+    }
+
+    if (session->buffers) {
+        for (size_t i = 0; i < session->numInputs + session->numOutputs; i++) {
+            releaseTensorBuffer(session->pool, session->buffers[i]);
+        }
+    }
+    larodDestroyInferenceRequest(&session->infReq);
+    larodDestroyTensors(&session->inputTensors, session->numInputs);
+    larodDestroyTensors(&session->outputTensors, session->numOutputs);
+
+    free(session->buffers);
+    free(session->inputs);
+    free(session->outputs);
+    free(session);
+}
+
+size_t getSessionNumInputs(const ModelSession_t* session) {
+    return session->numInputs;
+}
+
+size_t getSessionNumOutputs(const ModelSession_t* session) {
+    return session->numOutputs;
+}
+
+const ModelTensorView_t* getSessionInput(const ModelSession_t* session,
+                                         size_t index) {
+    if (index >= session->numInputs) {
+        syslog(LOG_ERR, "%s: Model has %zu inputs, no input %zu", __func__,
+               session->numInputs, index);
+        return NULL;
+    }
+
+    return &session->inputs[index];
+}
+
+const ModelTensorView_t* getSessionOutput(const ModelSession_t* session,
+                                          size_t index) {
+    if (index >= session->numOutputs) {
+        syslog(LOG_ERR, "%s: Model has %zu outputs, no output %zu", __func__,
+               session->numOutputs, index);
+        return NULL;
+    }
+
+    return &session->outputs[index];
+}
+
+const void* getSessionOutputData(const ModelSession_t* session, size_t index,
+                                 larodTensorDataType dataType,
+                                 size_t* numElements) {
+    const ModelTensorView_t* view = getSessionOutput(session, index);
+    if (!view) {
+        return NULL;
+    }
+    if (view->dataType != dataType) {
+        syslog(LOG_ERR, "%s: Output %zu has data type %d, expected %d",
+               __func__, index, view->dataType, dataType);
+        return NULL;
+    }
+    if (numElements) {
+        *numElements = view->numElements;
+    }
+
+    return view->data;
+}
+
+bool runModelSession(ModelSession_t* session, larodConnection* conn) {
+    larodError* error = NULL;
+
+    if (!larodRunInference(conn, session->infReq, &error)) {
+        syslog(LOG_ERR, "%s: Unable to run inference: %s (%d)", __func__,
+               error->msg, error->code);
+        larodClearError(&error);
+
+        return false;
+    }
+
+    return true;
+}
+
+bool startModelSession(ModelSession_t* session, larodConnection* conn,
+                       larodRunInferenceCallback callback, void* userData) {
+    larodError* error = NULL;
+
+    if (!larodRunInferenceAsync(conn, session->infReq, callback, userData,
+                                &error)) {
+        syslog(LOG_ERR, "%s: Unable to start inference: %s (%d)", __func__,
+               error->msg, error->code);
+        larodClearError(&error);
+
+        return false;
+    }
+
+    return true;
+}
@@ -41,13 +41,14 @@
   * 
   * Eighth argument, LABELSFILE, is a string describing path to the label txt.
   * 
+  * With --replay and --replay-raw the frames are read from two recordings
+  * made together instead of from the camera.
   */
 
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -55,10 +56,13 @@
 #include <unistd.h>
 
 #include "argparse.h"
+#include "framepair.h"
 #include "imgconverter.h"
 #include "imgprovider.h"
 #include "imgutils.h"
 #include "larod.h"
+#include "modelsession.h"
+#include "tensorpool.h"
 #include "vdo-frame.h"
 #include "vdo-types.h"
 
@@ -211,6 +215,10 @@ end:
     return ret;
 }
 
+/// Largest difference in capture time between the inference frame and the
+/// frame detections are cropped from, in microseconds.
+#define PAIR_TOLERANCE_US (5000)
+
 /// Set by signal handler if an interrupt signal sent to process.
 /// Indicates that app should stop asap and exit gracefully.
 volatile sig_atomic_t stopRunning = false;
@@ -236,66 +244,6 @@ void sigintHandler(int sig) {
     stopRunning = true;
 }
 
-/**
- * @brief Creates a temporary fd and truncated to correct size and mapped.
- *
- * This convenience function creates temp files to be used for input and output.
- *
- * @param fileName Pattern for how the temp file will be named in file system.
- * @param fileSize How much space needed to be allocated (truncated) in fd.
- * @param mappedAddr Pointer to the address of the fd mapped for this process.
- * @param Pointer to the generated fd.
- * @return Positive errno style return code (zero means success).
- */
-bool createAndMapTmpFile(char* fileName, size_t fileSize, void** mappedAddr,
-                         int* convFd) {
-    syslog(LOG_INFO, "%s: Setting up a temp fd with pattern %s and size %zu", __func__,
-            fileName, fileSize);
-
-    int fd = mkstemp(fileName);
-    if (fd < 0) {
-        syslog(LOG_ERR, "%s: Unable to open temp file %s: %s", __func__, fileName,
-                 strerror(errno));
-        goto error;
-    }
-
-    // Allocate enough space in for the fd.
-    if (ftruncate(fd, (off_t) fileSize) < 0) {
-        syslog(LOG_ERR, "%s: Unable to truncate temp file %s: %s", __func__, fileName,
-                 strerror(errno));
-        goto error;
-    }
-
-    // Remove since we don't actually care about writing to the file system.
-    if (unlink(fileName)) {
-        syslog(LOG_ERR, "%s: Unable to unlink from temp file %s: %s", __func__,
-                 fileName, strerror(errno));
-        goto error;
-    }
-
-    // Get an address to fd's memory for this process's memory space.
-    void* data =
-        mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-
-    if (data == MAP_FAILED) {
-        syslog(LOG_ERR, "%s: Unable to mmap temp file %s: %s", __func__, fileName,
-                 strerror(errno));
-        goto error;
-    }
-
-    *mappedAddr = data;
-    *convFd = fd;
-
-    return true;
-
-error:
-    if (fd >= 0) {
-        close(fd);
-    }
-
-    return false;
-}
-
 /**
  * @brief Sets up and configures a connection to larod, and loads a model.
  *
@@ -366,44 +314,18 @@ end:
 int main(int argc, char** argv) {
     // Hardcode to use three image "color" channels (eg. RGB).
     const unsigned int CHANNELS = 3;
-    // Hardcode to set output bytes of four tensors from MobileNet V2 model.
-    const unsigned int FLOATSIZE = 4;
-    const unsigned int TENSOR1SIZE = 80 * FLOATSIZE;
-    const unsigned int TENSOR2SIZE = 20 * FLOATSIZE;
-    const unsigned int TENSOR3SIZE = 20 * FLOATSIZE;
-    const unsigned int TENSOR4SIZE = 1 * FLOATSIZE;
-
-    // Name patterns for the temp file we will create.
-    char CONV_INP_FILE_PATTERN[] = "/tmp/larod.in.test-XXXXXX";
-    char CROP_FILE_PATTERN[] = "/tmp/crop.test-XXXXXX";
-    char CONV_OUT1_FILE_PATTERN[] = "/tmp/larod.out1.test-XXXXXX";
-    char CONV_OUT2_FILE_PATTERN[] = "/tmp/larod.out2.test-XXXXXX";
-    char CONV_OUT3_FILE_PATTERN[] = "/tmp/larod.out3.test-XXXXXX";
-    char CONV_OUT4_FILE_PATTERN[] = "/tmp/larod.out4.test-XXXXXX";
 
     bool ret = false;
     ImgProvider_t* provider = NULL;
     ImgProvider_t* provider_raw = NULL;
-    larodError* error = NULL;
+    ImgFramePair_t* framePair = NULL;
+    ImgConverter_t* converter = NULL;
+    RowPool_t* rowPool = NULL;
     larodConnection* conn = NULL;
-    larodTensor** inputTensors = NULL;
-    size_t numInputs = 0;
-    larodTensor** outputTensors = NULL;
-    size_t numOutputs = 0;
-    larodInferenceRequest* infReq = NULL;
-    void* larodInputAddr = MAP_FAILED;
-    void* cropAddr = MAP_FAILED;
-    void* larodOutput1Addr = MAP_FAILED;
-    void* larodOutput2Addr = MAP_FAILED;
-    void* larodOutput3Addr = MAP_FAILED;
-    void* larodOutput4Addr = MAP_FAILED;
+    TensorPool_t* tensorPool = NULL;
+    ModelSession_t* session = NULL;
+    TensorBuffer_t* crop = NULL;
     int larodModelFd = -1;
-    int larodInputFd = -1;
-    int cropFd = -1;
-    int larodOutput1Fd = -1;
-    int larodOutput2Fd = -1;
-    int larodOutput3Fd = -1;
-    int larodOutput4Fd = -1;
     char** labels = NULL; // This is the array of label strings. The label
                           // entries points into the large labelFileData buffer.
     size_t numLabels = 0; // Number of entries in the labels array.
@@ -432,123 +354,141 @@ int main(int argc, char** argv) {
         goto end;
     }
 
-    syslog(LOG_INFO, "Creating VDO image provider and creating stream %d x %d",
-            streamWidth, streamHeight);
-    provider = createImgProvider(streamWidth, streamHeight, 2, VDO_FORMAT_YUV);
+    if (args.replayFile) {
+        // Every frame of the recording, as fast as it is analyzed.
+        syslog(LOG_INFO, "Creating image provider replaying %s at %d x %d",
+               args.replayFile, streamWidth, streamHeight);
+        provider = createImgProviderReplay(args.replayFile, streamWidth,
+                                           streamHeight, 0, 0, false);
+    } else {
+        syslog(LOG_INFO,
+               "Creating VDO image provider and creating stream %d x %d",
+               streamWidth, streamHeight);
+        provider =
+            createImgProvider(streamWidth, streamHeight, 0, VDO_FORMAT_YUV);
+    }
     if (!provider) {
       syslog(LOG_ERR, "%s: Failed to create ImgProvider", __func__);
         goto end;
     }
 
-    provider_raw = createImgProvider(args.raw_width, args.raw_height, 2, VDO_FORMAT_YUV);
-    if (!provider_raw) {
-      syslog(LOG_ERR, "%s: Failed to create crop ImgProvider", __func__);
+    converter = createImgConverter(streamWidth, streamHeight, args.width,
+                                   args.height, IMG_CROP_FULL);
+    if (!converter) {
+        syslog(LOG_ERR, "%s: Failed to create ImgConverter", __func__);
         goto end;
     }
-
-    larodModelFd = open(args.modelFile, O_RDONLY);
-    if (larodModelFd < 0) {
-        syslog(LOG_ERR, "Unable to open model file %s: %s", args.modelFile,
-                 strerror(errno));
+    // VDO buffers can have padded rows, convert them in place.
+    ImgNv12Layout_t srcLayout = {0, provider->uvOffset, provider->yPitch,
+                                 provider->uvPitch};
+    if (!setImgConverterSourceLayout(converter, &srcLayout)) {
+        syslog(LOG_ERR, "%s: Failed to set ImgConverter source layout",
+               __func__);
         goto end;
     }
 
-    syslog(LOG_INFO, "Setting up larod connection with chip %d and model %s", args.chip,
-            args.modelFile);
-    larodModel* model = NULL;
-    if (!setupLarod(args.chip, larodModelFd, &conn, &model)) {
+    // Split image conversion over the otherwise idle cores.
+    rowPool = createRowPool(0);
+    if (!rowPool) {
+        syslog(LOG_ERR, "%s: Failed to create RowPool", __func__);
         goto end;
     }
-
-    syslog(LOG_INFO, "Creating temporary files and memmaps for inference input and "
-            "output tensors");
-
-
-    // Allocate space for input tensor
-    if (!createAndMapTmpFile(CONV_INP_FILE_PATTERN,
-                             args.width * args.height * CHANNELS,
-                             &larodInputAddr, &larodInputFd)) {
+    if (!setImgConverterPool(converter, rowPool)) {
+        syslog(LOG_ERR, "%s: Failed to set ImgConverter pool", __func__);
         goto end;
     }
 
-    // Allocate space to save a high resolution frame for crop
-    if (!createAndMapTmpFile(CROP_FILE_PATTERN,
-                             args.raw_width * args.raw_height * CHANNELS,
-                             &cropAddr, &cropFd)) {
-        goto end;
+    if (args.replayRawFile) {
+        provider_raw = createImgProviderReplay(args.replayRawFile,
+                                               args.raw_width, args.raw_height,
+                                               0, 0, false);
+    } else {
+        provider_raw = createImgProvider(args.raw_width, args.raw_height, 0,
+                                         VDO_FORMAT_YUV);
     }
-
-    // Allocate space for output tensor 1 (Locations)
-    if (!createAndMapTmpFile(CONV_OUT1_FILE_PATTERN, TENSOR1SIZE,
-                             &larodOutput1Addr, &larodOutput1Fd)) {
+    if (!provider_raw) {
+      syslog(LOG_ERR, "%s: Failed to create crop ImgProvider", __func__);
         goto end;
     }
 
-    // Allocate space for output tensor 2 (Classes)
-    if (!createAndMapTmpFile(CONV_OUT2_FILE_PATTERN, TENSOR2SIZE,
-                             &larodOutput2Addr, &larodOutput2Fd)) {
+    // Crop from the high resolution frame captured together with the frame
+    // inference runs on.
+    framePair = createImgFramePair(provider, provider_raw, PAIR_TOLERANCE_US);
+    if (!framePair) {
+        syslog(LOG_ERR, "%s: Failed to create ImgFramePair", __func__);
         goto end;
     }
+    ImgNv12Layout_t rawLayout = {0, provider_raw->uvOffset,
+                                 provider_raw->yPitch, provider_raw->uvPitch};
 
-    // Allocate space for output tensor 3 (Scores)
-    if (!createAndMapTmpFile(CONV_OUT3_FILE_PATTERN, TENSOR3SIZE,
-                             &larodOutput3Addr, &larodOutput3Fd)) {
+    larodModelFd = open(args.modelFile, O_RDONLY);
+    if (larodModelFd < 0) {
+        syslog(LOG_ERR, "Unable to open model file %s: %s", args.modelFile,
+                 strerror(errno));
         goto end;
     }
 
-    // Allocate space for output tensor 4 (Number of detections)
-    if (!createAndMapTmpFile(CONV_OUT4_FILE_PATTERN, TENSOR4SIZE,
-                             &larodOutput4Addr, &larodOutput4Fd)) {
+    syslog(LOG_INFO, "Setting up larod connection with chip %d and model %s", args.chip,
+            args.modelFile);
+    larodModel* model = NULL;
+    if (!setupLarod(args.chip, larodModelFd, &conn, &model)) {
         goto end;
     }
 
-    syslog(LOG_INFO, "Create input tensors");
-    inputTensors = larodCreateModelInputs(model, &numInputs, &error);
-    if (!inputTensors) {
-        syslog(LOG_ERR, "Failed retrieving input tensors: %s", error->msg);
+    syslog(LOG_INFO, "Creating buffers for inference input and output tensors");
+    tensorPool = createTensorPool();
+    if (!tensorPool) {
         goto end;
     }
 
-    syslog(LOG_INFO, "Set input tensors");
-    if (!larodSetTensorFd(inputTensors[0], larodInputFd, &error)) {
-        syslog(LOG_ERR, "Failed setting input tensor fd: %s", error->msg);
+    // Allocate space to save a high resolution frame for crop
+    crop = getTensorBuffer(tensorPool,
+                           args.raw_width * args.raw_height * CHANNELS);
+    if (!crop) {
         goto end;
     }
 
-    syslog(LOG_INFO, "Create output tensors");
-    outputTensors = larodCreateModelOutputs(model, &numOutputs, &error);
-    if (!outputTensors) {
-        syslog(LOG_ERR, "Failed retrieving output tensors: %s", error->msg);
+    syslog(LOG_INFO, "Create input and output tensors");
+    session = createModelSession(model, tensorPool);
+    if (!session) {
         goto end;
     }
 
-
-    syslog(LOG_INFO, "Set output tensors");
-    if (!larodSetTensorFd(outputTensors[0], larodOutput1Fd, &error)) {
-        syslog(LOG_ERR, "Failed setting output tensor fd: %s", error->msg);
+    const ModelTensorView_t* larodInput = getSessionInput(session, 0);
+    if (larodInput->size < args.width * args.height * CHANNELS) {
+        syslog(LOG_ERR, "Input tensor of %zu bytes can't hold a %ux%u image",
+               larodInput->size, args.width, args.height);
         goto end;
     }
 
-    if (!larodSetTensorFd(outputTensors[1], larodOutput2Fd, &error)) {
-        syslog(LOG_ERR, "Failed setting output tensor fd: %s", error->msg);
+    // The outputs are locations, classes, scores and number of detections.
+    if (getSessionNumOutputs(session) != 4) {
+        syslog(LOG_ERR, "Model has %zu outputs, app expects 4 output tensors.",
+               getSessionNumOutputs(session));
         goto end;
     }
-
-    if (!larodSetTensorFd(outputTensors[2], larodOutput3Fd, &error)) {
-        syslog(LOG_ERR, "Failed setting output tensor fd: %s", error->msg);
+    size_t numLocations = 0;
+    size_t numClasses = 0;
+    size_t numScores = 0;
+    const float* locations = getSessionOutputData(
+        session, 0, LAROD_TENSOR_DATA_TYPE_FLOAT32, &numLocations);
+    const float* classes = getSessionOutputData(
+        session, 1, LAROD_TENSOR_DATA_TYPE_FLOAT32, &numClasses);
+    const float* scores = getSessionOutputData(
+        session, 2, LAROD_TENSOR_DATA_TYPE_FLOAT32, &numScores);
+    const float* numberofdetections = getSessionOutputData(
+        session, 3, LAROD_TENSOR_DATA_TYPE_FLOAT32, NULL);
+    if (!locations || !classes || !scores || !numberofdetections) {
         goto end;
     }
-
-    if (!larodSetTensorFd(outputTensors[3], larodOutput4Fd, &error)) {
-        syslog(LOG_ERR, "Failed setting output tensor fd: %s", error->msg);
-        goto end;
+    // Never read past the outputs, whatever number of detections the model
+    // reports.
+    size_t maxDetections = numLocations / 4;
+    if (numClasses < maxDetections) {
+        maxDetections = numClasses;
     }
-
-    infReq = larodCreateInferenceRequest(model, inputTensors, numInputs, outputTensors,
-                                         numOutputs, &error);
-    if (!infReq) {
-        syslog(LOG_ERR, "Failed creating inference request: %s", error->msg);
-        goto end;
+    if (numScores < maxDetections) {
+        maxDetections = numScores;
     }
 
     if (args.labelsFile) {
@@ -559,7 +499,6 @@ int main(int argc, char** argv) {
         }
     }
 
-    syslog(LOG_INFO, "Found %x input tensors and %x output tensors", numInputs, numOutputs);
     syslog(LOG_INFO, "Start fetching video frames from VDO");
     if (!startFrameFetch(provider)) {
         goto end;
@@ -573,33 +512,38 @@ int main(int argc, char** argv) {
         struct timeval startTs, endTs;
         unsigned int elapsedMs = 0;
 
-        // Get latest frame from image pipeline.
-        VdoBuffer* buf = getLastFrameBlocking(provider);
-        if (!buf) {
+        // Get latest frame from image pipeline, and the high resolution
+        // frame captured at the same time.
+        VdoBuffer* buf = NULL;
+        VdoBuffer* buf_hq = NULL;
+        if (!getFramePair(framePair, -1, &buf, &buf_hq)) {
+            if (isFrameFetchStopped(provider) ||
+                isFrameFetchStopped(provider_raw)) {
+                syslog(LOG_INFO, "End of recording");
+                break;
+            }
             goto end;
         }
 
-        VdoBuffer* buf_hq = getLastFrameBlocking(provider_raw);
-        if (!buf_hq) {
+        // Get data from latest frame.
+        const uint8_t* nv12Data = getFrameData(provider, buf);
+        const uint8_t* nv12Data_hq = getFrameData(provider_raw, buf_hq);
+        if (!nv12Data || !nv12Data_hq) {
+            returnFramePair(framePair, buf, buf_hq);
             goto end;
         }
 
-        // Get data from latest frame.
-        uint8_t* nv12Data = (uint8_t*) vdo_buffer_get_data(buf);
-        uint8_t* nv12Data_hq = (uint8_t*) vdo_buffer_get_data(buf_hq);
-
         // Covert image data from NV12 format to interleaved uint8_t RGB format.
         gettimeofday(&startTs, NULL);
 
-        if (!convertCropScaleU8yuvToRGB(nv12Data, streamWidth, streamHeight,
-                                        (uint8_t*) larodInputAddr, args.width,
-                                        args.height)) {
-            syslog(LOG_ERR, "%s: Failed img scale/convert in "
-                     "convertCropScaleU8yuvToRGB() (continue anyway)",
-                     __func__);
+        if (!convertFrame(converter, nv12Data, (uint8_t*) larodInput->data)) {
+            syslog(LOG_ERR, "%s: Failed img scale/convert in convertFrame() "
+                   "(continue anyway)", __func__);
         }
 
-        convertU8yuvToRGBlibYuv(args.raw_width, args.raw_height, nv12Data_hq, (uint8_t*) cropAddr);
+        convertU8yuvToRGBlibYuv(args.raw_width, args.raw_height,
+                                (uint8_t*) nv12Data_hq, &rawLayout,
+                                (uint8_t*) crop->addr, rowPool);
 
         gettimeofday(&endTs, NULL);
 
@@ -607,40 +551,10 @@ int main(int argc, char** argv) {
                                     ((endTs.tv_usec - startTs.tv_usec) / 1000));
         syslog(LOG_INFO, "Converted image in %u ms", elapsedMs);
 
-        // Since larodOutputAddr points to the beginning of the fd we should
-        // rewind the file position before each inference.
-        if (lseek(larodOutput1Fd, 0, SEEK_SET) == -1) {
-            syslog(LOG_ERR, "Unable to rewind output file position: %s",
-                     strerror(errno));
-
-            goto end;
-        }
-
-        if (lseek(larodOutput2Fd, 0, SEEK_SET) == -1) {
-            syslog(LOG_ERR, "Unable to rewind output file position: %s",
-                     strerror(errno));
-
-            goto end;
-        }
-
-        if (lseek(larodOutput3Fd, 0, SEEK_SET) == -1) {
-            syslog(LOG_ERR, "Unable to rewind output file position: %s",
-                     strerror(errno));
-
-            goto end;
-        }
-
-        if (lseek(larodOutput4Fd, 0, SEEK_SET) == -1) {
-            syslog(LOG_ERR, "Unable to rewind output file position: %s",
-                     strerror(errno));
-
-            goto end;
-        }
-
         gettimeofday(&startTs, NULL);
-        if (!larodRunInference(conn, infReq, &error)) {
-            syslog(LOG_ERR, "Unable to run inference on model %s: %s (%d)",
-                     args.modelFile, error->msg, error->code);
+        if (!runModelSession(session, conn)) {
+            syslog(LOG_ERR, "Unable to run inference on model %s",
+                   args.modelFile);
             goto end;
         }
         gettimeofday(&endTs, NULL);
@@ -649,17 +563,17 @@ int main(int argc, char** argv) {
                                     ((endTs.tv_usec - startTs.tv_usec) / 1000));
         syslog(LOG_INFO, "Ran inference for %u ms", elapsedMs);
 
-        float* locations = (float*) larodOutput1Addr;
-        float* classes = (float*) larodOutput2Addr;
-        float* scores = (float*) larodOutput3Addr;
-        float* numberofdetections = (float*) larodOutput4Addr;
-        
-        if ((int) numberofdetections[0] == 0) {
+        int numDetections = (int) numberofdetections[0];
+        if (numDetections > (int) maxDetections) {
+            numDetections = (int) maxDetections;
+        }
+
+        if (numDetections <= 0) {
            syslog(LOG_INFO,"No object is detected");
         }
         else {
 
-            for (int i = 0; i < numberofdetections[0]; i++){
+            for (int i = 0; i < numDetections; i++){
 
                 float top = locations[4*i];
                 float left = locations[4*i+1];
@@ -675,7 +589,7 @@ int main(int argc, char** argv) {
                     syslog(LOG_INFO, "Object %d: Classes: %s - Scores: %f - Locations: [%f,%f,%f,%f]",
                        i, labels[(int) classes[i]], scores[i], top, left, bottom, right);
                        
-                    unsigned char* crop_buffer = crop_interleaved(cropAddr, args.raw_width, args.raw_height, CHANNELS,
+                    unsigned char* crop_buffer = crop_interleaved(crop->addr, args.raw_width, args.raw_height, CHANNELS,
                                                                   crop_x, crop_y, crop_w, crop_h);
 
                     unsigned long jpeg_size = 0;
@@ -694,21 +608,26 @@ int main(int argc, char** argv) {
         }          
 
         // Release frame reference to provider.
-        returnFrame(provider, buf);
-        returnFrame(provider_raw, buf_hq);
+        returnFramePair(framePair, buf, buf_hq);
     }
 
     syslog(LOG_INFO, "Stop streaming video from VDO");
     if (!stopFrameFetch(provider)) {
         goto end;
     }
+    if (!stopFrameFetch(provider_raw)) {
+        goto end;
+    }
 
     ret = true;
 
 end:
+    destroyImgFramePair(framePair);
     if (provider) {
         destroyImgProvider(provider);
     }
+    destroyImgConverter(converter);
+    destroyRowPool(rowPool);
         if (provider_raw) {
         destroyImgProvider(provider_raw);
     }
@@ -722,54 +641,8 @@ end:
     if (larodModelFd >= 0) {
         close(larodModelFd);
     }
-    if (larodInputAddr != MAP_FAILED) {
-        munmap(larodInputAddr, args.width * args.height * CHANNELS);
-    }
-    if (larodInputFd >= 0) {
-        close(larodInputFd);
-    }
-     if (cropAddr != MAP_FAILED) {
-        munmap(cropAddr, args.raw_width * args.raw_height * CHANNELS);
-    }
-    if (cropFd >= 0) {
-        close(cropFd);
-    }
-    if (larodOutput1Addr != MAP_FAILED) {
-        munmap(larodOutput1Addr, TENSOR1SIZE);
-    }
-
-    if (larodOutput2Addr != MAP_FAILED) {
-        munmap(larodOutput2Addr, TENSOR2SIZE);
-    }
-
-    if (larodOutput3Addr != MAP_FAILED) {
-        munmap(larodOutput3Addr, TENSOR3SIZE);
-    }
-
-    if (larodOutput4Addr != MAP_FAILED) {
-        munmap(larodOutput4Addr, TENSOR4SIZE);
-    }
-
-    if (larodOutput1Fd >= 0) {
-        close(larodOutput1Fd);
-    }
-
-    if (larodOutput2Fd >= 0) {
-        close(larodOutput2Fd);
-    }
-
-    if (larodOutput3Fd >= 0) {
-        close(larodOutput3Fd);
-    }
-
-    if (larodOutput4Fd >= 0) {
-        close(larodOutput4Fd);
-    }
-
-    larodDestroyInferenceRequest(&infReq);
-    larodDestroyTensors(&inputTensors, numInputs);
-    larodDestroyTensors(&outputTensors, numOutputs);
-    larodClearError(&error);
+    destroyModelSession(session);
+    destroyTensorPool(tensorPool);
 
     if (labels) {
         freeLabels(labels, labelFileData);
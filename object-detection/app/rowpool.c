@@ -0,0 +1,270 @@
+/**
+ * Copyright (C) 2021, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file handles the row band worker pool.
+ *
+ * Workers wait on a condition variable for the job generation counter to
+ * change. The caller publishes a job by bumping the generation, processes
+ * band 0 and then waits until the number of pending bands reaches zero.
+ */
+
+#define _GNU_SOURCE
+
+#include "rowpool.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+/// Upper limit of worker threads, well above the core count of any camera.
+#define MAX_WORKERS (16)
+
+typedef struct RowPoolWorker {
+    RowPool_t* pool;
+    pthread_t thread;
+    unsigned int band;
+} RowPoolWorker;
+
+struct RowPool {
+    pthread_mutex_t lock;
+    /// Signaled when a new job is published or the pool shuts down.
+    pthread_cond_t jobCond;
+    /// Signaled when the last pending band is done.
+    pthread_cond_t doneCond;
+
+    /// Current job, valid while pending > 0.
+    RowBandFunc func;
+    void* ctx;
+    unsigned int numRows;
+    unsigned int bandRows;
+
+    unsigned int generation;
+    unsigned int pending;
+    bool shutDown;
+
+    unsigned int numWorkers;
+    RowPoolWorker workers[MAX_WORKERS];
+};
+
+/**
+ * brief Compute the rows of one band and process them.
+ *
+ * param func Function processing one band.
+ * param ctx Job context passed to func.
+ * param band Index of the band.
+ * param bandRows Number of rows per band.
+ * param numRows Total number of rows.
+ */
+static void runBand(RowBandFunc func, void* ctx, unsigned int band,
+                    unsigned int bandRows, unsigned int numRows) {
+    unsigned long start = (unsigned long) band * bandRows;
+    unsigned long end = start + bandRows;
+
+    if (start >= numRows) {
+        return;
+    }
+    if (end > numRows) {
+        end = numRows;
+    }
+
+    func(ctx, band, (unsigned int) start, (unsigned int) end);
+}
+
+static void* workerEntry(void* data) {
+    RowPoolWorker* worker = (RowPoolWorker*) data;
+    RowPool_t* pool = worker->pool;
+    unsigned int seenGeneration = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (pool->generation == seenGeneration && !pool->shutDown) {
+            pthread_cond_wait(&pool->jobCond, &pool->lock);
+        }
+        if (pool->shutDown) {
+            break;
+        }
+        seenGeneration = pool->generation;
+
+        RowBandFunc func = pool->func;
+        void* ctx = pool->ctx;
+        unsigned int bandRows = pool->bandRows;
+        unsigned int numRows = pool->numRows;
+        pthread_mutex_unlock(&pool->lock);
+
+        runBand(func, ctx, worker->band, bandRows, numRows);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->doneCond);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/**
+ * brief Pin a worker thread to one core.
+ *
+ * Failing to pin is not fatal, the worker is then scheduled freely.
+ *
+ * param worker Worker to pin.
+ * param numCores Number of online cores.
+ */
+static void pinWorker(RowPoolWorker* worker, unsigned int numCores) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(worker->band % numCores, &cpus);
+
+    int err = pthread_setaffinity_np(worker->thread, sizeof(cpus), &cpus);
+    if (err) {
+        syslog(LOG_WARNING, "%s: Unable to pin worker %u: %s", __func__,
+               worker->band, strerror(err));
+    }
+}
+
+RowPool_t* createRowPool(unsigned int numWorkers) {
+    long onlineCores = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int numCores = onlineCores > 0 ? (unsigned int) onlineCores : 1;
+
+    if (numWorkers == 0) {
+        numWorkers = numCores - 1;
+    }
+    if (numWorkers > MAX_WORKERS) {
+        numWorkers = MAX_WORKERS;
+    }
+
+    RowPool_t* pool = calloc(1, sizeof(RowPool_t));
+    if (!pool) {
+        syslog(LOG_ERR, "%s: Unable to allocate RowPool: %s", __func__,
+               strerror(errno));
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&pool->lock, NULL)) {
+        syslog(LOG_ERR, "%s: Unable to initialize mutex", __func__);
+        free(pool);
+        return NULL;
+    }
+    if (pthread_cond_init(&pool->jobCond, NULL)) {
+        syslog(LOG_ERR, "%s: Unable to initialize condition variable",
+               __func__);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool);
+        return NULL;
+    }
+    if (pthread_cond_init(&pool->doneCond, NULL)) {
+        syslog(LOG_ERR, "%s: Unable to initialize condition variable",
+               __func__);
+        pthread_cond_destroy(&pool->jobCond);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool);
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < numWorkers; i++) {
+        RowPoolWorker* worker = &pool->workers[i];
+        worker->pool = pool;
+        // Band 0 is run by the caller.
+        worker->band = i + 1;
+
+        int err = pthread_create(&worker->thread, NULL, workerEntry, worker);
+        if (err) {
+            syslog(LOG_ERR, "%s: Unable to create worker thread: %s",
+                   __func__, strerror(err));
+            goto errorExit;
+        }
+        pool->numWorkers++;
+
+        pinWorker(worker, numCores);
+    }
+
+    syslog(LOG_INFO, "%s: Created %u worker threads on %u cores", __func__,
+           pool->numWorkers, numCores);
+
+    return pool;
+
+errorExit:
+    destroyRowPool(pool);
+
+    return NULL;
+}
+
+void destroyRowPool(RowPool_t* pool) {
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutDown = true;
+    pthread_cond_broadcast(&pool->jobCond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned int i = 0; i < pool->numWorkers; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    pthread_cond_destroy(&pool->doneCond);
+    pthread_cond_destroy(&pool->jobCond);
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool);
+}
+
+unsigned int getRowPoolBands(const RowPool_t* pool) {
+    return pool ? pool->numWorkers + 1 : 1;
+}
+
+void runRowPool(RowPool_t* pool, RowBandFunc func, void* ctx,
+                unsigned int numRows, unsigned int rowAlign) {
+    unsigned int numBands = getRowPoolBands(pool);
+
+    if (rowAlign == 0) {
+        rowAlign = 1;
+    }
+
+    // Not worth waking the workers if every band would be tiny.
+    if (numBands == 1 || numRows < numBands * rowAlign) {
+        func(ctx, 0, 0, numRows);
+        return;
+    }
+
+    unsigned int bandRows = (numRows + numBands - 1) / numBands;
+    bandRows = (bandRows + rowAlign - 1) / rowAlign * rowAlign;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->func = func;
+    pool->ctx = ctx;
+    pool->numRows = numRows;
+    pool->bandRows = bandRows;
+    pool->pending = pool->numWorkers;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->jobCond);
+    pthread_mutex_unlock(&pool->lock);
+
+    runBand(func, ctx, 0, bandRows, numRows);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->doneCond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -24,6 +24,7 @@
 #include <stdlib.h>
 
 #define KEY_USAGE (127)
+#define KEY_EVERY (128)
 
 static int parsePosInt(char* arg, unsigned long long* i,
                        unsigned long long limit);
@@ -35,6 +36,13 @@ const struct argp_option opts[] = {
      "from the library. If not specified, the default chip for a new "
      "connection will be used.",
      0},
+    {"fps", 'r', "FPS", 0,
+     "Run inferences on at most FPS frames per second. Lowers the frame rate "
+     "of the stream if VDO supports it, otherwise frames are skipped. "
+     "Default is the full frame rate.",
+     0},
+    {"every", KEY_EVERY, "N", 0,
+     "Only run inferences on every Nth frame of the stream.", 0},
     {"help", 'h', NULL, 0, "Print this help text and exit.", 0},
     {"usage", KEY_USAGE, NULL, 0, "Print short usage message and exit.", 0},
     {0}};
@@ -74,6 +82,24 @@ int parseOpt(int key, char* arg, struct argp_state* state) {
         args->chip = (larodChip) chip;
         break;
     }
+    case 'r': {
+        unsigned long long fps;
+        int ret = parsePosInt(arg, &fps, UINT_MAX);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid frame rate");
+        }
+        args->fps = (unsigned int) fps;
+        break;
+    }
+    case KEY_EVERY: {
+        unsigned long long everyNth;
+        int ret = parsePosInt(arg, &everyNth, UINT_MAX);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid frame interval");
+        }
+        args->everyNth = (unsigned int) everyNth;
+        break;
+    }
     case 'h':
         argp_state_help(state, stdout, ARGP_HELP_STD_HELP);
         break;
@@ -114,6 +140,8 @@ int parseOpt(int key, char* arg, struct argp_state* state) {
         args->outputBytes = 0;
         args->chip = 0;
         args->modelFile = NULL;
+        args->fps = 0;
+        args->everyNth = 1;
         break;
     case ARGP_KEY_END:
         if (state->arg_num != 4) {
@@ -30,6 +30,8 @@ typedef struct args_t {
     unsigned width;
     unsigned height;
     larodChip chip;
+    unsigned fps;
+    unsigned everyNth;
 } args_t;
 
 bool parseArgs(int argc, char** argv, args_t* args);
@@ -0,0 +1,130 @@
+/**
+ * Copyright (C) 2021, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file handles handing frames from a producer thread to a
+ * consumer thread without locks or memory allocation.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * brief A type representing a bounded handoff of frames between one producer
+ * thread and one consumer thread.
+ *
+ * The producer publishes frames into a fixed number of slots, overwriting the
+ * oldest one. The consumer always takes the most recent frame still in a
+ * slot, and hands frames back through a return queue that the producer
+ * drains. Frames are opaque pointers that are never dereferenced.
+ *
+ * All operations are lock-free. A consumer waiting for a frame sleeps on a
+ * futex, which the producer only wakes when someone is waiting.
+ */
+typedef struct FrameRing FrameRing_t;
+
+/**
+ * brief Create a frame ring.
+ *
+ * param numSlots Number of most recent frames kept for the consumer.
+ * param maxReturned Largest number of frames that can be returned and not
+ *                    yet reclaimed, e.g. the total number of frames.
+ * return Pointer to new FrameRing, or NULL if failed.
+ */
+FrameRing_t* createFrameRing(unsigned int numSlots, unsigned int maxReturned);
+
+/**
+ * brief Deallocate a frame ring.
+ *
+ * Frames still held by the ring are not touched, the owner of the frames is
+ * expected to release them.
+ *
+ * param ring Pointer to FrameRing to be destroyed. Can be NULL.
+ */
+void destroyFrameRing(FrameRing_t* ring);
+
+/**
+ * brief Publish a frame. Producer only.
+ *
+ * param ring Pointer to a FrameRing.
+ * param frame Frame to publish, must not be NULL.
+ * return The frame overwritten in its slot, which the consumer never took
+ *        and is now owned by the producer again, or NULL.
+ */
+void* pushFrameRing(FrameRing_t* ring, void* frame);
+
+/**
+ * brief Publish a frame only if it would not overwrite one. Producer only.
+ *
+ * The frame goes into the slot pushFrameRing() would use, as long as the
+ * consumer has taken the frame that was there.
+ *
+ * param ring Pointer to a FrameRing.
+ * param frame Frame to publish, must not be NULL.
+ * return False if the slot still held a frame and nothing was published,
+ *        otherwise true.
+ */
+bool offerFrameRing(FrameRing_t* ring, void* frame);
+
+/**
+ * brief Take back one frame returned by the consumer. Producer only.
+ *
+ * param ring Pointer to a FrameRing.
+ * return The oldest returned frame, or NULL if there is none.
+ */
+void* reclaimFrameRing(FrameRing_t* ring);
+
+/**
+ * brief Take the most recent published frame. Consumer only.
+ *
+ * Blocks until a frame is available or the ring is closed.
+ *
+ * param ring Pointer to a FrameRing.
+ * return Most recent frame not taken before, or NULL if the ring was closed.
+ */
+void* popFrameRing(FrameRing_t* ring);
+
+/**
+ * brief Take the most recent published frame, waiting at most a given time.
+ * Consumer only.
+ *
+ * param ring Pointer to a FrameRing.
+ * param timeoutMs Longest time to wait in milliseconds, 0 to not wait at all
+ *                 or negative to wait like popFrameRing().
+ * return Most recent frame not taken before, or NULL if none was published
+ *        in time or the ring was closed.
+ */
+void* popFrameRingTimeout(FrameRing_t* ring, int timeoutMs);
+
+/**
+ * brief Hand a taken frame back to the producer. Consumer only.
+ *
+ * param ring Pointer to a FrameRing.
+ * param frame Frame previously returned by popFrameRing().
+ * return False if the return queue is full, otherwise true.
+ */
+bool returnFrameRing(FrameRing_t* ring, void* frame);
+
+/**
+ * brief Close the ring and wake a waiting consumer.
+ *
+ * After this popFrameRing() returns NULL at once, frames still in the ring
+ * are left for the producer's owner to release.
+ *
+ * param ring Pointer to a FrameRing.
+ */
+void closeFrameRing(FrameRing_t* ring);
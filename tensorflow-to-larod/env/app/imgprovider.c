@@ -23,12 +23,50 @@
 #include <assert.h>
 #include <errno.h>
 #include <gmodule.h>
+#include <limits.h>
+#include <sys/eventfd.h>
 #include <syslog.h>
+#include <time.h>
+#include <unistd.h>
 #include <vdo-channel.h>
 
+#include "framering.h"
 #include "vdo-map.h"
 
 #define VDO_CHANNEL (1)
+/// Frames between decisions of an adaptive buffer pool.
+#define POOL_WINDOW_FRAMES (60)
+/// Buffers an adaptive pool keeps enqueued in VDO beyond what the consumers
+/// hold, one being filled and one ready for the next frame.
+#define POOL_HEADROOM (2)
+/// Time between checks for returned buffers while VDO has none.
+#define STARVED_POLL_US (1000)
+/// A frame arriving up to 1 / FRAME_RATE_SLACK of the frame interval early
+/// is still delivered by a frame rate limit, which absorbs capture jitter.
+#define FRAME_RATE_SLACK (4)
+
+/**
+ * brief One consumer of the frames of an ImgProvider.
+ */
+struct ImgConsumer {
+    ImgProvider_t* provider;
+    ImgDropPolicy dropPolicy;
+
+    /// Frames published to the consumer and not yet fetched, and frames the
+    /// consumer has handed back.
+    FrameRing_t* frames;
+    /// Readable when a frame has been published to the consumer. Only
+    /// written once the consumer has asked for it.
+    int eventFd;
+    atomic_bool eventFdWanted;
+
+    /// Frames skipped before each of the provider's buffers, only accessed
+    /// by the consumer.
+    unsigned int framesSkipped[MAX_VDO_BUFFERS];
+    /// Newest sequence number handed to the consumer.
+    unsigned int lastFetchedSeq;
+    bool anyFetched;
+};
 
 /**
  * brief Set up a stream through VDO.
@@ -44,6 +82,18 @@
 static bool createStream(ImgProvider_t* provider, unsigned int w,
                          unsigned int h);
 
+/**
+ * brief Read the stream size, frame rate and buffer layout back from VDO.
+ *
+ * param provider Pointer to ImgProvider owning the stream.
+ * param vdoStream VDO stream to query.
+ * param w Requested stream width, used if VDO does not report one.
+ * param h Requested stream height, used if VDO does not report one.
+ * return False if any errors occur, otherwise true.
+ */
+static bool readStreamLayout(ImgProvider_t* provider, VdoStream* vdoStream,
+                             unsigned int w, unsigned int h);
+
 /**
  * brief Allocate VDO buffers on a stream.
  *
@@ -67,70 +117,241 @@ static void releaseVdoBuffers(ImgProvider_t* provider);
  *
  * Responsible for fetching buffers/frames from VDO and re-enqueue buffers back
  * to VDO when they are not needed by the application. The ImgProvider always
- * keeps one or several of the most recent frames available in the application.
- * There are two queues involved: deliveredFrames and processedFrames.
- * - deliveredFrames are frames delivered from VDO and
- *   not processed by the client.
- * - processedFrames are frames that the client has consumed and handed
- *   back to the ImgProvider.
- * The thread works roughly like this:
+ * keeps one or several of the most recent frames available to each consumer.
+ * Frames are handed over through one FrameRing per consumer:
  * 1. The thread blocks on vdo_stream_get_buffer() until VDO deliver a new
- * frame.
- * 2. The fresh frame is put at the end of the deliveredFrame queue. If the
- *    client want to fetch a frame the item at the end of deliveredFrame
- *    list is returned.
- * 3. If there are any frames in the processedFrames list one of these are
- *    enqueued back to VDO to keep the flow of buffers.
- * 4. If the processedFrames list is empty we instead check if there are
- *    frames available in the deliveredFrames list. We want to make sure
- *    there is at least numAppFrames buffers available to the client to
- *    fetch. If there are more than numAppFrames in deliveredFrames we
- *    pick the first buffer (oldest) in the list and enqueue it to VDO.
-
+ *    frame.
+ * 2. The fresh frame gets one reference per consumer and is published to
+ *    every consumer. If a consumer want to fetch a frame the most recent
+ *    frame still in its ring is returned.
+ * 3. With IMG_DROP_OLDEST the frame goes in the consumer's oldest slot, and
+ *    the frame that was there is released. With IMG_DROP_NEWEST the fresh
+ *    frame is released instead if the slot is still taken.
+ * 4. Frames the consumers have handed back are released.
+ * A released frame goes back to VDO once no consumer holds it.
+ *
  * param data Pointer to ImgProvider owning thread.
  * return Pointer to unused return data.
  */
 static void* threadEntry(void* data);
 
+/**
+ * brief Starting point function for the thread replaying a recording.
+ *
+ * Takes the place of threadEntry() for a provider created with
+ * createImgProviderReplay(). Each frame of the recording is put in a free
+ * buffer and delivered like a frame from VDO. A lockstep replay first waits
+ * for the consumers to hand back every frame. At the end of a recording
+ * that does not loop the thread waits for the last frames to come back and
+ * then closes the consumers' rings.
+ *
+ * param data Pointer to ImgProvider owning thread.
+ * return Pointer to unused return data.
+ */
+static void* replayThreadEntry(void* data);
+
+/**
+ * brief Wait until the consumers have handed back every frame of a replay.
+ *
+ * Returns early when fetching stops.
+ *
+ * param provider Pointer to ImgProvider replaying a recording.
+ */
+static void waitForReturnedFrames(ImgProvider_t* provider);
+
+/**
+ * brief Hand a frame just received to the consumers, unless the frame rate
+ * policy skips it, and take back the frames the consumers have returned.
+ *
+ * Only called by the fetcher thread.
+ *
+ * param provider Pointer to ImgProvider receiving the frame.
+ * param buffer Buffer holding the frame, with one reference per consumer.
+ * param tracked False if the buffer is not one of the provider's.
+ */
+static void deliverFrame(ImgProvider_t* provider, VdoBuffer* buffer,
+                         bool tracked);
+
+/**
+ * brief Stop delivering frames and wake the consumers waiting for one, or
+ * polling for one.
+ *
+ * param provider Pointer to ImgProvider whose consumers to close.
+ */
+static void closeConsumers(ImgProvider_t* provider);
+
+/**
+ * brief Find which of the provider's buffers a frame is.
+ *
+ * param provider Pointer to ImgProvider owning the buffers.
+ * param buffer Buffer to look up.
+ * return Index in vdoBuffers, or -1 if the buffer is not the provider's.
+ */
+static int findBufferIndex(ImgProvider_t* provider, VdoBuffer* buffer);
+
+/**
+ * brief Record metadata of a frame just received from VDO and give it one
+ * reference per consumer.
+ *
+ * param provider Pointer to ImgProvider owning the buffer.
+ * param buffer Buffer received from VDO.
+ * return False if the buffer is not one of the provider's, otherwise true.
+ */
+static bool recordFrameInfo(ImgProvider_t* provider, VdoBuffer* buffer);
+
+/**
+ * brief Drop one consumer's reference to a buffer, and enqueue the buffer
+ * back to VDO if it was the last one. Only called by the fetcher thread.
+ *
+ * param provider Pointer to ImgProvider owning the buffer.
+ * param buffer Buffer to release.
+ */
+static void releaseBuffer(ImgProvider_t* provider, VdoBuffer* buffer);
+
+/**
+ * brief Hand a fresh frame to every consumer according to its drop policy.
+ *
+ * param provider Pointer to ImgProvider owning the buffer.
+ * param buffer Buffer received from VDO, with one reference per consumer.
+ */
+static void publishFrame(ImgProvider_t* provider, VdoBuffer* buffer);
+
+/**
+ * brief Make a consumer's event fd readable, if the consumer polls it.
+ *
+ * param consumer Pointer to ImgConsumer to notify.
+ */
+static void notifyConsumer(ImgConsumer_t* consumer);
+
+/**
+ * brief Deallocate a consumer.
+ *
+ * param consumer Pointer to ImgConsumer to be destroyed. Can be NULL.
+ */
+static void destroyImgConsumer(ImgConsumer_t* consumer);
+
+/**
+ * brief Enqueue a buffer back to VDO.
+ *
+ * param provider Pointer to ImgProvider owning the stream.
+ * param buffer Buffer to enqueue.
+ */
+static void enqueueBuffer(ImgProvider_t* provider, VdoBuffer* buffer);
+
+/**
+ * brief Hand a buffer no consumer holds back to VDO, or release it if the
+ * adaptive pool is shrinking.
+ *
+ * param provider Pointer to ImgProvider owning the stream.
+ * param buffer Buffer to recycle.
+ */
+static void recycleBuffer(ImgProvider_t* provider, VdoBuffer* buffer);
+
+/**
+ * brief Allocate one more buffer on a running stream and enqueue it.
+ *
+ * param provider Pointer to ImgProvider owning the stream.
+ * return False if any errors occur, otherwise true.
+ */
+static bool addVdoBuffer(ImgProvider_t* provider);
+
+/**
+ * brief Enqueue back to VDO the buffers all consumers have handed back.
+ *
+ * param provider Pointer to ImgProvider owning the stream.
+ */
+static void reclaimBuffers(ImgProvider_t* provider);
+
+/**
+ * brief Get a buffer into VDO when the consumers hold all of them.
+ *
+ * VDO has nowhere to put the next frame then, and vdo_stream_get_buffer()
+ * would block until a buffer is enqueued, which only this thread does. An
+ * adaptive pool grows, otherwise returned buffers are polled for.
+ *
+ * param provider Pointer to ImgProvider with no buffers in VDO.
+ */
+static void waitForFreeBuffer(ImgProvider_t* provider);
+
+/**
+ * brief Grow or shrink an adaptive buffer pool.
+ *
+ * Called by the fetcher thread once per frame. At the end of each window of
+ * POOL_WINDOW_FRAMES frames the pool grows by one buffer if VDO dropped
+ * frames for lack of buffers, or shrinks by one if the consumers never held
+ * more than the pool size minus POOL_HEADROOM buffers.
+ *
+ * param provider Pointer to ImgProvider with an adaptive pool.
+ */
+static void adaptBufferPool(ImgProvider_t* provider);
+
+/**
+ * brief Apply the frame rate policy to a frame just received from VDO.
+ *
+ * Only called by the fetcher thread.
+ *
+ * param provider Pointer to ImgProvider receiving the frame.
+ * param buffer Buffer received from VDO.
+ * return True if the frame should go back to VDO undelivered, otherwise
+ *        false.
+ */
+static bool skipFrame(ImgProvider_t* provider, VdoBuffer* buffer);
+
 ImgProvider_t* createImgProvider(unsigned int w, unsigned int h,
                                  unsigned int numFrames, VdoFormat format) {
-    bool mtxInitialized = false;
-    bool condInitialized = false;
+    return createImgProviderWithPool(w, h, numFrames, format, NULL);
+}
 
-    ImgProvider_t* provider = calloc(1, sizeof(ImgProvider_t));
-    if (!provider) {
-        syslog(LOG_ERR, "%s: Unable to allocate ImgProvider: %s", __func__,
-                 strerror(errno));
-        goto errorExit;
+ImgProvider_t* createImgProviderWithPool(unsigned int w, unsigned int h,
+                                         unsigned int numFrames,
+                                         VdoFormat format,
+                                         const ImgBufferPool_t* pool) {
+    ImgProvider_t* provider = NULL;
+    ImgBufferPool_t poolSize = {NUM_VDO_BUFFERS, NUM_VDO_BUFFERS,
+                                NUM_VDO_BUFFERS};
+
+    if (pool) {
+        poolSize = *pool;
+        if (poolSize.numBuffers == 0) {
+            poolSize.numBuffers = NUM_VDO_BUFFERS;
+        }
+        if (poolSize.minBuffers >= poolSize.maxBuffers) {
+            poolSize.minBuffers = poolSize.numBuffers;
+            poolSize.maxBuffers = poolSize.numBuffers;
+        }
     }
-
-    provider->vdoFormat = format;
-    provider->numAppFrames = numFrames;
-
-    if (pthread_mutex_init(&provider->frameMutex, NULL)) {
-        syslog(LOG_ERR, "%s: Unable to initialize mutex: %s", __func__,
-                 strerror(errno));
+    if (poolSize.minBuffers < POOL_HEADROOM ||
+        poolSize.maxBuffers > MAX_VDO_BUFFERS ||
+        poolSize.numBuffers < poolSize.minBuffers ||
+        poolSize.numBuffers > poolSize.maxBuffers) {
+        syslog(LOG_ERR,
+               "%s: Invalid buffer pool of %u buffers within [%u, %u], at "
+               "most %d buffers are supported",
+               __func__, poolSize.numBuffers, poolSize.minBuffers,
+               poolSize.maxBuffers, MAX_VDO_BUFFERS);
         goto errorExit;
     }
-    mtxInitialized = true;
 
-    if (pthread_cond_init(&provider->frameDeliverCond, NULL)) {
-        syslog(LOG_ERR, "%s: Unable to initialize condition variable: %s", __func__,
+    provider = calloc(1, sizeof(ImgProvider_t));
+    if (!provider) {
+        syslog(LOG_ERR, "%s: Unable to allocate ImgProvider: %s", __func__,
                  strerror(errno));
         goto errorExit;
     }
-    condInitialized = true;
-
-    provider->deliveredFrames = g_queue_new();
-    if (!provider->deliveredFrames) {
-        syslog(LOG_ERR, "%s: Unable to create deliveredFrames queue!", __func__);
-        goto errorExit;
-    }
 
-    provider->processedFrames = g_queue_new();
-    if (!provider->processedFrames) {
-        syslog(LOG_ERR, "%s: Unable to create processedFrames queue!", __func__);
-        goto errorExit;
+    provider->vdoFormat = format;
+    atomic_init(&provider->numBuffers, poolSize.numBuffers);
+    provider->minBuffers = poolSize.minBuffers;
+    provider->maxBuffers = poolSize.maxBuffers;
+    atomic_init(&provider->decimation, 1);
+    atomic_init(&provider->frameIntervalUs, 0);
+
+    if (numFrames > 0) {
+        provider->defaultConsumer =
+            subscribeImgProvider(provider, numFrames, IMG_DROP_OLDEST);
+        if (!provider->defaultConsumer) {
+            goto errorExit;
+        }
     }
 
     if (!createStream(provider, w, h)) {
@@ -141,17 +362,10 @@ ImgProvider_t* createImgProvider(unsigned int w, unsigned int h,
     return provider;
 
 errorExit:
-    if (mtxInitialized) {
-        pthread_mutex_destroy(&provider->frameMutex);
-    }
-    if (condInitialized) {
-        pthread_cond_destroy(&provider->frameDeliverCond);
-    }
-    if (provider->deliveredFrames) {
-        g_queue_free(provider->deliveredFrames);
-    }
-    if (provider->processedFrames) {
-        g_queue_free(provider->processedFrames);
+    if (provider) {
+        for (unsigned int i = 0; i < provider->numConsumers; i++) {
+            destroyImgConsumer(provider->consumers[i]);
+        }
     }
 
     free(provider);
@@ -159,6 +373,58 @@ errorExit:
     return NULL;
 }
 
+ImgProvider_t* createImgProviderReplay(const char* path, unsigned int w,
+                                       unsigned int h, unsigned int numFrames,
+                                       double fps, bool loop) {
+    ImgProvider_t* provider = calloc(1, sizeof(ImgProvider_t));
+    if (!provider) {
+        syslog(LOG_ERR, "%s: Unable to allocate ImgProvider: %s", __func__,
+               strerror(errno));
+        return NULL;
+    }
+
+    provider->replay = createImgReplay(path, w, h, fps, loop);
+    if (!provider->replay) {
+        free(provider);
+        return NULL;
+    }
+    pthread_mutex_init(&provider->replayMutex, NULL);
+    pthread_cond_init(&provider->replayCond, NULL);
+    provider->replayLockstep = fps == 0;
+
+    // Recorded frames are packed.
+    provider->vdoFormat = VDO_FORMAT_YUV;
+    provider->streamWidth = w;
+    provider->streamHeight = h;
+    provider->yPitch = w;
+    provider->uvPitch = w;
+    provider->uvOffset = (size_t) w * h;
+    provider->streamFrameRate = fps;
+
+    atomic_init(&provider->numBuffers, NUM_VDO_BUFFERS);
+    provider->minBuffers = NUM_VDO_BUFFERS;
+    provider->maxBuffers = NUM_VDO_BUFFERS;
+    for (unsigned int i = 0; i < NUM_VDO_BUFFERS; i++) {
+        atomic_init(&provider->vdoBuffers[i],
+                    (VdoBuffer*) (void*) &provider->replayData[i]);
+        provider->replayFree[i] = i;
+    }
+    provider->buffersInVdo = NUM_VDO_BUFFERS;
+    atomic_init(&provider->decimation, 1);
+    atomic_init(&provider->frameIntervalUs, 0);
+
+    if (numFrames > 0) {
+        provider->defaultConsumer =
+            subscribeImgProvider(provider, numFrames, IMG_DROP_OLDEST);
+        if (!provider->defaultConsumer) {
+            destroyImgProvider(provider);
+            return NULL;
+        }
+    }
+
+    return provider;
+}
+
 void destroyImgProvider(ImgProvider_t* provider) {
     if (!provider) {
         syslog(LOG_ERR, "%s: Invalid pointer to ImgProvider", __func__);
@@ -167,15 +433,88 @@ void destroyImgProvider(ImgProvider_t* provider) {
 
     releaseVdoBuffers(provider);
 
-    pthread_mutex_destroy(&provider->frameMutex);
-    pthread_cond_destroy(&provider->frameDeliverCond);
+    for (unsigned int i = 0; i < provider->numConsumers; i++) {
+        destroyImgConsumer(provider->consumers[i]);
+    }
 
-    g_queue_free(provider->deliveredFrames);
-    g_queue_free(provider->processedFrames);
+    if (provider->replay) {
+        destroyImgReplay(provider->replay);
+        pthread_mutex_destroy(&provider->replayMutex);
+        pthread_cond_destroy(&provider->replayCond);
+    }
 
     free(provider);
 }
 
+ImgConsumer_t* subscribeImgProvider(ImgProvider_t* provider,
+                                    unsigned int numFrames,
+                                    ImgDropPolicy dropPolicy) {
+    if (numFrames == 0 || numFrames >= provider->maxBuffers) {
+        syslog(LOG_ERR, "%s: Invalid number of frames %u", __func__, numFrames);
+        return NULL;
+    }
+    if (provider->numConsumers >= MAX_IMG_CONSUMERS) {
+        syslog(LOG_ERR, "%s: Provider already has %d consumers", __func__,
+               MAX_IMG_CONSUMERS);
+        return NULL;
+    }
+
+    ImgConsumer_t* consumer = calloc(1, sizeof(ImgConsumer_t));
+    if (!consumer) {
+        syslog(LOG_ERR, "%s: Unable to allocate ImgConsumer: %s", __func__,
+               strerror(errno));
+        return NULL;
+    }
+
+    consumer->provider = provider;
+    consumer->dropPolicy = dropPolicy;
+
+    consumer->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (consumer->eventFd < 0) {
+        syslog(LOG_ERR, "%s: Unable to create event fd: %s", __func__,
+               strerror(errno));
+        free(consumer);
+        return NULL;
+    }
+
+    // Every buffer can be returned before the thread reclaims any.
+    consumer->frames = createFrameRing(numFrames, MAX_VDO_BUFFERS);
+    if (!consumer->frames) {
+        syslog(LOG_ERR, "%s: Unable to create frame ring!", __func__);
+        close(consumer->eventFd);
+        free(consumer);
+        return NULL;
+    }
+
+    provider->consumers[provider->numConsumers++] = consumer;
+
+    return consumer;
+}
+
+static void destroyImgConsumer(ImgConsumer_t* consumer) {
+    if (!consumer) {
+        return;
+    }
+
+    destroyFrameRing(consumer->frames);
+    close(consumer->eventFd);
+    free(consumer);
+}
+
+static void notifyConsumer(ImgConsumer_t* consumer) {
+    if (!atomic_load_explicit(&consumer->eventFdWanted,
+                              memory_order_relaxed)) {
+        return;
+    }
+
+    // Only fails if the counter would overflow, then it is readable anyway.
+    uint64_t one = 1;
+    if (write(consumer->eventFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        syslog(LOG_WARNING, "%s: Failed to signal event fd: %s", __func__,
+               strerror(errno));
+    }
+}
+
 bool allocateVdoBuffers(ImgProvider_t* provider, VdoStream* vdoStream) {
     GError* error = NULL;
     bool ret = false;
@@ -183,31 +522,32 @@ bool allocateVdoBuffers(ImgProvider_t* provider, VdoStream* vdoStream) {
     assert(provider);
     assert(vdoStream);
 
-    for (size_t i = 0; i < NUM_VDO_BUFFERS; i++) {
-        provider->vdoBuffers[i] =
-            vdo_stream_buffer_alloc(vdoStream, NULL, &error);
-        if (provider->vdoBuffers[i] == NULL) {
+    for (size_t i = 0; i < provider->numBuffers; i++) {
+        VdoBuffer* buffer = vdo_stream_buffer_alloc(vdoStream, NULL, &error);
+        if (buffer == NULL) {
             syslog(LOG_ERR, "%s: Failed creating VDO buffer: %s", __func__,
                      (error != NULL) ? error->message : "N/A");
             goto errorExit;
         }
+        atomic_store_explicit(&provider->vdoBuffers[i], buffer,
+                              memory_order_release);
 
         // Make a 'speculative' vdo_buffer_get_data() call to trigger a
         // memory mapping of the buffer. The mapping is cached in the VDO
         // implementation.
-        void* dummyPtr = vdo_buffer_get_data(provider->vdoBuffers[i]);
+        void* dummyPtr = vdo_buffer_get_data(buffer);
         if (!dummyPtr) {
             syslog(LOG_ERR, "%s: Failed initializing buffer memmap: %s", __func__,
                      (error != NULL) ? error->message : "N/A");
             goto errorExit;
         }
 
-        if (!vdo_stream_buffer_enqueue(vdoStream, provider->vdoBuffers[i],
-                                       &error)) {
+        if (!vdo_stream_buffer_enqueue(vdoStream, buffer, &error)) {
             syslog(LOG_ERR, "%s: Failed enqueue VDO buffer: %s", __func__,
                      (error != NULL) ? error->message : "N/A");
             goto errorExit;
         }
+        provider->buffersInVdo++;
     }
 
     ret = true;
@@ -310,6 +650,11 @@ bool createStream(ImgProvider_t* provider, unsigned int w, unsigned int h) {
         goto errorExit;
     }
 
+    if (!readStreamLayout(provider, vdoStream, w, h)) {
+        syslog(LOG_ERR, "%s: Failed reading VDO stream info!", __func__);
+        goto errorExit;
+    }
+
     if (!allocateVdoBuffers(provider, vdoStream)) {
         syslog(LOG_ERR, "%s: Failed setting up VDO buffers!", __func__);
         goto errorExit;
@@ -339,46 +684,534 @@ end:
     return ret;
 }
 
+static bool readStreamLayout(ImgProvider_t* provider, VdoStream* vdoStream,
+                             unsigned int w, unsigned int h) {
+    GError* error = NULL;
+
+    VdoMap* info = vdo_stream_get_info(vdoStream, &error);
+    if (!info) {
+        syslog(LOG_ERR, "%s: Failed vdo_stream_get_info(): %s", __func__,
+               (error != NULL) ? error->message : "N/A");
+        g_clear_error(&error);
+        return false;
+    }
+
+    provider->streamWidth = vdo_map_get_uint32(info, "width", w);
+    provider->streamHeight = vdo_map_get_uint32(info, "height", h);
+    // Rows are unpadded if VDO reports no pitch. Chroma rows have the
+    // same pitch and follow directly after the last luma row.
+    provider->yPitch = vdo_map_get_uint32(info, "pitch", provider->streamWidth);
+    provider->uvPitch = provider->yPitch;
+    provider->uvOffset = (size_t) provider->yPitch * provider->streamHeight;
+    provider->streamFrameRate = vdo_map_get_double(info, "framerate", 0.0);
+
+    syslog(LOG_INFO, "%s: Stream %u x %u, pitch %u, UV plane at offset %zu",
+           __func__, provider->streamWidth, provider->streamHeight,
+           provider->yPitch, provider->uvOffset);
+
+    g_object_unref(info);
+
+    return true;
+}
+
 static void releaseVdoBuffers(ImgProvider_t* provider) {
     if (!provider->vdoStream) {
         return;
     }
 
-    for (size_t i = 0; i < NUM_VDO_BUFFERS; i++) {
-        if (provider->vdoBuffers[i] != NULL) {
-            vdo_stream_buffer_unref(provider->vdoStream,
-                                    &provider->vdoBuffers[i], NULL);
+    for (size_t i = 0; i < MAX_VDO_BUFFERS; i++) {
+        VdoBuffer* buffer = atomic_exchange_explicit(
+            &provider->vdoBuffers[i], NULL, memory_order_acq_rel);
+        if (buffer != NULL) {
+            vdo_stream_buffer_unref(provider->vdoStream, &buffer, NULL);
         }
     }
 }
 
-VdoBuffer* getLastFrameBlocking(ImgProvider_t* provider) {
-    VdoBuffer* returnBuf = NULL;
-    pthread_mutex_lock(&provider->frameMutex);
-
-    while (g_queue_get_length(provider->deliveredFrames) < 1) {
-        if (pthread_cond_wait(&provider->frameDeliverCond,
-                              &provider->frameMutex)) {
-            syslog(LOG_ERR, "%s: Failed to wait on condition: %s", __func__,
-                     strerror(errno));
-            goto errorExit;
+static int findBufferIndex(ImgProvider_t* provider, VdoBuffer* buffer) {
+    // An adaptive pool changes entries while consumers look up buffers, but
+    // never the entry of a buffer a consumer holds. The acquire loads pair
+    // with the release stores of the fetcher thread.
+    for (int i = 0; i < MAX_VDO_BUFFERS; i++) {
+        if (atomic_load_explicit(&provider->vdoBuffers[i],
+                                 memory_order_acquire) == buffer) {
+            return i;
         }
     }
 
-    returnBuf = g_queue_pop_tail(provider->deliveredFrames);
+    return -1;
+}
 
-errorExit:
-    pthread_mutex_unlock(&provider->frameMutex);
+static uint64_t monotonicTimeUs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    return returnBuf;
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static bool recordFrameInfo(ImgProvider_t* provider, VdoBuffer* buffer) {
+    VdoFrame* frame = vdo_buffer_get_frame(buffer);
+    unsigned int seq = frame ? vdo_frame_get_sequence_nbr(frame) : 0;
+
+    // Sequence numbers wrap, so only count gaps that move forward.
+    unsigned int ahead = seq - provider->lastReceivedSeq;
+    if (atomic_load_explicit(&provider->framesReceived, memory_order_relaxed) &&
+        ahead > 1 && ahead < UINT_MAX / 2) {
+        atomic_fetch_add_explicit(&provider->framesMissed, ahead - 1,
+                                  memory_order_relaxed);
+    }
+    provider->lastReceivedSeq = seq;
+    atomic_fetch_add_explicit(&provider->framesReceived, 1,
+                              memory_order_relaxed);
+
+    int idx = findBufferIndex(provider, buffer);
+    if (idx < 0) {
+        return false;
+    }
+
+    ImgFrameInfo_t* info = &provider->frameInfo[idx];
+    info->sequenceNbr = seq;
+    info->captureTimeUs = frame ? vdo_frame_get_timestamp(frame) : 0;
+    info->deliveryTimeUs = monotonicTimeUs();
+    info->framesSkipped = 0;
+
+    provider->bufferRefs[idx] = provider->numConsumers;
+
+    return true;
+}
+
+VdoBuffer* getConsumerFrameBlocking(ImgConsumer_t* consumer) {
+    return getConsumerFrameTimeout(consumer, -1);
+}
+
+VdoBuffer* getConsumerFrameTimeout(ImgConsumer_t* consumer, int timeoutMs) {
+    ImgProvider_t* provider = consumer->provider;
+
+    // Clear the event fd before looking for frames, a frame published after
+    // this makes it readable again.
+    if (atomic_load_explicit(&consumer->eventFdWanted, memory_order_relaxed)) {
+        uint64_t count;
+        if (read(consumer->eventFd, &count, sizeof(count)) < 0 &&
+            errno != EAGAIN) {
+            syslog(LOG_WARNING, "%s: Failed to clear event fd: %s", __func__,
+                   strerror(errno));
+        }
+    }
+
+    VdoBuffer* buffer = popFrameRingTimeout(consumer->frames, timeoutMs);
+    if (!buffer) {
+        return NULL;
+    }
+    atomic_fetch_add_explicit(&provider->framesFetched, 1,
+                              memory_order_relaxed);
+
+    int idx = findBufferIndex(provider, buffer);
+    if (idx < 0) {
+        return buffer;
+    }
+
+    // An older frame still in the ring can be fetched after a newer one, it
+    // skips nothing and does not move lastFetchedSeq back.
+    unsigned int seq = provider->frameInfo[idx].sequenceNbr;
+    unsigned int ahead = seq - consumer->lastFetchedSeq;
+    consumer->framesSkipped[idx] = 0;
+    if (!consumer->anyFetched) {
+        consumer->lastFetchedSeq = seq;
+        consumer->anyFetched = true;
+    } else if (ahead > 0 && ahead < UINT_MAX / 2) {
+        consumer->framesSkipped[idx] = ahead - 1;
+        consumer->lastFetchedSeq = seq;
+    }
+
+    return buffer;
+}
+
+void returnConsumerFrame(ImgConsumer_t* consumer, VdoBuffer* buffer) {
+    ImgProvider_t* provider = consumer->provider;
+
+    // Cannot fail, the ring has room for every buffer.
+    if (!returnFrameRing(consumer->frames, buffer)) {
+        syslog(LOG_ERR, "%s: Frame return queue is full", __func__);
+    }
+
+    // A replay can be waiting for the frame to come back.
+    if (provider->replay) {
+        pthread_mutex_lock(&provider->replayMutex);
+        pthread_cond_signal(&provider->replayCond);
+        pthread_mutex_unlock(&provider->replayMutex);
+    }
+}
+
+int getConsumerFrameEventFd(ImgConsumer_t* consumer) {
+    // Frames published before the fetcher thread sees the flag are not
+    // signalled, so start out readable and let the consumer look.
+    if (!atomic_exchange(&consumer->eventFdWanted, true)) {
+        notifyConsumer(consumer);
+    }
+
+    return consumer->eventFd;
+}
+
+bool getConsumerFrameInfo(ImgConsumer_t* consumer, VdoBuffer* buffer,
+                          ImgFrameInfo_t* info) {
+    int idx = findBufferIndex(consumer->provider, buffer);
+    if (idx < 0) {
+        syslog(LOG_ERR, "%s: Unknown buffer %p", __func__, (void*) buffer);
+        return false;
+    }
+
+    *info = consumer->provider->frameInfo[idx];
+    info->framesSkipped = consumer->framesSkipped[idx];
+
+    return true;
+}
+
+VdoBuffer* getLastFrameBlocking(ImgProvider_t* provider) {
+    if (!provider->defaultConsumer) {
+        syslog(LOG_ERR, "%s: Provider has no frames of its own, use a consumer",
+               __func__);
+        return NULL;
+    }
+
+    return getConsumerFrameBlocking(provider->defaultConsumer);
+}
+
+VdoBuffer* getLastFrameTimeout(ImgProvider_t* provider, int timeoutMs) {
+    if (!provider->defaultConsumer) {
+        syslog(LOG_ERR, "%s: Provider has no frames of its own, use a consumer",
+               __func__);
+        return NULL;
+    }
+
+    return getConsumerFrameTimeout(provider->defaultConsumer, timeoutMs);
+}
+
+int getFrameEventFd(ImgProvider_t* provider) {
+    if (!provider->defaultConsumer) {
+        syslog(LOG_ERR, "%s: Provider has no frames of its own, use a consumer",
+               __func__);
+        return -1;
+    }
+
+    return getConsumerFrameEventFd(provider->defaultConsumer);
+}
+
+bool getFrameInfo(ImgProvider_t* provider, VdoBuffer* buffer,
+                  ImgFrameInfo_t* info) {
+    if (!provider->defaultConsumer) {
+        syslog(LOG_ERR, "%s: Provider has no frames of its own, use a consumer",
+               __func__);
+        return false;
+    }
+
+    return getConsumerFrameInfo(provider->defaultConsumer, buffer, info);
+}
+
+const uint8_t* getFrameData(ImgProvider_t* provider, VdoBuffer* buffer) {
+    if (!provider->replay) {
+        return (const uint8_t*) vdo_buffer_get_data(buffer);
+    }
+
+    int idx = findBufferIndex(provider, buffer);
+    if (idx < 0) {
+        syslog(LOG_ERR, "%s: Unknown buffer %p", __func__, (void*) buffer);
+        return NULL;
+    }
+
+    return provider->replayData[idx];
+}
+
+bool isFrameFetchStopped(ImgProvider_t* provider) {
+    return atomic_load(&provider->fetchStopped);
+}
+
+void getProviderStats(ImgProvider_t* provider, ImgProviderStats_t* stats) {
+    stats->framesReceived =
+        atomic_load_explicit(&provider->framesReceived, memory_order_relaxed);
+    stats->framesFetched =
+        atomic_load_explicit(&provider->framesFetched, memory_order_relaxed);
+    stats->framesDropped =
+        atomic_load_explicit(&provider->framesDropped, memory_order_relaxed);
+    stats->framesMissed =
+        atomic_load_explicit(&provider->framesMissed, memory_order_relaxed);
+    stats->fetchErrors =
+        atomic_load_explicit(&provider->fetchErrors, memory_order_relaxed);
+    stats->framesDecimated =
+        atomic_load_explicit(&provider->framesDecimated, memory_order_relaxed);
+    stats->numBuffers =
+        atomic_load_explicit(&provider->numBuffers, memory_order_relaxed);
 }
 
 void returnFrame(ImgProvider_t* provider, VdoBuffer* buffer) {
-    pthread_mutex_lock(&provider->frameMutex);
+    if (!provider->defaultConsumer) {
+        syslog(LOG_ERR, "%s: Provider has no frames of its own, use a consumer",
+               __func__);
+        return;
+    }
+
+    returnConsumerFrame(provider->defaultConsumer, buffer);
+}
+
+static void releaseBuffer(ImgProvider_t* provider, VdoBuffer* buffer) {
+    int idx = findBufferIndex(provider, buffer);
+
+    // A buffer we cannot track has no references, hand it straight back.
+    if (idx < 0 || provider->bufferRefs[idx] <= 1) {
+        if (idx >= 0) {
+            provider->bufferRefs[idx] = 0;
+        }
+        recycleBuffer(provider, buffer);
+        return;
+    }
+
+    provider->bufferRefs[idx]--;
+}
+
+static void enqueueBuffer(ImgProvider_t* provider, VdoBuffer* buffer) {
+    GError* error = NULL;
+
+    // A replay can put the next frame in the buffer right away.
+    if (provider->replay) {
+        int idx = findBufferIndex(provider, buffer);
+        if (idx >= 0) {
+            provider->replayFree[provider->buffersInVdo++] = (unsigned int) idx;
+        }
+        return;
+    }
+
+    if (!vdo_stream_buffer_enqueue(provider->vdoStream, buffer, &error)) {
+        // Fail but we continue anyway hoping for the best.
+        syslog(LOG_WARNING, "%s: Failed enqueueing buffer to vdo: %s", __func__,
+               (error != NULL) ? error->message : "N/A");
+        g_clear_error(&error);
+        return;
+    }
+    provider->buffersInVdo++;
+}
+
+static void recycleBuffer(ImgProvider_t* provider, VdoBuffer* buffer) {
+    int idx = findBufferIndex(provider, buffer);
+
+    if (provider->buffersToRetire == 0 || idx < 0) {
+        enqueueBuffer(provider, buffer);
+        return;
+    }
+
+    // Unpublish the entry before the buffer goes away.
+    atomic_store_explicit(&provider->vdoBuffers[idx], NULL,
+                          memory_order_release);
+    vdo_stream_buffer_unref(provider->vdoStream, &buffer, NULL);
+    provider->buffersToRetire--;
+    atomic_fetch_sub(&provider->numBuffers, 1);
+}
+
+static bool addVdoBuffer(ImgProvider_t* provider) {
+    GError* error = NULL;
+    int idx = findBufferIndex(provider, NULL);
+    if (idx < 0) {
+        return false;
+    }
+
+    VdoBuffer* buffer = vdo_stream_buffer_alloc(provider->vdoStream, NULL,
+                                                &error);
+    if (!buffer) {
+        syslog(LOG_WARNING, "%s: Failed creating VDO buffer: %s", __func__,
+               (error != NULL) ? error->message : "N/A");
+        g_clear_error(&error);
+        return false;
+    }
+
+    // Map it now rather than when the first frame arrives, and only publish
+    // it to consumers once it is ready.
+    if (!vdo_buffer_get_data(buffer)) {
+        syslog(LOG_WARNING, "%s: Failed initializing buffer memmap", __func__);
+        vdo_stream_buffer_unref(provider->vdoStream, &buffer, NULL);
+        return false;
+    }
+    atomic_store_explicit(&provider->vdoBuffers[idx], buffer,
+                          memory_order_release);
+    atomic_fetch_add(&provider->numBuffers, 1);
+
+    enqueueBuffer(provider, buffer);
+
+    return true;
+}
+
+static void reclaimBuffers(ImgProvider_t* provider) {
+    for (unsigned int i = 0; i < provider->numConsumers; i++) {
+        FrameRing_t* frames = provider->consumers[i]->frames;
+        VdoBuffer* oldBuffer;
+        while ((oldBuffer = reclaimFrameRing(frames))) {
+            releaseBuffer(provider, oldBuffer);
+        }
+    }
+}
+
+static void waitForFreeBuffer(ImgProvider_t* provider) {
+    // Whatever the pool was about to give back is needed now.
+    provider->buffersToRetire = 0;
+
+    if (provider->minBuffers < provider->maxBuffers &&
+        atomic_load(&provider->numBuffers) < provider->maxBuffers &&
+        addVdoBuffer(provider)) {
+        syslog(LOG_INFO, "%s: Consumers hold every buffer, pool grows to %u "
+               "buffers", __func__, atomic_load(&provider->numBuffers));
+        return;
+    }
+
+    while (!provider->shutDown) {
+        reclaimBuffers(provider);
+        if (provider->buffersInVdo > 0) {
+            return;
+        }
+        usleep(STARVED_POLL_US);
+    }
+}
 
-    g_queue_push_tail(provider->processedFrames, buffer);
+static void adaptBufferPool(ImgProvider_t* provider) {
+    unsigned int numBuffers =
+        atomic_load_explicit(&provider->numBuffers, memory_order_relaxed);
+    unsigned int buffersOut = numBuffers - provider->buffersInVdo;
+    if (buffersOut > provider->peakBuffersOut) {
+        provider->peakBuffersOut = buffersOut;
+    }
+
+    uint64_t received =
+        atomic_load_explicit(&provider->framesReceived, memory_order_relaxed);
+    if (received - provider->windowStartReceived < POOL_WINDOW_FRAMES) {
+        return;
+    }
+
+    uint64_t missed =
+        atomic_load_explicit(&provider->framesMissed, memory_order_relaxed);
+    unsigned int target = numBuffers - provider->buffersToRetire;
+
+    if (missed > provider->windowStartMissed && target < provider->maxBuffers) {
+        // VDO ran dry, keep a buffer that was about to go or add one.
+        if (provider->buffersToRetire > 0) {
+            provider->buffersToRetire--;
+            target++;
+        } else if (addVdoBuffer(provider)) {
+            target++;
+        }
+        syslog(LOG_INFO, "%s: VDO dropped %llu frames, pool has %u buffers",
+               __func__,
+               (unsigned long long) (missed - provider->windowStartMissed),
+               target);
+    } else if (missed == provider->windowStartMissed &&
+               target > provider->minBuffers &&
+               provider->peakBuffersOut + POOL_HEADROOM < target) {
+        // Released when it next comes back from the consumers.
+        provider->buffersToRetire++;
+        syslog(LOG_INFO, "%s: At most %u buffers in use, pool shrinks to %u "
+               "buffers", __func__, provider->peakBuffersOut, target - 1);
+    }
 
-    pthread_mutex_unlock(&provider->frameMutex);
+    provider->windowStartReceived = received;
+    provider->windowStartMissed = missed;
+    provider->peakBuffersOut = 0;
+}
+
+bool setFrameDecimation(ImgProvider_t* provider, unsigned int interval) {
+    if (interval == 0) {
+        syslog(LOG_ERR, "%s: Invalid decimation interval 0", __func__);
+        return false;
+    }
+
+    atomic_store(&provider->decimation, interval);
+
+    return true;
+}
+
+bool setTargetFrameRate(ImgProvider_t* provider, double fps) {
+    GError* error = NULL;
+
+    if (!(fps >= 0)) {
+        syslog(LOG_ERR, "%s: Invalid frame rate %f", __func__, fps);
+        return false;
+    }
+
+    bool fullRate = fps == 0 || (provider->streamFrameRate > 0 &&
+                                 fps >= provider->streamFrameRate);
+    double vdoFps = fullRate ? provider->streamFrameRate : fps;
+
+    // Full rate is only restored through VDO if it is known. A replay has no
+    // stream and always skips frames.
+    if (vdoFps > 0 && provider->vdoStream &&
+        vdo_stream_set_framerate(provider->vdoStream, vdoFps, &error)) {
+        atomic_store(&provider->frameIntervalUs, 0);
+        syslog(LOG_INFO, "%s: VDO delivers %.2f fps", __func__, vdoFps);
+        return true;
+    }
+    if (error) {
+        syslog(LOG_INFO,
+               "%s: VDO cannot change the frame rate, skipping frames "
+               "instead: %s",
+               __func__, error->message);
+        g_clear_error(&error);
+    }
+
+    atomic_store(&provider->frameIntervalUs,
+                 fullRate ? 0 : (unsigned int) (1000000.0 / fps));
+
+    return true;
+}
+
+static bool skipFrame(ImgProvider_t* provider, VdoBuffer* buffer) {
+    unsigned int decimation =
+        atomic_load_explicit(&provider->decimation, memory_order_relaxed);
+    if (decimation > 1 && ++provider->framesSinceDelivery < decimation) {
+        return true;
+    }
+    provider->framesSinceDelivery = 0;
+
+    unsigned int intervalUs =
+        atomic_load_explicit(&provider->frameIntervalUs, memory_order_relaxed);
+    if (intervalUs == 0) {
+        return false;
+    }
+
+    // Capture time as recorded when the frame was received.
+    int idx = findBufferIndex(provider, buffer);
+    uint64_t timeUs = idx >= 0 && provider->frameInfo[idx].captureTimeUs ?
+                          provider->frameInfo[idx].captureTimeUs :
+                          monotonicTimeUs();
+    if (timeUs + intervalUs / FRAME_RATE_SLACK < provider->nextDeliveryUs) {
+        return true;
+    }
+
+    // Keep to the target rate on average, unless delivery fell more than a
+    // frame interval behind, e.g. after the limit was changed.
+    provider->nextDeliveryUs += intervalUs;
+    if (provider->nextDeliveryUs < timeUs) {
+        provider->nextDeliveryUs = timeUs + intervalUs;
+    }
+
+    return false;
+}
+
+static void publishFrame(ImgProvider_t* provider, VdoBuffer* buffer) {
+    for (unsigned int i = 0; i < provider->numConsumers; i++) {
+        ImgConsumer_t* consumer = provider->consumers[i];
+        VdoBuffer* droppedBuffer = NULL;
+
+        if (consumer->dropPolicy == IMG_DROP_NEWEST) {
+            if (!offerFrameRing(consumer->frames, buffer)) {
+                droppedBuffer = buffer;
+            }
+        } else {
+            droppedBuffer = pushFrameRing(consumer->frames, buffer);
+        }
+        if (droppedBuffer != buffer) {
+            notifyConsumer(consumer);
+        }
+
+        if (droppedBuffer) {
+            atomic_fetch_add_explicit(&provider->framesDropped, 1,
+                                      memory_order_relaxed);
+            releaseBuffer(provider, droppedBuffer);
+        }
+    }
 }
 
 static void* threadEntry(void* data) {
@@ -386,6 +1219,11 @@ static void* threadEntry(void* data) {
     ImgProvider_t* provider = (ImgProvider_t*) data;
 
     while (!provider->shutDown) {
+        if (provider->buffersInVdo == 0) {
+            waitForFreeBuffer(provider);
+            continue;
+        }
+
         // Block waiting for a frame from VDO
         VdoBuffer* newBuffer =
             vdo_stream_get_buffer(provider->vdoStream, &error);
@@ -395,44 +1233,120 @@ static void* threadEntry(void* data) {
             syslog(LOG_WARNING, "%s: Failed fetching frame from vdo: %s", __func__,
                        (error != NULL) ? error->message : "N/A");
             g_clear_error(&error);
+            atomic_fetch_add_explicit(&provider->fetchErrors, 1,
+                                      memory_order_relaxed);
             continue;
         }
-        pthread_mutex_lock(&provider->frameMutex);
+        if (provider->buffersInVdo > 0) {
+            provider->buffersInVdo--;
+        }
 
-        g_queue_push_tail(provider->deliveredFrames, newBuffer);
+        // The rings hand the metadata over along with the buffer. This also
+        // takes one reference per consumer.
+        bool tracked = recordFrameInfo(provider, newBuffer);
+        deliverFrame(provider, newBuffer, tracked);
 
-        VdoBuffer* oldBuffer = NULL;
+        if (provider->minBuffers < provider->maxBuffers) {
+            adaptBufferPool(provider);
+        }
+    }
+    return NULL;
+}
 
-        // First check if there are any frames returned from app
-        // processing
-        if (g_queue_get_length(provider->processedFrames) > 0) {
-            oldBuffer = g_queue_pop_head(provider->processedFrames);
-        } else {
-            // Client specifies the number-of-recent-frames it needs to collect
-            // in one chunk (numAppFrames). Thus only enqueue buffers back to
-            // VDO if we have collected more buffers than numAppFrames.
-            if (g_queue_get_length(provider->deliveredFrames) >
-                provider->numAppFrames) {
-                oldBuffer = g_queue_pop_head(provider->deliveredFrames);
-            }
+static void deliverFrame(ImgProvider_t* provider, VdoBuffer* buffer,
+                         bool tracked) {
+    if (skipFrame(provider, buffer)) {
+        // Not wanted at the current frame rate.
+        atomic_fetch_add_explicit(&provider->framesDecimated, 1,
+                                  memory_order_relaxed);
+        recycleBuffer(provider, buffer);
+    } else if (provider->numConsumers == 0 ||
+               (!tracked && provider->numConsumers > 1)) {
+        // Nobody to hand it to, or no way to count references.
+        recycleBuffer(provider, buffer);
+    } else {
+        publishFrame(provider, buffer);
+    }
+
+    // Then everything the consumers have handed back since the last frame.
+    reclaimBuffers(provider);
+}
+
+static void waitForReturnedFrames(ImgProvider_t* provider) {
+    unsigned int numBuffers = atomic_load(&provider->numBuffers);
+
+    // Consumers signal under the mutex after handing a frame back, so a
+    // frame returned after the reclaim below still wakes the wait.
+    pthread_mutex_lock(&provider->replayMutex);
+    while (!provider->shutDown) {
+        reclaimBuffers(provider);
+        if (provider->buffersInVdo == numBuffers) {
+            break;
         }
+        pthread_cond_wait(&provider->replayCond, &provider->replayMutex);
+    }
+    pthread_mutex_unlock(&provider->replayMutex);
+}
 
-        if (oldBuffer) {
-            if (!vdo_stream_buffer_enqueue(provider->vdoStream, oldBuffer,
-                                           &error)) {
-                // Fail but we continue anyway hoping for the best.
-                syslog(LOG_WARNING, "%s: Failed enqueueing buffer to vdo: %s", __func__,
-                           (error != NULL) ? error->message : "N/A");
-                g_clear_error(&error);
-            }
+static void* replayThreadEntry(void* data) {
+    ImgProvider_t* provider = (ImgProvider_t*) data;
+    ImgReplayFrame_t frame;
+
+    while (!provider->shutDown) {
+        if (provider->replayLockstep) {
+            waitForReturnedFrames(provider);
+        } else if (provider->buffersInVdo == 0) {
+            waitForFreeBuffer(provider);
         }
-        pthread_cond_signal(&provider->frameDeliverCond);
-        pthread_mutex_unlock(&provider->frameMutex);
+        if (provider->shutDown || provider->buffersInVdo == 0) {
+            continue;
+        }
+
+        if (!getReplayFrame(provider->replay, &frame)) {
+            syslog(LOG_INFO, "%s: End of recording", __func__);
+            // Let the consumers have the last frames before closing.
+            waitForReturnedFrames(provider);
+            closeConsumers(provider);
+            break;
+        }
+
+        unsigned int idx = provider->replayFree[--provider->buffersInVdo];
+        VdoBuffer* buffer = atomic_load_explicit(&provider->vdoBuffers[idx],
+                                                 memory_order_relaxed);
+        provider->replayData[idx] = frame.data;
+
+        // Frames the replay was too late for count as missed, like frames
+        // VDO drops.
+        atomic_fetch_add_explicit(&provider->framesReceived, 1,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&provider->framesMissed, frame.framesSkipped,
+                                  memory_order_relaxed);
+
+        ImgFrameInfo_t* info = &provider->frameInfo[idx];
+        info->sequenceNbr = frame.sequenceNbr;
+        info->captureTimeUs = frame.captureTimeUs;
+        info->deliveryTimeUs = monotonicTimeUs();
+        info->framesSkipped = 0;
+        provider->bufferRefs[idx] = provider->numConsumers;
+
+        deliverFrame(provider, buffer, true);
+    }
+
+    return NULL;
+}
+
+static void closeConsumers(ImgProvider_t* provider) {
+    atomic_store(&provider->fetchStopped, true);
+    for (unsigned int i = 0; i < provider->numConsumers; i++) {
+        closeFrameRing(provider->consumers[i]->frames);
+        notifyConsumer(provider->consumers[i]);
     }
 }
 
 bool startFrameFetch(ImgProvider_t* provider) {
-    if (pthread_create(&provider->fetcherThread, NULL, threadEntry, provider)) {
+    if (pthread_create(&provider->fetcherThread, NULL,
+                       provider->replay ? replayThreadEntry : threadEntry,
+                       provider)) {
         syslog(LOG_ERR, "%s: Failed to start thread fetching frames from vdo: %s",
                  __func__, strerror(errno));
         return false;
@@ -443,6 +1357,14 @@ bool startFrameFetch(ImgProvider_t* provider) {
 
 bool stopFrameFetch(ImgProvider_t* provider) {
     provider->shutDown = true;
+    // Wake a replay waiting for frames to come back, the flag is set before
+    // the mutex is taken.
+    if (provider->replay) {
+        pthread_mutex_lock(&provider->replayMutex);
+        pthread_cond_broadcast(&provider->replayCond);
+        pthread_mutex_unlock(&provider->replayMutex);
+    }
+    closeConsumers(provider);
 
     if (pthread_join(provider->fetcherThread, NULL)) {
         syslog(LOG_ERR, "%s: Failed to join thread fetching frames from vdo: %s",
@@ -0,0 +1,151 @@
+/**
+ * Copyright (C) 2021, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file handles running a larod model on a set of tensors.
+ *
+ * A session creates all input and output tensors the model has, backs each
+ * of them by a buffer from a TensorPool sized from the tensor's pitches and
+ * creates the inference request once. Running an inference is then a single
+ * larod call, and the tensors are read and written in place through views
+ * describing their data type, layout and dimensions.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "larod.h"
+#include "tensorpool.h"
+
+/**
+ * brief A type representing a model with its tensors and inference request.
+ */
+typedef struct ModelSession ModelSession_t;
+
+/**
+ * brief A view of one input or output tensor of a session.
+ */
+typedef struct {
+    /// Tensor data, mapped for this process.
+    void* data;
+    /// Size of the tensor in bytes, including any padding.
+    size_t size;
+    /// Number of elements, the product of the dimensions.
+    size_t numElements;
+    larodTensorDataType dataType;
+    larodTensorLayout layout;
+    larodTensorDims dims;
+    larodTensorPitches pitches;
+} ModelTensorView_t;
+
+/**
+ * brief Create the tensors and the inference request of a model.
+ *
+ * param model Loaded model.
+ * param pool Pool to take the tensor buffers from. Must outlive the session.
+ * return Pointer to new ModelSession, or NULL if failed.
+ */
+ModelSession_t* createModelSession(const larodModel* model, TensorPool_t* pool);
+
+/**
+ * brief Destroy the tensors and the inference request and release the
+ * buffers to the pool.
+ *
+ * No inference may be running on the session.
+ *
+ * param session Pointer to ModelSession to be destroyed. Can be NULL.
+ */
+void destroyModelSession(ModelSession_t* session);
+
+/**
+ * brief Get the number of input tensors of the model.
+ *
+ * param session Pointer to a ModelSession.
+ * return Number of input tensors.
+ */
+size_t getSessionNumInputs(const ModelSession_t* session);
+
+/**
+ * brief Get the number of output tensors of the model.
+ *
+ * param session Pointer to a ModelSession.
+ * return Number of output tensors.
+ */
+size_t getSessionNumOutputs(const ModelSession_t* session);
+
+/**
+ * brief Get a view of an input tensor.
+ *
+ * param session Pointer to a ModelSession.
+ * param index Index of the input, in model order.
+ * return Pointer to the view, valid for the life of the session, or NULL if
+ *        the model has no such input.
+ */
+const ModelTensorView_t* getSessionInput(const ModelSession_t* session,
+                                         size_t index);
+
+/**
+ * brief Get a view of an output tensor.
+ *
+ * param session Pointer to a ModelSession.
+ * param index Index of the output, in model order.
+ * return Pointer to the view, valid for the life of the session, or NULL if
+ *        the model has no such output.
+ */
+const ModelTensorView_t* getSessionOutput(const ModelSession_t* session,
+                                          size_t index);
+
+/**
+ * brief Get the data of an output tensor of an expected data type.
+ *
+ * Meant to be called once after the session is created, so the type is
+ * checked once and the returned pointer used for every inference.
+ *
+ * param session Pointer to a ModelSession.
+ * param index Index of the output, in model order.
+ * param dataType Data type the caller reads the output as.
+ * param numElements Output number of elements in the tensor. Can be NULL.
+ * return Pointer to the output data, or NULL if the model has no such output
+ *        or it has another data type.
+ */
+const void* getSessionOutputData(const ModelSession_t* session, size_t index,
+                                 larodTensorDataType dataType,
+                                 size_t* numElements);
+
+/**
+ * brief Run an inference and wait for it to complete.
+ *
+ * param session Pointer to a ModelSession.
+ * param conn larod connection the model was loaded on.
+ * return False if any errors occur, otherwise true.
+ */
+bool runModelSession(ModelSession_t* session, larodConnection* conn);
+
+/**
+ * brief Start an inference and return without waiting for it.
+ *
+ * The tensors must not be touched until callback has been called.
+ *
+ * param session Pointer to a ModelSession.
+ * param conn larod connection the model was loaded on.
+ * param callback Called on a larod thread when the inference has completed.
+ * param userData Passed to callback.
+ * return False if the inference could not be started, otherwise true.
+ */
+bool startModelSession(ModelSession_t* session, larodConnection* conn,
+                       larodRunInferenceCallback callback, void* userData);
@@ -0,0 +1,404 @@
+/**
+ * Copyright (C) 2021, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file handles postprocessing of classification scores.
+ *
+ * Scores are compared as stored. The scale is positive, so the order of the
+ * stored values is the order of the scores and only the results need to be
+ * dequantized.
+ */
+
+#include "postprocess.h"
+
+#include <math.h>
+#include <string.h>
+#include <syslog.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/// Number of scores checked with one vectorized max when finding the top k.
+#define TOP_BLOCK (64)
+
+/**
+ * brief Get the highest of a range of uint8 scores.
+ *
+ * param v Scores.
+ * param n Number of scores.
+ * return The highest score, 0 if n is 0.
+ */
+static uint8_t maxU8(const uint8_t* v, size_t n) {
+    uint8_t max = 0;
+    size_t i = 0;
+
+#if defined(__ARM_NEON)
+    if (n >= 16) {
+        uint8x16_t acc = vld1q_u8(v);
+        for (i = 16; i + 16 <= n; i += 16) {
+            acc = vmaxq_u8(acc, vld1q_u8(v + i));
+        }
+        uint8x8_t m = vmax_u8(vget_low_u8(acc), vget_high_u8(acc));
+        m = vpmax_u8(m, m);
+        m = vpmax_u8(m, m);
+        m = vpmax_u8(m, m);
+        max = vget_lane_u8(m, 0);
+    }
+#elif defined(__SSE2__)
+    if (n >= 16) {
+        __m128i acc = _mm_loadu_si128((const __m128i*) v);
+        for (i = 16; i + 16 <= n; i += 16) {
+            acc = _mm_max_epu8(acc, _mm_loadu_si128((const __m128i*) (v + i)));
+        }
+        acc = _mm_max_epu8(acc, _mm_srli_si128(acc, 8));
+        acc = _mm_max_epu8(acc, _mm_srli_si128(acc, 4));
+        acc = _mm_max_epu8(acc, _mm_srli_si128(acc, 2));
+        acc = _mm_max_epu8(acc, _mm_srli_si128(acc, 1));
+        max = (uint8_t) _mm_cvtsi128_si32(acc);
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (v[i] > max) {
+            max = v[i];
+        }
+    }
+
+    return max;
+}
+
+/**
+ * brief Get the highest of a range of int8 scores.
+ *
+ * param v Scores.
+ * param n Number of scores.
+ * return The highest score, INT8_MIN if n is 0.
+ */
+static int8_t maxS8(const int8_t* v, size_t n) {
+    int8_t max = INT8_MIN;
+    size_t i = 0;
+
+#if defined(__ARM_NEON)
+    if (n >= 16) {
+        int8x16_t acc = vld1q_s8(v);
+        for (i = 16; i + 16 <= n; i += 16) {
+            acc = vmaxq_s8(acc, vld1q_s8(v + i));
+        }
+        int8x8_t m = vmax_s8(vget_low_s8(acc), vget_high_s8(acc));
+        m = vpmax_s8(m, m);
+        m = vpmax_s8(m, m);
+        m = vpmax_s8(m, m);
+        max = vget_lane_s8(m, 0);
+    }
+#elif defined(__SSE2__)
+    if (n >= 16) {
+        // SSE2 only has an unsigned byte max, flipping the sign bit maps
+        // int8 to uint8 keeping the order.
+        const __m128i sign = _mm_set1_epi8((char) 0x80);
+        __m128i acc = _mm_xor_si128(_mm_loadu_si128((const __m128i*) v), sign);
+        for (i = 16; i + 16 <= n; i += 16) {
+            acc = _mm_max_epu8(
+                acc,
+                _mm_xor_si128(_mm_loadu_si128((const __m128i*) (v + i)), sign));
+        }
+        acc = _mm_max_epu8(acc, _mm_srli_si128(acc, 8));
+        acc = _mm_max_epu8(acc, _mm_srli_si128(acc, 4));
+        acc = _mm_max_epu8(acc, _mm_srli_si128(acc, 2));
+        acc = _mm_max_epu8(acc, _mm_srli_si128(acc, 1));
+        max = (int8_t) (_mm_cvtsi128_si32(acc) ^ 0x80);
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (v[i] > max) {
+            max = v[i];
+        }
+    }
+
+    return max;
+}
+
+/**
+ * brief Get the highest of a range of float scores.
+ *
+ * param v Scores.
+ * param n Number of scores.
+ * return The highest score, -INFINITY if n is 0.
+ */
+static float maxF32(const float* v, size_t n) {
+    float max = -INFINITY;
+    size_t i = 0;
+
+#if defined(__ARM_NEON)
+    if (n >= 4) {
+        float32x4_t acc = vld1q_f32(v);
+        for (i = 4; i + 4 <= n; i += 4) {
+            acc = vmaxq_f32(acc, vld1q_f32(v + i));
+        }
+        float32x2_t m = vmax_f32(vget_low_f32(acc), vget_high_f32(acc));
+        m = vpmax_f32(m, m);
+        max = vget_lane_f32(m, 0);
+    }
+#elif defined(__SSE2__)
+    if (n >= 4) {
+        __m128 acc = _mm_loadu_ps(v);
+        for (i = 4; i + 4 <= n; i += 4) {
+            acc = _mm_max_ps(acc, _mm_loadu_ps(v + i));
+        }
+        acc = _mm_max_ps(acc, _mm_movehl_ps(acc, acc));
+        acc = _mm_max_ps(acc, _mm_shuffle_ps(acc, acc, 1));
+        max = _mm_cvtss_f32(acc);
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (v[i] > max) {
+            max = v[i];
+        }
+    }
+
+    return max;
+}
+
+/**
+ * brief Get a score as stored, before dequantization.
+ *
+ * param scores Scores.
+ * param dataType Data type of the scores.
+ * param index Index of the score.
+ * return The stored value.
+ */
+static inline float storedScore(const void* scores, ScoreDataType_t dataType,
+                                size_t index) {
+    switch (dataType) {
+    case SCORE_DTYPE_UINT8:
+        return ((const uint8_t*) scores)[index];
+    case SCORE_DTYPE_INT8:
+        return ((const int8_t*) scores)[index];
+    default:
+        return ((const float*) scores)[index];
+    }
+}
+
+/**
+ * brief Get the highest stored value of a range of scores.
+ *
+ * param scores Scores.
+ * param dataType Data type of the scores.
+ * param start Index of the first score of the range.
+ * param n Number of scores in the range.
+ * return The highest stored value.
+ */
+static float maxStoredScore(const void* scores, ScoreDataType_t dataType,
+                            size_t start, size_t n) {
+    switch (dataType) {
+    case SCORE_DTYPE_UINT8:
+        return maxU8((const uint8_t*) scores + start, n);
+    case SCORE_DTYPE_INT8:
+        return maxS8((const int8_t*) scores + start, n);
+    default:
+        return maxF32((const float*) scores + start, n);
+    }
+}
+
+/**
+ * brief Compute the softmax denominator relative to the highest score.
+ *
+ * param scores Scores.
+ * param numScores Number of scores.
+ * param format Format of the scores.
+ * param maxStored Highest stored value of all scores.
+ * return Sum of exp(scale * (v - maxStored)) over all stored values v.
+ */
+static double softmaxDenominator(const void* scores, size_t numScores,
+                                 const ScoreFormat_t* format, float maxStored) {
+    double sum = 0.0;
+
+    if (format->dataType == SCORE_DTYPE_FLOAT32) {
+        const float* v = (const float*) scores;
+        for (size_t i = 0; i < numScores; i++) {
+            sum += expf(format->scale * (v[i] - maxStored));
+        }
+
+        return sum;
+    }
+
+    // Quantized scores take at most 256 values, so exp is computed once per
+    // value instead of once per score.
+    uint32_t histogram[256] = {0};
+    const uint8_t* bytes = (const uint8_t*) scores;
+    for (size_t i = 0; i < numScores; i++) {
+        histogram[bytes[i]]++;
+    }
+    for (unsigned int b = 0; b < 256; b++) {
+        if (histogram[b]) {
+            float stored = format->dataType == SCORE_DTYPE_INT8 ?
+                               (float) (int8_t) b :
+                               (float) b;
+            sum += histogram[b] * exp(format->scale * (stored - maxStored));
+        }
+    }
+
+    return sum;
+}
+
+void initScoreFormat(ScoreFormat_t* format, ScoreDataType_t dataType) {
+    format->dataType = dataType;
+    switch (dataType) {
+    case SCORE_DTYPE_UINT8:
+        format->scale = 1.0f / 256.0f;
+        format->zeroPoint = 0;
+        break;
+    case SCORE_DTYPE_INT8:
+        format->scale = 1.0f / 256.0f;
+        format->zeroPoint = -128;
+        break;
+    default:
+        format->scale = 1.0f;
+        format->zeroPoint = 0;
+        break;
+    }
+    format->softmax = false;
+}
+
+bool initScoreFormatFromLarod(ScoreFormat_t* format,
+                              larodTensorDataType dataType) {
+    switch (dataType) {
+    case LAROD_TENSOR_DATA_TYPE_UINT8:
+        initScoreFormat(format, SCORE_DTYPE_UINT8);
+        return true;
+    case LAROD_TENSOR_DATA_TYPE_INT8:
+        initScoreFormat(format, SCORE_DTYPE_INT8);
+        return true;
+    case LAROD_TENSOR_DATA_TYPE_FLOAT32:
+        initScoreFormat(format, SCORE_DTYPE_FLOAT32);
+        return true;
+    default:
+        syslog(LOG_ERR, "%s: Unsupported output tensor data type %d", __func__,
+               dataType);
+        return false;
+    }
+}
+
+size_t getScoreSize(ScoreDataType_t dataType) {
+    return dataType == SCORE_DTYPE_FLOAT32 ? sizeof(float) : 1;
+}
+
+size_t argmaxScores(const void* scores, size_t numScores,
+                    ScoreDataType_t dataType) {
+    if (numScores == 0) {
+        return 0;
+    }
+
+    // Find the highest value with a vectorized max, then its first index.
+    // Bytes are found with memchr(), which is vectorized by libc.
+    if (dataType != SCORE_DTYPE_FLOAT32) {
+        uint8_t max = dataType == SCORE_DTYPE_UINT8 ?
+                          maxU8((const uint8_t*) scores, numScores) :
+                          (uint8_t) maxS8((const int8_t*) scores, numScores);
+        const uint8_t* found = memchr(scores, max, numScores);
+
+        return (size_t) (found - (const uint8_t*) scores);
+    }
+
+    const float* v = (const float*) scores;
+    float max = maxF32(v, numScores);
+    for (size_t i = 0; i < numScores; i++) {
+        if (v[i] == max) {
+            return i;
+        }
+    }
+
+    // Only NaN scores.
+    return 0;
+}
+
+float dequantizeScore(const void* scores, size_t index,
+                      const ScoreFormat_t* format) {
+    return format->scale *
+           (storedScore(scores, format->dataType, index) - format->zeroPoint);
+}
+
+size_t getTopScores(const void* scores, size_t numScores,
+                    const ScoreFormat_t* format, ScoreResult_t* results,
+                    size_t k) {
+    if (k > numScores) {
+        k = numScores;
+    }
+    if (k == 0) {
+        return 0;
+    }
+
+    // While searching, the score of a result is its stored value.
+    size_t count = 0;
+    if (k == 1) {
+        results[0].index = argmaxScores(scores, numScores, format->dataType);
+        results[0].score =
+            storedScore(scores, format->dataType, results[0].index);
+        count = 1;
+    } else {
+        for (size_t start = 0; start < numScores; start += TOP_BLOCK) {
+            size_t n = numScores - start < TOP_BLOCK ? numScores - start :
+                                                       TOP_BLOCK;
+            // Once k results are found most blocks hold nothing better than
+            // the worst of them.
+            if (count == k &&
+                maxStoredScore(scores, format->dataType, start, n) <=
+                    results[k - 1].score) {
+                continue;
+            }
+
+            for (size_t i = start; i < start + n; i++) {
+                float value = storedScore(scores, format->dataType, i);
+                if (count == k && value <= results[k - 1].score) {
+                    continue;
+                }
+
+                // Insert sorted, replacing the worst result if full.
+                size_t pos = count < k ? count++ : k - 1;
+                while (pos > 0 && results[pos - 1].score < value) {
+                    results[pos] = results[pos - 1];
+                    pos--;
+                }
+                results[pos].index = i;
+                results[pos].score = value;
+            }
+        }
+    }
+
+    // The first result holds the highest stored value, which keeps exp()
+    // from overflowing.
+    float maxStored = results[0].score;
+    double denominator = format->softmax ?
+                             softmaxDenominator(scores, numScores, format,
+                                                maxStored) :
+                             0.0;
+    for (size_t i = 0; i < count; i++) {
+        float stored = results[i].score;
+        if (format->softmax) {
+            results[i].score =
+                (float) (exp(format->scale * (stored - maxStored)) /
+                         denominator);
+        } else {
+            results[i].score = format->scale * (stored - format->zeroPoint);
+        }
+    }
+
+    return count;
+}
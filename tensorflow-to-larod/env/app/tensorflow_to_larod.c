@@ -35,7 +35,6 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/mman.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <syslog.h>
@@ -45,6 +44,9 @@
 #include "imgconverter.h"
 #include "imgprovider.h"
 #include "larod.h"
+#include "modelsession.h"
+#include "postprocess.h"
+#include "tensorpool.h"
 #include "vdo-frame.h"
 #include "vdo-types.h"
 
@@ -73,66 +75,6 @@ void sigintHandler(int sig) {
     stopRunning = true;
 }
 
-/**
- * brief Creates a temporary fd and truncated to correct size and mapped.
- *
- * This convenience function creates temp files to be used for input and output.
- *
- * param fileName Pattern for how the temp file will be named in file system.
- * param fileSize How much space needed to be allocated (truncated) in fd.
- * param mappedAddr Pointer to the address of the fd mapped for this process.
- * param Pointer to the generated fd.
- * return Positive errno style return code (zero means success).
- */
-bool createAndMapTmpFile(char* fileName, size_t fileSize, void** mappedAddr,
-                         int* convFd) {
-    syslog(LOG_INFO, "%s: Setting up a temp fd with pattern %s and size %zu", __func__,
-            fileName, fileSize);
-
-    int fd = mkstemp(fileName);
-    if (fd < 0) {
-        syslog(LOG_ERR, "%s: Unable to open temp file %s: %s", __func__, fileName,
-                 strerror(errno));
-        goto error;
-    }
-
-    // Allocate enough space in for the fd.
-    if (ftruncate(fd, (off_t) fileSize) < 0) {
-        syslog(LOG_ERR, "%s: Unable to truncate temp file %s: %s", __func__, fileName,
-                 strerror(errno));
-        goto error;
-    }
-
-    // Remove since we don't actually care about writing to the file system.
-    if (unlink(fileName)) {
-        syslog(LOG_ERR, "%s: Unable to unlink from temp file %s: %s", __func__,
-                 fileName, strerror(errno));
-        goto error;
-    }
-
-    // Get an address to fd's memory for this process's memory space.
-    void* data =
-        mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-
-    if (data == MAP_FAILED) {
-        syslog(LOG_ERR, "%s: Unable to mmap temp file %s: %s", __func__, fileName,
-                 strerror(errno));
-        goto error;
-    }
-
-    *mappedAddr = data;
-    *convFd = fd;
-
-    return true;
-
-error:
-    if (fd >= 0) {
-        close(fd);
-    }
-
-    return false;
-}
-
 /**
  * brief Sets up and configures a connection to larod, and loads a model.
  *
@@ -201,30 +143,14 @@ end:
  * brief Main function that starts a stream with different options.
  */
 int main(int argc, char** argv) {
-    // Hardcode to use three image "color" channels (eg. RGB).
-    const unsigned int CHANNELS = 3;
-
-    // Name patterns for the temp file we will create.
-    char CONV_INP_FILE_PATTERN[] = "/tmp/larod.in.test-XXXXXX";
-    char CONV_OUT1_FILE_PATTERN[] = "/tmp/larod.out1.test-XXXXXX";
-    char CONV_OUT2_FILE_PATTERN[] = "/tmp/larod.out2.test-XXXXXX";
-
     bool ret = false;
     ImgProvider_t* provider = NULL;
-    larodError* error = NULL;
+    ImgConverter_t* converter = NULL;
+    RowPool_t* rowPool = NULL;
     larodConnection* conn = NULL;
-    larodTensor** inputTensors = NULL;
-    size_t numInputs = 0;
-    larodTensor** outputTensors = NULL;
-    size_t numOutputs = 0;
-    larodInferenceRequest* infReq = NULL;
-    void* larodInputAddr = MAP_FAILED;
-    void* larodOutput1Addr = MAP_FAILED;
-    void* larodOutput2Addr = MAP_FAILED;
+    TensorPool_t* tensorPool = NULL;
+    ModelSession_t* session = NULL;
     int larodModelFd = -1;
-    int larodInputFd = -1;
-    int larodOutput1Fd = -1;
-    int larodOutput2Fd = -1;
     args_t args;
 
     // Open the syslog to report messages for "tensorflow_to_larod"
@@ -255,84 +181,86 @@ int main(int argc, char** argv) {
       syslog(LOG_ERR, "%s: Failed to create ImgProvider", __func__);
         goto end;
     }
-
-    larodModelFd = open(args.modelFile, O_RDONLY);
-    if (larodModelFd < 0) {
-        syslog(LOG_ERR, "Unable to open model file %s: %s", args.modelFile,
-                 strerror(errno));
+    // Frames that would not be analyzed are not delivered at all.
+    if (!setFrameDecimation(provider, args.everyNth) ||
+        !setTargetFrameRate(provider, args.fps)) {
         goto end;
     }
 
-    syslog(LOG_INFO, "Setting up larod connection with chip %d and model %s", args.chip,
-            args.modelFile);
-    larodModel* model = NULL;
-    if (!setupLarod(args.chip, larodModelFd, &conn, &model)) {
+    converter = createImgConverter(streamWidth, streamHeight, args.width,
+                                   args.height, IMG_CROP_FULL);
+    if (!converter) {
+        syslog(LOG_ERR, "%s: Failed to create ImgConverter", __func__);
         goto end;
     }
-
-    syslog(LOG_INFO, "Creating temporary files and memmaps for inference input and "
-            "output tensors");
-
-
-    // Allocate space for input tensor
-    if (!createAndMapTmpFile(CONV_INP_FILE_PATTERN,
-                             args.width * args.height * CHANNELS,
-                             &larodInputAddr, &larodInputFd)) {
+    // VDO buffers can have padded rows, convert them in place.
+    ImgNv12Layout_t srcLayout = {0, provider->uvOffset, provider->yPitch,
+                                 provider->uvPitch};
+    if (!setImgConverterSourceLayout(converter, &srcLayout)) {
+        syslog(LOG_ERR, "%s: Failed to set ImgConverter source layout",
+               __func__);
         goto end;
     }
 
-    // Allocate space for output tensor 1 (the person prediction)
-    if (!createAndMapTmpFile(CONV_OUT1_FILE_PATTERN, args.outputBytes,
-                             &larodOutput1Addr, &larodOutput1Fd)) {
+    // Split image conversion over the otherwise idle cores.
+    rowPool = createRowPool(0);
+    if (!rowPool) {
+        syslog(LOG_ERR, "%s: Failed to create RowPool", __func__);
         goto end;
     }
-
-    // Allocate space for output tensor 2 (the car prediction)
-    if (!createAndMapTmpFile(CONV_OUT2_FILE_PATTERN, args.outputBytes,
-                             &larodOutput2Addr, &larodOutput2Fd)) {
+    if (!setImgConverterPool(converter, rowPool)) {
+        syslog(LOG_ERR, "%s: Failed to set ImgConverter pool", __func__);
         goto end;
     }
 
-    syslog(LOG_INFO, "Create input tensors");
-    inputTensors = larodCreateModelInputs(model, &numInputs, &error);
-    if (!inputTensors) {
-        syslog(LOG_ERR, "Failed retrieving input tensors: %s", error->msg);
+    larodModelFd = open(args.modelFile, O_RDONLY);
+    if (larodModelFd < 0) {
+        syslog(LOG_ERR, "Unable to open model file %s: %s", args.modelFile,
+                 strerror(errno));
         goto end;
     }
 
-    syslog(LOG_INFO, "Set input tensors");
-    if (!larodSetTensorFd(inputTensors[0], larodInputFd, &error)) {
-        syslog(LOG_ERR, "Failed setting input tensor fd: %s", error->msg);
+    syslog(LOG_INFO, "Setting up larod connection with chip %d and model %s", args.chip,
+            args.modelFile);
+    larodModel* model = NULL;
+    if (!setupLarod(args.chip, larodModelFd, &conn, &model)) {
         goto end;
     }
 
-    syslog(LOG_INFO, "Create output tensors");
-    outputTensors = larodCreateModelOutputs(model, &numOutputs, &error);
-    if (!outputTensors) {
-        syslog(LOG_ERR, "Failed retrieving output tensors: %s", error->msg);
+    syslog(LOG_INFO, "Creating buffers for inference input and output tensors");
+    tensorPool = createTensorPool();
+    if (!tensorPool) {
         goto end;
     }
 
-
-    syslog(LOG_INFO, "Set output tensors");
-    if (!larodSetTensorFd(outputTensors[0], larodOutput1Fd, &error)) {
-        syslog(LOG_ERR, "Failed setting output tensor fd: %s", error->msg);
+    syslog(LOG_INFO, "Create input and output tensors");
+    session = createModelSession(model, tensorPool);
+    if (!session) {
         goto end;
     }
+    const ModelTensorView_t* larodInput = getSessionInput(session, 0);
 
-    if (!larodSetTensorFd(outputTensors[1], larodOutput2Fd, &error)) {
-        syslog(LOG_ERR, "Failed setting output tensor fd: %s", error->msg);
+    // Output tensor 1 is the person prediction, 2 the car prediction.
+    const ModelTensorView_t* larodOutput1 = getSessionOutput(session, 0);
+    const ModelTensorView_t* larodOutput2 = getSessionOutput(session, 1);
+    if (!larodOutput1 || !larodOutput2) {
         goto end;
     }
-
-    infReq = larodCreateInferenceRequest(model, inputTensors, numInputs, outputTensors,
-                                         numOutputs, &error);
-    if (!infReq) {
-        syslog(LOG_ERR, "Failed creating inference request: %s", error->msg);
+    if (args.outputBytes > larodOutput1->size ||
+        args.outputBytes > larodOutput2->size) {
+        syslog(LOG_ERR, "Model outputs are %zu and %zu bytes, OUTPUT_SIZE %zu "
+               "is too large", larodOutput1->size, larodOutput2->size,
+               args.outputBytes);
+        goto end;
+    }
+    // The outputs are read in the data type the model was converted to.
+    ScoreFormat_t personFormat;
+    ScoreFormat_t carFormat;
+    if (!initScoreFormatFromLarod(&personFormat, larodOutput1->dataType) ||
+        !initScoreFormatFromLarod(&carFormat, larodOutput2->dataType)) {
         goto end;
     }
 
-    syslog(LOG_INFO, "Found %x input tensors and %x output tensors", numInputs, numOutputs);
     syslog(LOG_INFO, "Start fetching video frames from VDO");
     if (!startFrameFetch(provider)) {
         goto end;
@@ -354,12 +282,9 @@ int main(int argc, char** argv) {
         // Covert image data from NV12 format to interleaved uint8_t RGB format.
         gettimeofday(&startTs, NULL);
 
-        if (!convertCropScaleU8yuvToRGB(nv12Data, streamWidth, streamHeight,
-                                        (uint8_t*) larodInputAddr, args.width,
-                                        args.height)) {
-            syslog(LOG_ERR, "%s: Failed img scale/convert in "
-                     "convertCropScaleU8yuvToRGB() (continue anyway)",
-                     __func__);
+        if (!convertFrame(converter, nv12Data, (uint8_t*) larodInput->data)) {
+            syslog(LOG_ERR, "%s: Failed img scale/convert in convertFrame() "
+                   "(continue anyway)", __func__);
         }
         gettimeofday(&endTs, NULL);
 
@@ -367,26 +292,10 @@ int main(int argc, char** argv) {
                                     ((endTs.tv_usec - startTs.tv_usec) / 1000));
         syslog(LOG_INFO, "Converted image in %u ms", elapsedMs);
 
-        // Since larodOutputAddr points to the beginning of the fd we should
-        // rewind the file position before each inference.
-        if (lseek(larodOutput1Fd, 0, SEEK_SET) == -1) {
-            syslog(LOG_ERR, "Unable to rewind output file position: %s",
-                     strerror(errno));
-
-            goto end;
-        }
-
-        if (lseek(larodOutput2Fd, 0, SEEK_SET) == -1) {
-            syslog(LOG_ERR, "Unable to rewind output file position: %s",
-                     strerror(errno));
-
-            goto end;
-        }
-
         gettimeofday(&startTs, NULL);
-        if (!larodRunInference(conn, infReq, &error)) {
-            syslog(LOG_ERR, "Unable to run inference on model %s: %s (%d)",
-                     args.modelFile, error->msg, error->code);
+        if (!runModelSession(session, conn)) {
+            syslog(LOG_ERR, "Unable to run inference on model %s",
+                   args.modelFile);
             goto end;
         }
         gettimeofday(&endTs, NULL);
@@ -395,11 +304,11 @@ int main(int argc, char** argv) {
                                     ((endTs.tv_usec - startTs.tv_usec) / 1000));
         syslog(LOG_INFO, "Ran inference for %u ms", elapsedMs);
 
-        uint8_t* person_pred = (uint8_t*) larodOutput1Addr;
-        uint8_t* car_pred = (uint8_t*) larodOutput2Addr;
+        float personPred = dequantizeScore(larodOutput1->data, 0, &personFormat);
+        float carPred = dequantizeScore(larodOutput2->data, 0, &carFormat);
 
         syslog(LOG_INFO, "Person detected: %.2f%% - Car detected: %.2f%%",
-               (float) person_pred[0] / 2.55f, (float) car_pred[0]  / 2.55f);
+               personPred * 100.0f, carPred * 100.0f);
 
         // Release frame reference to provider.
         returnFrame(provider, buf);
@@ -416,6 +325,8 @@ end:
     if (provider) {
         destroyImgProvider(provider);
     }
+    destroyImgConverter(converter);
+    destroyRowPool(rowPool);
     // Only the model handle is released here. We count on larod service to
     // release the privately loaded model when the session is disconnected in
     // larodDisconnect().
@@ -426,32 +337,8 @@ end:
     if (larodModelFd >= 0) {
         close(larodModelFd);
     }
-    if (larodInputAddr != MAP_FAILED) {
-        munmap(larodInputAddr, args.width * args.height * CHANNELS);
-    }
-    if (larodInputFd >= 0) {
-        close(larodInputFd);
-    }
-    if (larodOutput1Addr != MAP_FAILED) {
-        munmap(larodOutput1Addr, args.outputBytes);
-    }
-
-    if (larodOutput2Addr != MAP_FAILED) {
-        munmap(larodOutput2Addr, args.outputBytes);
-    }
-
-    if (larodOutput1Fd >= 0) {
-        close(larodOutput1Fd);
-    }
-
-    if (larodOutput2Fd >= 0) {
-        close(larodOutput2Fd);
-    }
-
-    larodDestroyInferenceRequest(&infReq);
-    larodDestroyTensors(&inputTensors, numInputs);
-    larodDestroyTensors(&outputTensors, numOutputs);
-    larodClearError(&error);
+    destroyModelSession(session);
+    destroyTensorPool(tensorPool);
 
     // Close application logging to syslog
     closelog();
@@ -42,9 +42,18 @@ int main(int argc, char* argv[]) {
       exit(1);
   }
 
-  syslog(LOG_INFO, "Creating VDO image provider and creating stream %d x %d",
-          streamWidth, streamHeight);
-  provider = createImgProvider(streamWidth, streamHeight, 2, VDO_FORMAT_YUV);
+  // An optional argument is a recording of the stream to replay instead,
+  // with every frame analyzed in order
+  if (argc > 1) {
+    syslog(LOG_INFO, "Creating image provider replaying %s at %d x %d",
+           argv[1], streamWidth, streamHeight);
+    provider = createImgProviderReplay(argv[1], streamWidth, streamHeight, 2,
+                                       0, false);
+  } else {
+    syslog(LOG_INFO, "Creating VDO image provider and creating stream %d x %d",
+            streamWidth, streamHeight);
+    provider = createImgProvider(streamWidth, streamHeight, 2, VDO_FORMAT_YUV);
+  }
   if (!provider) {
     syslog(LOG_ERR, "%s: Failed to create ImgProvider", __func__);
     exit(2);
@@ -63,10 +72,9 @@ int main(int argc, char* argv[]) {
   // noise, with a bigger size corresponding to more denoising
   Mat kernel = getStructuringElement(MORPH_ELLIPSE, Size(9, 9));
 
-  // Create OpenCV Mats for the camera frame (nv12), the converted frame (bgr)
-  // and the foreground frame that is outputted by the background subtractor
-  Mat bgr_mat = Mat(height, width, CV_8UC3);
-  Mat nv12_mat = Mat(height * 3 / 2, width, CV_8UC1);
+  // Create OpenCV Mats for the converted frame (bgr) and the foreground
+  // frame that is outputted by the background subtractor
+  Mat bgr_mat = Mat(provider->streamHeight, provider->streamWidth, CV_8UC3);
   Mat fg;
 
   while (true) {
@@ -74,16 +82,24 @@ int main(int argc, char* argv[]) {
     VdoBuffer* buf = getLastFrameBlocking(provider);
     if (!buf) {
       syslog(LOG_INFO, "No more frames available, exiting");
+      stopFrameFetch(provider);
+      destroyImgProvider(provider);
       exit(0);
     }
 
-    // Assign the VDO image buffer to the nv12_mat OpenCV Mat.
-    // This specific Mat is used as it is the one we created for NV12,
-    // which has a different layout than e.g., BGR.
-    nv12_mat.data = static_cast<uint8_t*>(vdo_buffer_get_data(buf));
+    // Wrap the Y and UV planes of the VDO image buffer in OpenCV Mats
+    // without copying. The rows of VDO buffers can be padded, so the pitches
+    // reported by the image provider are used as the Mat steps. The frame
+    // is only read.
+    uint8_t* nv12Data = const_cast<uint8_t*>(getFrameData(provider, buf));
+    Mat y_mat = Mat(provider->streamHeight, provider->streamWidth, CV_8UC1,
+                    nv12Data, provider->yPitch);
+    Mat uv_mat = Mat(provider->streamHeight / 2, provider->streamWidth / 2,
+                     CV_8UC2, nv12Data + provider->uvOffset,
+                     provider->uvPitch);
 
     // Convert the NV12 data to BGR
-    cvtColor(nv12_mat, bgr_mat, COLOR_YUV2BGR_NV12, 3);
+    cvtColorTwoPlane(y_mat, uv_mat, bgr_mat, COLOR_YUV2BGR_NV12);
 
     // Perform background subtraction on the bgr image with
     // learning rate 0.005. The resulting image should have
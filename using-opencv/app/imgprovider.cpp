@@ -44,6 +44,18 @@
 static bool createStream(ImgProvider_t* provider, unsigned int w,
                          unsigned int h);
 
+/**
+ * brief Read the stream size and buffer layout back from VDO.
+ *
+ * param provider Pointer to ImgProvider owning the stream.
+ * param vdoStream VDO stream to query.
+ * param w Requested stream width, used if VDO does not report one.
+ * param h Requested stream height, used if VDO does not report one.
+ * return False if any errors occur, otherwise true.
+ */
+static bool readStreamLayout(ImgProvider_t* provider, VdoStream* vdoStream,
+                             unsigned int w, unsigned int h);
+
 /**
  * brief Allocate VDO buffers on a stream.
  *
@@ -92,10 +104,82 @@ static void releaseVdoBuffers(ImgProvider_t* provider);
  */
 static void* threadEntry(void* data);
 
+/**
+ * brief Starting point function for the thread replaying a recording.
+ *
+ * Works like threadEntry(), but takes the frames from the recording. The
+ * handed back buffers in processedFrames are the free ones. An unpaced
+ * replay waits for the client to hand back every frame before it replays
+ * the next one.
+ *
+ * param data Pointer to ImgProvider owning thread.
+ * return Pointer to unused return data.
+ */
+static void* replayThreadEntry(void* data);
+
+/**
+ * brief Allocate an ImgProvider with its queues and synchronization, but no
+ * frame source.
+ *
+ * param numFrames Number of fetched frames to keep.
+ * param format Image format of the frames.
+ * return Pointer to new ImgProvider, or NULL if failed.
+ */
+static ImgProvider_t* allocateImgProvider(unsigned int numFrames,
+                                          VdoFormat format);
+
 ImgProvider_t* createImgProvider(unsigned int w, unsigned int h,
                                  unsigned int numFrames, VdoFormat format) {
+    ImgProvider_t* provider = allocateImgProvider(numFrames, format);
+    if (!provider) {
+        return NULL;
+    }
+
+    if (!createStream(provider, w, h)) {
+        syslog(LOG_ERR, "%s: Could not create VDO stream!", __func__);
+        destroyImgProvider(provider);
+        return NULL;
+    }
+
+    return provider;
+}
+
+ImgProvider_t* createImgProviderReplay(const char* path, unsigned int w,
+                                       unsigned int h, unsigned int numFrames,
+                                       double fps, bool loop) {
+    ImgProvider_t* provider = allocateImgProvider(numFrames, VDO_FORMAT_YUV);
+    if (!provider) {
+        return NULL;
+    }
+
+    provider->replay = createImgReplay(path, w, h, fps, loop);
+    if (!provider->replay) {
+        destroyImgProvider(provider);
+        return NULL;
+    }
+    provider->replayLockstep = fps == 0;
+
+    // Recorded frames are packed.
+    provider->streamWidth = w;
+    provider->streamHeight = h;
+    provider->yPitch = w;
+    provider->uvPitch = w;
+    provider->uvOffset = (size_t) w * h;
+
+    // All buffers start out free.
+    for (size_t i = 0; i < NUM_VDO_BUFFERS; i++) {
+        provider->vdoBuffers[i] = (VdoBuffer*) (void*) &provider->replayData[i];
+        g_queue_push_tail(provider->processedFrames, provider->vdoBuffers[i]);
+    }
+
+    return provider;
+}
+
+static ImgProvider_t* allocateImgProvider(unsigned int numFrames,
+                                          VdoFormat format) {
     bool mtxInitialized = false;
     bool condInitialized = false;
+    bool returnCondInitialized = false;
 
     ImgProvider_t* provider = (ImgProvider_t*) calloc(1, sizeof(ImgProvider_t));
     if (!provider) {
@@ -121,6 +205,13 @@ ImgProvider_t* createImgProvider(unsigned int w, unsigned int h,
     }
     condInitialized = true;
 
+    if (pthread_cond_init(&provider->frameReturnCond, NULL)) {
+        syslog(LOG_ERR, "%s: Unable to initialize condition variable: %s", __func__,
+                 strerror(errno));
+        goto errorExit;
+    }
+    returnCondInitialized = true;
+
     provider->deliveredFrames = g_queue_new();
     if (!provider->deliveredFrames) {
         syslog(LOG_ERR, "%s: Unable to create deliveredFrames queue!", __func__);
@@ -133,20 +224,21 @@ ImgProvider_t* createImgProvider(unsigned int w, unsigned int h,
         goto errorExit;
     }
 
-    if (!createStream(provider, w, h)) {
-        syslog(LOG_ERR, "%s: Could not create VDO stream!", __func__);
-        goto errorExit;
-    }
-
     return provider;
 
 errorExit:
+    if (!provider) {
+        return NULL;
+    }
     if (mtxInitialized) {
         pthread_mutex_destroy(&provider->frameMutex);
     }
     if (condInitialized) {
         pthread_cond_destroy(&provider->frameDeliverCond);
     }
+    if (returnCondInitialized) {
+        pthread_cond_destroy(&provider->frameReturnCond);
+    }
     if (provider->deliveredFrames) {
         g_queue_free(provider->deliveredFrames);
     }
@@ -166,9 +258,11 @@ void destroyImgProvider(ImgProvider_t* provider) {
     }
 
     releaseVdoBuffers(provider);
+    destroyImgReplay(provider->replay);
 
     pthread_mutex_destroy(&provider->frameMutex);
     pthread_cond_destroy(&provider->frameDeliverCond);
+    pthread_cond_destroy(&provider->frameReturnCond);
 
     g_queue_free(provider->deliveredFrames);
     g_queue_free(provider->processedFrames);
@@ -311,6 +405,14 @@ bool createStream(ImgProvider_t* provider, unsigned int w, unsigned int h) {
     releaseVdoBuffers(provider);
     }
 
+    if (!readStreamLayout(provider, vdoStream, w, h)) {
+        syslog(LOG_ERR, "%s: Failed reading VDO stream info!", __func__);
+        g_object_unref(vdoStream);
+        g_object_unref(vdoMap);
+        g_clear_error(&error);
+        return ret;
+    }
+
     if (!allocateVdoBuffers(provider, vdoStream)) {
         syslog(LOG_ERR, "%s: Failed setting up VDO buffers!", __func__);
     releaseVdoBuffers(provider);
@@ -334,6 +436,35 @@ bool createStream(ImgProvider_t* provider, unsigned int w, unsigned int h) {
 
 }
 
+static bool readStreamLayout(ImgProvider_t* provider, VdoStream* vdoStream,
+                             unsigned int w, unsigned int h) {
+    GError* error = NULL;
+
+    VdoMap* info = vdo_stream_get_info(vdoStream, &error);
+    if (!info) {
+        syslog(LOG_ERR, "%s: Failed vdo_stream_get_info(): %s", __func__,
+               (error != NULL) ? error->message : "N/A");
+        g_clear_error(&error);
+        return false;
+    }
+
+    provider->streamWidth = vdo_map_get_uint32(info, "width", w);
+    provider->streamHeight = vdo_map_get_uint32(info, "height", h);
+    // Rows are unpadded if VDO reports no pitch. Chroma rows have the
+    // same pitch and follow directly after the last luma row.
+    provider->yPitch = vdo_map_get_uint32(info, "pitch", provider->streamWidth);
+    provider->uvPitch = provider->yPitch;
+    provider->uvOffset = (size_t) provider->yPitch * provider->streamHeight;
+
+    syslog(LOG_INFO, "%s: Stream %u x %u, pitch %u, UV plane at offset %zu",
+           __func__, provider->streamWidth, provider->streamHeight,
+           provider->yPitch, provider->uvOffset);
+
+    g_object_unref(info);
+
+    return true;
+}
+
 static void releaseVdoBuffers(ImgProvider_t* provider) {
     if (!provider->vdoStream) {
         return;
@@ -351,7 +482,8 @@ VdoBuffer* getLastFrameBlocking(ImgProvider_t* provider) {
     VdoBuffer* returnBuf = NULL;
     pthread_mutex_lock(&provider->frameMutex);
 
-    while (g_queue_get_length(provider->deliveredFrames) < 1) {
+    while (g_queue_get_length(provider->deliveredFrames) < 1 &&
+           !provider->fetchStopped) {
         if (pthread_cond_wait(&provider->frameDeliverCond,
                               &provider->frameMutex)) {
             syslog(LOG_ERR, "%s: Failed to wait on condition: %s", __func__,
@@ -360,6 +492,7 @@ VdoBuffer* getLastFrameBlocking(ImgProvider_t* provider) {
         }
     }
 
+    // NULL if fetching stopped with no frames left.
     returnBuf = (VdoBuffer*) g_queue_pop_tail(provider->deliveredFrames);
 
 errorExit:
@@ -372,10 +505,22 @@ void returnFrame(ImgProvider_t* provider, VdoBuffer* buffer) {
     pthread_mutex_lock(&provider->frameMutex);
 
     g_queue_push_tail(provider->processedFrames, buffer);
+    if (provider->replay) {
+        pthread_cond_signal(&provider->frameReturnCond);
+    }
 
     pthread_mutex_unlock(&provider->frameMutex);
 }
 
+const uint8_t* getFrameData(ImgProvider_t* provider, VdoBuffer* buffer) {
+    if (!provider->replay) {
+        return (const uint8_t*) vdo_buffer_get_data(buffer);
+    }
+
+    // Replay handles point at their entry of replayData.
+    return *(const uint8_t**) (void*) buffer;
+}
+
 static void* threadEntry(void* data) {
     GError* error = NULL;
     ImgProvider_t* provider = (ImgProvider_t*) data;
@@ -427,8 +572,70 @@ static void* threadEntry(void* data) {
   return NULL;
 }
 
+static void* replayThreadEntry(void* data) {
+    ImgProvider_t* provider = (ImgProvider_t*) data;
+    ImgReplayFrame_t frame;
+
+    while (!provider->shutDown) {
+        if (provider->replayLockstep) {
+            pthread_mutex_lock(&provider->frameMutex);
+            while (!provider->shutDown &&
+                   g_queue_get_length(provider->processedFrames) <
+                       NUM_VDO_BUFFERS) {
+                pthread_cond_wait(&provider->frameReturnCond,
+                                  &provider->frameMutex);
+            }
+            pthread_mutex_unlock(&provider->frameMutex);
+            if (provider->shutDown) {
+                break;
+            }
+        }
+
+        if (!getReplayFrame(provider->replay, &frame)) {
+            syslog(LOG_INFO, "%s: End of recording", __func__);
+            pthread_mutex_lock(&provider->frameMutex);
+            // Only the last frame is left to the client, older ones would be
+            // handed out after it.
+            while (g_queue_get_length(provider->deliveredFrames) > 1) {
+                g_queue_push_tail(provider->processedFrames,
+                                  g_queue_pop_head(provider->deliveredFrames));
+            }
+            provider->fetchStopped = true;
+            pthread_cond_broadcast(&provider->frameDeliverCond);
+            pthread_mutex_unlock(&provider->frameMutex);
+            break;
+        }
+
+        pthread_mutex_lock(&provider->frameMutex);
+
+        // Reuse a frame returned by the client, or else the oldest frame
+        // beyond the numAppFrames the client wants to keep.
+        VdoBuffer* buffer = NULL;
+        if (g_queue_get_length(provider->processedFrames) > 0) {
+            buffer = (VdoBuffer*) g_queue_pop_head(provider->processedFrames);
+        } else if (g_queue_get_length(provider->deliveredFrames) > 0 &&
+                   g_queue_get_length(provider->deliveredFrames) >=
+                       provider->numAppFrames) {
+            buffer = (VdoBuffer*) g_queue_pop_head(provider->deliveredFrames);
+        }
+
+        // With every buffer held by the client the frame is skipped, like
+        // VDO drops frames when it runs out of buffers.
+        if (buffer) {
+            *(const uint8_t**) (void*) buffer = frame.data;
+            g_queue_push_tail(provider->deliveredFrames, buffer);
+            pthread_cond_signal(&provider->frameDeliverCond);
+        }
+        pthread_mutex_unlock(&provider->frameMutex);
+    }
+
+    return NULL;
+}
+
 bool startFrameFetch(ImgProvider_t* provider) {
-    if (pthread_create(&provider->fetcherThread, NULL, threadEntry, provider)) {
+    if (pthread_create(&provider->fetcherThread, NULL,
+                       provider->replay ? replayThreadEntry : threadEntry,
+                       provider)) {
         syslog(LOG_ERR, "%s: Failed to start thread fetching frames from vdo: %s",
                  __func__, strerror(errno));
         return false;
@@ -439,6 +646,12 @@ bool startFrameFetch(ImgProvider_t* provider) {
 
 bool stopFrameFetch(ImgProvider_t* provider) {
     provider->shutDown = true;
+    if (provider->replay) {
+        // Wake a replay waiting for the client to hand frames back.
+        pthread_mutex_lock(&provider->frameMutex);
+        pthread_cond_broadcast(&provider->frameReturnCond);
+        pthread_mutex_unlock(&provider->frameMutex);
+    }
 
     if (pthread_join(provider->fetcherThread, NULL)) {
         syslog(LOG_ERR, "%s: Failed to join thread fetching frames from vdo: %s",
@@ -448,3 +661,7 @@ bool stopFrameFetch(ImgProvider_t* provider) {
 
     return true;
 }
+
+bool isFrameFetchStopped(ImgProvider_t* provider) {
+    return provider->fetchStopped;
+}
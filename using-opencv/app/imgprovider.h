@@ -26,7 +26,10 @@
 # define _Atomic(X) std::atomic< X >
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
+#include "imgreplay.h"
 #include "vdo-stream.h"
 #include "vdo-types.h"
 
@@ -43,10 +46,30 @@ typedef struct ImgProvider {
     /// Stream configuration parameters.
     VdoFormat vdoFormat;
 
+    /// Size of the created stream and layout of its NV12 buffers, as
+    /// reported by VDO. Rows can be padded to an aligned pitch, so the
+    /// pitches may be larger than streamWidth.
+    unsigned int streamWidth;
+    unsigned int streamHeight;
+    unsigned int yPitch;
+    unsigned int uvPitch;
+    /// Byte offset of the UV plane from the start of a buffer.
+    size_t uvOffset;
+
     /// Vdo stream and buffers handling.
     VdoStream* vdoStream;
     VdoBuffer* vdoBuffers[NUM_VDO_BUFFERS];
 
+    /// Recording replayed instead of a VDO stream, NULL when streaming. See
+    /// createImgProviderReplay(). The entries of vdoBuffers are then the
+    /// addresses of the entries of replayData, handles that never reach VDO.
+    ImgReplay_t* replay;
+    /// Frame held by each of vdoBuffers while replaying.
+    const uint8_t* replayData[NUM_VDO_BUFFERS];
+    /// Set if the next frame is only replayed once the client has handed
+    /// back all earlier frames.
+    bool replayLockstep;
+
     /// Keeping track of frames' statuses.
     GQueue* deliveredFrames;
     GQueue* processedFrames;
@@ -56,8 +79,12 @@ typedef struct ImgProvider {
     /// To support fetching frames asynchonously with VDO.
     pthread_mutex_t frameMutex;
     pthread_cond_t frameDeliverCond;
+    /// Signaled when the client hands back a frame of a replay.
+    pthread_cond_t frameReturnCond;
     pthread_t fetcherThread;
     std::atomic_bool shutDown;
+    /// Set once no more frames are delivered, see isFrameFetchStopped().
+    std::atomic_bool fetchStopped;
 } ImgProvider_t;
 
 /**
@@ -93,6 +120,33 @@ bool chooseStreamResolution(unsigned int reqWidth, unsigned int reqHeight,
 ImgProvider_t* createImgProvider(unsigned int w, unsigned int h,
                                  unsigned int numFrames, VdoFormat vdoFormat);
 
+/**
+ * brief Initializes an ImgProvider that replays a recording instead of
+ * streaming from VDO.
+ *
+ * The frames are handed out by the same calls as frames from VDO, but the
+ * buffers are not VDO buffers, so read them with getFrameData(). The stream
+ * is the size of the recording and its frames are packed. Paced frames are
+ * delivered like a live stream. Without pacing the next frame is replayed
+ * once the client has handed back the frames it got, so every frame is
+ * delivered in order and runs are repeatable. Once a recording that does
+ * not loop has ended, getLastFrameBlocking() returns NULL and
+ * isFrameFetchStopped() returns true.
+ *
+ * param path Recording file, or directory of frame files, see
+ *             createImgReplay().
+ * param w Frame width of the recording.
+ * param h Frame height of the recording.
+ * param numFrames Number of fetched frames to keep.
+ * param fps Frames per second to replay at, or 0 for as fast as the client
+ *            hands frames back.
+ * param loop True to start over at the end of the recording.
+ * return Pointer to new ImgProvider, or NULL if failed.
+ */
+ImgProvider_t* createImgProviderReplay(const char* path, unsigned int w,
+                                       unsigned int h, unsigned int numFrames,
+                                       double fps, bool loop);
+
 /**
  * brief Release VDO buffers and deallocate provider.
  *
@@ -116,11 +170,20 @@ bool startFrameFetch(ImgProvider_t* provider);
  */
 bool stopFrameFetch(ImgProvider_t* provider);
 
+/**
+ * brief Check if a provider has stopped delivering frames.
+ *
+ * param provider Pointer to an ImgProvider.
+ * return True at the end of a replay that does not loop, otherwise false.
+ */
+bool isFrameFetchStopped(ImgProvider_t* provider);
+
 /**
  * brief Get the most recent frame the thread has fetched from VDO.
  *
  * param provider Pointer to an ImgProvider fetching frames.
- * return Pointer to an image buffer on success, otherwise NULL.
+ * return Pointer to an image buffer on success, otherwise NULL, also at the
+ *        end of a replay.
  */
 VdoBuffer* getLastFrameBlocking(ImgProvider_t* provider);
 
@@ -131,3 +194,16 @@ VdoBuffer* getLastFrameBlocking(ImgProvider_t* provider);
  * param buffer Pointer to the image buffer to be released.
  */
 void returnFrame(ImgProvider_t* provider, VdoBuffer* buffer);
+
+/**
+ * brief Get the image data of a frame held by the client.
+ *
+ * Same as vdo_buffer_get_data() for frames from VDO, and also works for the
+ * frames of a replay.
+ *
+ * param provider Pointer to the ImgProvider the frame came from.
+ * param buffer Frame returned by getLastFrameBlocking().
+ * return Pointer to the NV12 frame, laid out as given by yPitch, uvPitch and
+ *        uvOffset of the provider.
+ */
+const uint8_t* getFrameData(ImgProvider_t* provider, VdoBuffer* buffer);
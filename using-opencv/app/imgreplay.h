@@ -0,0 +1,157 @@
+/**
+ * Copyright (C) 2021, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file handles recording frames to file and replaying them.
+ *
+ * A recording is raw NV12 with tightly packed planes, either all frames
+ * concatenated in one file or one file per frame in a directory, replayed in
+ * file name order. There is no header, so the frame size has to be known.
+ * The single file format is the same as e.g.
+ * ffmpeg -f rawvideo -pix_fmt nv12 -s WIDTHxHEIGHT.
+ *
+ * Neither side depends on VDO, so recordings made on a camera can be
+ * replayed on a build host.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * brief A type representing a recording being replayed.
+ */
+typedef struct ImgReplay ImgReplay_t;
+
+/**
+ * brief A type representing a recording being written.
+ */
+typedef struct ImgRecorder ImgRecorder_t;
+
+/**
+ * brief A frame of a recording.
+ *
+ * Same meaning as the fields of ImgFrameInfo_t, so replayed frames can be
+ * handled like frames from an ImgProvider.
+ */
+typedef struct {
+    /// Tightly packed NV12 frame, mapped from the recording.
+    const uint8_t* data;
+    /// Number of frames replayed before this one, counting skipped frames.
+    unsigned int sequenceNbr;
+    /// Time the frame was due, in microseconds on CLOCK_MONOTONIC.
+    uint64_t captureTimeUs;
+    /// Frames not replayed since the previous frame because the client was
+    /// too slow for the frame rate.
+    unsigned int framesSkipped;
+} ImgReplayFrame_t;
+
+/**
+ * brief Open a recording for replay.
+ *
+ * The frames are mapped, not read, so replaying costs no copies. Like a live
+ * stream, a paced replay hands out the most recent frame due when a frame
+ * is asked for, and skips the frames the client was too slow for. An
+ * unpaced replay hands out every frame at once, which makes runs
+ * deterministic.
+ *
+ * param path Recording file, or directory of frame files.
+ * param width Frame width.
+ * param height Frame height.
+ * param fps Frames per second to replay at, or 0 for as fast as possible.
+ * param loop True to start over at the end of the recording.
+ * return Pointer to new ImgReplay, or NULL if failed.
+ */
+ImgReplay_t* createImgReplay(const char* path, unsigned int width,
+                             unsigned int height, double fps, bool loop);
+
+/**
+ * brief Unmap a recording and deallocate the replay.
+ *
+ * param replay Pointer to ImgReplay to be destroyed. Can be NULL.
+ */
+void destroyImgReplay(ImgReplay_t* replay);
+
+/**
+ * brief Get the number of frames in a recording.
+ *
+ * param replay Pointer to an ImgReplay.
+ * return Number of frames.
+ */
+unsigned int getReplayNumFrames(ImgReplay_t* replay);
+
+/**
+ * brief Get the next frame of a recording.
+ *
+ * Waits until the next frame is due if the client is ahead of the frame
+ * rate. The replay clock starts at the first call. The frame data stays
+ * valid until the replay is destroyed.
+ *
+ * param replay Pointer to an ImgReplay.
+ * param frame Next frame.
+ * return False at the end of a recording that does not loop, otherwise
+ *        true.
+ */
+bool getReplayFrame(ImgReplay_t* replay, ImgReplayFrame_t* frame);
+
+/**
+ * brief Create a recording file.
+ *
+ * An existing file is truncated.
+ *
+ * Frames can have padded rows, like the buffers of an ImgProvider. The
+ * padding is stripped when recording.
+ *
+ * param path Recording file to write.
+ * param width Frame width.
+ * param height Frame height.
+ * param yPitch Bytes between the starts of two luma rows.
+ * param uvPitch Bytes between the starts of two chroma rows.
+ * param uvOffset Byte offset of the UV plane from the start of a frame.
+ * return Pointer to new ImgRecorder, or NULL if failed.
+ */
+ImgRecorder_t* createImgRecorder(const char* path, unsigned int width,
+                                 unsigned int height, unsigned int yPitch,
+                                 unsigned int uvPitch, size_t uvOffset);
+
+/**
+ * brief Close a recording file and deallocate the recorder.
+ *
+ * param recorder Pointer to ImgRecorder to be destroyed. Can be NULL.
+ */
+void destroyImgRecorder(ImgRecorder_t* recorder);
+
+/**
+ * brief Append a frame to a recording.
+ *
+ * The frame is written on the calling thread, so recording slows down the
+ * pipeline it is part of.
+ *
+ * param recorder Pointer to an ImgRecorder.
+ * param nv12 Frame in the layout given at creation.
+ * return False if any errors occur, otherwise true.
+ */
+bool recordFrame(ImgRecorder_t* recorder, const uint8_t* nv12);
+
+#ifdef __cplusplus
+}
+#endif
@@ -23,14 +23,95 @@
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
+#include "imgreplay.h"
 #include "vdo-stream.h"
 #include "vdo-types.h"
 
+/// Default number of VDO buffers allocated on a stream.
 #define NUM_VDO_BUFFERS (8)
+/// Largest number of VDO buffers on a stream.
+#define MAX_VDO_BUFFERS (16)
+/// Largest number of consumers sharing one ImgProvider.
+#define MAX_IMG_CONSUMERS (4)
 
 /**
- * brief A type representing a provider of frames from VDO.
+ * brief What a consumer loses when a new frame arrives while it already has
+ * as many unfetched frames as it asked for.
+ */
+typedef enum {
+    /// Drop the oldest unfetched frame, the consumer always gets the most
+    /// recent frames.
+    IMG_DROP_OLDEST,
+    /// Drop the new frame, the frames already waiting are kept.
+    IMG_DROP_NEWEST,
+} ImgDropPolicy;
+
+/**
+ * brief Size of the pool of VDO buffers of an ImgProvider.
+ *
+ * With minBuffers < maxBuffers the pool is adaptive: it grows by one buffer
+ * when VDO drops frames for lack of buffers, and gives back buffers that
+ * the consumers have not needed for a while, keeping between minBuffers and
+ * maxBuffers allocated. Otherwise it stays at numBuffers.
+ */
+typedef struct {
+    /// Buffers allocated when the stream is created.
+    unsigned int numBuffers;
+    /// Bounds of an adaptive pool, ignored if minBuffers >= maxBuffers.
+    unsigned int minBuffers;
+    unsigned int maxBuffers;
+} ImgBufferPool_t;
+
+/**
+ * brief A type representing one consumer of the frames of an ImgProvider.
+ */
+typedef struct ImgConsumer ImgConsumer_t;
+
+/**
+ * brief Metadata of a frame handed to the client.
+ *
+ * Timestamps are in microseconds on CLOCK_MONOTONIC, so end-to-end latency
+ * is the current CLOCK_MONOTONIC time minus captureTimeUs.
+ */
+typedef struct {
+    /// Sequence number VDO assigned to the frame.
+    unsigned int sequenceNbr;
+    /// Time the frame was captured, as reported by VDO.
+    uint64_t captureTimeUs;
+    /// Time the fetcher thread received the frame from VDO.
+    uint64_t deliveryTimeUs;
+    /// Number of frames the client never got between the previously fetched
+    /// frame and this one, whether recycled by the provider or dropped by VDO.
+    unsigned int framesSkipped;
+} ImgFrameInfo_t;
+
+/**
+ * brief Cumulative counters of an ImgProvider since it was created.
+ */
+typedef struct {
+    /// Frames received from VDO.
+    uint64_t framesReceived;
+    /// Frames handed to consumers, summed over all consumers.
+    uint64_t framesFetched;
+    /// Frames that never reached a consumer because of its drop policy.
+    uint64_t framesDropped;
+    /// Gaps in the VDO sequence numbers, i.e. frames VDO dropped, typically
+    /// because no buffer was enqueued in time.
+    uint64_t framesMissed;
+    /// Failed attempts to get a frame from VDO.
+    uint64_t fetchErrors;
+    /// Frames the provider skipped to keep to its frame rate policy.
+    uint64_t framesDecimated;
+    /// Buffers currently allocated on the stream.
+    unsigned int numBuffers;
+} ImgProviderStats_t;
+
+/**
+ * brief A type representing a provider of frames from VDO, or from a
+ * recording replayed in its place.
  *
  * Keep track of what kind of images the user wants, all the necessary
  * VDO types to setup and maintain a stream, as well as parameters to make
@@ -40,21 +121,94 @@ typedef struct ImgProvider {
     /// Stream configuration parameters.
     VdoFormat vdoFormat;
 
+    /// Size of the created stream and layout of its NV12 buffers, as
+    /// reported by VDO. Rows can be padded to an aligned pitch, so the
+    /// pitches may be larger than streamWidth.
+    unsigned int streamWidth;
+    unsigned int streamHeight;
+    unsigned int yPitch;
+    unsigned int uvPitch;
+    /// Byte offset of the UV plane from the start of a buffer.
+    size_t uvOffset;
+    /// Frame rate of the created stream, 0 if VDO does not report it.
+    double streamFrameRate;
+
     /// Vdo stream and buffers handling.
     VdoStream* vdoStream;
-    VdoBuffer* vdoBuffers[NUM_VDO_BUFFERS];
+    /// Allocated buffers, unused entries are NULL. Only written by the
+    /// fetcher thread, with release stores so that consumers looking up a
+    /// buffer with findBufferIndex() see whole entries.
+    _Atomic(VdoBuffer*) vdoBuffers[MAX_VDO_BUFFERS];
+    atomic_uint numBuffers;
+    /// Bounds of the pool, equal unless it is adaptive.
+    unsigned int minBuffers;
+    unsigned int maxBuffers;
+
+    /// State of an adaptive pool, only accessed by the fetcher thread.
+    /// Buffers currently enqueued in VDO.
+    unsigned int buffersInVdo;
+    /// Most buffers held outside VDO during the current window.
+    unsigned int peakBuffersOut;
+    /// Frames received and frames missed when the current window started.
+    uint64_t windowStartReceived;
+    uint64_t windowStartMissed;
+    /// Buffers to release instead of enqueueing when they come back.
+    unsigned int buffersToRetire;
+
+    /// Consumers sharing the stream, fixed once fetching has started.
+    ImgConsumer_t* consumers[MAX_IMG_CONSUMERS];
+    unsigned int numConsumers;
+    /// Consumer behind getLastFrameBlocking() and returnFrame(), or NULL.
+    ImgConsumer_t* defaultConsumer;
+    /// Number of consumers holding each of vdoBuffers. A buffer goes back to
+    /// VDO when this drops to zero. Only accessed by the fetcher thread.
+    unsigned int bufferRefs[MAX_VDO_BUFFERS];
+
+    /// Metadata of the frame in each of vdoBuffers, written by the fetcher
+    /// thread before the frame is handed to any consumer.
+    ImgFrameInfo_t frameInfo[MAX_VDO_BUFFERS];
+    /// Newest sequence number received by the fetcher thread.
+    unsigned int lastReceivedSeq;
+
+    /// Frame rate policy, see setFrameDecimation() and setTargetFrameRate().
+    /// One in decimation frames is delivered.
+    atomic_uint decimation;
+    /// Least time between delivered frames while VDO cannot lower the frame
+    /// rate itself, 0 for no limit.
+    atomic_uint frameIntervalUs;
+    /// State of the policy, only accessed by the fetcher thread.
+    unsigned int framesSinceDelivery;
+    uint64_t nextDeliveryUs;
 
-    /// Keeping track of frames' statuses.
-    GQueue* deliveredFrames;
-    GQueue* processedFrames;
-    /// Number of frames to keep in the deliveredFrames queue.
-    unsigned int numAppFrames;
+    /// Recording replayed instead of a VDO stream, or NULL, see
+    /// createImgProviderReplay(). The entries of vdoBuffers are then the
+    /// addresses of the entries of replayData, handles that never reach VDO.
+    ImgReplay_t* replay;
+    /// Frame held by each of vdoBuffers while replaying.
+    const uint8_t* replayData[MAX_VDO_BUFFERS];
+    /// Indices of the buffers no consumer holds, buffersInVdo of them.
+    /// Only accessed by the fetcher thread.
+    unsigned int replayFree[MAX_VDO_BUFFERS];
+    /// Set if the next frame is only replayed once the consumers have handed
+    /// back all earlier frames.
+    bool replayLockstep;
+    /// Wakes the fetcher thread of a replay when a frame is handed back.
+    pthread_mutex_t replayMutex;
+    pthread_cond_t replayCond;
+
+    /// Counters, see ImgProviderStats_t.
+    atomic_uint_least64_t framesReceived;
+    atomic_uint_least64_t framesFetched;
+    atomic_uint_least64_t framesDropped;
+    atomic_uint_least64_t framesMissed;
+    atomic_uint_least64_t fetchErrors;
+    atomic_uint_least64_t framesDecimated;
 
     /// To support fetching frames asynchonously with VDO.
-    pthread_mutex_t frameMutex;
-    pthread_cond_t frameDeliverCond;
     pthread_t fetcherThread;
     atomic_bool shutDown;
+    /// Set once no more frames are delivered, see isFrameFetchStopped().
+    atomic_bool fetchStopped;
 } ImgProvider_t;
 
 /**
@@ -83,13 +237,68 @@ bool chooseStreamResolution(unsigned int reqWidth, unsigned int reqHeight,
  *
  * param w Requested output image width.
  * param h Requested ouput image height.
- * param numFrames Number of fetched frames to keep.
+ * param numFrames Number of fetched frames to keep for getLastFrameBlocking(),
+ *                  or 0 to only serve consumers added with
+ *                  subscribeImgProvider().
  * param vdoFormat Image format to be output by stream.
  * return Pointer to new ImgProvider, or NULL if failed.
  */
 ImgProvider_t* createImgProvider(unsigned int w, unsigned int h,
                                  unsigned int numFrames, VdoFormat vdoFormat);
 
+/**
+ * brief Initializes an ImgProvider with a given VDO buffer pool.
+ *
+ * Same as createImgProvider(), which uses a fixed pool of NUM_VDO_BUFFERS.
+ * Fewer buffers save memory on large streams, as long as the consumers hold
+ * on to few frames at a time.
+ *
+ * param w Requested output image width.
+ * param h Requested ouput image height.
+ * param numFrames Number of fetched frames to keep for getLastFrameBlocking(),
+ *                  or 0 to only serve consumers added with
+ *                  subscribeImgProvider().
+ * param vdoFormat Image format to be output by stream.
+ * param pool Size of the buffer pool, NULL for the default.
+ * return Pointer to new ImgProvider, or NULL if failed.
+ */
+ImgProvider_t* createImgProviderWithPool(unsigned int w, unsigned int h,
+                                         unsigned int numFrames,
+                                         VdoFormat vdoFormat,
+                                         const ImgBufferPool_t* pool);
+
+/**
+ * brief Initializes an ImgProvider that replays a recording instead of
+ * streaming from VDO.
+ *
+ * The frames are handed out by the same calls as frames from VDO, also to
+ * consumers and frame pairs, but the buffers are not VDO buffers, so read
+ * them with getFrameData(). The stream is the size of the recording and
+ * its frames are packed. Paced frames are delivered like a live stream, and
+ * consumers that fall behind lose frames according to their drop policy.
+ * Without pacing the next frame is replayed once every consumer has handed
+ * back the frames it got, so every consumer gets every frame in order and
+ * runs are repeatable. A consumer must then return each frame before it
+ * asks for the next one. Once a recording that does not loop has ended and
+ * its last frames have been handed back, no more frames are delivered and
+ * isFrameFetchStopped() returns true.
+ *
+ * param path Recording file, or directory of frame files, see
+ *             createImgReplay().
+ * param w Frame width of the recording.
+ * param h Frame height of the recording.
+ * param numFrames Number of fetched frames to keep for getLastFrameBlocking(),
+ *                  or 0 to only serve consumers added with
+ *                  subscribeImgProvider().
+ * param fps Frames per second to replay at, or 0 for as fast as the
+ *            consumers hand frames back.
+ * param loop True to start over at the end of the recording.
+ * return Pointer to new ImgProvider, or NULL if failed.
+ */
+ImgProvider_t* createImgProviderReplay(const char* path, unsigned int w,
+                                       unsigned int h, unsigned int numFrames,
+                                       double fps, bool loop);
+
 /**
  * brief Release VDO buffers and deallocate provider.
  *
@@ -97,6 +306,52 @@ ImgProvider_t* createImgProvider(unsigned int w, unsigned int h,
  */
 void destroyImgProvider(ImgProvider_t* provider);
 
+/**
+ * brief Add a consumer sharing the frames of a provider.
+ *
+ * Every consumer gets every frame VDO delivers, subject to its own drop
+ * policy, and a buffer is only enqueued back to VDO when all consumers have
+ * released it. Consumers live as long as the provider and must be added
+ * before startFrameFetch(). All consumers share the provider's buffer pool,
+ * so the sum of their numFrames plus the frames they keep between fetch and
+ * return should stay below its size.
+ *
+ * param provider Pointer to an ImgProvider not fetching frames yet.
+ * param numFrames Number of most recent frames kept for the consumer.
+ * param dropPolicy Frame to drop when numFrames frames are waiting.
+ * return Pointer to new ImgConsumer, or NULL if failed.
+ */
+ImgConsumer_t* subscribeImgProvider(ImgProvider_t* provider,
+                                    unsigned int numFrames,
+                                    ImgDropPolicy dropPolicy);
+
+/**
+ * brief Deliver only every Nth frame of the stream to the consumers.
+ *
+ * The skipped frames go straight back to VDO, without waking any consumer.
+ * Can be combined with setTargetFrameRate(), and be called at any time,
+ * also while fetching.
+ *
+ * param provider Pointer to an ImgProvider.
+ * param interval Deliver one frame in interval, 1 for every frame.
+ * return False if any errors occur, otherwise true.
+ */
+bool setFrameDecimation(ImgProvider_t* provider, unsigned int interval);
+
+/**
+ * brief Limit the rate of frames delivered to the consumers.
+ *
+ * VDO is asked to lower the frame rate of the stream first, which saves the
+ * camera from producing frames nobody wants. If the stream does not support
+ * that, the fetcher thread skips frames by capture time instead, like
+ * setFrameDecimation(). Can be called at any time, also while fetching.
+ *
+ * param provider Pointer to an ImgProvider.
+ * param fps Frames per second, 0 for the full frame rate of the stream.
+ * return False if any errors occur, otherwise true.
+ */
+bool setTargetFrameRate(ImgProvider_t* provider, double fps);
+
 /**
  * brief Create the thread and start fetching frames.
  *
@@ -113,18 +368,161 @@ bool startFrameFetch(ImgProvider_t* provider);
  */
 bool stopFrameFetch(ImgProvider_t* provider);
 
+/**
+ * brief Check if a provider has stopped delivering frames.
+ *
+ * Tells the end of a replayed recording apart from a fetch that timed out.
+ *
+ * param provider Pointer to an ImgProvider.
+ * return True after stopFrameFetch() or at the end of a replay that does
+ *        not loop, otherwise false.
+ */
+bool isFrameFetchStopped(ImgProvider_t* provider);
+
 /**
  * brief Get the most recent frame the thread has fetched from VDO.
  *
+ * Frames are handed over without locks, so this must only be called from
+ * one thread per provider. Requires a provider created with numFrames > 0.
+ *
  * param provider Pointer to an ImgProvider fetching frames.
- * return Pointer to an image buffer on success, otherwise NULL.
+ * return Pointer to an image buffer on success, otherwise NULL, e.g. after
+ *        stopFrameFetch().
  */
 VdoBuffer* getLastFrameBlocking(ImgProvider_t* provider);
 
+/**
+ * brief Get the most recent frame, waiting at most a given time for one.
+ *
+ * Same as getLastFrameBlocking() otherwise. Lets an application check for
+ * a request to exit while no frames arrive.
+ *
+ * param provider Pointer to an ImgProvider fetching frames.
+ * param timeoutMs Longest time to wait in milliseconds, 0 to not wait at all
+ *                 or negative to wait like getLastFrameBlocking().
+ * return Pointer to an image buffer, or NULL if no frame arrived in time, on
+ *        errors or after stopFrameFetch().
+ */
+VdoBuffer* getLastFrameTimeout(ImgProvider_t* provider, int timeoutMs);
+
+/**
+ * brief Get a file descriptor that is readable when a frame is available.
+ *
+ * The descriptor can be polled with poll() or epoll, or added to a GLib main
+ * loop with g_unix_fd_add(). When it is readable, fetch the frame with
+ * getLastFrameTimeout() and a timeout of 0. That clears the descriptor
+ * until the next frame arrives. It can be readable with no frame left, e.g.
+ * if the frame was fetched before the poll, and also becomes readable when
+ * stopFrameFetch() is called. The descriptor is owned by the provider and
+ * must not be closed.
+ *
+ * param provider Pointer to an ImgProvider.
+ * return File descriptor, or -1 if the provider has no frames of its own.
+ */
+int getFrameEventFd(ImgProvider_t* provider);
+
 /**
  * brief Release reference to an image buffer.
  *
+ * Must be called from the thread calling getLastFrameBlocking().
+ *
  * param provider Pointer to an ImgProvider fetching frames.
  * param buffer Pointer to the image buffer to be released.
  */
 void returnFrame(ImgProvider_t* provider, VdoBuffer* buffer);
+
+/**
+ * brief Get the metadata of a frame held by the client.
+ *
+ * Must be called from the thread calling getLastFrameBlocking(), before the
+ * frame is handed back with returnFrame().
+ *
+ * param provider Pointer to an ImgProvider fetching frames.
+ * param buffer Frame returned by getLastFrameBlocking().
+ * param info Metadata of the frame.
+ * return False if the buffer is not one of the provider's, otherwise true.
+ */
+bool getFrameInfo(ImgProvider_t* provider, VdoBuffer* buffer,
+                  ImgFrameInfo_t* info);
+
+/**
+ * brief Get the image data of a frame held by the client.
+ *
+ * Same as vdo_buffer_get_data() for frames from VDO, and also works for the
+ * frames of a replay.
+ *
+ * param provider Pointer to the ImgProvider the frame came from.
+ * param buffer Frame returned by getLastFrameBlocking() or by a consumer.
+ * return Pointer to the NV12 frame, laid out as given by yPitch, uvPitch and
+ *        uvOffset of the provider, or NULL if failed.
+ */
+const uint8_t* getFrameData(ImgProvider_t* provider, VdoBuffer* buffer);
+
+/**
+ * brief Read the cumulative counters of a provider.
+ *
+ * Can be called from any thread. The counters are read one at a time, so
+ * they can be off by a frame relative to each other.
+ *
+ * param provider Pointer to an ImgProvider.
+ * param stats Current counters.
+ */
+void getProviderStats(ImgProvider_t* provider, ImgProviderStats_t* stats);
+
+/**
+ * brief Get the next frame of a consumer.
+ *
+ * Same as getLastFrameBlocking(), for a consumer added with
+ * subscribeImgProvider(). Must only be called from one thread per consumer.
+ *
+ * param consumer Pointer to an ImgConsumer.
+ * return Pointer to an image buffer on success, otherwise NULL, e.g. after
+ *        stopFrameFetch().
+ */
+VdoBuffer* getConsumerFrameBlocking(ImgConsumer_t* consumer);
+
+/**
+ * brief Get the next frame of a consumer, waiting at most a given time.
+ *
+ * Same as getLastFrameTimeout(), for a consumer.
+ *
+ * param consumer Pointer to an ImgConsumer.
+ * param timeoutMs Longest time to wait in milliseconds, 0 to not wait at all
+ *                 or negative to wait like getConsumerFrameBlocking().
+ * return Pointer to an image buffer, or NULL if no frame arrived in time or
+ *        after stopFrameFetch().
+ */
+VdoBuffer* getConsumerFrameTimeout(ImgConsumer_t* consumer, int timeoutMs);
+
+/**
+ * brief Get a file descriptor that is readable when a consumer has a frame.
+ *
+ * Same as getFrameEventFd(), for a consumer.
+ *
+ * param consumer Pointer to an ImgConsumer.
+ * return File descriptor owned by the consumer.
+ */
+int getConsumerFrameEventFd(ImgConsumer_t* consumer);
+
+/**
+ * brief Release a consumer's reference to an image buffer.
+ *
+ * Must be called from the thread calling getConsumerFrameBlocking().
+ *
+ * param consumer Pointer to an ImgConsumer.
+ * param buffer Pointer to the image buffer to be released.
+ */
+void returnConsumerFrame(ImgConsumer_t* consumer, VdoBuffer* buffer);
+
+/**
+ * brief Get the metadata of a frame held by a consumer.
+ *
+ * Same as getFrameInfo(), with framesSkipped counted for this consumer.
+ *
+ * param consumer Pointer to an ImgConsumer.
+ * param buffer Frame returned by getConsumerFrameBlocking().
+ * param info Metadata of the frame.
+ * return False if the buffer is not one of the provider's, otherwise true.
+ */
+bool getConsumerFrameInfo(ImgConsumer_t* consumer, VdoBuffer* buffer,
+                          ImgFrameInfo_t* info);
@@ -0,0 +1,140 @@
+/**
+ * Copyright (C) 2021, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file handles postprocessing of classification scores.
+ *
+ * Scores are searched in the data type the model outputs, uint8, int8 or
+ * float32, with NEON or SSE2 where available. Only the best scores are then
+ * dequantized with the scale and zero point of the output and, for models
+ * that output logits, turned into probabilities with softmax.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "larod.h"
+
+/**
+ * brief Data type of a score tensor.
+ */
+typedef enum {
+    SCORE_DTYPE_UINT8,
+    SCORE_DTYPE_INT8,
+    SCORE_DTYPE_FLOAT32,
+} ScoreDataType_t;
+
+/**
+ * brief How to read the scores of a model output.
+ *
+ * A stored value v is the score scale * (v - zeroPoint).
+ */
+typedef struct {
+    ScoreDataType_t dataType;
+    /// Quantization scale, must be positive.
+    float scale;
+    /// Quantization zero point.
+    int32_t zeroPoint;
+    /// Turn the scores into probabilities with softmax over all scores.
+    bool softmax;
+} ScoreFormat_t;
+
+/**
+ * brief One of the best scores.
+ */
+typedef struct {
+    /// Index of the class.
+    size_t index;
+    /// Dequantized score, or probability with softmax.
+    float score;
+} ScoreResult_t;
+
+/**
+ * brief Initialize a score format with the usual quantization of a data type.
+ *
+ * larod does not report quantization parameters. Quantized classifiers
+ * usually end in a softmax quantized with scale 1/256, with zero point 0
+ * for uint8 and -128 for int8, so those are the defaults. Float scores are
+ * used as they are.
+ *
+ * param format Format to initialize.
+ * param dataType Data type of the scores.
+ */
+void initScoreFormat(ScoreFormat_t* format, ScoreDataType_t dataType);
+
+/**
+ * brief Initialize a score format from the data type of an output tensor.
+ *
+ * param format Format to initialize, see initScoreFormat().
+ * param dataType larod data type of the output tensor.
+ * return False if the data type is not supported, otherwise true.
+ */
+bool initScoreFormatFromLarod(ScoreFormat_t* format,
+                              larodTensorDataType dataType);
+
+/**
+ * brief Get the size in bytes of one score.
+ *
+ * param dataType Data type of the scores.
+ * return Size in bytes.
+ */
+size_t getScoreSize(ScoreDataType_t dataType);
+
+/**
+ * brief Find the index of the highest score.
+ *
+ * param scores Scores as stored in the output tensor.
+ * param numScores Number of scores.
+ * param dataType Data type of the scores.
+ * return Index of the first highest score, 0 if there are no scores.
+ */
+size_t argmaxScores(const void* scores, size_t numScores,
+                    ScoreDataType_t dataType);
+
+/**
+ * brief Dequantize one score.
+ *
+ * Softmax is not applied, it needs all scores, see getTopScores().
+ *
+ * param scores Scores as stored in the output tensor.
+ * param index Index of the score.
+ * param format Format of the scores.
+ * return The dequantized score.
+ */
+float dequantizeScore(const void* scores, size_t index,
+                      const ScoreFormat_t* format);
+
+/**
+ * brief Find the highest scores.
+ *
+ * Scores are compared as stored, blocks of scores that can't hold a better
+ * result are skipped after a vectorized max, so the cost is close to a
+ * single pass over the scores even for many classes.
+ *
+ * param scores Scores as stored in the output tensor.
+ * param numScores Number of scores.
+ * param format Format of the scores.
+ * param results Output of at least k results, highest score first. Equal
+ *               scores are ordered by index.
+ * param k Number of scores to find.
+ * return Number of results, the smaller of k and numScores.
+ */
+size_t getTopScores(const void* scores, size_t numScores,
+                    const ScoreFormat_t* format, ScoreResult_t* results,
+                    size_t k);
@@ -16,9 +16,11 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <glib.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/mman.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -27,35 +29,88 @@
 
 #include "imgprovider.h"
 #include "larod.h"
+#include "postprocess.h"
+#include "tensorpool.h"
 #include "vdo-frame.h"
 #include "vdo-types.h"
 
 #define INFERENCE_INPUT_HEIGHT 224
 #define INFERENCE_INPUT_WIDTH 224
+// Hardcode to use three image "color" channels (eg. RGB).
+#define CHANNELS 3
 #define NUM_ROUNDS 5
-
+// Frames in flight at once, see PipelineSlot.
+#define PIPELINE_DEPTH 2
+// Value of the padding rows in letterbox mode.
+#define LETTERBOX_PAD_VALUE 0
 
 /**
- * brief Invoked on SIGINT. Makes app exit cleanly asap if invoked once, but
- * forces an immediate exit without clean up if invoked at least twice.
+ * brief Preprocessing job reading its input straight from one VDO buffer.
  *
- * param sig What signal has been sent.
+ * Kept per buffer in a hash table, so tensors and job request are set up
+ * once per buffer and larod maps each buffer once.
  */
-static void sigintHandler(int sig);
+typedef struct {
+    /// Fd of the buffer when the job was created. A buffer handle VDO
+    /// reuses for a new buffer gets a new job.
+    int fd;
+    larodTensor** inputTensors;
+    size_t numInputs;
+    /// NULL if the buffer can't be bound, its frames are copied instead.
+    larodJobRequest* req;
+} PpBufferJob;
 
 /**
- * brief Creates a temporary fd truncated to correct size and mapped.
+ * brief The tensors and job requests one frame passes through.
  *
- * This convenience function creates temp files to be used for input and output.
+ * A frame is preprocessed into the inference input of its slot, and the
+ * inference writes to the output of the slot. With PIPELINE_DEPTH slots the
+ * next frame is preprocessed in one slot while the inference on the
+ * previous frame runs in another.
+ */
+typedef struct {
+    larodTensor** ppInputTensors;
+    size_t ppNumInputs;
+    larodTensor** ppOutputTensors;
+    size_t ppNumOutputs;
+    larodTensor** inputTensors;
+    size_t numInputs;
+    larodTensor** outputTensors;
+    size_t numOutputs;
+    /// Preprocessing job reading a copy of the frame in ppInputBuffer.
+    larodJobRequest* ppReq;
+    larodJobRequest* infReq;
+    /// PpBufferJob per VDO buffer, writing to the inference input of this
+    /// slot.
+    GHashTable* ppJobCache;
+    TensorBuffer_t* ppInputBuffer;
+    TensorBuffer_t* inputBuffer;
+    TensorBuffer_t* outputBuffer;
+    /// How the scores in outputBuffer are stored.
+    ScoreFormat_t scoreFormat;
+    /// Number of scores in outputBuffer.
+    size_t numScores;
+
+    /// Set from when a job is started on the slot until it has completed.
+    /// Guarded by slotMutex.
+    bool busy;
+    /// Set by the completion callback if the job failed. Guarded by
+    /// slotMutex.
+    bool failed;
+    /// Set from when an inference is started until its result has been
+    /// handled.
+    bool haveFrame;
+    struct timeval startTs;
+    struct timeval endTs;
+} PipelineSlot;
+
+/**
+ * brief Invoked on SIGINT. Makes app exit cleanly asap if invoked once, but
+ * forces an immediate exit without clean up if invoked at least twice.
  *
- * param fileName Pattern for how the temp file will be named in file system.
- * param fileSize How much space needed to be allocated (truncated) in fd.
- * param mappedAddr Pointer to the address of the fd mapped for this process.
- * param Pointer to the generated fd.
- * return False if any errors occur, otherwise true.
+ * param sig What signal has been sent.
  */
-static bool createAndMapTmpFile(char* fileName, size_t fileSize,
-                                void** mappedAddr, int* convFd);
+static void sigintHandler(int sig);
 
 /**
  * brief Sets up and configures a connection to larod, and loads a model.
@@ -96,10 +151,126 @@ static void freeLabels(char** labelsArray, char* labelFileBuffer);
 static bool parseLabels(char*** labelsPtr, char** labelFileBuffer,
                         char* labelsPath, size_t* numLabelsPtr);
 
+/**
+ * brief Get the preprocessing job reading from a VDO buffer.
+ *
+ * The first time a buffer is seen its fd is bound to new preprocessing input
+ * tensors, and a job request writing to the shared output tensors is
+ * created. The job is cached in jobCache and reused for later frames in the
+ * same buffer.
+ *
+ * param jobCache Hash table of PpBufferJob keyed by VdoBuffer.
+ * param buf VDO buffer holding the frame.
+ * param ppModel Preprocessing model.
+ * param outputTensors Preprocessing output tensors shared by all jobs.
+ * param numOutputs Number of preprocessing output tensors.
+ * param cropMap Crop parameters of the job.
+ * param inputSize Bytes the preprocessing job reads from the buffer.
+ * return Job request, or NULL if the buffer can't be bound and the frame
+ *        must be copied to the preprocessing input instead.
+ */
+static larodJobRequest* getPpBufferJob(GHashTable* jobCache, VdoBuffer* buf,
+                                       larodModel* ppModel,
+                                       larodTensor** outputTensors,
+                                       size_t numOutputs, larodMap* cropMap,
+                                       size_t inputSize);
+
+/**
+ * brief Release a PpBufferJob, used as hash table value destroy function.
+ *
+ * param data Pointer to the PpBufferJob.
+ */
+static void destroyPpBufferJob(gpointer data);
+
+/**
+ * brief Create the tensors, buffers and job requests of a pipeline slot.
+ *
+ * param slot Zeroed slot to set up.
+ * param pool Pool to take the tensor buffers from.
+ * param ppModel Preprocessing model.
+ * param model Inference model.
+ * param cropMap Crop parameters of the preprocessing jobs.
+ * param ppOutputSize Expected size in bytes of the preprocessing output.
+ * param padY Letterbox padding rows above the preprocessing output.
+ * return False if any errors occur, otherwise true.
+ */
+static bool setupPipelineSlot(PipelineSlot* slot, TensorPool_t* pool,
+                              larodModel* ppModel, larodModel* model,
+                              larodMap* cropMap, size_t ppOutputSize,
+                              unsigned int padY);
+
+/**
+ * brief Free the resources of a pipeline slot. No job may be running on it.
+ *
+ * param slot Slot set up by setupPipelineSlot(), possibly partially.
+ * param pool Pool the tensor buffers came from.
+ */
+static void releasePipelineSlot(PipelineSlot* slot, TensorPool_t* pool);
+
+/**
+ * brief Completion callback of larodRunJobAsync(), run on a larod thread.
+ *
+ * param userData The PipelineSlot the job ran on.
+ * param error Error if the job failed, otherwise NULL.
+ */
+static void jobDone(void* userData, larodError* error);
+
+/**
+ * brief Start a job on a pipeline slot with larodRunJobAsync().
+ *
+ * param conn larod connection.
+ * param slot Slot the job belongs to, no job may be running on it.
+ * param req Job request to run.
+ * return False if the job could not be started, otherwise true.
+ */
+static bool startSlotJob(larodConnection* conn, PipelineSlot* slot,
+                         const larodJobRequest* req);
+
+/**
+ * brief Wait until the job running on a pipeline slot, if any, has completed.
+ *
+ * param slot Slot to wait for.
+ * return False if the job failed, otherwise true.
+ */
+static bool waitForSlotJob(PipelineSlot* slot);
+
+/**
+ * brief Time the last job on a pipeline slot took.
+ *
+ * param slot Slot with a completed job.
+ * return Milliseconds from the job being started to it completing.
+ */
+static unsigned int slotJobMs(const PipelineSlot* slot);
+
+/**
+ * brief Log the result of the inference on a pipeline slot.
+ *
+ * param slot Slot with a completed inference.
+ * param labels Array of label strings, or NULL.
+ * param numLabels Number of entries in labels.
+ */
+static void handleResult(const PipelineSlot* slot, char** labels,
+                         size_t numLabels);
+
+/**
+ * brief Wait for the inference on a pipeline slot and log its result.
+ *
+ * param slot Slot with an inference started.
+ * param labels Array of label strings, or NULL.
+ * param numLabels Number of entries in labels.
+ * return False if the inference failed, otherwise true.
+ */
+static bool finishSlot(PipelineSlot* slot, char** labels, size_t numLabels);
+
 /// Set by signal handler if an interrupt signal sent to process.
 /// Indicates that app should stop asap and exit gracefully.
 volatile sig_atomic_t stopRunning = false;
 
+/// Guards the busy and failed flags of all pipeline slots.
+static pthread_mutex_t slotMutex = PTHREAD_MUTEX_INITIALIZER;
+/// Signaled when a job on a pipeline slot completes.
+static pthread_cond_t slotCond = PTHREAD_COND_INITIALIZER;
+
 void sigintHandler(int sig) {
     if (stopRunning) {
         syslog(LOG_INFO, "Interrupted again, exiting immediately without clean up.");
@@ -117,52 +288,6 @@ void sigintHandler(int sig) {
     stopRunning = true;
 }
 
-static bool createAndMapTmpFile(char* fileName, size_t fileSize,
-                                void** mappedAddr, int* convFd) {
-    int fd = mkstemp(fileName);
-    if (fd < 0) {
-        syslog(LOG_ERR, "%s: Unable to open temp file %s: %s", __func__, fileName,
-               strerror(errno));
-        goto error;
-    }
-
-    // Allocate enough space in for the fd.
-    if (ftruncate(fd, (off_t) fileSize) < 0) {
-        syslog(LOG_ERR, "%s: Unable to truncate temp file %s: %s", __func__, fileName,
-               strerror(errno));
-        goto error;
-    }
-
-    // Remove since we don't actually care about writing to the file system.
-    if (unlink(fileName)) {
-        syslog(LOG_ERR, "%s: Unable to unlink from temp file %s: %s", __func__,
-               fileName, strerror(errno));
-        goto error;
-    }
-
-    // Get an address to fd's memory for this process's memory space.
-    void* data =
-        mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-
-    if (data == MAP_FAILED) {
-        syslog(LOG_ERR, "%s: Unable to mmap temp file %s: %s", __func__, fileName,
-               strerror(errno));
-        goto error;
-    }
-
-    *mappedAddr = data;
-    *convFd = fd;
-
-    return true;
-
-error:
-    if (fd >= 0) {
-        close(fd);
-    }
-
-    return false;
-}
-
 static bool setupLarod(const larodChip chip, const int larodModelFd,
                        larodConnection** larodConn, larodModel** model) {
     larodError* error = NULL;
@@ -217,6 +342,309 @@ end:
     return ret;
 }
 
+static void destroyPpBufferJob(gpointer data) {
+    PpBufferJob* job = data;
+
+    larodDestroyJobRequest(&job->req);
+    larodDestroyTensors(&job->inputTensors, job->numInputs);
+    free(job);
+}
+
+static larodJobRequest* getPpBufferJob(GHashTable* jobCache, VdoBuffer* buf,
+                                       larodModel* ppModel,
+                                       larodTensor** outputTensors,
+                                       size_t numOutputs, larodMap* cropMap,
+                                       size_t inputSize) {
+    larodError* error = NULL;
+    int fd = vdo_buffer_get_fd(buf);
+
+    PpBufferJob* job = g_hash_table_lookup(jobCache, buf);
+    if (job && job->fd == fd) {
+        return job->req;
+    }
+
+    job = calloc(1, sizeof(PpBufferJob));
+    if (!job) {
+        syslog(LOG_ERR, "%s: Unable to allocate job: %s", __func__,
+               strerror(errno));
+        return NULL;
+    }
+    job->fd = fd;
+    // Replaces and destroys a stale job for the same buffer handle.
+    g_hash_table_insert(jobCache, buf, job);
+
+    int64_t offset = vdo_buffer_get_offset(buf);
+    if (fd < 0 || vdo_buffer_get_capacity(buf) < inputSize) {
+        syslog(LOG_WARNING, "%s: VDO buffer %p can't be read by larod, "
+               "copying its frames", __func__, (void*) buf);
+        return NULL;
+    }
+
+    job->inputTensors = larodCreateModelInputs(ppModel, &job->numInputs,
+                                               &error);
+    if (!job->inputTensors) {
+        syslog(LOG_ERR, "%s: Failed creating input tensors: %s", __func__,
+               error->msg);
+        goto end;
+    }
+    // The frame is read where the ISP wrote it, larod maps the buffer once
+    // for this tensor.
+    if (!larodSetTensorFd(job->inputTensors[0], fd, &error) ||
+        !larodSetTensorFdOffset(job->inputTensors[0], offset, &error) ||
+        !larodSetTensorFdProps(job->inputTensors[0],
+                               LAROD_FD_PROP_MAP | LAROD_FD_PROP_DMABUF,
+                               &error)) {
+        syslog(LOG_WARNING, "%s: Failed binding VDO buffer to tensor, "
+               "copying its frames: %s", __func__, error->msg);
+        goto end;
+    }
+
+    job->req = larodCreateJobRequest(ppModel, job->inputTensors,
+                                     job->numInputs, outputTensors,
+                                     numOutputs, cropMap, &error);
+    if (!job->req) {
+        syslog(LOG_WARNING, "%s: Failed creating job request, copying "
+               "frames: %s", __func__, error->msg);
+        goto end;
+    }
+
+    syslog(LOG_INFO, "%s: Bound VDO buffer %p (fd %d, offset %lld) to "
+           "preprocessing", __func__, (void*) buf, fd, (long long) offset);
+
+end:
+    larodClearError(&error);
+
+    return job->req;
+}
+
+static void jobDone(void* userData, larodError* error) {
+    PipelineSlot* slot = userData;
+
+    pthread_mutex_lock(&slotMutex);
+    gettimeofday(&slot->endTs, NULL);
+    if (error) {
+        syslog(LOG_ERR, "Unable to run job: %s (%d)", error->msg, error->code);
+        slot->failed = true;
+    }
+    slot->busy = false;
+    pthread_cond_broadcast(&slotCond);
+    pthread_mutex_unlock(&slotMutex);
+}
+
+static bool startSlotJob(larodConnection* conn, PipelineSlot* slot,
+                         const larodJobRequest* req) {
+    larodError* error = NULL;
+
+    pthread_mutex_lock(&slotMutex);
+    slot->busy = true;
+    slot->failed = false;
+    pthread_mutex_unlock(&slotMutex);
+
+    gettimeofday(&slot->startTs, NULL);
+    if (!larodRunJobAsync(conn, req, jobDone, slot, &error)) {
+        syslog(LOG_ERR, "Unable to start job: %s (%d)", error->msg,
+               error->code);
+        larodClearError(&error);
+
+        pthread_mutex_lock(&slotMutex);
+        slot->busy = false;
+        pthread_mutex_unlock(&slotMutex);
+
+        return false;
+    }
+
+    return true;
+}
+
+static bool waitForSlotJob(PipelineSlot* slot) {
+    pthread_mutex_lock(&slotMutex);
+    while (slot->busy) {
+        pthread_cond_wait(&slotCond, &slotMutex);
+    }
+    bool ret = !slot->failed;
+    pthread_mutex_unlock(&slotMutex);
+
+    return ret;
+}
+
+static unsigned int slotJobMs(const PipelineSlot* slot) {
+    return (unsigned int) (((slot->endTs.tv_sec - slot->startTs.tv_sec) * 1000) +
+                           ((slot->endTs.tv_usec - slot->startTs.tv_usec) / 1000));
+}
+
+static bool setupPipelineSlot(PipelineSlot* slot, TensorPool_t* pool,
+                              larodModel* ppModel, larodModel* model,
+                              larodMap* cropMap, size_t ppOutputSize,
+                              unsigned int padY) {
+    larodError* error = NULL;
+    bool ret = false;
+
+    // Create input/output tensors
+    slot->ppInputTensors = larodCreateModelInputs(ppModel, &slot->ppNumInputs,
+                                                  &error);
+    if (!slot->ppInputTensors) {
+        syslog(LOG_ERR, "Failed retrieving input tensors: %s", error->msg);
+        goto end;
+    }
+    slot->ppOutputTensors = larodCreateModelOutputs(ppModel,
+                                                    &slot->ppNumOutputs, &error);
+    if (!slot->ppOutputTensors) {
+        syslog(LOG_ERR, "Failed retrieving output tensors: %s", error->msg);
+        goto end;
+    }
+    slot->inputTensors = larodCreateModelInputs(model, &slot->numInputs,
+                                                &error);
+    if (!slot->inputTensors) {
+        syslog(LOG_ERR, "Failed retrieving input tensors: %s", error->msg);
+        goto end;
+    }
+    // This app only supports 1 input tensor right now.
+    if (slot->numInputs != 1) {
+        syslog(LOG_ERR, "Model has %zu inputs, app only supports 1 input tensor.",
+               slot->numInputs);
+        goto end;
+    }
+    slot->outputTensors = larodCreateModelOutputs(model, &slot->numOutputs,
+                                                  &error);
+    if (!slot->outputTensors) {
+        syslog(LOG_ERR, "Failed retrieving output tensors: %s", error->msg);
+        goto end;
+    }
+    // This app only supports 1 output tensor right now.
+    if (slot->numOutputs != 1) {
+        syslog(LOG_ERR, "Model has %zu outputs, app only supports 1 output tensor.",
+               slot->numOutputs);
+        goto end;
+    }
+
+    size_t rgbBufferSize = 0;
+    if (!getTensorByteSize(slot->ppOutputTensors[0], &rgbBufferSize)) {
+        goto end;
+    }
+    if (ppOutputSize != rgbBufferSize) {
+        syslog(LOG_ERR, "Expected video output size %zu, actual %zu",
+               ppOutputSize, rgbBufferSize);
+        goto end;
+    }
+
+    // Allocate buffers sized from the tensors and connect them to the tensors
+    slot->ppInputBuffer = getBoundTensorBuffer(pool, slot->ppInputTensors[0]);
+    if (!slot->ppInputBuffer) {
+        goto end;
+    }
+    slot->inputBuffer = getBoundTensorBuffer(pool, slot->inputTensors[0]);
+    if (!slot->inputBuffer) {
+        goto end;
+    }
+    slot->outputBuffer = getBoundTensorBuffer(pool, slot->outputTensors[0]);
+    if (!slot->outputBuffer) {
+        goto end;
+    }
+    larodTensorDataType outputType =
+        larodGetTensorDataType(slot->outputTensors[0], &error);
+    if (outputType == LAROD_TENSOR_DATA_TYPE_INVALID) {
+        syslog(LOG_ERR, "%s: Failed getting output data type: %s", __func__,
+               error ? error->msg : "invalid");
+        goto end;
+    }
+    if (!initScoreFormatFromLarod(&slot->scoreFormat, outputType)) {
+        goto end;
+    }
+    slot->numScores =
+        slot->outputBuffer->size / getScoreSize(slot->scoreFormat.dataType);
+    if (padY > 0) {
+        memset(slot->inputBuffer->addr, LETTERBOX_PAD_VALUE,
+               slot->inputBuffer->size);
+    }
+    // Preprocessing writes straight to the inference input, below the top
+    // padding rows.
+    if (!bindTensorBuffer(slot->ppOutputTensors[0], slot->inputBuffer)) {
+        goto end;
+    }
+    if (!larodSetTensorFdOffset(slot->ppOutputTensors[0],
+                                (int64_t) padY * INFERENCE_INPUT_WIDTH * CHANNELS,
+                                &error)) {
+        syslog(LOG_ERR, "Failed setting preprocessing output offset: %s",
+               error->msg);
+        goto end;
+    }
+
+    // Create job requests. Frames are normally preprocessed straight from
+    // their VDO buffer by a job per buffer, ppReq reading the copy in
+    // ppInputBuffer is only used for buffers that can't be bound.
+    slot->ppJobCache = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                             NULL, destroyPpBufferJob);
+    slot->ppReq = larodCreateJobRequest(ppModel, slot->ppInputTensors,
+                                        slot->ppNumInputs,
+                                        slot->ppOutputTensors,
+                                        slot->ppNumOutputs, cropMap, &error);
+    if (!slot->ppReq) {
+        syslog(LOG_ERR, "Failed creating preprocessing job request: %s", error->msg);
+        goto end;
+    }
+
+    // App supports only one input/output tensor.
+    slot->infReq = larodCreateJobRequest(model, slot->inputTensors, 1,
+                                         slot->outputTensors, 1, NULL, &error);
+    if (!slot->infReq) {
+        syslog(LOG_ERR, "Failed creating inference request: %s", error->msg);
+        goto end;
+    }
+
+    ret = true;
+
+end:
+    larodClearError(&error);
+
+    return ret;
+}
+
+static void releasePipelineSlot(PipelineSlot* slot, TensorPool_t* pool) {
+    releaseTensorBuffer(pool, slot->ppInputBuffer);
+    releaseTensorBuffer(pool, slot->inputBuffer);
+    releaseTensorBuffer(pool, slot->outputBuffer);
+
+    larodDestroyJobRequest(&slot->ppReq);
+    larodDestroyJobRequest(&slot->infReq);
+    larodDestroyTensors(&slot->ppInputTensors, slot->ppNumInputs);
+    larodDestroyTensors(&slot->ppOutputTensors, slot->ppNumOutputs);
+    larodDestroyTensors(&slot->inputTensors, slot->numInputs);
+    larodDestroyTensors(&slot->outputTensors, slot->numOutputs);
+}
+
+static void handleResult(const PipelineSlot* slot, char** labels,
+                         size_t numLabels) {
+    ScoreResult_t top;
+    if (!getTopScores(slot->outputBuffer->addr, slot->numScores,
+                      &slot->scoreFormat, &top, 1)) {
+        return;
+    }
+    if (labels) {
+        if (top.index < numLabels) {
+            syslog(LOG_INFO, "Top result: %s with score %.2f%%",
+                   labels[top.index], top.score * 100.0f);
+        } else {
+            syslog(LOG_INFO, "Top result: index %zu with score %.2f%% (index larger "
+                   "than num items in labels file)",
+                   top.index, top.score * 100.0f);
+        }
+    } else {
+        syslog(LOG_INFO, "Top result: index %zu with score %.2f%%", top.index,
+               top.score * 100.0f);
+    }
+}
+
+static bool finishSlot(PipelineSlot* slot, char** labels, size_t numLabels) {
+    bool ret = waitForSlotJob(slot);
+    if (ret) {
+        syslog(LOG_INFO, "Ran inference for %u ms", slotJobMs(slot));
+        handleResult(slot, labels, numLabels);
+    }
+    slot->haveFrame = false;
+
+    return ret;
+}
+
 void freeLabels(char** labelsArray, char* labelFileBuffer) {
     free(labelsArray);
     free(labelFileBuffer);
@@ -353,14 +781,6 @@ end:
  * brief Main function that starts a stream with different options.
  */
 int main(int argc, char** argv) {
-    // Hardcode to use three image "color" channels (eg. RGB).
-    const unsigned int CHANNELS = 3;
-
-    // Name patterns for the temp file we will create.
-    char CONV_PP_FILE_PATTERN[] = "/tmp/larod.pp.test-XXXXXX";
-    char CONV_INP_FILE_PATTERN[] = "/tmp/larod.in.test-XXXXXX";
-    char CONV_OUT_FILE_PATTERN[] = "/tmp/larod.out.test-XXXXXX";
-
     bool ret = false;
     ImgProvider_t* provider = NULL;
     larodError* error = NULL;
@@ -369,24 +789,10 @@ int main(int argc, char** argv) {
     larodMap* cropMap = NULL;
     larodModel* ppModel = NULL;
     larodModel* model = NULL;
-    larodTensor** ppInputTensors = NULL;
-    size_t ppNumInputs = 0;
-    larodTensor** ppOutputTensors = NULL;
-    size_t ppNumOutputs = 0;
-    larodTensor** inputTensors = NULL;
-    size_t numInputs = 0;
-    larodTensor** outputTensors = NULL;
-    size_t numOutputs = 0;
-    larodJobRequest* ppReq = NULL;
-    larodJobRequest* infReq = NULL;
-    void* ppInputAddr = MAP_FAILED;
-    void* larodInputAddr = MAP_FAILED;
-    void* larodOutputAddr = MAP_FAILED;
-    size_t outputBufferSize = 0;
+    TensorPool_t* tensorPool = NULL;
+    PipelineSlot slots[PIPELINE_DEPTH];
+    unsigned int numSlots = 0;
     int larodModelFd = -1;
-    int ppInputFd = -1;
-    int larodInputFd = -1;
-    int larodOutputFd = -1;
     char** labels = NULL; // This is the array of label strings. The label
                           // entries points into the large labelFileData buffer.
     size_t numLabels = 0; // Number of entries in the labels array.
@@ -401,11 +807,12 @@ int main(int argc, char** argv) {
     // but exits immediately if further invoked.
     signal(SIGINT, sigintHandler);
 
-    if (argc != 4) {
+    if (argc != 4 && !(argc == 5 && strcmp(argv[4], "letterbox") == 0)) {
         syslog(LOG_ERR, "Invalid number of arguments\nArguments are: "
-                        "INF_CHIP MODEL_PATH LABELS_PATH\n");
+                        "INF_CHIP MODEL_PATH LABELS_PATH [letterbox]\n");
         goto end;
     }
+    bool letterbox = argc == 5;
 
     // Create video stream provider
     unsigned int streamWidth = 0;
@@ -440,6 +847,34 @@ int main(int argc, char** argv) {
     unsigned int clipH = (unsigned int)cropH;
     unsigned int clipX = (streamWidth - clipW) / 2;
     unsigned int clipY = (streamHeight - clipH) / 2;
+
+    // In letterbox mode the whole frame is scaled to the inference input
+    // width, keeping its aspect ratio, and written between padding rows at
+    // the top and bottom of the inference input. The padding is written once
+    // and never touched by the preprocessing job, so it costs nothing per
+    // frame. Frames narrower than the input would need padding at the sides,
+    // which the preprocessing output can't skip, so those are cropped.
+    unsigned int ppOutputHeight = INFERENCE_INPUT_HEIGHT;
+    unsigned int padY = 0;
+    if (letterbox) {
+        unsigned int scaledH = (unsigned int) ((float) streamHeight *
+                                                   INFERENCE_INPUT_WIDTH /
+                                                   streamWidth +
+                                               0.5f);
+        if (scaledH <= INFERENCE_INPUT_HEIGHT) {
+            clipX = 0;
+            clipY = 0;
+            clipW = streamWidth;
+            clipH = streamHeight;
+            ppOutputHeight = scaledH;
+            padY = (INFERENCE_INPUT_HEIGHT - scaledH) / 2;
+            syslog(LOG_INFO, "Letterbox image at X=0 Y=%u (%d x %u)", padY,
+                   INFERENCE_INPUT_WIDTH, ppOutputHeight);
+        } else {
+            syslog(LOG_WARNING, "Letterbox needs side padding for %u x %u, "
+                   "using crop", streamWidth, streamHeight);
+        }
+    }
     syslog(LOG_INFO, "Crop VDO image X=%d Y=%d (%d x %d)", clipX, clipY, clipW, clipH);
 
     // Create preprocessing maps
@@ -457,11 +892,17 @@ int main(int argc, char** argv) {
         syslog(LOG_ERR, "Failed setting preprocessing parameters: %s", error->msg);
         goto end;
     }
+    // VDO buffers can have padded rows, with the UV plane following the
+    // last padded Y row.
+    if (!larodMapSetInt(ppMap, "image.input.row-pitch", provider->yPitch, &error)) {
+        syslog(LOG_ERR, "Failed setting preprocessing parameters: %s", error->msg);
+        goto end;
+    }
     if (!larodMapSetStr(ppMap, "image.output.format", "rgb-interleaved", &error)) {
         syslog(LOG_ERR, "Failed setting preprocessing parameters: %s", error->msg);
         goto end;
     }
-    if (!larodMapSetIntArr2(ppMap, "image.output.size", INFERENCE_INPUT_WIDTH, INFERENCE_INPUT_HEIGHT, &error)) {
+    if (!larodMapSetIntArr2(ppMap, "image.output.size", INFERENCE_INPUT_WIDTH, ppOutputHeight, &error)) {
         syslog(LOG_ERR, "Failed setting preprocessing parameters: %s", error->msg);
         goto end;
     }
@@ -498,117 +939,23 @@ int main(int argc, char** argv) {
        goto end;
     }
 
-    // Create input/output tensors
-    syslog(LOG_INFO, "Create input/output tensors");
-    ppInputTensors = larodCreateModelInputs(ppModel, &ppNumInputs, &error);
-    if (!ppInputTensors) {
-        syslog(LOG_ERR, "Failed retrieving input tensors: %s", error->msg);
+    // Create input/output tensors, buffers and job requests for every
+    // pipeline slot
+    syslog(LOG_INFO, "Create input/output tensors for %d pipeline slots",
+           PIPELINE_DEPTH);
+    tensorPool = createTensorPool();
+    if (!tensorPool) {
         goto end;
     }
-    ppOutputTensors = larodCreateModelOutputs(ppModel, &ppNumOutputs, &error);
-    if (!ppOutputTensors) {
-        syslog(LOG_ERR, "Failed retrieving output tensors: %s", error->msg);
-        goto end;
-    }
-    inputTensors = larodCreateModelInputs(model, &numInputs, &error);
-    if (!inputTensors) {
-        syslog(LOG_ERR, "Failed retrieving input tensors: %s", error->msg);
-        goto end;
-    }
-    // This app only supports 1 input tensor right now.
-    if (numInputs != 1) {
-        syslog(LOG_ERR, "Model has %zu inputs, app only supports 1 input tensor.",
-               numInputs);
-        goto end;
-    }
-    outputTensors = larodCreateModelOutputs(model, &numOutputs, &error);
-    if (!outputTensors) {
-        syslog(LOG_ERR, "Failed retrieving output tensors: %s", error->msg);
-        goto end;
-    }
-    // This app only supports 1 output tensor right now.
-    if (numOutputs != 1) {
-        syslog(LOG_ERR, "Model has %zu outputs, app only supports 1 output tensor.",
-               numOutputs);
-        goto end;
-    }
-
-    // Determine tensor buffer sizes
-    syslog(LOG_INFO, "Determine tensor buffer sizes");
-    const larodTensorPitches* ppInputPitches = larodGetTensorPitches(ppInputTensors[0], &error);
-    if (!ppInputPitches) {
-        syslog(LOG_ERR, "Could not get pitches of tensor: %s", error->msg);
-        goto end;
-    }
-    size_t yuyvBufferSize = ppInputPitches->pitches[0];
-    const larodTensorPitches* ppOutputPitches = larodGetTensorPitches(ppOutputTensors[0], &error);
-    if (!ppOutputPitches) {
-        syslog(LOG_ERR, "Could not get pitches of tensor: %s", error->msg);
-        goto end;
-    }
-    size_t rgbBufferSize = ppOutputPitches->pitches[0];
-    size_t expectedSize = INFERENCE_INPUT_WIDTH * INFERENCE_INPUT_HEIGHT * CHANNELS;
-    if (expectedSize != rgbBufferSize) {
-        syslog(LOG_ERR, "Expected video output size %d, actual %d", expectedSize, rgbBufferSize);
-        goto end;
-    }
-    const larodTensorPitches* outputPitches = larodGetTensorPitches(outputTensors[0], &error);
-    if (!outputPitches) {
-        syslog(LOG_ERR, "Could not get pitches of tensor: %s", error->msg);
-        goto end;
-    }
-    outputBufferSize = outputPitches->pitches[0];
-
-    // Allocate memory for input/output buffers
-    syslog(LOG_INFO, "Allocate memory for input/output buffers");
-    if (!createAndMapTmpFile(CONV_PP_FILE_PATTERN, yuyvBufferSize,
-                             &ppInputAddr, &ppInputFd)) {
-        goto end;
-    }
-    if (!createAndMapTmpFile(CONV_INP_FILE_PATTERN,
-                             INFERENCE_INPUT_WIDTH * INFERENCE_INPUT_HEIGHT * CHANNELS,
-                             &larodInputAddr, &larodInputFd)) {
-        goto end;
-    }
-    if (!createAndMapTmpFile(CONV_OUT_FILE_PATTERN, outputBufferSize,
-                             &larodOutputAddr, &larodOutputFd)) {
-        goto end;
-    }
-
-    // Connect tensors to file descriptors
-    syslog(LOG_INFO, "Connect tensors to file descriptors");
-    if (!larodSetTensorFd(ppInputTensors[0], ppInputFd, &error)) {
-        syslog(LOG_ERR, "Failed setting input tensor fd: %s", error->msg);
-        goto end;
-    }
-    if (!larodSetTensorFd(ppOutputTensors[0], larodInputFd, &error)) {
-        syslog(LOG_ERR, "Failed setting input tensor fd: %s", error->msg);
-        goto end;
-    }
-    if (!larodSetTensorFd(inputTensors[0], larodInputFd, &error)) {
-        syslog(LOG_ERR, "Failed setting input tensor fd: %s", error->msg);
-        goto end;
-    }
-    if (!larodSetTensorFd(outputTensors[0], larodOutputFd, &error)) {
-        syslog(LOG_ERR, "Failed setting output tensor fd: %s", error->msg);
-        goto end;
-    }
-
-    // Create job requests
-    syslog(LOG_INFO, "Create job requests");
-    ppReq = larodCreateJobRequest(ppModel, ppInputTensors, ppNumInputs,
-        ppOutputTensors, ppNumOutputs, cropMap, &error);
-    if (!ppReq) {
-        syslog(LOG_ERR, "Failed creating preprocessing job request: %s", error->msg);
-        goto end;
-    }
-
-    // App supports only one input/output tensor.
-    infReq = larodCreateJobRequest(model, inputTensors, 1, outputTensors,
-                                         1, NULL, &error);
-    if (!infReq) {
-        syslog(LOG_ERR, "Failed creating inference request: %s", error->msg);
-        goto end;
+    for (; numSlots < PIPELINE_DEPTH; numSlots++) {
+        PipelineSlot* slot = &slots[numSlots];
+        memset(slot, 0, sizeof(*slot));
+        if (!setupPipelineSlot(slot, tensorPool, ppModel, model, cropMap,
+                               INFERENCE_INPUT_WIDTH * ppOutputHeight * CHANNELS,
+                               padY)) {
+            numSlots++;
+            goto end;
+        }
     }
 
     if (argv[2]) {
@@ -624,9 +971,18 @@ int main(int argc, char** argv) {
         goto end;
     }
 
-    for (unsigned int i = 0; i < NUM_ROUNDS && !stopRunning; i++) {
-        struct timeval startTs, endTs;
-        unsigned int elapsedMs = 0;
+    // Frame i goes through slot i % PIPELINE_DEPTH. The main thread only
+    // waits for the preprocessing of a frame before starting its inference,
+    // and handles the result of the previous frame in the slot before
+    // reusing it. So the next frame is preprocessed, and the result of the
+    // frame before is handled, while the inference on a frame runs.
+    unsigned int frameIdx = 0;
+    for (; frameIdx < NUM_ROUNDS && !stopRunning; frameIdx++) {
+        PipelineSlot* slot = &slots[frameIdx % PIPELINE_DEPTH];
+
+        if (slot->haveFrame && !finishSlot(slot, labels, numLabels)) {
+            goto end;
+        }
 
         // Get latest frame from image pipeline.
         VdoBuffer* buf = getLastFrameBlocking(provider);
@@ -634,70 +990,41 @@ int main(int argc, char** argv) {
             goto end;
         }
 
-        // Get data from latest frame.
-        uint8_t* nv12Data = (uint8_t*) vdo_buffer_get_data(buf);
-
         // Covert image data from NV12 format to interleaved uint8_t RGB format
-        gettimeofday(&startTs, NULL);
-        memcpy(ppInputAddr, nv12Data, yuyvBufferSize);
-        if (!larodRunJob(conn, ppReq, &error)) {
-            syslog(LOG_ERR, "Unable to run job on model pp: %s (%d)",
-                   error->msg, error->code);
-            goto end;
+        larodJobRequest* req =
+            getPpBufferJob(slot->ppJobCache, buf, ppModel,
+                           slot->ppOutputTensors, slot->ppNumOutputs, cropMap,
+                           slot->ppInputBuffer->size);
+        if (!req) {
+            uint8_t* nv12Data = (uint8_t*) vdo_buffer_get_data(buf);
+            memcpy(slot->ppInputBuffer->addr, nv12Data,
+                   slot->ppInputBuffer->size);
+            req = slot->ppReq;
         }
-        gettimeofday(&endTs, NULL);
+        bool converted = startSlotJob(conn, slot, req) && waitForSlotJob(slot);
 
-        elapsedMs = (unsigned int) (((endTs.tv_sec - startTs.tv_sec) * 1000) +
-                                    ((endTs.tv_usec - startTs.tv_usec) / 1000));
-        syslog(LOG_INFO, "Converted image in %u ms", elapsedMs);
-
-        // Since larodOutputAddr points to the beginning of the fd we should
-        // rewind the file position before each job.
-        if (lseek(larodOutputFd, 0, SEEK_SET) == -1) {
-            syslog(LOG_ERR, "Unable to rewind output file position: %s",
-                   strerror(errno));
+        // Release frame reference to provider, the job has read it.
+        returnFrame(provider, buf);
 
+        if (!converted) {
+            syslog(LOG_ERR, "Unable to run job on model pp");
             goto end;
         }
+        syslog(LOG_INFO, "Converted image in %u ms", slotJobMs(slot));
 
-        gettimeofday(&startTs, NULL);
-        if (!larodRunJob(conn, infReq, &error)) {
-            syslog(LOG_ERR, "Unable to run inference on model %s: %s (%d)",
-                   argv[2], error->msg, error->code);
+        if (!startSlotJob(conn, slot, slot->infReq)) {
+            syslog(LOG_ERR, "Unable to run inference on model %s", argv[2]);
             goto end;
         }
-        gettimeofday(&endTs, NULL);
-
-        elapsedMs = (unsigned int) (((endTs.tv_sec - startTs.tv_sec) * 1000) +
-                                    ((endTs.tv_usec - startTs.tv_usec) / 1000));
-        syslog(LOG_INFO, "Ran inference for %u ms", elapsedMs);
-
-        // Compute the most likely index.
-        uint8_t maxProb = 0;
-        size_t maxIdx = 0;
-        uint8_t* outputPtr = (uint8_t*) larodOutputAddr;
-        for (size_t j = 0; j < outputBufferSize; j++) {
-            if (outputPtr[j] > maxProb) {
-                maxProb = outputPtr[j];
-                maxIdx = j;
-            }
-        }
-        if (labels) {
-            if (maxIdx < numLabels) {
-                syslog(LOG_INFO, "Top result: %s with score %.2f%%", labels[maxIdx],
-                       (float) maxProb / 2.5f);
-            } else {
-                syslog(LOG_INFO, "Top result: index %zu with score %.2f%% (index larger "
-                       "than num items in labels file)",
-                       maxIdx, (float) maxProb / 2.5f);
-            }
-        } else {
-            syslog(LOG_INFO, "Top result: index %zu with score %.2f%%", maxIdx,
-                   (float) maxProb / 2.5f);
-        }
+        slot->haveFrame = true;
+    }
 
-        // Release frame reference to provider.
-        returnFrame(provider, buf);
+    // Handle the results still in flight, oldest first.
+    for (unsigned int i = 0; i < PIPELINE_DEPTH; i++) {
+        PipelineSlot* slot = &slots[(frameIdx + i) % PIPELINE_DEPTH];
+        if (slot->haveFrame && !finishSlot(slot, labels, numLabels)) {
+            goto end;
+        }
     }
 
     syslog(LOG_INFO, "Stop streaming video from VDO");
@@ -708,6 +1035,15 @@ int main(int argc, char** argv) {
     ret = true;
 
 end:
+    // larod still uses the tensors of jobs in flight, and calls back with
+    // the slot. The cached jobs refer to the VDO buffers, release them
+    // before the provider.
+    for (unsigned int i = 0; i < numSlots; i++) {
+        waitForSlotJob(&slots[i]);
+        if (slots[i].ppJobCache) {
+            g_hash_table_destroy(slots[i].ppJobCache);
+        }
+    }
     if (provider) {
         destroyImgProvider(provider);
     }
@@ -724,29 +1060,10 @@ end:
     if (larodModelFd >= 0) {
         close(larodModelFd);
     }
-    if (ppInputAddr != MAP_FAILED) {
-        munmap(ppInputAddr, INFERENCE_INPUT_WIDTH * INFERENCE_INPUT_HEIGHT * CHANNELS);
-    }
-    if (ppInputFd >= 0) {
-        close(ppInputFd);
-    }
-    if (larodInputAddr != MAP_FAILED) {
-        munmap(larodInputAddr, INFERENCE_INPUT_WIDTH * INFERENCE_INPUT_HEIGHT * CHANNELS);
+    for (unsigned int i = 0; i < numSlots; i++) {
+        releasePipelineSlot(&slots[i], tensorPool);
     }
-    if (larodInputFd >= 0) {
-        close(larodInputFd);
-    }
-    if (larodOutputAddr != MAP_FAILED) {
-        munmap(larodOutputAddr, outputBufferSize);
-    }
-    if (larodOutputFd >= 0) {
-        close(larodOutputFd);
-    }
-
-    larodDestroyJobRequest(&ppReq);
-    larodDestroyJobRequest(&infReq);
-    larodDestroyTensors(&inputTensors, numInputs);
-    larodDestroyTensors(&outputTensors, numOutputs);
+    destroyTensorPool(tensorPool);
     larodClearError(&error);
 
     if (labels) {
@@ -21,9 +21,19 @@
 #include "argparse.h"
 
 #include <argp.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #define KEY_USAGE (127)
+#define KEY_LETTERBOX (128)
+#define KEY_BT709 (129)
+#define KEY_FULL_RANGE (130)
+#define KEY_MIN_BUFFERS (131)
+#define KEY_EVERY (132)
+#define KEY_RECORD (133)
+#define KEY_REPLAY (134)
+#define KEY_SOFTMAX (135)
+#define KEY_OUTPUT_QUANT (136)
 
 static int parsePosInt(char* arg, unsigned long long* i,
                        unsigned long long limit);
@@ -43,6 +53,57 @@ const struct argp_option opts[] = {
      0},
     {"num-frames", 'n', "NUM_FRAMES", 0,
      "How many frames to run inferences on. Default is 100 frames.", 0},
+    {"buffers", 'b', "NUM_BUFFERS", 0,
+     "How many vdo buffers to allocate for the stream. Default is 8. Fewer "
+     "buffers use less memory at large resolutions.",
+     0},
+    {"min-buffers", KEY_MIN_BUFFERS, "MIN_BUFFERS", 0,
+     "Let the number of vdo buffers adapt to the load, between MIN_BUFFERS "
+     "and NUM_BUFFERS.",
+     0},
+    {"fps", 'r', "FPS", 0,
+     "Run inferences on at most FPS frames per second. Lowers the frame rate "
+     "of the stream if VDO supports it, otherwise frames are skipped. "
+     "Default is the full frame rate.",
+     0},
+    {"every", KEY_EVERY, "N", 0,
+     "Only run inferences on every Nth frame of the stream.", 0},
+    {"pipeline", 'p', "DEPTH", 0,
+     "Keep up to DEPTH frames in flight, converting the next frame while "
+     "inferences run on the previous ones. 1 runs each frame to completion "
+     "before fetching the next. Default is 2, at most 4.",
+     0},
+    {"top-k", 'k', "K", 0,
+     "Log the K highest scores of each inference. Default is 1, at most 10.",
+     0},
+    {"softmax", KEY_SOFTMAX, NULL, 0,
+     "Turn the output scores into probabilities with softmax, for models "
+     "that output logits.",
+     0},
+    {"output-quant", KEY_OUTPUT_QUANT, "SCALE,ZERO_POINT", 0,
+     "Dequantize the output scores with SCALE and ZERO_POINT. Default is a "
+     "scale of 1/256 with zero point 0 for uint8 and -128 for int8 outputs, "
+     "float outputs are used as they are.",
+     0},
+    {"record", KEY_RECORD, "FILE", 0,
+     "Record the frames inferences are run on to FILE as raw NV12.", 0},
+    {"replay", KEY_REPLAY, "FILE", 0,
+     "Run inferences on the frames of a recording instead of the camera. "
+     "FILE is a raw NV12 file or a directory of frame files at the stream "
+     "resolution chosen for WIDTH x HEIGHT. Frames are replayed at FPS if "
+     "given, otherwise as fast as possible.",
+     0},
+    {"letterbox", KEY_LETTERBOX, NULL, 0,
+     "Scale the whole frame keeping its aspect ratio and pad the borders, "
+     "instead of cropping the center of the frame to the WIDTH x HEIGHT "
+     "aspect ratio.",
+     0},
+    {"bt709", KEY_BT709, NULL, 0,
+     "Convert from YUV to RGB with the BT.709 matrix instead of BT.601. Use "
+     "the conversion the model was trained with.",
+     0},
+    {"full-range", KEY_FULL_RANGE, NULL, 0,
+     "Treat the YUV frames as full range instead of limited range.", 0},
     {"help", 'h', NULL, 0, "Print this help text and exit.", 0},
     {"usage", KEY_USAGE, NULL, 0, "Print short usage message and exit.", 0},
     {0}};
@@ -95,6 +156,88 @@ int parseOpt(int key, char* arg, struct argp_state* state) {
         args->numFrames = (unsigned int) numFrames;
         break;
     }
+    case 'b': {
+        unsigned long long numBuffers;
+        int ret = parsePosInt(arg, &numBuffers, UINT_MAX);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid number of buffers");
+        }
+        args->numBuffers = (unsigned int) numBuffers;
+        break;
+    }
+    case KEY_MIN_BUFFERS: {
+        unsigned long long minBuffers;
+        int ret = parsePosInt(arg, &minBuffers, UINT_MAX);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid number of buffers");
+        }
+        args->minBuffers = (unsigned int) minBuffers;
+        break;
+    }
+    case 'r': {
+        unsigned long long fps;
+        int ret = parsePosInt(arg, &fps, UINT_MAX);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid frame rate");
+        }
+        args->fps = (unsigned int) fps;
+        break;
+    }
+    case KEY_EVERY: {
+        unsigned long long everyNth;
+        int ret = parsePosInt(arg, &everyNth, UINT_MAX);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid frame interval");
+        }
+        args->everyNth = (unsigned int) everyNth;
+        break;
+    }
+    case 'p': {
+        unsigned long long depth;
+        int ret = parsePosInt(arg, &depth, MAX_PIPELINE_DEPTH);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid pipeline depth");
+        }
+        args->pipelineDepth = (unsigned int) depth;
+        break;
+    }
+    case 'k': {
+        unsigned long long topK;
+        int ret = parsePosInt(arg, &topK, MAX_TOP_K);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid number of results");
+        }
+        args->topK = (unsigned int) topK;
+        break;
+    }
+    case KEY_SOFTMAX:
+        args->softmax = true;
+        break;
+    case KEY_OUTPUT_QUANT: {
+        char end;
+        if (sscanf(arg, "%f,%d%c", &args->outputScale, &args->outputZeroPoint,
+                   &end) != 2 ||
+            !(args->outputScale > 0.0f)) {
+            argp_failure(state, EXIT_FAILURE, EINVAL,
+                         "invalid output quantization");
+        }
+        break;
+    }
+    case KEY_RECORD:
+        args->recordFile = arg;
+        break;
+    case KEY_REPLAY:
+        args->replayFile = arg;
+        break;
+    case KEY_LETTERBOX:
+        args->letterbox = true;
+        break;
+    case KEY_BT709:
+        args->bt709 = true;
+        break;
+    case KEY_FULL_RANGE:
+        args->fullRange = true;
+        break;
     case 'h':
         argp_state_help(state, stdout, ARGP_HELP_STD_HELP);
         break;
@@ -134,9 +277,23 @@ int parseOpt(int key, char* arg, struct argp_state* state) {
         args->height = 0;
         args->outputBytes = 0;
         args->numFrames = 100;
+        args->numBuffers = 8;
+        args->minBuffers = 0;
+        args->fps = 0;
+        args->everyNth = 1;
+        args->pipelineDepth = 2;
+        args->topK = 1;
+        args->outputScale = 0.0f;
+        args->outputZeroPoint = 0;
+        args->recordFile = NULL;
+        args->replayFile = NULL;
         args->chip = 0;
         args->modelFile = NULL;
         args->labelsFile = NULL;
+        args->letterbox = false;
+        args->bt709 = false;
+        args->fullRange = false;
+        args->softmax = false;
         break;
     case ARGP_KEY_END:
         if (state->arg_num != 4) {
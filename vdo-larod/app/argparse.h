@@ -24,6 +24,12 @@
 
 #include "larod.h"
 
+/// Most frames in flight at once, see --pipeline.
+#define MAX_PIPELINE_DEPTH (4)
+
+/// Most results logged per inference, see --top-k.
+#define MAX_TOP_K (10)
+
 typedef struct args_t {
     size_t outputBytes;
     char* modelFile;
@@ -31,7 +37,22 @@ typedef struct args_t {
     unsigned width;
     unsigned height;
     unsigned numFrames;
+    unsigned numBuffers;
+    unsigned minBuffers;
+    unsigned fps;
+    unsigned everyNth;
+    unsigned pipelineDepth;
+    unsigned topK;
+    /// Output quantization scale, 0 for the default of the output data type.
+    float outputScale;
+    int outputZeroPoint;
+    char* recordFile;
+    char* replayFile;
     larodChip chip;
+    bool letterbox;
+    bool bt709;
+    bool fullRange;
+    bool softmax;
 } args_t;
 
 bool parseArgs(int argc, char** argv, args_t* args);
@@ -20,32 +20,763 @@
 
 #include "imgconverter.h"
 
-#include <arm_neon.h>
 #include <assert.h>
 #include <errno.h>
 #include <libyuv.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 
-#define ARGB_BYTES_PER_PIXEL (4)
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/// Number of fractional bits in the bilinear filter weights.
+#define FILTER_BITS (8)
+#define FILTER_ONE (1 << FILTER_BITS)
+
+/// Number of fractional bits in the fixed-point YUV to RGB coefficients.
+#define YUV_BITS (6)
+
+/// Number of fractional bits in the coefficients of the 8-bit SIMD
+/// conversion. The products are 32 bits, 13 bits keeps the largest
+/// coefficient (BT.709 limited range U to B) within 16 bits.
+#define YUV_PRECISE_BITS (13)
+
+/// Smallest ROI in source pixels, one chroma sample. Smaller ROIs are grown
+/// to this size inside the frame.
+#define MIN_ROI_SIZE (2)
+
+/// Stream and model sizes (srcWidth, srcHeight, dstWidth, dstHeight) that
+/// get their own horizontal filters, with the taps of the center crop fixed
+/// at compile time and fully unrolled. convertFrame() uses them when the
+/// taps of the converter match and the generic filters otherwise. Override
+/// with e.g. -D'IMG_FIXED_KERNELS(X)=X(1280, 720, 256, 256)'. Each entry
+/// adds a few kB of code per 100 destination pixels.
+#ifndef IMG_FIXED_KERNELS
+#define IMG_FIXED_KERNELS(X)                                                 \
+    X(480, 270, 224, 224)                                                    \
+    X(640, 360, 224, 224)                                                    \
+    X(1280, 720, 224, 224)                                                   \
+    X(640, 360, 300, 300)                                                    \
+    X(1280, 720, 300, 300)                                                   \
+    X(640, 360, 320, 320)                                                    \
+    X(1280, 720, 320, 320)                                                   \
+    X(800, 450, 416, 416)                                                    \
+    X(1280, 720, 416, 416)
+#endif
+
+/// Largest destination width of a fixed kernel, which is fully unrolled.
+#define FIXED_MAX_WIDTH (1024)
+
+/// Bytes read at once by the table lookups of the fixed kernels. Scratch
+/// rows are padded by this much.
+#define TAP_TABLE_BYTES (32)
+
+/// Force inlining into the fixed kernels, so their taps fold to constants.
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+/**
+ * brief Fixed-point YUV to RGB conversion coefficients.
+ *
+ * R = yGain * (Y - yOffset) + vToR * (V - 128)
+ * G = yGain * (Y - yOffset) - uToG * (U - 128) - vToG * (V - 128)
+ * B = yGain * (Y - yOffset) + uToB * (U - 128)
+ *
+ * With YUV_BITS fractional bits the products fit in 16 bits, which is what
+ * the SIMD float paths rely on. YuvLut holds them with YUV_PRECISE_BITS.
+ */
+typedef struct YuvCoeffs {
+    int16_t yOffset;
+    int16_t yGain;
+    int16_t vToR;
+    int16_t uToG;
+    int16_t vToG;
+    int16_t uToB;
+} YuvCoeffs;
+
+/// Full range analog YUV as used by convertU8yuvToRGBnaive(), see
+/// https://gist.github.com/CreaRo/0d50442145b63c6c288d1c1675909990
+static const YuvCoeffs kAnalogYuvFull = {0, 64, 73, 25, 37, 130};
+
+/// Number of fractional bits in the YUV to RGB lookup tables.
+#define LUT_BITS (16)
+
+/**
+ * brief YUV to RGB conversion for one matrix and range.
+ *
+ * The tables hold the contribution of each component to each output
+ * channel, so the scalar conversion is a handful of lookups and adds:
+ *
+ * R = yTab[Y] + vToR[V]
+ * G = yTab[Y] + uToG[U] + vToG[V]
+ * B = yTab[Y] + uToB[U]
+ *
+ * The tables are computed in double precision, so the scalar path rounds
+ * correctly. The NEON and SSE2 paths use coeffs with 32-bit products, which
+ * is within one step of the tables for every matrix and range.
+ */
+typedef struct YuvLut {
+    /// The same conversion with YUV_PRECISE_BITS fractional bits.
+    YuvCoeffs coeffs;
+    /// Scaled luma including the rounding bias, and signed chroma
+    /// contributions, all with LUT_BITS fractional bits.
+    int32_t yTab[256];
+    int32_t vToR[256];
+    int32_t uToG[256];
+    int32_t vToG[256];
+    int32_t uToB[256];
+} YuvLut;
+
+/// Tables for every matrix and range, built once on first use.
+static YuvLut yuvLuts[2][2];
+static pthread_once_t yuvLutsOnce = PTHREAD_ONCE_INIT;
+
+/// Alignment of scratch memory, a multiple of the cache line size.
+#define SCRATCH_ALIGN (64)
+#define ALIGN_UP(x) (((x) + (SCRATCH_ALIGN - 1)) & ~((size_t) SCRATCH_ALIGN - 1))
+
+/**
+ * brief Start and pitch of the planes of one NV12 frame.
+ */
+typedef struct Nv12Planes {
+    const uint8_t* y;
+    const uint8_t* uv;
+    size_t yPitch;
+    size_t uvPitch;
+} Nv12Planes;
+
+/**
+ * brief Precomputed bilinear sampling positions for a crop/scale operation.
+ *
+ * For every destination column and row we store the index of the first of
+ * the two source samples and the weight of the second one. Column indices are
+ * relative to the start of the span of source columns the crop touches, so
+ * that only that span needs to be filtered vertically.
+ */
+typedef struct ScaleMap {
+    unsigned int dstWidth;
+    unsigned int dstHeight;
+    /// Destination size the arrays below are allocated for.
+    unsigned int maxWidth;
+    unsigned int maxHeight;
+
+    /// Luma and chroma column taps, relative to lumaSpanX/chromaSpanX.
+    int32_t* xIdx;
+    uint16_t* xFrac;
+    int32_t* cxIdx;
+    uint16_t* cxFrac;
+
+    /// Luma and chroma row taps, in absolute source rows.
+    int32_t* yIdx;
+    uint16_t* yFrac;
+    int32_t* cyIdx;
+    uint16_t* cyFrac;
+
+    /// Source columns touched by the crop. Chroma is counted in UV pairs.
+    unsigned int lumaSpanX;
+    unsigned int lumaSpanW;
+    unsigned int chromaSpanX;
+    unsigned int chromaSpanW;
+
+    /// Single allocation backing all the arrays above.
+    void* mem;
+} ScaleMap;
+
+/**
+ * brief Horizontal filters with the taps of one IMG_FIXED_KERNELS entry
+ * fixed at compile time.
+ */
+typedef struct FixedKernel {
+    unsigned int srcWidth;
+    unsigned int srcHeight;
+    unsigned int dstWidth;
+    unsigned int dstHeight;
+    /// Center crop width the taps are computed for, and 1 if the crop starts
+    /// halfway into a chroma sample.
+    unsigned int cropWidth;
+    unsigned int chromaPhase;
+    /// Filter the vertically filtered spans like scaleLumaRow() and
+    /// scaleChromaRow() with step 1.
+    void (*lumaTaps)(const uint8_t* lumaRow, uint8_t* dst);
+    void (*chromaTaps)(const uint8_t* uvRow, uint8_t* dstU, uint8_t* dstV);
+} FixedKernel;
+
+/**
+ * brief Scratch rows used while producing output rows from a ScaleMap.
+ */
+typedef struct ScaleScratch {
+    /// Vertically filtered luma span and UV span.
+    uint8_t* lumaRow;
+    uint8_t* uvRow;
+    /// Horizontally filtered Y, U and V rows at output resolution.
+    uint8_t* dstY;
+    uint8_t* dstU;
+    uint8_t* dstV;
+    /// Planar R, G and B rows, used for output formats other than plain
+    /// interleaved uint8 RGB.
+    uint8_t* rgbR;
+    uint8_t* rgbG;
+    uint8_t* rgbB;
+    /// Source chroma row and weight currently held in dstU/dstV.
+    int32_t cachedCy;
+    uint16_t cachedCyFrac;
+
+    /// Single allocation backing all the rows above.
+    void* mem;
+} ScaleScratch;
+
+/**
+ * brief Resolved output tensor format.
+ *
+ * Normalization and quantization only depend on the 8-bit value of each
+ * channel, so they are folded into one lookup table per channel.
+ */
+typedef struct OutputFormat {
+    ImgTensorLayout layout;
+    ImgTensorDataType dataType;
+    /// Bytes between rows, and between planes for IMG_LAYOUT_CHW.
+    size_t rowPitch;
+    size_t planePitch;
+    /// True for packed HWC uint8 without normalization, which is written
+    /// directly by the color conversion.
+    bool plainRGB;
+    /// Per channel tables for IMG_DTYPE_UINT8/IMG_DTYPE_INT8 and
+    /// IMG_DTYPE_FLOAT32 respectively.
+    uint8_t lutU8[3][256];
+    float lutF32[3][256];
+    /// Conversion from the scaled YUV samples to RGB.
+    const YuvLut* color;
+} OutputFormat;
+
+/**
+ * brief Crop rectangle and scaling taps producing one output image.
+ */
+typedef struct CropGeometry {
+    /// Crop rectangle (x, y, w, h) in source pixels.
+    unsigned int crop[4];
+    /// Rectangle (x, y, w, h) in destination pixels the crop is scaled to.
+    /// Anything outside it is padding.
+    unsigned int content[4];
+
+    ScaleMap map;
+    /// Taps for half the content size. Its chroma taps give the chroma
+    /// samples of an NV12 image of the content size.
+    ScaleMap halfMap;
+    /// Fixed kernel with the same horizontal taps as map, or NULL.
+    const FixedKernel* fixed;
+} CropGeometry;
+
+/**
+ * brief A converter set up for one stream geometry.
+ *
+ * Holds the crop rectangle, the precomputed scaling taps and all scratch
+ * memory needed by convertFrame(), so converting a frame never allocates.
+ */
+struct ImgConverter {
+    unsigned int srcWidth;
+    unsigned int srcHeight;
+    unsigned int dstWidth;
+    unsigned int dstHeight;
+    ImgCropPolicy cropPolicy;
+
+    /// Geometry of the whole frame, used by convertFrame().
+    CropGeometry geometry;
+    /// Geometries used by convertFrameRois(). Grown to the largest number
+    /// of ROIs seen so far and reused for later frames.
+    CropGeometry* roiGeometry;
+    unsigned int numRoiGeometry;
+
+    OutputFormat output;
+
+    /// Pad color and one destination row of it in the output format. For
+    /// IMG_LAYOUT_CHW the row holds the three planes after each other.
+    uint8_t padColor[3];
+    uint8_t* padRow;
+
+    /// Optional worker pool, and one set of scratch rows per band.
+    RowPool_t* pool;
+    ScaleScratch* scratch;
+    unsigned int numScratch;
+
+    ImgScalePath scalePath;
+    /// Plane layout of the frames passed in.
+    ImgNv12Layout_t srcLayout;
+};
+
+/**
+ * brief A scaler from NV12 frames to smaller NV12 images.
+ */
+struct ImgNv12Scaler {
+    unsigned int srcWidth;
+    unsigned int srcHeight;
+    unsigned int dstWidth;
+    unsigned int dstHeight;
+
+    /// Luma is scaled with geometry.map and chroma with geometry.halfMap.
+    CropGeometry geometry;
+    ImgNv12Layout_t srcLayout;
+
+    RowPool_t* pool;
+    ScaleScratch* scratch;
+    unsigned int numScratch;
+};
+
+/**
+ * brief Job context for producing a band of rows with scaleNv12Frame().
+ */
+typedef struct Nv12ScaleJob {
+    const ImgNv12Scaler_t* scaler;
+    Nv12Planes src;
+    uint8_t* dstData;
+} Nv12ScaleJob;
+
+/**
+ * brief Job context for producing a band of output rows with convertFrame().
+ */
+typedef struct CropScaleJob {
+    const ImgConverter_t* converter;
+    Nv12Planes src;
+    uint8_t* outData;
+} CropScaleJob;
+
+/**
+ * brief Job context for producing a band of batch rows with
+ * convertFrameRois().
+ *
+ * Rows are numbered through all ROIs, so row r is row r % dstHeight of slot
+ * r / dstHeight.
+ */
+typedef struct RoiJob {
+    const ImgConverter_t* converter;
+    Nv12Planes src;
+    uint8_t* outData;
+    size_t slotSize;
+} RoiJob;
+
+/**
+ * brief Job context for nv12ToFloatRGB().
+ */
+typedef struct FloatJob {
+    unsigned int width;
+    Nv12Planes src;
+    const YuvCoeffs* c;
+    const float* scale;
+    const float* bias;
+    float* out;
+} FloatJob;
+
+/**
+ * brief Job context for convertU8yuvToRGBlibYuv().
+ */
+typedef struct LibYuvJob {
+    unsigned int width;
+    Nv12Planes src;
+    uint8_t* rgbOut;
+} LibYuvJob;
+
+/**
+ * brief Job context for convertU8yuvToRGBlut().
+ */
+typedef struct LutJob {
+    unsigned int width;
+    Nv12Planes src;
+    uint8_t* rgbOut;
+    const YuvLut* lut;
+} LutJob;
+
+/**
+ * brief Locate the planes of an NV12 frame.
+ *
+ * param data Start of the frame buffer.
+ * param layout Plane layout of the buffer, or NULL for packed planes.
+ * param width Image width in pixels.
+ * param height Image height in pixels.
+ * return Start and pitch of each plane.
+ */
+static Nv12Planes getNv12Planes(const uint8_t* data,
+                                const ImgNv12Layout_t* layout,
+                                unsigned int width, unsigned int height);
+
+/**
+ * brief Resolve an optional layout and check that it fits the image width.
+ *
+ * param layout Plane layout, or NULL for packed planes.
+ * param width Image width in pixels.
+ * param height Image height in pixels.
+ * param resolved Output layout.
+ * return False if a pitch is smaller than the width, otherwise true.
+ */
+static bool resolveNv12Layout(const ImgNv12Layout_t* layout,
+                              unsigned int width, unsigned int height,
+                              ImgNv12Layout_t* resolved);
+
+/**
+ * brief Build the tables in yuvLuts, run through pthread_once().
+ */
+static void initYuvLuts(void);
+
+/**
+ * brief Get the conversion tables for a matrix and range.
+ *
+ * param matrix Color matrix.
+ * param range Color range.
+ * return Pointer to the tables, or NULL if matrix or range is invalid.
+ */
+static const YuvLut* getYuvLut(ImgColorMatrix matrix, ImgColorRange range);
+
+/**
+ * brief RowBandFunc converting a band of rows for convertU8yuvToRGBlut().
+ */
+static void lutBand(void* ctx, unsigned int band, unsigned int rowStart,
+                    unsigned int rowEnd);
+
+/**
+ * brief Calculate the crop and content rectangles for a crop policy.
+ *
+ * param policy How to fit the source into the destination aspect ratio.
+ * param srcWidth Source image width in pixels.
+ * param srcHeight Source image height in pixels.
+ * param dstWidth Destination image width in pixels.
+ * param dstHeight Destination image height in pixels.
+ * param rect Output crop rectangle (x, y, w, h) in source pixels.
+ * param content Output rectangle (x, y, w, h) in destination pixels that the
+ *                crop is scaled to.
+ */
+static void computeCrop(ImgCropPolicy policy, unsigned int srcWidth,
+                        unsigned int srcHeight, unsigned int dstWidth,
+                        unsigned int dstHeight, unsigned int rect[4],
+                        unsigned int content[4]);
+
+/**
+ * brief Fill the converter's pad row with the pad color in the output format.
+ *
+ * param converter Pointer to an ImgConverter.
+ */
+static void fillPadRow(ImgConverter_t* converter);
+
+/**
+ * brief Copy columns x0 to x1 - 1 of the pad row to an output row.
+ *
+ * param output Output tensor format.
+ * param padRow Pad row in the output format.
+ * param width Destination width in pixels.
+ * param y Output row index.
+ * param x0 First column to pad.
+ * param x1 One past the last column to pad.
+ * param outData Start of output tensor.
+ */
+static void writePadSpan(const OutputFormat* output, const uint8_t* padRow,
+                         unsigned int width, unsigned int y, unsigned int x0,
+                         unsigned int x1, uint8_t* outData);
+
+/**
+ * brief Allocate a ScaleMap for destination sizes up to a maximum.
+ *
+ * param map ScaleMap to initialize.
+ * param maxWidth Largest destination width in pixels.
+ * param maxHeight Largest destination height in pixels.
+ * return False if any errors occur, otherwise true.
+ */
+static bool initScaleMap(ScaleMap* map, unsigned int maxWidth,
+                         unsigned int maxHeight);
+
+/**
+ * brief Fill an allocated ScaleMap for a crop rectangle.
+ *
+ * Does not allocate, so it can be called for every frame.
+ *
+ * param map ScaleMap allocated by initScaleMap().
+ * param srcWidth Source image width in pixels.
+ * param srcHeight Source image height in pixels.
+ * param rect Crop rectangle (x, y, w, h) in source pixels.
+ * param dstWidth Destination image width in pixels, at most the maximum
+ *                 width the map was allocated for.
+ * param dstHeight Destination image height in pixels, at most the maximum
+ *                  height the map was allocated for.
+ * return False if the geometry is invalid, otherwise true.
+ */
+static bool updateScaleMap(ScaleMap* map, unsigned int srcWidth,
+                           unsigned int srcHeight, const unsigned int rect[4],
+                           unsigned int dstWidth, unsigned int dstHeight);
+
+/**
+ * brief Release memory held by a ScaleMap.
+ *
+ * param map ScaleMap to clear.
+ */
+static void clearScaleMap(ScaleMap* map);
+
+/**
+ * brief Allocate scratch rows for producing output from a ScaleMap.
+ *
+ * param scratch ScaleScratch to initialize.
+ * param srcWidth Source image width in pixels.
+ * param dstWidth Destination image width in pixels.
+ * return False if any errors occur, otherwise true.
+ */
+static bool initScaleScratch(ScaleScratch* scratch, unsigned int srcWidth,
+                             unsigned int dstWidth);
+
+/**
+ * brief Release memory held by a ScaleScratch.
+ *
+ * param scratch ScaleScratch to clear.
+ */
+static void clearScaleScratch(ScaleScratch* scratch);
+
+/**
+ * brief Allocate one ScaleScratch per band of a worker pool.
+ *
+ * param pool Worker pool, or NULL for a single band.
+ * param srcWidth Source image width in pixels.
+ * param dstWidth Destination image width in pixels.
+ * param numScratch Output number of ScaleScratch allocated.
+ * return Array of ScaleScratch, or NULL if failed.
+ */
+static ScaleScratch* createBandScratch(RowPool_t* pool, unsigned int srcWidth,
+                                       unsigned int dstWidth,
+                                       unsigned int* numScratch);
+
+/**
+ * brief Release an array from createBandScratch().
+ *
+ * param scratch Array of ScaleScratch. Can be NULL.
+ * param numScratch Number of entries.
+ */
+static void destroyBandScratch(ScaleScratch* scratch, unsigned int numScratch);
+
+/**
+ * brief Allocate the ScaleMaps of a CropGeometry.
+ *
+ * param geometry CropGeometry to initialize.
+ * param dstWidth Destination image width in pixels.
+ * param dstHeight Destination image height in pixels.
+ * return False if any errors occur, otherwise true.
+ */
+static bool initCropGeometry(CropGeometry* geometry, unsigned int dstWidth,
+                             unsigned int dstHeight);
+
+/**
+ * brief Release memory held by a CropGeometry.
+ *
+ * param geometry CropGeometry to clear.
+ */
+static void clearCropGeometry(CropGeometry* geometry);
+
+/**
+ * brief Fill a CropGeometry for fitting a source rectangle into a
+ * destination size.
+ *
+ * param geometry CropGeometry allocated by initCropGeometry().
+ * param policy How to fit the rectangle into the destination size.
+ * param srcWidth Source image width in pixels.
+ * param srcHeight Source image height in pixels.
+ * param roi Source rectangle (x, y, w, h) in source pixels.
+ * param dstWidth Destination image width in pixels.
+ * param dstHeight Destination image height in pixels.
+ * return False if the geometry is invalid, otherwise true.
+ */
+static bool fillCropGeometry(CropGeometry* geometry, ImgCropPolicy policy,
+                             unsigned int srcWidth, unsigned int srcHeight,
+                             const unsigned int roi[4], unsigned int dstWidth,
+                             unsigned int dstHeight);
+
+/**
+ * brief Crop, scale and convert NV12 to interleaved RGB in a single pass.
+ *
+ * For each destination row the two source luma rows and the two source
+ * chroma rows it depends on are blended vertically (only across the cropped
+ * span), then sampled horizontally at the destination resolution and
+ * finally converted to RGB. Source pixels outside the crop are never read.
+ *
+ * param map Precomputed ScaleMap.
+ * param fixed Fixed kernel with the horizontal taps of map, or NULL to use
+ *              the taps in map.
+ * param output Output tensor format.
+ * param scratch Scratch rows, at least as wide as the ScaleMap needs.
+ * param src Planes of the source frame.
+ * param outData Start of output tensor.
+ * param rowStart First destination row to produce.
+ * param rowEnd One past the last destination row to produce.
+ */
+static void cropScaleNv12ToRGB(const ScaleMap* map, const FixedKernel* fixed,
+                               const OutputFormat* output,
+                               ScaleScratch* scratch, const Nv12Planes* src,
+                               uint8_t* outData, unsigned int rowStart,
+                               unsigned int rowEnd);
+
+/**
+ * brief Find the fixed kernel for the whole frame geometry of a converter.
+ *
+ * A kernel is only returned if its taps are exactly those of the geometry's
+ * ScaleMap, so the output is the same as with the generic filters.
+ *
+ * param converter Pointer to an ImgConverter.
+ * return Matching kernel, or NULL if there is none.
+ */
+static const FixedKernel* findFixedKernel(const ImgConverter_t* converter);
+
+/**
+ * brief Crop, scale and convert NV12 to RGB with chroma at half the output
+ * resolution.
+ *
+ * Gives the same result as scaling the crop to an NV12 image of the output
+ * size and then converting that, but without storing the NV12 image. Each
+ * chroma sample covers 2 x 2 output pixels, so a quarter of the chroma taps
+ * of cropScaleNv12ToRGB() are computed.
+ *
+ * param map ScaleMap with the luma taps.
+ * param halfMap ScaleMap for half the output size, with the chroma taps.
+ * param output Output tensor format.
+ * param scratch Scratch rows.
+ * param src Planes of the source frame.
+ * param outData Start of output tensor.
+ * param rowStart First destination row to produce.
+ * param rowEnd One past the last destination row to produce.
+ */
+static void cropScaleHalfChroma(const ScaleMap* map, const ScaleMap* halfMap,
+                                const OutputFormat* output,
+                                ScaleScratch* scratch, const Nv12Planes* src,
+                                uint8_t* outData, unsigned int rowStart,
+                                unsigned int rowEnd);
+
+/**
+ * brief RowBandFunc producing a band of rows for scaleNv12Frame().
+ */
+static void nv12ScaleBand(void* ctx, unsigned int band, unsigned int rowStart,
+                          unsigned int rowEnd);
+
+/**
+ * brief Resolve an output tensor descriptor into an OutputFormat.
+ *
+ * param desc Output tensor descriptor.
+ * param width Output width in pixels.
+ * param height Output height in pixels.
+ * param output OutputFormat to initialize.
+ * return False if the descriptor is invalid, otherwise true.
+ */
+static bool initOutputFormat(const ImgTensorDesc_t* desc, unsigned int width,
+                             unsigned int height, OutputFormat* output);
+
+/**
+ * brief Write one row of converted Y, U and V samples to the output tensor.
+ *
+ * param output Output tensor format.
+ * param scratch Scratch holding dstY/dstU/dstV for the row.
+ * param width Row width in pixels.
+ * param y Output row index.
+ * param outData Start of output tensor.
+ */
+static void writeOutputRow(const OutputFormat* output, ScaleScratch* scratch,
+                           unsigned int width, unsigned int y,
+                           uint8_t* outData);
+
+/**
+ * brief Produce output rows rowStart to rowEnd - 1 of one image, padding
+ * included.
+ *
+ * param converter Pointer to an ImgConverter.
+ * param geometry Crop and scaling taps of the image.
+ * param scratch Scratch rows of the calling band.
+ * param src Planes of the source frame.
+ * param outData Start of the output image.
+ * param rowStart First output row.
+ * param rowEnd One past the last output row.
+ */
+static void cropScaleRows(const ImgConverter_t* converter,
+                          const CropGeometry* geometry, ScaleScratch* scratch,
+                          const Nv12Planes* src, uint8_t* outData,
+                          unsigned int rowStart, unsigned int rowEnd);
+
+/**
+ * brief RowBandFunc producing a band of rows for convertFrame().
+ */
+static void cropScaleBand(void* ctx, unsigned int band, unsigned int rowStart,
+                          unsigned int rowEnd);
+
+/**
+ * brief RowBandFunc producing a band of batch rows for convertFrameRois().
+ */
+static void roiBand(void* ctx, unsigned int band, unsigned int rowStart,
+                    unsigned int rowEnd);
+
+/**
+ * brief Set up a CropGeometry for fitting a source rectangle into the
+ * destination size with the converter's crop policy.
+ *
+ * param converter Pointer to an ImgConverter.
+ * param roi Source rectangle (x, y, w, h) in source pixels.
+ * param geometry CropGeometry with an allocated ScaleMap.
+ * return False if the geometry is invalid, otherwise true.
+ */
+static bool updateCropGeometry(const ImgConverter_t* converter,
+                               const unsigned int roi[4],
+                               CropGeometry* geometry);
+
+/**
+ * brief Convert an NV12 image to interleaved float RGB.
+ *
+ * param width Width of input image.
+ * param height Height of input image.
+ * param src Planes of the input image.
+ * param c Conversion coefficients.
+ * param scale Per channel scale applied to 8-bit RGB values.
+ * param bias Per channel bias added after scaling.
+ * param out Output interleaved float RGB image.
+ * param pool Worker pool to split the rows over, or NULL.
+ */
+static void nv12ToFloatRGB(unsigned int width, unsigned int height,
+                           const Nv12Planes* src, const YuvCoeffs* c,
+                           const float scale[3], const float bias[3],
+                           float* out, RowPool_t* pool);
+
+/**
+ * brief RowBandFunc converting a band of rows for nv12ToFloatRGB().
+ */
+static void floatBand(void* ctx, unsigned int band, unsigned int rowStart,
+                      unsigned int rowEnd);
 
-static void ARGBtoRAW(const uint8_t* srcARGB, uint8_t* dstRGB, unsigned int w,
-                      int unsigned h);
+/**
+ * brief RowBandFunc converting a band of rows for convertU8yuvToRGBlibYuv().
+ */
+static void libYuvBand(void* ctx, unsigned int band, unsigned int rowStart,
+                       unsigned int rowEnd);
 
 void convertU8yuvToRGBlibYuv(unsigned int width, unsigned int height,
-                             uint8_t* yuvIn, uint8_t* rgbOut) {
-    const uint8_t* src_y = yuvIn;
-    int src_stride_y = (int) width;
-    const uint8_t* src_uv = yuvIn + (width * height);
-    int src_stride_uv = (int) width;
-    uint8_t* dst_raw = rgbOut;
+                             uint8_t* yuvIn, const ImgNv12Layout_t* layout,
+                             uint8_t* rgbOut, RowPool_t* pool) {
+    LibYuvJob job = {width, getNv12Planes(yuvIn, layout, width, height),
+                     rgbOut};
+
+    // Bands start on even rows so that each band has its own chroma rows.
+    runRowPool(pool, libYuvBand, &job, height, 2);
+}
+
+static void libYuvBand(void* ctx, unsigned int band, unsigned int rowStart,
+                       unsigned int rowEnd) {
+    (void) band;
+    const LibYuvJob* job = (const LibYuvJob*) ctx;
+    const unsigned int width = job->width;
+
+    const Nv12Planes* src = &job->src;
+
+    const uint8_t* src_y = src->y + rowStart * src->yPitch;
+    int src_stride_y = (int) src->yPitch;
+    const uint8_t* src_uv = src->uv + (rowStart / 2) * src->uvPitch;
+    int src_stride_uv = (int) src->uvPitch;
+    uint8_t* dst_raw = job->rgbOut + (size_t) rowStart * width * 3;
     int dst_stride_raw = 3 * (int) width;
 
     // libyuv 'RAW' format is RGB, while libyuv 'RGB24' is stored as BGR in
     // memory
     int result = NV12ToRAW(src_y, src_stride_y, src_uv, src_stride_uv, dst_raw,
-                           dst_stride_raw, (int) width, (int) height);
+                           dst_stride_raw, (int) width, (int) (rowEnd - rowStart));
 
     if (result != 0) {
         syslog(LOG_ERR, "%s: Failed NV12ToRAW(), result=%d!", __func__, result);
@@ -53,13 +784,14 @@ void convertU8yuvToRGBlibYuv(unsigned int width, unsigned int height,
 }
 
 void convertU8yuvToRGBnaive(unsigned int width, unsigned int height,
-                            uint8_t* yuvIn, uint8_t* rgbOut) {
-    uint8_t* yPlane = yuvIn;
-    uint8_t* uvPlane = yPlane + (width * height);
+                            uint8_t* yuvIn, const ImgNv12Layout_t* layout,
+                            uint8_t* rgbOut) {
+    Nv12Planes src = getNv12Planes(yuvIn, layout, width, height);
 
     for (unsigned int yPos = 0; yPos < height; yPos++) {
 
-        uint8_t* uvLine = uvPlane + (yPos / 2) * width;
+        const uint8_t* yPlane = src.y + yPos * src.yPitch;
+        const uint8_t* uvLine = src.uv + (yPos / 2) * src.uvPitch;
 
         for (unsigned int x = 0; x < width; x++) {
 
@@ -92,124 +824,73 @@ void convertU8yuvToRGBnaive(unsigned int width, unsigned int height,
 }
 
 void convertU8yuvToFloat32RGB(unsigned int width, unsigned int height,
-                              uint8_t* inBuffer, float* outBuffer,
-                              float outSwing, float outCenter) {
-    uint8_t* yPlane = inBuffer;
-    uint8_t* uvPlane = yPlane + (width * height);
-
-    for (unsigned int yPos = 0; yPos < height; yPos++) {
-
-        uint8_t* uvLine = uvPlane + (yPos / 2) * width;
-
-        for (unsigned int x = 0; x < width; x++) {
-
-            uint8_t Yval = yPlane[0];
-            uint8_t Uval = uvLine[0];
-            uint8_t Vval = uvLine[1];
-
-            // Get y in range 0.0..1.0 and U,V in range -0.5..0.5.
-            float y = Yval / 255.0f;
-            float u = (Uval / 255.0f) - 0.5f;
-            float v = (Vval / 255.0f) - 0.5f;
-
-            // This conversion is from:
-            // https://gist.github.com/CreaRo/0d50442145b63c6c288d1c1675909990
-            float r = y + 1.13983f * v;
-            float g = y - 0.39465f * u - 0.58060f * v;
-            float b = y + 2.03211f * u;
+                              uint8_t* inBuffer,
+                              const ImgNv12Layout_t* layout, float* outBuffer,
+                              float outSwing, float outCenter,
+                              RowPool_t* pool) {
+    // Map 8-bit RGB values 0..255 to outCenter +/- outSwing / 2.
+    const float s = outSwing / 255.0f;
+    const float b = outCenter - outSwing / 2.0f;
+    const float scale[3] = {s, s, s};
+    const float bias[3] = {b, b, b};
+    Nv12Planes src = getNv12Planes(inBuffer, layout, width, height);
 
-            // Scale to desired outpout range.
-            float k = outCenter - outSwing / 2.0f;
+    nv12ToFloatRGB(width, height, &src, &kAnalogYuvFull, scale, bias,
+                   outBuffer, pool);
+}
 
-            r = r * outSwing + k;
-            g = g * outSwing + k;
-            b = b * outSwing + k;
+void convertU8yuvToFloat32RGBNormalized(unsigned int width,
+                                        unsigned int height,
+                                        const uint8_t* inBuffer,
+                                        const ImgNv12Layout_t* layout,
+                                        float* outBuffer, const float mean[3],
+                                        const float std[3], RowPool_t* pool) {
+    float scale[3];
+    float bias[3];
 
-            // Clamp.
-            float maxV = outCenter + outSwing / 2.0f;
-            float minV = outCenter - outSwing / 2.0f;
+    // (rgb - mean) / std == rgb * (1 / std) - mean / std
+    for (int c = 0; c < 3; c++) {
+        scale[c] = 1.0f / std[c];
+        bias[c] = -mean[c] / std[c];
+    }
 
-            if (r < minV) {
-                r = minV;
-            }
-            if (g < minV) {
-                g = minV;
-            }
-            if (b < minV) {
-                b = minV;
-            }
-            if (r > maxV) {
-                r = maxV;
-            }
-            if (g > maxV) {
-                g = maxV;
-            }
-            if (b > maxV) {
-                b = maxV;
-            }
+    Nv12Planes src = getNv12Planes(inBuffer, layout, width, height);
+    nv12ToFloatRGB(width, height, &src, &kAnalogYuvFull, scale, bias,
+                   outBuffer, pool);
+}
 
-            // Write to output array.
-            outBuffer[0] = r;
-            outBuffer[1] = g;
-            outBuffer[2] = b;
+static void computeCrop(ImgCropPolicy policy, unsigned int srcWidth,
+                        unsigned int srcHeight, unsigned int dstWidth,
+                        unsigned int dstHeight, unsigned int rect[4],
+                        unsigned int content[4]) {
+    content[0] = 0;
+    content[1] = 0;
+    content[2] = dstWidth;
+    content[3] = dstHeight;
 
-            outBuffer += 3;
-            yPlane++;
-            uvLine += (x % 2) * 2; // Step forward one UV-pair in the uvPlane
-                                   // every second loop.
-        }
+    if (policy == IMG_CROP_FULL || policy == IMG_CROP_LETTERBOX) {
+        rect[0] = 0;
+        rect[1] = 0;
+        rect[2] = srcWidth;
+        rect[3] = srcHeight;
     }
-}
 
-void ARGBtoRAW(const uint8_t* srcARGB, uint8_t* dstRGB, unsigned int w,
-               unsigned int h) {
-
-    const uint8_t* src = srcARGB;
-    uint8_t* dst = dstRGB;
-    for (size_t y = 0; y < h; y++) {
-        for (size_t x = 0; x < w; x++) {
-            uint8_t b = *src++;
-            uint8_t g = *src++;
-            uint8_t r = *src++;
-            src++; // Skip Alpha channel
-            *dst++ = r;
-            *dst++ = g;
-            *dst++ = b;
-        }
+    if (policy == IMG_CROP_FULL) {
+        return;
     }
-}
 
-bool convertCropScaleU8yuvToRGB(const uint8_t* nv12Data, unsigned int srcWidth,
-                                unsigned int srcHeight, uint8_t* rgbData,
-                                unsigned int dstWidth, unsigned int dstHeight) {
-    bool ret = false;
-    uint8_t* tempARGBbig = NULL;
-    uint8_t* tempARGBsmall = NULL;
-
-    tempARGBbig = malloc((size_t)(srcWidth * srcHeight * ARGB_BYTES_PER_PIXEL));
-    if (!tempARGBbig) {
-        syslog(LOG_ERR, "%s: Failed allocating big tempARGB buffer: %s", __func__,
-                 strerror(errno));
-        goto end;
-    }
-
-    tempARGBsmall =
-        malloc((size_t)(dstWidth * dstHeight * ARGB_BYTES_PER_PIXEL));
-    if (!tempARGBsmall) {
-        syslog(LOG_ERR, "%s: Failed allocating small tempARGB buffer: %s", __func__,
-                 strerror(errno));
-        goto end;
-    }
-
-    const uint8_t* uvPlane = nv12Data + (srcWidth * srcHeight);
-    unsigned int bigARGBstride = ARGB_BYTES_PER_PIXEL * srcWidth;
-    unsigned int smallARGBstride = ARGB_BYTES_PER_PIXEL * dstWidth;
-    int result = NV12ToARGB(nv12Data, (int) srcWidth, uvPlane, (int) srcWidth,
-                            tempARGBbig, (int) bigARGBstride, (int) srcWidth,
-                            (int) srcHeight);
-    if (result != 0) {
-        syslog(LOG_ERR, "%s: Failed NV12ToARGB() with result=%d", __func__, result);
-        goto end;
+    if (policy == IMG_CROP_LETTERBOX) {
+        // Scale the full source as large as possible while keeping its
+        // aspect ratio, and center it.
+        double scale = fmin((double) dstWidth / srcWidth,
+                            (double) dstHeight / srcHeight);
+        unsigned int w = (unsigned int) lround(srcWidth * scale);
+        unsigned int h = (unsigned int) lround(srcHeight * scale);
+        content[2] = w < 1 ? 1 : (w > dstWidth ? dstWidth : w);
+        content[3] = h < 1 ? 1 : (h > dstHeight ? dstHeight : h);
+        content[0] = (dstWidth - content[2]) / 2;
+        content[1] = (dstHeight - content[3]) / 2;
+        return;
     }
 
     // 1. The crop area shall fill the input image either horizontally or
@@ -224,35 +905,2442 @@ bool convertCropScaleU8yuvToRGB(const uint8_t* nv12Data, unsigned int srcWidth,
         clipW = clipH * destWHratio;
     }
 
-    unsigned int clipX = (srcWidth - (unsigned int) clipW) / 2;
-    unsigned int clipY = (srcHeight - (unsigned int) clipH) / 2;
+    // A thin source can truncate to nothing, keep at least one pixel.
+    rect[2] = clipW < 1.0f ? 1 : (unsigned int) clipW;
+    rect[3] = clipH < 1.0f ? 1 : (unsigned int) clipH;
+    rect[0] = (srcWidth - rect[2]) / 2;
+    rect[1] = (srcHeight - rect[3]) / 2;
+}
 
-    uint8_t* bigARGBcrop =
-        tempARGBbig + (bigARGBstride * clipY) + (ARGB_BYTES_PER_PIXEL * clipX);
+/**
+ * brief Compute bilinear taps for one dimension.
+ *
+ * Sample positions are pixel center aligned, like libyuv, and clamped to
+ * the valid source range. A tap at the last source sample always gets zero
+ * weight on its (non-existing) right/bottom neighbour.
+ *
+ * param srcStart First source sample of the crop.
+ * param srcLen Number of source samples in the crop.
+ * param srcLimit Number of samples in the source dimension.
+ * param dstLen Number of destination samples.
+ * param idx Output index of the first tap for each destination sample.
+ * param frac Output weight of the second tap for each destination sample.
+ */
+static void computeTaps(double srcStart, double srcLen, unsigned int srcLimit,
+                        unsigned int dstLen, int32_t* idx, uint16_t* frac) {
+    double step = srcLen / (double) dstLen;
 
-    // We use pointer offset (bigARGBcrop), clipW and clipH to realize the
-    // cropping of source image.
-    result = ARGBScale(bigARGBcrop, (int) bigARGBstride, (int) clipW,
-                       (int) clipH, tempARGBsmall, (int) smallARGBstride,
-                       (int) dstWidth, (int) dstHeight, kFilterBilinear);
-    if (result != 0) {
-        syslog(LOG_ERR, "%s: Failed ARGBScale() with result=%d", __func__, result);
-        goto end;
-    }
+    for (unsigned int i = 0; i < dstLen; i++) {
+        double pos = srcStart + ((double) i + 0.5) * step - 0.5;
+        if (pos < 0.0) {
+            pos = 0.0;
+        }
+        if (pos > (double) (srcLimit - 1)) {
+            pos = (double) (srcLimit - 1);
+        }
+
+        int32_t i0 = (int32_t) pos;
+        int32_t f = (int32_t) lround((pos - (double) i0) * FILTER_ONE);
+        if (f >= FILTER_ONE) {
+            i0++;
+            f = 0;
+        }
+        if (i0 >= (int32_t) srcLimit - 1) {
+            i0 = (int32_t) srcLimit - 1;
+            f = 0;
+        }
+
+        idx[i] = i0;
+        frac[i] = (uint16_t) f;
+    }
+}
+
+static bool initScaleMap(ScaleMap* map, unsigned int maxWidth,
+                         unsigned int maxHeight) {
+    memset(map, 0, sizeof(*map));
+
+    if (maxWidth == 0 || maxHeight == 0) {
+        syslog(LOG_ERR, "%s: Invalid destination size", __func__);
+        return false;
+    }
+
+    size_t idxX = ALIGN_UP(sizeof(int32_t) * maxWidth);
+    size_t fracX = ALIGN_UP(sizeof(uint16_t) * maxWidth);
+    size_t idxY = ALIGN_UP(sizeof(int32_t) * maxHeight);
+    size_t fracY = ALIGN_UP(sizeof(uint16_t) * maxHeight);
+
+    uint8_t* mem = NULL;
+    if (posix_memalign((void**) &mem, SCRATCH_ALIGN,
+                       2 * (idxX + fracX + idxY + fracY))) {
+        syslog(LOG_ERR, "%s: Failed allocating scale map", __func__);
+        return false;
+    }
+
+    map->mem = mem;
+    map->xIdx = (int32_t*) mem;
+    map->cxIdx = (int32_t*) (mem += idxX);
+    map->xFrac = (uint16_t*) (mem += idxX);
+    map->cxFrac = (uint16_t*) (mem += fracX);
+    map->yIdx = (int32_t*) (mem += fracX);
+    map->cyIdx = (int32_t*) (mem += idxY);
+    map->yFrac = (uint16_t*) (mem += idxY);
+    map->cyFrac = (uint16_t*) (mem += fracY);
+
+    map->maxWidth = maxWidth;
+    map->maxHeight = maxHeight;
+
+    return true;
+}
+
+static bool updateScaleMap(ScaleMap* map, unsigned int srcWidth,
+                           unsigned int srcHeight, const unsigned int rect[4],
+                           unsigned int dstWidth, unsigned int dstHeight) {
+    if (srcWidth < 2 || srcHeight < 2 || dstWidth == 0 || dstHeight == 0 ||
+        dstWidth > map->maxWidth || dstHeight > map->maxHeight ||
+        rect[2] == 0 || rect[3] == 0 || rect[0] + rect[2] > srcWidth ||
+        rect[1] + rect[3] > srcHeight) {
+        syslog(LOG_ERR, "%s: Invalid crop/scale geometry", __func__);
+        return false;
+    }
+
+    map->dstWidth = dstWidth;
+    map->dstHeight = dstHeight;
+
+    // Chroma is subsampled 2x2. Positions are mapped from luma to chroma
+    // sample coordinates by halving the crop.
+    unsigned int chromaWidth = srcWidth / 2;
+    unsigned int chromaHeight = srcHeight / 2;
+    computeTaps(rect[0], rect[2], srcWidth, dstWidth, map->xIdx, map->xFrac);
+    computeTaps(rect[0] / 2.0, rect[2] / 2.0, chromaWidth, dstWidth,
+                map->cxIdx, map->cxFrac);
+    computeTaps(rect[1], rect[3], srcHeight, dstHeight, map->yIdx,
+                map->yFrac);
+    computeTaps(rect[1] / 2.0, rect[3] / 2.0, chromaHeight, dstHeight,
+                map->cyIdx, map->cyFrac);
+
+    // Taps are monotonic so the spans are given by the first and last taps.
+    unsigned int lastX = (unsigned int) map->xIdx[dstWidth - 1] + 1;
+    unsigned int lastCx = (unsigned int) map->cxIdx[dstWidth - 1] + 1;
+    map->lumaSpanX = (unsigned int) map->xIdx[0];
+    map->lumaSpanW = (lastX < srcWidth ? lastX + 1 : srcWidth) - map->lumaSpanX;
+    map->chromaSpanX = (unsigned int) map->cxIdx[0];
+    map->chromaSpanW =
+        (lastCx < chromaWidth ? lastCx + 1 : chromaWidth) - map->chromaSpanX;
+
+    for (unsigned int i = 0; i < dstWidth; i++) {
+        map->xIdx[i] -= (int32_t) map->lumaSpanX;
+        map->cxIdx[i] -= (int32_t) map->chromaSpanX;
+    }
+
+    return true;
+}
+
+static void clearScaleMap(ScaleMap* map) {
+    free(map->mem);
+    memset(map, 0, sizeof(*map));
+}
+
+static bool initScaleScratch(ScaleScratch* scratch, unsigned int srcWidth,
+                             unsigned int dstWidth) {
+    memset(scratch, 0, sizeof(*scratch));
+
+    // Spans are at most the full source width. Each span row gets extra
+    // room so the right-hand tap and the table lookups of the fixed kernels
+    // are always readable.
+    size_t lumaBytes = ALIGN_UP((size_t) srcWidth + 1 + TAP_TABLE_BYTES);
+    size_t uvBytes = ALIGN_UP((size_t) srcWidth + 2 + TAP_TABLE_BYTES);
+    size_t dstBytes = ALIGN_UP(dstWidth);
+
+    uint8_t* mem = NULL;
+    if (posix_memalign((void**) &mem, SCRATCH_ALIGN,
+                       lumaBytes + uvBytes + 6 * dstBytes)) {
+        syslog(LOG_ERR, "%s: Failed allocating scratch rows", __func__);
+        return false;
+    }
+
+    scratch->mem = mem;
+    scratch->lumaRow = mem;
+    scratch->uvRow = (mem += lumaBytes);
+    scratch->dstY = (mem += uvBytes);
+    scratch->dstU = (mem += dstBytes);
+    scratch->dstV = (mem += dstBytes);
+    scratch->rgbR = (mem += dstBytes);
+    scratch->rgbG = (mem += dstBytes);
+    scratch->rgbB = (mem += dstBytes);
+    scratch->cachedCy = -1;
+
+    return true;
+}
+
+static void clearScaleScratch(ScaleScratch* scratch) {
+    free(scratch->mem);
+    memset(scratch, 0, sizeof(*scratch));
+}
+
+/**
+ * brief Blend two source rows with a fixed vertical weight.
+ *
+ * param row0 First source row.
+ * param row1 Second source row.
+ * param dst Output row.
+ * param len Number of bytes to blend.
+ * param frac Weight of row1 in FILTER_BITS fixed-point.
+ */
+static void blendRows(const uint8_t* row0, const uint8_t* row1, uint8_t* dst,
+                      unsigned int len, unsigned int frac) {
+    if (frac == 0) {
+        memcpy(dst, row0, len);
+        return;
+    }
+
+    unsigned int x = 0;
+#if defined(__ARM_NEON)
+    uint8x8_t w0 = vdup_n_u8((uint8_t) (FILTER_ONE - frac));
+    uint8x8_t w1 = vdup_n_u8((uint8_t) frac);
+    for (; x + 16 <= len; x += 16) {
+        uint8x16_t a = vld1q_u8(row0 + x);
+        uint8x16_t b = vld1q_u8(row1 + x);
+        uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(a), w0), vget_low_u8(b), w1);
+        uint16x8_t hi =
+            vmlal_u8(vmull_u8(vget_high_u8(a), w0), vget_high_u8(b), w1);
+        vst1q_u8(dst + x, vcombine_u8(vrshrn_n_u16(lo, FILTER_BITS),
+                                      vrshrn_n_u16(hi, FILTER_BITS)));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w0 = _mm_set1_epi16((int16_t) (FILTER_ONE - frac));
+    const __m128i w1 = _mm_set1_epi16((int16_t) frac);
+    const __m128i round = _mm_set1_epi16(FILTER_ONE / 2);
+    // The weighted sum is at most 255 * FILTER_ONE + round, so 16-bit lanes
+    // hold it without overflow.
+    for (; x + 16 <= len; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (row0 + x));
+        __m128i b = _mm_loadu_si128((const __m128i*) (row1 + x));
+        __m128i lo = _mm_add_epi16(
+            _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), w0),
+                          _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), w1)),
+            round);
+        __m128i hi = _mm_add_epi16(
+            _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), w0),
+                          _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), w1)),
+            round);
+        _mm_storeu_si128((__m128i*) (dst + x),
+                         _mm_packus_epi16(_mm_srli_epi16(lo, FILTER_BITS),
+                                          _mm_srli_epi16(hi, FILTER_BITS)));
+    }
+#endif
+    for (; x < len; x++) {
+        dst[x] = (uint8_t) ((row0[x] * (FILTER_ONE - frac) + row1[x] * frac +
+                             FILTER_ONE / 2) >> FILTER_BITS);
+    }
+}
+
+static inline uint8_t clampU8(int v) {
+    return (uint8_t) (v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+/**
+ * brief Convert a single YUV sample to RGB.
+ *
+ * param yVal Luma sample.
+ * param uVal U sample.
+ * param vVal V sample.
+ * param c Conversion coefficients.
+ * param rgb Output R, G and B values.
+ */
+static inline void yuvToRGB(int yVal, int uVal, int vVal, const YuvCoeffs* c,
+                            uint8_t rgb[3]) {
+    const int round = 1 << (YUV_BITS - 1);
+    int y = (yVal - c->yOffset) * c->yGain;
+    int u = uVal - 128;
+    int v = vVal - 128;
+
+    rgb[0] = clampU8((y + c->vToR * v + round) >> YUV_BITS);
+    rgb[1] = clampU8((y - c->uToG * u - c->vToG * v + round) >> YUV_BITS);
+    rgb[2] = clampU8((y + c->uToB * u + round) >> YUV_BITS);
+}
+
+/**
+ * brief Convert a single YUV sample to RGB with lookup tables.
+ *
+ * param yVal Luma sample.
+ * param uVal U sample.
+ * param vVal V sample.
+ * param lut Conversion tables.
+ * param rgb Output R, G and B values.
+ */
+static inline void yuvToRGBLut(uint8_t yVal, uint8_t uVal, uint8_t vVal,
+                               const YuvLut* lut, uint8_t rgb[3]) {
+    int32_t y = lut->yTab[yVal];
+
+    rgb[0] = clampU8((y + lut->vToR[vVal]) >> LUT_BITS);
+    rgb[1] = clampU8((y + lut->uToG[uVal] + lut->vToG[vVal]) >> LUT_BITS);
+    rgb[2] = clampU8((y + lut->uToB[uVal]) >> LUT_BITS);
+}
+
+#if defined(__ARM_NEON)
+/**
+ * brief Convert 8 YUV samples to RGB with NEON.
+ *
+ * Uses the same arithmetic as yuvToRGB(). Adds are saturating: an overflow
+ * only happens for values that end up clamped to 255 anyway.
+ *
+ * param yVal Luma samples.
+ * param uVal U samples.
+ * param vVal V samples.
+ * param c Conversion coefficients.
+ * return R, G and B samples.
+ */
+static inline uint8x8x3_t yuvToRGBNeon(uint8x8_t yVal, uint8x8_t uVal,
+                                       uint8x8_t vVal, const YuvCoeffs* c) {
+    int16x8_t y = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(yVal)),
+                            vdupq_n_s16(c->yOffset));
+    int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(uVal)),
+                            vdupq_n_s16(128));
+    int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vVal)),
+                            vdupq_n_s16(128));
+
+    int16x8_t yy = vmulq_n_s16(y, c->yGain);
+    int16x8_t r = vqaddq_s16(yy, vmulq_n_s16(v, c->vToR));
+    int16x8_t g = vqsubq_s16(vqsubq_s16(yy, vmulq_n_s16(u, c->uToG)),
+                             vmulq_n_s16(v, c->vToG));
+    int16x8_t b = vqaddq_s16(yy, vmulq_n_s16(u, c->uToB));
+
+    uint8x8x3_t px;
+    px.val[0] = vqrshrun_n_s16(r, YUV_BITS);
+    px.val[1] = vqrshrun_n_s16(g, YUV_BITS);
+    px.val[2] = vqrshrun_n_s16(b, YUV_BITS);
+
+    return px;
+}
+
+/**
+ * brief Convert 8 YUV samples to RGB with NEON and 32-bit products.
+ *
+ * The coefficients have YUV_PRECISE_BITS fractional bits, so the result is
+ * within one step of yuvToRGBLut(). Narrowing saturates, outputs are clamped
+ * to 0..255.
+ *
+ * param yVal Luma samples.
+ * param uVal U samples.
+ * param vVal V samples.
+ * param c Conversion coefficients with YUV_PRECISE_BITS fractional bits.
+ * return R, G and B samples.
+ */
+static inline uint8x8x3_t yuvToRGBNeonPrecise(uint8x8_t yVal, uint8x8_t uVal,
+                                              uint8x8_t vVal,
+                                              const YuvCoeffs* c) {
+    int16x8_t y = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(yVal)),
+                            vdupq_n_s16(c->yOffset));
+    int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(uVal)),
+                            vdupq_n_s16(128));
+    int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vVal)),
+                            vdupq_n_s16(128));
+
+    int32x4_t yyLo = vmull_n_s16(vget_low_s16(y), c->yGain);
+    int32x4_t yyHi = vmull_n_s16(vget_high_s16(y), c->yGain);
+    int16x4_t uLo = vget_low_s16(u), uHi = vget_high_s16(u);
+    int16x4_t vLo = vget_low_s16(v), vHi = vget_high_s16(v);
+
+    int32x4_t rLo = vmlal_n_s16(yyLo, vLo, c->vToR);
+    int32x4_t rHi = vmlal_n_s16(yyHi, vHi, c->vToR);
+    int32x4_t gLo = vmlsl_n_s16(vmlsl_n_s16(yyLo, uLo, c->uToG), vLo, c->vToG);
+    int32x4_t gHi = vmlsl_n_s16(vmlsl_n_s16(yyHi, uHi, c->uToG), vHi, c->vToG);
+    int32x4_t bLo = vmlal_n_s16(yyLo, uLo, c->uToB);
+    int32x4_t bHi = vmlal_n_s16(yyHi, uHi, c->uToB);
+
+    uint8x8x3_t px;
+    px.val[0] = vqmovun_s16(vcombine_s16(vqrshrn_n_s32(rLo, YUV_PRECISE_BITS),
+                                         vqrshrn_n_s32(rHi, YUV_PRECISE_BITS)));
+    px.val[1] = vqmovun_s16(vcombine_s16(vqrshrn_n_s32(gLo, YUV_PRECISE_BITS),
+                                         vqrshrn_n_s32(gHi, YUV_PRECISE_BITS)));
+    px.val[2] = vqmovun_s16(vcombine_s16(vqrshrn_n_s32(bLo, YUV_PRECISE_BITS),
+                                         vqrshrn_n_s32(bHi, YUV_PRECISE_BITS)));
+
+    return px;
+}
+#elif defined(__SSE2__)
+/**
+ * brief Convert 8 YUV samples to RGB with SSE2.
+ *
+ * Inputs and outputs are 16-bit lanes. Uses the same arithmetic as
+ * yuvToRGB(), outputs are clamped to 0..255.
+ *
+ * param y Luma samples.
+ * param u U samples.
+ * param v V samples.
+ * param c Conversion coefficients.
+ * param rgb Output R, G and B samples.
+ */
+static inline void yuvToRGBSse(__m128i y, __m128i u, __m128i v,
+                               const YuvCoeffs* c, __m128i rgb[3]) {
+    const __m128i round = _mm_set1_epi16(1 << (YUV_BITS - 1));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max = _mm_set1_epi16(255);
+
+    y = _mm_sub_epi16(y, _mm_set1_epi16(c->yOffset));
+    u = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    v = _mm_sub_epi16(v, _mm_set1_epi16(128));
+
+    __m128i yy = _mm_adds_epi16(_mm_mullo_epi16(y, _mm_set1_epi16(c->yGain)),
+                                round);
+    __m128i r = _mm_adds_epi16(yy, _mm_mullo_epi16(v, _mm_set1_epi16(c->vToR)));
+    __m128i g = _mm_subs_epi16(
+        _mm_subs_epi16(yy, _mm_mullo_epi16(u, _mm_set1_epi16(c->uToG))),
+        _mm_mullo_epi16(v, _mm_set1_epi16(c->vToG)));
+    __m128i b = _mm_adds_epi16(yy, _mm_mullo_epi16(u, _mm_set1_epi16(c->uToB)));
+
+    rgb[0] = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(r, YUV_BITS), zero), max);
+    rgb[1] = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(g, YUV_BITS), zero), max);
+    rgb[2] = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(b, YUV_BITS), zero), max);
+}
+
+/**
+ * brief Sum of two products per 32-bit lane, rounded and shifted down.
+ *
+ * param a First samples, 16-bit lanes.
+ * param b Second samples, 16-bit lanes.
+ * param ca Coefficient of a.
+ * param cb Coefficient of b.
+ * param hi True for the upper four lanes of a and b.
+ * return Four 32-bit results with YUV_PRECISE_BITS removed.
+ */
+static inline __m128i dotPreciseSse(__m128i a, __m128i b, int16_t ca,
+                                    int16_t cb, bool hi) {
+    __m128i pairs = hi ? _mm_unpackhi_epi16(a, b) : _mm_unpacklo_epi16(a, b);
+    __m128i coeffs = _mm_set1_epi32((int32_t) ((uint32_t) (uint16_t) cb << 16 |
+                                               (uint16_t) ca));
+    __m128i sum = _mm_add_epi32(_mm_madd_epi16(pairs, coeffs),
+                                _mm_set1_epi32(1 << (YUV_PRECISE_BITS - 1)));
+    return _mm_srai_epi32(sum, YUV_PRECISE_BITS);
+}
+
+/**
+ * brief Convert 8 YUV samples to RGB with SSE2 and 32-bit products.
+ *
+ * Inputs and outputs are 16-bit lanes. Uses the same arithmetic as
+ * yuvToRGBNeonPrecise(), so the result is within one step of yuvToRGBLut().
+ * Outputs are clamped to 0..255.
+ *
+ * param y Luma samples.
+ * param u U samples.
+ * param v V samples.
+ * param c Conversion coefficients with YUV_PRECISE_BITS fractional bits.
+ * param rgb Output R, G and B samples.
+ */
+static inline void yuvToRGBSsePrecise(__m128i y, __m128i u, __m128i v,
+                                      const YuvCoeffs* c, __m128i rgb[3]) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max = _mm_set1_epi16(255);
+
+    y = _mm_sub_epi16(y, _mm_set1_epi16(c->yOffset));
+    u = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    v = _mm_sub_epi16(v, _mm_set1_epi16(128));
+
+    // G needs three products, the third one is paired with zero.
+    __m128i r[2], g[2], b[2];
+    for (int hi = 0; hi < 2; hi++) {
+        r[hi] = dotPreciseSse(y, v, c->yGain, c->vToR, hi);
+        b[hi] = dotPreciseSse(y, u, c->yGain, c->uToB, hi);
+        __m128i yu = _mm_madd_epi16(
+            hi ? _mm_unpackhi_epi16(y, u) : _mm_unpacklo_epi16(y, u),
+            _mm_set1_epi32((int32_t) ((uint32_t) (uint16_t) -c->uToG << 16 |
+                                      (uint16_t) c->yGain)));
+        __m128i vz = _mm_madd_epi16(
+            hi ? _mm_unpackhi_epi16(v, zero) : _mm_unpacklo_epi16(v, zero),
+            _mm_set1_epi32((uint16_t) -c->vToG));
+        g[hi] = _mm_srai_epi32(
+            _mm_add_epi32(_mm_add_epi32(yu, vz),
+                          _mm_set1_epi32(1 << (YUV_PRECISE_BITS - 1))),
+            YUV_PRECISE_BITS);
+    }
+
+    rgb[0] = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(r[0], r[1]), zero), max);
+    rgb[1] = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(g[0], g[1]), zero), max);
+    rgb[2] = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(b[0], b[1]), zero), max);
+}
+
+/**
+ * brief Store 8 RGB pixels held as 16-bit lanes, interleaved.
+ *
+ * param rgbOut Output, 24 bytes.
+ * param rgb R, G and B samples.
+ */
+static inline void storeRGBSse(uint8_t* rgbOut, const __m128i rgb[3]) {
+    // R | G << 8 | B << 16 in one 32-bit lane per pixel.
+    __m128i rg = _mm_or_si128(rgb[0], _mm_slli_epi16(rgb[1], 8));
+    uint32_t px[8];
+    _mm_storeu_si128((__m128i*) px, _mm_unpacklo_epi16(rg, rgb[2]));
+    _mm_storeu_si128((__m128i*) (px + 4), _mm_unpackhi_epi16(rg, rgb[2]));
+
+    // Each 4-byte store is overlapped by the next pixel, except the last.
+    for (int i = 0; i < 7; i++) {
+        memcpy(rgbOut + 3 * i, &px[i], 4);
+    }
+    memcpy(rgbOut + 21, &px[7], 3);
+}
+#endif
+
+/**
+ * brief Convert one row of planar Y, U and V samples to interleaved RGB.
+ *
+ * param yRow Luma samples.
+ * param uRow U samples, one per output pixel.
+ * param vRow V samples, one per output pixel.
+ * param lut Conversion tables.
+ * param rgb Output interleaved RGB row.
+ * param width Number of pixels.
+ */
+static void yuvRowToRGB(const uint8_t* yRow, const uint8_t* uRow,
+                        const uint8_t* vRow, const YuvLut* lut, uint8_t* rgb,
+                        unsigned int width) {
+    unsigned int x = 0;
+#if defined(__ARM_NEON)
+    for (; x + 8 <= width; x += 8) {
+        vst3_u8(rgb + 3 * x,
+                yuvToRGBNeonPrecise(vld1_u8(yRow + x), vld1_u8(uRow + x),
+                                    vld1_u8(vRow + x), &lut->coeffs));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 8 <= width; x += 8) {
+        __m128i px[3];
+        yuvToRGBSsePrecise(
+            _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (yRow + x)), zero),
+            _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (uRow + x)), zero),
+            _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (vRow + x)), zero),
+            &lut->coeffs, px);
+        storeRGBSse(rgb + 3 * x, px);
+    }
+#endif
+    for (; x < width; x++) {
+        yuvToRGBLut(yRow[x], uRow[x], vRow[x], lut, rgb + 3 * x);
+    }
+}
+
+/**
+ * brief Convert one row of planar Y, U and V samples to planar RGB.
+ *
+ * param yRow Luma samples.
+ * param uRow U samples, one per output pixel.
+ * param vRow V samples, one per output pixel.
+ * param lut Conversion tables.
+ * param rRow Output R row.
+ * param gRow Output G row.
+ * param bRow Output B row.
+ * param width Number of pixels.
+ */
+static void yuvRowToPlanarRGB(const uint8_t* yRow, const uint8_t* uRow,
+                              const uint8_t* vRow, const YuvLut* lut,
+                              uint8_t* rRow, uint8_t* gRow, uint8_t* bRow,
+                              unsigned int width) {
+    unsigned int x = 0;
+    uint8_t rgb[3];
+#if defined(__ARM_NEON)
+    for (; x + 8 <= width; x += 8) {
+        uint8x8x3_t px =
+            yuvToRGBNeonPrecise(vld1_u8(yRow + x), vld1_u8(uRow + x),
+                                vld1_u8(vRow + x), &lut->coeffs);
+        vst1_u8(rRow + x, px.val[0]);
+        vst1_u8(gRow + x, px.val[1]);
+        vst1_u8(bRow + x, px.val[2]);
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 8 <= width; x += 8) {
+        __m128i px[3];
+        yuvToRGBSsePrecise(
+            _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (yRow + x)), zero),
+            _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (uRow + x)), zero),
+            _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (vRow + x)), zero),
+            &lut->coeffs, px);
+        _mm_storel_epi64((__m128i*) (rRow + x), _mm_packus_epi16(px[0], px[0]));
+        _mm_storel_epi64((__m128i*) (gRow + x), _mm_packus_epi16(px[1], px[1]));
+        _mm_storel_epi64((__m128i*) (bRow + x), _mm_packus_epi16(px[2], px[2]));
+    }
+#endif
+    for (; x < width; x++) {
+        yuvToRGBLut(yRow[x], uRow[x], vRow[x], lut, rgb);
+        rRow[x] = rgb[0];
+        gRow[x] = rgb[1];
+        bRow[x] = rgb[2];
+    }
+}
+
+/**
+ * brief Convert one NV12 row to interleaved RGB.
+ *
+ * param yRow Luma row.
+ * param uvRow Interleaved UV row, subsampled 2x horizontally.
+ * param lut Conversion tables.
+ * param rgb Output interleaved RGB row.
+ * param width Number of pixels.
+ */
+static void nv12RowToRGB(const uint8_t* yRow, const uint8_t* uvRow,
+                         const YuvLut* lut, uint8_t* rgb, unsigned int width) {
+    unsigned int x = 0;
+#if defined(__ARM_NEON)
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t yVal = vld1q_u8(yRow + x);
+        uint8x8x2_t uv = vld2_u8(uvRow + x);
+        // Each chroma sample covers two output pixels.
+        uint8x8x2_t u = vzip_u8(uv.val[0], uv.val[0]);
+        uint8x8x2_t v = vzip_u8(uv.val[1], uv.val[1]);
+
+        vst3_u8(rgb + 3 * x, yuvToRGBNeonPrecise(vget_low_u8(yVal), u.val[0],
+                                                 v.val[0], &lut->coeffs));
+        vst3_u8(rgb + 3 * (x + 8),
+                yuvToRGBNeonPrecise(vget_high_u8(yVal), u.val[1], v.val[1],
+                                    &lut->coeffs));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lowBytes = _mm_set1_epi16(0xff);
+    for (; x + 16 <= width; x += 16) {
+        __m128i yVal = _mm_loadu_si128((const __m128i*) (yRow + x));
+        __m128i uv = _mm_loadu_si128((const __m128i*) (uvRow + x));
+        __m128i u = _mm_and_si128(uv, lowBytes);
+        __m128i v = _mm_srli_epi16(uv, 8);
+        __m128i px[3];
+
+        // Each chroma sample covers two output pixels.
+        yuvToRGBSsePrecise(_mm_unpacklo_epi8(yVal, zero),
+                           _mm_unpacklo_epi16(u, u), _mm_unpacklo_epi16(v, v),
+                           &lut->coeffs, px);
+        storeRGBSse(rgb + 3 * x, px);
+        yuvToRGBSsePrecise(_mm_unpackhi_epi8(yVal, zero),
+                           _mm_unpackhi_epi16(u, u), _mm_unpackhi_epi16(v, v),
+                           &lut->coeffs, px);
+        storeRGBSse(rgb + 3 * (x + 8), px);
+    }
+#endif
+    for (; x < width; x++) {
+        const uint8_t* c = uvRow + (x & ~1u);
+        yuvToRGBLut(yRow[x], c[0], c[1], lut, rgb + 3 * x);
+    }
+}
+
+/**
+ * brief Fill a YuvLut from the luma weights of a matrix.
+ *
+ * param lut YuvLut to fill.
+ * param kr Luma weight of red.
+ * param kb Luma weight of blue.
+ * param limited True for limited range input.
+ */
+static void initYuvLut(YuvLut* lut, double kr, double kb, bool limited) {
+    const double kg = 1.0 - kr - kb;
+    const double one = 1 << LUT_BITS;
+    // Limited range has 219 luma and 224 chroma steps instead of 255.
+    const double yScale = limited ? 255.0 / 219.0 : 1.0;
+    const double cScale = limited ? 255.0 / 224.0 : 1.0;
+    const int yOffset = limited ? 16 : 0;
+
+    const double vr = cScale * 2.0 * (1.0 - kr);
+    const double ug = cScale * 2.0 * kb * (1.0 - kb) / kg;
+    const double vg = cScale * 2.0 * kr * (1.0 - kr) / kg;
+    const double ub = cScale * 2.0 * (1.0 - kb);
+
+    for (int i = 0; i < 256; i++) {
+        lut->yTab[i] = (int32_t) lround(yScale * (i - yOffset) * one) +
+                       (1 << (LUT_BITS - 1));
+        lut->vToR[i] = (int32_t) lround(vr * (i - 128) * one);
+        lut->uToG[i] = (int32_t) lround(-ug * (i - 128) * one);
+        lut->vToG[i] = (int32_t) lround(-vg * (i - 128) * one);
+        lut->uToB[i] = (int32_t) lround(ub * (i - 128) * one);
+    }
+
+    const double q = 1 << YUV_PRECISE_BITS;
+    lut->coeffs.yOffset = (int16_t) yOffset;
+    lut->coeffs.yGain = (int16_t) lround(yScale * q);
+    lut->coeffs.vToR = (int16_t) lround(vr * q);
+    lut->coeffs.uToG = (int16_t) lround(ug * q);
+    lut->coeffs.vToG = (int16_t) lround(vg * q);
+    lut->coeffs.uToB = (int16_t) lround(ub * q);
+}
+
+static void initYuvLuts(void) {
+    // Luma weights of red and blue.
+    static const double weights[2][2] = {
+        [IMG_MATRIX_BT601] = {0.299, 0.114},
+        [IMG_MATRIX_BT709] = {0.2126, 0.0722},
+    };
+
+    for (int m = 0; m < 2; m++) {
+        initYuvLut(&yuvLuts[m][IMG_RANGE_LIMITED], weights[m][0],
+                   weights[m][1], true);
+        initYuvLut(&yuvLuts[m][IMG_RANGE_FULL], weights[m][0], weights[m][1],
+                   false);
+    }
+}
+
+static const YuvLut* getYuvLut(ImgColorMatrix matrix, ImgColorRange range) {
+    if ((matrix != IMG_MATRIX_BT601 && matrix != IMG_MATRIX_BT709) ||
+        (range != IMG_RANGE_LIMITED && range != IMG_RANGE_FULL)) {
+        syslog(LOG_ERR, "%s: Unsupported color matrix %d or range %d",
+               __func__, matrix, range);
+        return NULL;
+    }
+
+    pthread_once(&yuvLutsOnce, initYuvLuts);
+
+    return &yuvLuts[matrix][range];
+}
+
+bool convertU8yuvToRGBlut(unsigned int width, unsigned int height,
+                          const uint8_t* yuvIn, const ImgNv12Layout_t* layout,
+                          uint8_t* rgbOut,
+                          ImgColorMatrix matrix, ImgColorRange range,
+                          RowPool_t* pool) {
+    const YuvLut* lut = getYuvLut(matrix, range);
+    if (!lut) {
+        return false;
+    }
+
+    LutJob job = {width, getNv12Planes(yuvIn, layout, width, height), rgbOut,
+                  lut};
+    runRowPool(pool, lutBand, &job, height, 2);
+
+    return true;
+}
+
+static void lutBand(void* ctx, unsigned int band, unsigned int rowStart,
+                    unsigned int rowEnd) {
+    (void) band;
+    const LutJob* job = (const LutJob*) ctx;
+    const unsigned int width = job->width;
+    const Nv12Planes* src = &job->src;
+
+    for (unsigned int y = rowStart; y < rowEnd; y++) {
+        nv12RowToRGB(src->y + y * src->yPitch,
+                     src->uv + (y / 2) * src->uvPitch, job->lut,
+                     job->rgbOut + (size_t) y * width * 3, width);
+    }
+}
+
+/**
+ * brief Convert one NV12 row to interleaved float RGB.
+ *
+ * Each output channel is computed as rgb * scale + bias, where rgb is the
+ * 8-bit RGB value. Since rgb is clamped to 0..255 the output is implicitly
+ * clamped to the corresponding normalized range.
+ *
+ * param yRow Luma row.
+ * param uvRow Interleaved UV row, subsampled 2x horizontally.
+ * param c Conversion coefficients.
+ * param scale Per channel scale.
+ * param bias Per channel bias.
+ * param out Output interleaved float RGB row.
+ * param width Number of pixels.
+ */
+static void nv12RowToFloatRGB(const uint8_t* yRow, const uint8_t* uvRow,
+                              const YuvCoeffs* c, const float scale[3],
+                              const float bias[3], float* out,
+                              unsigned int width) {
+    unsigned int x = 0;
+#if defined(__ARM_NEON)
+    const float32x4_t s0 = vdupq_n_f32(scale[0]);
+    const float32x4_t s1 = vdupq_n_f32(scale[1]);
+    const float32x4_t s2 = vdupq_n_f32(scale[2]);
+    const float32x4_t b0 = vdupq_n_f32(bias[0]);
+    const float32x4_t b1 = vdupq_n_f32(bias[1]);
+    const float32x4_t b2 = vdupq_n_f32(bias[2]);
+    for (; x + 8 <= width; x += 8) {
+        // 8 luma samples share 4 UV pairs, duplicate chroma horizontally.
+        uint8x8x2_t uv = vld2_u8(uvRow + x);
+        uint8x8_t u = vzip_u8(uv.val[0], uv.val[0]).val[0];
+        uint8x8_t v = vzip_u8(uv.val[1], uv.val[1]).val[0];
+        uint8x8x3_t rgb = yuvToRGBNeon(vld1_u8(yRow + x), u, v, c);
+
+        uint16x8_t r16 = vmovl_u8(rgb.val[0]);
+        uint16x8_t g16 = vmovl_u8(rgb.val[1]);
+        uint16x8_t b16 = vmovl_u8(rgb.val[2]);
+
+        float32x4x3_t px;
+        px.val[0] = vmlaq_f32(b0, vcvtq_f32_u32(vmovl_u16(vget_low_u16(r16))), s0);
+        px.val[1] = vmlaq_f32(b1, vcvtq_f32_u32(vmovl_u16(vget_low_u16(g16))), s1);
+        px.val[2] = vmlaq_f32(b2, vcvtq_f32_u32(vmovl_u16(vget_low_u16(b16))), s2);
+        vst3q_f32(out + 3 * x, px);
+
+        px.val[0] = vmlaq_f32(b0, vcvtq_f32_u32(vmovl_u16(vget_high_u16(r16))), s0);
+        px.val[1] = vmlaq_f32(b1, vcvtq_f32_u32(vmovl_u16(vget_high_u16(g16))), s1);
+        px.val[2] = vmlaq_f32(b2, vcvtq_f32_u32(vmovl_u16(vget_high_u16(b16))), s2);
+        vst3q_f32(out + 3 * x + 12, px);
+    }
+#elif defined(__SSE2__)
+    const __m128 s0 = _mm_set1_ps(scale[0]);
+    const __m128 s1 = _mm_set1_ps(scale[1]);
+    const __m128 s2 = _mm_set1_ps(scale[2]);
+    const __m128 b0 = _mm_set1_ps(bias[0]);
+    const __m128 b1 = _mm_set1_ps(bias[1]);
+    const __m128 b2 = _mm_set1_ps(bias[2]);
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 8 <= width; x += 8) {
+        __m128i y = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (yRow + x)),
+                                      zero);
+        __m128i uv = _mm_unpacklo_epi8(
+            _mm_loadl_epi64((const __m128i*) (uvRow + x)), zero);
+        // uv holds u0 v0 u1 v1 ... as 16-bit lanes. Split and duplicate
+        // chroma horizontally.
+        __m128i u = _mm_shufflelo_epi16(_mm_shufflehi_epi16(uv, 0xa0), 0xa0);
+        __m128i v = _mm_shufflelo_epi16(_mm_shufflehi_epi16(uv, 0xf5), 0xf5);
+
+        __m128i rgb[3];
+        yuvToRGBSse(y, u, v, c, rgb);
+
+        for (int half = 0; half < 2; half++) {
+            __m128 r, g, b;
+            if (half == 0) {
+                r = _mm_cvtepi32_ps(_mm_unpacklo_epi16(rgb[0], zero));
+                g = _mm_cvtepi32_ps(_mm_unpacklo_epi16(rgb[1], zero));
+                b = _mm_cvtepi32_ps(_mm_unpacklo_epi16(rgb[2], zero));
+            } else {
+                r = _mm_cvtepi32_ps(_mm_unpackhi_epi16(rgb[0], zero));
+                g = _mm_cvtepi32_ps(_mm_unpackhi_epi16(rgb[1], zero));
+                b = _mm_cvtepi32_ps(_mm_unpackhi_epi16(rgb[2], zero));
+            }
+            r = _mm_add_ps(_mm_mul_ps(r, s0), b0);
+            g = _mm_add_ps(_mm_mul_ps(g, s1), b1);
+            b = _mm_add_ps(_mm_mul_ps(b, s2), b2);
+
+            // Interleave four pixels into r0g0b0r1 g1b1r2g2 b2r3g3b3.
+            __m128 rg01 = _mm_unpacklo_ps(r, g);
+            __m128 rg23 = _mm_unpackhi_ps(r, g);
+            __m128 br01 = _mm_shuffle_ps(b, r, _MM_SHUFFLE(1, 1, 0, 0));
+            __m128 gb11 = _mm_shuffle_ps(g, b, _MM_SHUFFLE(1, 1, 1, 1));
+            __m128 br23 = _mm_shuffle_ps(b, r, _MM_SHUFFLE(3, 3, 2, 2));
+            __m128 gb33 = _mm_shuffle_ps(g, b, _MM_SHUFFLE(3, 3, 3, 3));
+
+            float* dst = out + 3 * (x + 4 * (unsigned int) half);
+            _mm_storeu_ps(dst, _mm_shuffle_ps(rg01, br01, _MM_SHUFFLE(2, 0, 1, 0)));
+            _mm_storeu_ps(dst + 4,
+                          _mm_shuffle_ps(gb11, rg23, _MM_SHUFFLE(1, 0, 2, 0)));
+            _mm_storeu_ps(dst + 8,
+                          _mm_shuffle_ps(br23, gb33, _MM_SHUFFLE(2, 0, 2, 0)));
+        }
+    }
+#endif
+    for (; x < width; x++) {
+        const uint8_t* uv = uvRow + (x & ~1u);
+        uint8_t rgb[3];
+        yuvToRGB(yRow[x], uv[0], uv[1], c, rgb);
+
+        out[3 * x] = rgb[0] * scale[0] + bias[0];
+        out[3 * x + 1] = rgb[1] * scale[1] + bias[1];
+        out[3 * x + 2] = rgb[2] * scale[2] + bias[2];
+    }
+}
+
+static void nv12ToFloatRGB(unsigned int width, unsigned int height,
+                           const Nv12Planes* src, const YuvCoeffs* c,
+                           const float scale[3], const float bias[3],
+                           float* out, RowPool_t* pool) {
+    FloatJob job = {width, *src, c, scale, bias, out};
+
+    runRowPool(pool, floatBand, &job, height, 2);
+}
+
+static void floatBand(void* ctx, unsigned int band, unsigned int rowStart,
+                      unsigned int rowEnd) {
+    (void) band;
+    const FloatJob* job = (const FloatJob*) ctx;
+    const unsigned int width = job->width;
+    const Nv12Planes* src = &job->src;
+
+    for (unsigned int y = rowStart; y < rowEnd; y++) {
+        nv12RowToFloatRGB(src->y + y * src->yPitch,
+                          src->uv + (y / 2) * src->uvPitch, job->c,
+                          job->scale, job->bias,
+                          job->out + (size_t) y * width * 3, width);
+    }
+}
+
+static inline uint16_t load16(const uint8_t* p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t load32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+#if defined(__ARM_NEON)
+/**
+ * brief Blend 8 pairs of horizontal taps with NEON.
+ *
+ * a * FILTER_ONE + (b - a) * f is in 0..255 * FILTER_ONE, so it is exact in
+ * wrapping 16-bit arithmetic. Rounds like the scalar filter.
+ *
+ * param a First taps.
+ * param b Second taps.
+ * param frac Weights of the second taps.
+ * return Filtered samples.
+ */
+static inline uint8x8_t lerpTapsNeon(uint8x8_t a, uint8x8_t b,
+                                     uint16x8_t frac) {
+    uint16x8_t sum =
+        vmlaq_u16(vshll_n_u8(a, FILTER_BITS), vsubl_u8(b, a), frac);
+    return vrshrn_n_u16(sum, FILTER_BITS);
+}
+
+/**
+ * brief Filter 8 luma samples with NEON.
+ *
+ * There is no gather, so the two taps of each sample are loaded as one
+ * 16-bit lane and split after 8 samples.
+ *
+ * param row Vertically filtered luma span.
+ * param idx Offsets of the first taps of the 8 samples.
+ * param frac Weights of the second taps.
+ * return Filtered samples.
+ */
+static ALWAYS_INLINE uint8x8_t lumaTapsNeon(const uint8_t* row,
+                                            const int32_t* idx,
+                                            uint16x8_t frac) {
+    uint16x8_t t = vdupq_n_u16(0);
+    t = vsetq_lane_u16(load16(row + idx[0]), t, 0);
+    t = vsetq_lane_u16(load16(row + idx[1]), t, 1);
+    t = vsetq_lane_u16(load16(row + idx[2]), t, 2);
+    t = vsetq_lane_u16(load16(row + idx[3]), t, 3);
+    t = vsetq_lane_u16(load16(row + idx[4]), t, 4);
+    t = vsetq_lane_u16(load16(row + idx[5]), t, 5);
+    t = vsetq_lane_u16(load16(row + idx[6]), t, 6);
+    t = vsetq_lane_u16(load16(row + idx[7]), t, 7);
+    return lerpTapsNeon(vmovn_u16(t), vshrn_n_u16(t, 8), frac);
+}
+
+/**
+ * brief Filter 8 chroma samples with NEON.
+ *
+ * Like lumaTapsNeon(), with both UV pairs of each sample in a 32-bit lane.
+ *
+ * param row Vertically filtered UV span.
+ * param idx Offsets in UV pairs of the first taps of the 8 samples.
+ * param frac Weights of the second taps.
+ * param u Output U samples.
+ * param v Output V samples.
+ */
+static ALWAYS_INLINE void chromaTapsNeon(const uint8_t* row,
+                                         const int32_t* idx, uint16x8_t frac,
+                                         uint8x8_t* u, uint8x8_t* v) {
+    uint32x4_t lo = vdupq_n_u32(0);
+    uint32x4_t hi = vdupq_n_u32(0);
+    lo = vsetq_lane_u32(load32(row + 2 * idx[0]), lo, 0);
+    lo = vsetq_lane_u32(load32(row + 2 * idx[1]), lo, 1);
+    lo = vsetq_lane_u32(load32(row + 2 * idx[2]), lo, 2);
+    lo = vsetq_lane_u32(load32(row + 2 * idx[3]), lo, 3);
+    hi = vsetq_lane_u32(load32(row + 2 * idx[4]), hi, 0);
+    hi = vsetq_lane_u32(load32(row + 2 * idx[5]), hi, 1);
+    hi = vsetq_lane_u32(load32(row + 2 * idx[6]), hi, 2);
+    hi = vsetq_lane_u32(load32(row + 2 * idx[7]), hi, 3);
+    // Even bytes are the U taps and odd bytes the V taps of each sample.
+    uint8x16x2_t t =
+        vuzpq_u8(vreinterpretq_u8_u32(lo), vreinterpretq_u8_u32(hi));
+    uint16x8_t uTaps = vreinterpretq_u16_u8(t.val[0]);
+    uint16x8_t vTaps = vreinterpretq_u16_u8(t.val[1]);
+    *u = lerpTapsNeon(vmovn_u16(uTaps), vshrn_n_u16(uTaps, 8), frac);
+    *v = lerpTapsNeon(vmovn_u16(vTaps), vshrn_n_u16(vTaps, 8), frac);
+}
+#elif defined(__SSE2__)
+/**
+ * brief Blend 4 pairs of horizontal taps with SSE2.
+ *
+ * param taps First and second tap of each sample in alternating 16-bit
+ * lanes.
+ * param weights Weights of the first and second tap of each sample in the
+ * same lanes.
+ * return Filtered samples in 32-bit lanes.
+ */
+static inline __m128i lerpTapsSse(__m128i taps, __m128i weights) {
+    __m128i sum = _mm_add_epi32(_mm_madd_epi16(taps, weights),
+                                _mm_set1_epi32(FILTER_ONE / 2));
+    return _mm_srli_epi32(sum, FILTER_BITS);
+}
+
+/**
+ * brief Tap weights of 8 samples for lerpTapsSse().
+ *
+ * param frac Weights of the second taps.
+ * param weights Output weights of samples 0 to 3 and 4 to 7.
+ */
+static inline void tapWeightsSse(const uint16_t* frac, __m128i weights[2]) {
+    __m128i f = _mm_loadu_si128((const __m128i*) frac);
+    __m128i inv = _mm_sub_epi16(_mm_set1_epi16(FILTER_ONE), f);
+    weights[0] = _mm_unpacklo_epi16(inv, f);
+    weights[1] = _mm_unpackhi_epi16(inv, f);
+}
+
+/**
+ * brief Filter 8 luma samples with SSE2.
+ *
+ * param row Vertically filtered luma span.
+ * param idx Offsets of the first taps of the 8 samples.
+ * param weights Tap weights from tapWeightsSse().
+ * return Filtered samples in the low 8 bytes.
+ */
+static ALWAYS_INLINE __m128i lumaTapsSse(const uint8_t* row,
+                                         const int32_t* idx,
+                                         const __m128i weights[2]) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i t = _mm_set_epi16(
+        (int16_t) load16(row + idx[7]), (int16_t) load16(row + idx[6]),
+        (int16_t) load16(row + idx[5]), (int16_t) load16(row + idx[4]),
+        (int16_t) load16(row + idx[3]), (int16_t) load16(row + idx[2]),
+        (int16_t) load16(row + idx[1]), (int16_t) load16(row + idx[0]));
+    __m128i out =
+        _mm_packs_epi32(lerpTapsSse(_mm_unpacklo_epi8(t, zero), weights[0]),
+                        lerpTapsSse(_mm_unpackhi_epi8(t, zero), weights[1]));
+    return _mm_packus_epi16(out, out);
+}
+
+/**
+ * brief Filter 8 chroma samples with SSE2.
+ *
+ * param row Vertically filtered UV span.
+ * param idx Offsets in UV pairs of the first taps of the 8 samples.
+ * param weights Tap weights from tapWeightsSse().
+ * param u Output U samples in 16-bit lanes.
+ * param v Output V samples in 16-bit lanes.
+ */
+static ALWAYS_INLINE void chromaTapsSse(const uint8_t* row,
+                                        const int32_t* idx,
+                                        const __m128i weights[2], __m128i* u,
+                                        __m128i* v) {
+    const __m128i lowBytes = _mm_set1_epi16(0xff);
+    __m128i t0 = _mm_set_epi32((int32_t) load32(row + 2 * idx[3]),
+                               (int32_t) load32(row + 2 * idx[2]),
+                               (int32_t) load32(row + 2 * idx[1]),
+                               (int32_t) load32(row + 2 * idx[0]));
+    __m128i t1 = _mm_set_epi32((int32_t) load32(row + 2 * idx[7]),
+                               (int32_t) load32(row + 2 * idx[6]),
+                               (int32_t) load32(row + 2 * idx[5]),
+                               (int32_t) load32(row + 2 * idx[4]));
+    *u = _mm_packs_epi32(lerpTapsSse(_mm_and_si128(t0, lowBytes), weights[0]),
+                         lerpTapsSse(_mm_and_si128(t1, lowBytes), weights[1]));
+    *v = _mm_packs_epi32(lerpTapsSse(_mm_srli_epi16(t0, 8), weights[0]),
+                         lerpTapsSse(_mm_srli_epi16(t1, 8), weights[1]));
+}
+#endif
+
+/**
+ * brief Filter one luma sample.
+ *
+ * param p First tap.
+ * param f Weight of the second tap.
+ * return Filtered sample.
+ */
+static inline uint8_t lumaTap(const uint8_t* p, unsigned int f) {
+    return (uint8_t) ((p[0] * (FILTER_ONE - f) + p[1] * f + FILTER_ONE / 2) >>
+                      FILTER_BITS);
+}
+
+/**
+ * brief Filter one chroma sample.
+ *
+ * param p First UV pair.
+ * param f Weight of the second UV pair.
+ * param u Output U sample.
+ * param v Output V sample.
+ */
+static inline void chromaTap(const uint8_t* p, unsigned int f, uint8_t* u,
+                             uint8_t* v) {
+    *u = (uint8_t) ((p[0] * (FILTER_ONE - f) + p[2] * f + FILTER_ONE / 2) >>
+                    FILTER_BITS);
+    *v = (uint8_t) ((p[1] * (FILTER_ONE - f) + p[3] * f + FILTER_ONE / 2) >>
+                    FILTER_BITS);
+}
+
+/**
+ * brief Blend the two source luma rows of a destination row over the span.
+ *
+ * The sample after the span repeats the last one, for the right-hand tap.
+ *
+ * param map ScaleMap with the luma taps.
+ * param lumaRow Output vertically filtered span.
+ * param yPlane Start of the source luma plane.
+ * param pitch Bytes between source luma rows.
+ * param y Destination row.
+ */
+static void blendLumaSpan(const ScaleMap* map, uint8_t* lumaRow,
+                          const uint8_t* yPlane, size_t pitch,
+                          unsigned int y) {
+    const uint8_t* row0 = yPlane + map->yIdx[y] * pitch + map->lumaSpanX;
+    blendRows(row0, row0 + pitch, lumaRow, map->lumaSpanW, map->yFrac[y]);
+    lumaRow[map->lumaSpanW] = lumaRow[map->lumaSpanW - 1];
+}
+
+/**
+ * brief Blend two source chroma rows over the UV span.
+ *
+ * param map ScaleMap with the chroma taps.
+ * param uvRow Output vertically filtered UV span.
+ * param uvPlane Start of the source UV plane.
+ * param pitch Bytes between source UV rows.
+ * param cy First of the two source chroma rows.
+ * param cyFrac Weight of the second source chroma row.
+ */
+static void blendChromaSpan(const ScaleMap* map, uint8_t* uvRow,
+                            const uint8_t* uvPlane, size_t pitch, int32_t cy,
+                            uint16_t cyFrac) {
+    unsigned int spanBytes = 2 * map->chromaSpanW;
+    const uint8_t* uv0 = uvPlane + cy * pitch + 2 * map->chromaSpanX;
+    blendRows(uv0, uv0 + pitch, uvRow, spanBytes, cyFrac);
+    uvRow[spanBytes] = uvRow[spanBytes - 2];
+    uvRow[spanBytes + 1] = uvRow[spanBytes - 1];
+}
+
+/**
+ * brief Scale one luma row: vertical filter over the span, then horizontal
+ * taps.
+ *
+ * param map ScaleMap with the luma taps.
+ * param lumaRow Scratch for the vertically filtered span.
+ * param yPlane Start of the source luma plane.
+ * param pitch Bytes between source luma rows.
+ * param y Destination row.
+ * param dst Output luma row.
+ * param dstWidth Destination width in pixels.
+ */
+static void scaleLumaRow(const ScaleMap* map, uint8_t* lumaRow,
+                         const uint8_t* yPlane, size_t pitch, unsigned int y,
+                         uint8_t* dst, unsigned int dstWidth) {
+    blendLumaSpan(map, lumaRow, yPlane, pitch, y);
+
+    unsigned int x = 0;
+#if defined(__ARM_NEON)
+    for (; x + 8 <= dstWidth; x += 8) {
+        vst1_u8(dst + x, lumaTapsNeon(lumaRow, map->xIdx + x,
+                                      vld1q_u16(map->xFrac + x)));
+    }
+#elif defined(__SSE2__)
+    for (; x + 8 <= dstWidth; x += 8) {
+        __m128i weights[2];
+        tapWeightsSse(map->xFrac + x, weights);
+        _mm_storel_epi64((__m128i*) (dst + x),
+                         lumaTapsSse(lumaRow, map->xIdx + x, weights));
+    }
+#endif
+    for (; x < dstWidth; x++) {
+        dst[x] = lumaTap(lumaRow + map->xIdx[x], map->xFrac[x]);
+    }
+}
+
+/**
+ * brief Scale one chroma row from the chroma taps of a ScaleMap.
+ *
+ * param map ScaleMap with the chroma taps.
+ * param uvRow Scratch for the vertically filtered UV span.
+ * param uvPlane Start of the source UV plane.
+ * param pitch Bytes between source UV rows.
+ * param cy First of the two source chroma rows.
+ * param cyFrac Weight of the second source chroma row.
+ * param dstU Output U samples.
+ * param dstV Output V samples.
+ * param step Distance between output samples, 2 for interleaved UV with
+ * dstV at dstU + 1.
+ * param dstWidth Number of output samples.
+ */
+static void scaleChromaRow(const ScaleMap* map, uint8_t* uvRow,
+                           const uint8_t* uvPlane, size_t pitch, int32_t cy,
+                           uint16_t cyFrac, uint8_t* dstU, uint8_t* dstV,
+                           unsigned int step, unsigned int dstWidth) {
+    blendChromaSpan(map, uvRow, uvPlane, pitch, cy, cyFrac);
+
+    unsigned int x = 0;
+#if defined(__ARM_NEON)
+    for (; x + 8 <= dstWidth; x += 8) {
+        uint8x8_t u;
+        uint8x8_t v;
+        chromaTapsNeon(uvRow, map->cxIdx + x, vld1q_u16(map->cxFrac + x), &u,
+                       &v);
+        if (step == 2) {
+            uint8x8x2_t uv = {{u, v}};
+            vst2_u8(dstU + 2 * x, uv);
+        } else {
+            vst1_u8(dstU + x, u);
+            vst1_u8(dstV + x, v);
+        }
+    }
+#elif defined(__SSE2__)
+    for (; x + 8 <= dstWidth; x += 8) {
+        __m128i weights[2];
+        __m128i u;
+        __m128i v;
+        tapWeightsSse(map->cxFrac + x, weights);
+        chromaTapsSse(uvRow, map->cxIdx + x, weights, &u, &v);
+        if (step == 2) {
+            __m128i uv = _mm_or_si128(u, _mm_slli_epi16(v, 8));
+            _mm_storeu_si128((__m128i*) (dstU + 2 * x), uv);
+        } else {
+            _mm_storel_epi64((__m128i*) (dstU + x), _mm_packus_epi16(u, u));
+            _mm_storel_epi64((__m128i*) (dstV + x), _mm_packus_epi16(v, v));
+        }
+    }
+#endif
+    for (; x < dstWidth; x++) {
+        chromaTap(uvRow + 2 * map->cxIdx[x], map->cxFrac[x], &dstU[step * x],
+                  &dstV[step * x]);
+    }
+}
+
+/// Completely unroll the loops of the fixed kernels.
+#define FIXED_UNROLL _Pragma("GCC unroll 128")
+
+/**
+ * brief Floor of num / den for den > 0.
+ */
+static ALWAYS_INLINE int64_t floorDiv(int64_t num, int64_t den) {
+    return num >= 0 ? num / den : -((den - 1 - num) / den);
+}
+
+/**
+ * brief Position of a horizontal tap of a crop in FILTER_BITS fixed-point.
+ *
+ * Rounds like computeTaps(), in integer arithmetic and without clamping.
+ * Positions are relative to the whole sample the crop starts in. Folds to
+ * a constant when the arguments are constants.
+ *
+ * param i Destination sample.
+ * param srcLen Crop width in luma samples.
+ * param dstLen Destination width.
+ * param sub 1 for luma and 2 for chroma taps.
+ * param phase 1 if the crop starts halfway into a chroma sample, 0 for
+ *              luma.
+ * return Fixed-point position.
+ */
+static ALWAYS_INLINE int64_t fixedTapPos(unsigned int i, unsigned int srcLen,
+                                        unsigned int dstLen, unsigned int sub,
+                                        unsigned int phase) {
+    // (i + 0.5) * srcLen / sub / dstLen - 0.5 + phase / 2 in units of
+    // 1 / (2 * sub * dstLen).
+    int64_t den = 2 * (int64_t) sub * dstLen;
+    int64_t num = (2 * (int64_t) i + 1) * srcLen - (int64_t) sub * dstLen +
+                  (int64_t) phase * 2 * dstLen;
+    return floorDiv(num * FILTER_ONE + den / 2, den);
+}
+
+/**
+ * brief First tap of a destination sample relative to that of sample 0,
+ * like the taps of a ScaleMap relative to its span.
+ */
+static ALWAYS_INLINE int32_t fixedTapIdx(unsigned int i, unsigned int srcLen,
+                                         unsigned int dstLen, unsigned int sub,
+                                         unsigned int phase) {
+    return (int32_t) (floorDiv(fixedTapPos(i, srcLen, dstLen, sub, phase),
+                               FILTER_ONE) -
+                      floorDiv(fixedTapPos(0, srcLen, dstLen, sub, phase),
+                               FILTER_ONE));
+}
+
+/**
+ * brief Weight of the second tap of a destination sample.
+ */
+static ALWAYS_INLINE uint16_t fixedTapFrac(unsigned int i, unsigned int srcLen,
+                                           unsigned int dstLen,
+                                           unsigned int sub,
+                                           unsigned int phase) {
+    int64_t pos = fixedTapPos(i, srcLen, dstLen, sub, phase);
+    return (uint16_t) (pos - floorDiv(pos, FILTER_ONE) * FILTER_ONE);
+}
+
+#if defined(__ARM_NEON)
+/**
+ * brief Weights of the second taps of 8 destination samples.
+ */
+static ALWAYS_INLINE uint16x8_t fixedFracNeon(unsigned int x,
+                                              unsigned int srcLen,
+                                              unsigned int dstLen,
+                                              unsigned int sub,
+                                              unsigned int phase) {
+    uint64_t lanes[2] = {0, 0};
+    FIXED_UNROLL
+    for (unsigned int i = 0; i < 8; i++) {
+        lanes[i / 4] |=
+            (uint64_t) fixedTapFrac(x + i, srcLen, dstLen, sub, phase)
+            << (16 * (i % 4));
+    }
+    return vcombine_u16(vcreate_u16(lanes[0]), vcreate_u16(lanes[1]));
+}
+#elif defined(__SSE2__)
+/**
+ * brief Tap weights of 8 destination samples for lerpTapsSse().
+ */
+static ALWAYS_INLINE void fixedWeightsSse(unsigned int x, unsigned int srcLen,
+                                          unsigned int dstLen,
+                                          unsigned int sub,
+                                          unsigned int phase,
+                                          __m128i weights[2]) {
+    uint64_t lanes[4] = {0, 0, 0, 0};
+    FIXED_UNROLL
+    for (unsigned int i = 0; i < 8; i++) {
+        uint64_t f = fixedTapFrac(x + i, srcLen, dstLen, sub, phase);
+        lanes[i / 2] |= ((FILTER_ONE - f) | f << 16) << (32 * (i % 2));
+    }
+    weights[0] = _mm_set_epi64x((int64_t) lanes[1], (int64_t) lanes[0]);
+    weights[1] = _mm_set_epi64x((int64_t) lanes[3], (int64_t) lanes[2]);
+}
+#endif
+
+#if defined(__ARM_NEON)
+/**
+ * brief Byte offsets of the taps of 8 destination samples from the first
+ * tap of sample x, packed as table indices.
+ *
+ * param x First destination sample.
+ * param srcLen Crop width in luma samples.
+ * param dstLen Destination width.
+ * param sub 1 for luma and 2 for chroma taps, also the bytes per sample.
+ * param phase 1 if the crop starts halfway into a chroma sample.
+ * param add Byte to select within the taps, e.g. sub for the second tap.
+ * return Indices for vtbl2_u8() or vtbl4_u8().
+ */
+static ALWAYS_INLINE uint8x8_t fixedTableIdx(unsigned int x,
+                                             unsigned int srcLen,
+                                             unsigned int dstLen,
+                                             unsigned int sub,
+                                             unsigned int phase,
+                                             unsigned int add) {
+    uint64_t bytes = 0;
+    int32_t base = fixedTapIdx(x, srcLen, dstLen, sub, phase);
+    FIXED_UNROLL
+    for (unsigned int i = 0; i < 8; i++) {
+        int32_t idx = fixedTapIdx(x + i, srcLen, dstLen, sub, phase);
+        bytes |= (uint64_t) (sub * (idx - base) + add) << (8 * i);
+    }
+    return vcreate_u8(bytes);
+}
+
+/**
+ * brief Load a lookup table of TAP_TABLE_BYTES bytes.
+ */
+static ALWAYS_INLINE uint8x8x4_t loadTapTable(const uint8_t* p) {
+    uint8x16_t lo = vld1q_u8(p);
+    uint8x16_t hi = vld1q_u8(p + 16);
+    uint8x8x4_t table = {{vget_low_u8(lo), vget_high_u8(lo), vget_low_u8(hi),
+                          vget_high_u8(hi)}};
+    return table;
+}
+#endif
+
+/**
+ * brief Horizontal luma taps with the geometry fixed at compile time.
+ *
+ * Inlined into one filter per IMG_FIXED_KERNELS entry. Once the loops are
+ * unrolled all tap offsets and weights are constants. With NEON, blocks of
+ * 8 samples whose taps fit in TAP_TABLE_BYTES are gathered with table
+ * lookups from one or two vector loads.
+ *
+ * param lumaRow Vertically filtered luma span.
+ * param dst Output luma row.
+ * param srcLen Crop width.
+ * param dstLen Destination width.
+ */
+static ALWAYS_INLINE void lumaTapsFixed(const uint8_t* lumaRow, uint8_t* dst,
+                                        const unsigned int srcLen,
+                                        const unsigned int dstLen) {
+    unsigned int x = 0;
+#if defined(__ARM_NEON) || defined(__SSE2__)
+    FIXED_UNROLL
+    for (; x + 8 <= dstLen; x += 8) {
+        int32_t idx[8];
+        FIXED_UNROLL
+        for (unsigned int i = 0; i < 8; i++) {
+            idx[i] = fixedTapIdx(x + i, srcLen, dstLen, 1, 0);
+        }
+#if defined(__ARM_NEON)
+        uint16x8_t frac = fixedFracNeon(x, srcLen, dstLen, 1, 0);
+        // Both taps of the last sample must be in the table.
+        unsigned int span = (unsigned int) (idx[7] - idx[0]) + 2;
+        if (span <= 16) {
+            uint8x16_t t = vld1q_u8(lumaRow + idx[0]);
+            uint8x8x2_t table = {{vget_low_u8(t), vget_high_u8(t)}};
+            uint8x8_t a = vtbl2_u8(table, fixedTableIdx(x, srcLen, dstLen, 1, 0, 0));
+            uint8x8_t b = vtbl2_u8(table, fixedTableIdx(x, srcLen, dstLen, 1, 0, 1));
+            vst1_u8(dst + x, lerpTapsNeon(a, b, frac));
+        } else if (span <= TAP_TABLE_BYTES) {
+            uint8x8x4_t table = loadTapTable(lumaRow + idx[0]);
+            uint8x8_t a = vtbl4_u8(table, fixedTableIdx(x, srcLen, dstLen, 1, 0, 0));
+            uint8x8_t b = vtbl4_u8(table, fixedTableIdx(x, srcLen, dstLen, 1, 0, 1));
+            vst1_u8(dst + x, lerpTapsNeon(a, b, frac));
+        } else {
+            vst1_u8(dst + x, lumaTapsNeon(lumaRow, idx, frac));
+        }
+#else
+        __m128i weights[2];
+        fixedWeightsSse(x, srcLen, dstLen, 1, 0, weights);
+        _mm_storel_epi64((__m128i*) (dst + x),
+                         lumaTapsSse(lumaRow, idx, weights));
+#endif
+    }
+#endif
+    FIXED_UNROLL
+    for (; x < dstLen; x++) {
+        dst[x] = lumaTap(lumaRow + fixedTapIdx(x, srcLen, dstLen, 1, 0),
+                         fixedTapFrac(x, srcLen, dstLen, 1, 0));
+    }
+}
+
+/**
+ * brief Horizontal chroma taps with the geometry fixed at compile time.
+ *
+ * Like lumaTapsFixed(), for the UV span. With NEON the table lookups also
+ * split U from V.
+ *
+ * param uvRow Vertically filtered UV span.
+ * param dstU Output U row.
+ * param dstV Output V row.
+ * param srcLen Crop width in luma samples.
+ * param dstLen Destination width.
+ * param phase 1 if the crop starts halfway into a chroma sample.
+ */
+static ALWAYS_INLINE void chromaTapsFixed(const uint8_t* uvRow, uint8_t* dstU,
+                                          uint8_t* dstV,
+                                          const unsigned int srcLen,
+                                          const unsigned int dstLen,
+                                          const unsigned int phase) {
+    unsigned int x = 0;
+#if defined(__ARM_NEON) || defined(__SSE2__)
+    FIXED_UNROLL
+    for (; x + 8 <= dstLen; x += 8) {
+        int32_t idx[8];
+        FIXED_UNROLL
+        for (unsigned int i = 0; i < 8; i++) {
+            idx[i] = fixedTapIdx(x + i, srcLen, dstLen, 2, phase);
+        }
+#if defined(__ARM_NEON)
+        uint16x8_t frac = fixedFracNeon(x, srcLen, dstLen, 2, phase);
+        // Both UV pairs of the last sample must be in the table.
+        unsigned int span = 2 * (unsigned int) (idx[7] - idx[0]) + 4;
+        uint8x8_t u;
+        uint8x8_t v;
+        if (span <= TAP_TABLE_BYTES) {
+            uint8x8x4_t table = loadTapTable(uvRow + 2 * idx[0]);
+            u = lerpTapsNeon(
+                vtbl4_u8(table, fixedTableIdx(x, srcLen, dstLen, 2, phase, 0)),
+                vtbl4_u8(table, fixedTableIdx(x, srcLen, dstLen, 2, phase, 2)),
+                frac);
+            v = lerpTapsNeon(
+                vtbl4_u8(table, fixedTableIdx(x, srcLen, dstLen, 2, phase, 1)),
+                vtbl4_u8(table, fixedTableIdx(x, srcLen, dstLen, 2, phase, 3)),
+                frac);
+        } else {
+            chromaTapsNeon(uvRow, idx, frac, &u, &v);
+        }
+        vst1_u8(dstU + x, u);
+        vst1_u8(dstV + x, v);
+#else
+        __m128i weights[2];
+        __m128i u;
+        __m128i v;
+        fixedWeightsSse(x, srcLen, dstLen, 2, phase, weights);
+        chromaTapsSse(uvRow, idx, weights, &u, &v);
+        _mm_storel_epi64((__m128i*) (dstU + x), _mm_packus_epi16(u, u));
+        _mm_storel_epi64((__m128i*) (dstV + x), _mm_packus_epi16(v, v));
+#endif
+    }
+#endif
+    FIXED_UNROLL
+    for (; x < dstLen; x++) {
+        chromaTap(uvRow + 2 * fixedTapIdx(x, srcLen, dstLen, 2, phase),
+                  fixedTapFrac(x, srcLen, dstLen, 2, phase), &dstU[x],
+                  &dstV[x]);
+    }
+}
+
+/// Center crop width of computeCrop() for a stream and model size.
+#define FIXED_CROP_WIDTH(sw, sh, dw, dh)                                     \
+    ((sw) * (dh) > (sh) * (dw) ? (sh) * (dw) / (dh) : (sw))
+
+/// 1 if the center crop starts halfway into a chroma sample.
+#define FIXED_CROP_PHASE(sw, sh, dw, dh)                                     \
+    ((((sw) - FIXED_CROP_WIDTH(sw, sh, dw, dh)) / 2) % 2)
+
+/// Defines the filters of one IMG_FIXED_KERNELS entry.
+#define DEFINE_FIXED_KERNEL(sw, sh, dw, dh)                                  \
+    _Static_assert((dw) <= FIXED_MAX_WIDTH, "Fixed kernel too wide");        \
+    static void lumaTaps##sw##x##sh##to##dw##x##dh(const uint8_t* lumaRow,   \
+                                                   uint8_t* dst) {           \
+        lumaTapsFixed(lumaRow, dst, FIXED_CROP_WIDTH(sw, sh, dw, dh), dw);   \
+    }                                                                        \
+    static void chromaTaps##sw##x##sh##to##dw##x##dh(                        \
+        const uint8_t* uvRow, uint8_t* dstU, uint8_t* dstV) {                \
+        chromaTapsFixed(uvRow, dstU, dstV, FIXED_CROP_WIDTH(sw, sh, dw, dh), \
+                        dw, FIXED_CROP_PHASE(sw, sh, dw, dh));               \
+    }
+IMG_FIXED_KERNELS(DEFINE_FIXED_KERNEL)
+#undef DEFINE_FIXED_KERNEL
+
+#define FIXED_KERNEL_ENTRY(sw, sh, dw, dh)                                   \
+    {sw,                                                                     \
+     sh,                                                                     \
+     dw,                                                                     \
+     dh,                                                                     \
+     FIXED_CROP_WIDTH(sw, sh, dw, dh),                                       \
+     FIXED_CROP_PHASE(sw, sh, dw, dh),                                       \
+     lumaTaps##sw##x##sh##to##dw##x##dh,                                     \
+     chromaTaps##sw##x##sh##to##dw##x##dh},
+
+/// All fixed kernels, ended by an entry with dstWidth 0.
+static const FixedKernel fixedKernels[] = {
+    IMG_FIXED_KERNELS(FIXED_KERNEL_ENTRY){0, 0, 0, 0, 0, 0, NULL, NULL}};
+#undef FIXED_KERNEL_ENTRY
+
+static const FixedKernel* findFixedKernel(const ImgConverter_t* converter) {
+    const ScaleMap* map = &converter->geometry.map;
+
+    for (const FixedKernel* k = fixedKernels; k->dstWidth; k++) {
+        if (k->srcWidth != converter->srcWidth ||
+            k->srcHeight != converter->srcHeight ||
+            k->dstWidth != map->dstWidth ||
+            k->dstHeight != converter->dstHeight) {
+            continue;
+        }
+
+        // The float crop and scaling of the generic path can round
+        // differently, in which case the generic filters are used.
+        bool match = true;
+        for (unsigned int i = 0; match && i < map->dstWidth; i++) {
+            match = map->xIdx[i] ==
+                        fixedTapIdx(i, k->cropWidth, k->dstWidth, 1, 0) &&
+                    map->xFrac[i] ==
+                        fixedTapFrac(i, k->cropWidth, k->dstWidth, 1, 0) &&
+                    map->cxIdx[i] == fixedTapIdx(i, k->cropWidth, k->dstWidth,
+                                                 2, k->chromaPhase) &&
+                    map->cxFrac[i] == fixedTapFrac(i, k->cropWidth,
+                                                   k->dstWidth, 2,
+                                                   k->chromaPhase);
+        }
+        if (match) {
+            return k;
+        }
+    }
+
+    return NULL;
+}
+
+static void cropScaleNv12ToRGB(const ScaleMap* map, const FixedKernel* fixed,
+                               const OutputFormat* output,
+                               ScaleScratch* scratch, const Nv12Planes* src,
+                               uint8_t* outData, unsigned int rowStart,
+                               unsigned int rowEnd) {
+    const unsigned int dstWidth = map->dstWidth;
+
+    // A new frame (or band) invalidates the cached chroma rows.
+    scratch->cachedCy = -1;
+
+    for (unsigned int y = rowStart; y < rowEnd; y++) {
+        if (fixed) {
+            blendLumaSpan(map, scratch->lumaRow, src->y, src->yPitch, y);
+            fixed->lumaTaps(scratch->lumaRow, scratch->dstY);
+        } else {
+            scaleLumaRow(map, scratch->lumaRow, src->y, src->yPitch, y,
+                         scratch->dstY, dstWidth);
+        }
+
+        // Chroma: consecutive output rows often share the same source rows
+        // and weight, in which case the previous U/V rows are still valid.
+        if (map->cyIdx[y] != scratch->cachedCy ||
+            map->cyFrac[y] != scratch->cachedCyFrac) {
+            scratch->cachedCy = map->cyIdx[y];
+            scratch->cachedCyFrac = map->cyFrac[y];
+            if (fixed) {
+                blendChromaSpan(map, scratch->uvRow, src->uv, src->uvPitch,
+                                scratch->cachedCy, scratch->cachedCyFrac);
+                fixed->chromaTaps(scratch->uvRow, scratch->dstU,
+                                  scratch->dstV);
+            } else {
+                scaleChromaRow(map, scratch->uvRow, src->uv, src->uvPitch,
+                               scratch->cachedCy, scratch->cachedCyFrac,
+                               scratch->dstU, scratch->dstV, 1, dstWidth);
+            }
+        }
+
+        writeOutputRow(output, scratch, dstWidth, y, outData);
+    }
+}
+
+static void cropScaleHalfChroma(const ScaleMap* map, const ScaleMap* halfMap,
+                                const OutputFormat* output,
+                                ScaleScratch* scratch, const Nv12Planes* src,
+                                uint8_t* outData, unsigned int rowStart,
+                                unsigned int rowEnd) {
+    const unsigned int dstWidth = map->dstWidth;
+    const unsigned int halfWidth = halfMap->dstWidth;
+
+    scratch->cachedCy = -1;
+
+    for (unsigned int y = rowStart; y < rowEnd; y++) {
+        scaleLumaRow(map, scratch->lumaRow, src->y, src->yPitch, y,
+                     scratch->dstY, dstWidth);
+
+        // Output rows 2n and 2n + 1 share chroma row n.
+        int32_t cy = (int32_t) (y / 2);
+        if (cy != scratch->cachedCy) {
+            scratch->cachedCy = cy;
+            scaleChromaRow(halfMap, scratch->uvRow, src->uv, src->uvPitch,
+                           halfMap->cyIdx[cy], halfMap->cyFrac[cy],
+                           scratch->dstU, scratch->dstV, 1, halfWidth);
+
+            // Repeat each sample for two pixels, from the end so that no
+            // sample is overwritten before it is read.
+            for (unsigned int x = dstWidth; x-- > 0;) {
+                scratch->dstU[x] = scratch->dstU[x / 2];
+                scratch->dstV[x] = scratch->dstV[x / 2];
+            }
+        }
+
+        writeOutputRow(output, scratch, dstWidth, y, outData);
+    }
+}
+
+static void nv12ScaleBand(void* ctx, unsigned int band, unsigned int rowStart,
+                          unsigned int rowEnd) {
+    const Nv12ScaleJob* job = (const Nv12ScaleJob*) ctx;
+    const ImgNv12Scaler_t* scaler = job->scaler;
+    const ScaleMap* map = &scaler->geometry.map;
+    const ScaleMap* halfMap = &scaler->geometry.halfMap;
+    ScaleScratch* scratch = &scaler->scratch[band];
+    const Nv12Planes* src = &job->src;
+    const unsigned int dstWidth = scaler->dstWidth;
+    uint8_t* dstUv = job->dstData + (size_t) dstWidth * scaler->dstHeight;
+
+    for (unsigned int y = rowStart; y < rowEnd; y++) {
+        scaleLumaRow(map, scratch->lumaRow, src->y, src->yPitch, y,
+                     job->dstData + (size_t) y * dstWidth, dstWidth);
+    }
+
+    // Bands start on even rows, so each band owns its chroma rows.
+    for (unsigned int cy = rowStart / 2; cy < (rowEnd + 1) / 2; cy++) {
+        uint8_t* uvRow = dstUv + (size_t) cy * dstWidth;
+        scaleChromaRow(halfMap, scratch->uvRow, src->uv, src->uvPitch,
+                       halfMap->cyIdx[cy], halfMap->cyFrac[cy], uvRow,
+                       uvRow + 1, 2, halfMap->dstWidth);
+    }
+}
+
+static void writeOutputRow(const OutputFormat* output, ScaleScratch* scratch,
+                           unsigned int width, unsigned int y,
+                           uint8_t* outData) {
+    uint8_t* rowData = outData + (size_t) y * output->rowPitch;
+
+    if (output->plainRGB) {
+        yuvRowToRGB(scratch->dstY, scratch->dstU, scratch->dstV,
+                    output->color, rowData, width);
+        return;
+    }
+
+    const uint8_t* planes[3] = {scratch->rgbR, scratch->rgbG, scratch->rgbB};
+    yuvRowToPlanarRGB(scratch->dstY, scratch->dstU, scratch->dstV,
+                      output->color, scratch->rgbR, scratch->rgbG,
+                      scratch->rgbB, width);
+
+    if (output->layout == IMG_LAYOUT_CHW) {
+        for (int c = 0; c < 3; c++) {
+            const uint8_t* src = planes[c];
+            uint8_t* dst = rowData + c * output->planePitch;
+            if (output->dataType == IMG_DTYPE_FLOAT32) {
+                const float* lut = output->lutF32[c];
+                float* dstF = (float*) dst;
+                for (unsigned int x = 0; x < width; x++) {
+                    dstF[x] = lut[src[x]];
+                }
+            } else {
+                const uint8_t* lut = output->lutU8[c];
+                for (unsigned int x = 0; x < width; x++) {
+                    dst[x] = lut[src[x]];
+                }
+            }
+        }
+        return;
+    }
+
+    if (output->dataType == IMG_DTYPE_FLOAT32) {
+        float* dstF = (float*) rowData;
+        for (unsigned int x = 0; x < width; x++) {
+            dstF[3 * x] = output->lutF32[0][planes[0][x]];
+            dstF[3 * x + 1] = output->lutF32[1][planes[1][x]];
+            dstF[3 * x + 2] = output->lutF32[2][planes[2][x]];
+        }
+    } else {
+        for (unsigned int x = 0; x < width; x++) {
+            rowData[3 * x] = output->lutU8[0][planes[0][x]];
+            rowData[3 * x + 1] = output->lutU8[1][planes[1][x]];
+            rowData[3 * x + 2] = output->lutU8[2][planes[2][x]];
+        }
+    }
+}
+
+static bool initOutputFormat(const ImgTensorDesc_t* desc, unsigned int width,
+                             unsigned int height, OutputFormat* output) {
+    size_t elemSize = desc->dataType == IMG_DTYPE_FLOAT32 ? sizeof(float) : 1;
+    size_t minRowPitch = (size_t) width * elemSize *
+                         (desc->layout == IMG_LAYOUT_HWC ? 3 : 1);
+
+    if (desc->layout != IMG_LAYOUT_HWC && desc->layout != IMG_LAYOUT_CHW) {
+        syslog(LOG_ERR, "%s: Unsupported layout %d", __func__, desc->layout);
+        return false;
+    }
+    if (desc->dataType != IMG_DTYPE_UINT8 && desc->dataType != IMG_DTYPE_INT8 &&
+        desc->dataType != IMG_DTYPE_FLOAT32) {
+        syslog(LOG_ERR, "%s: Unsupported data type %d", __func__,
+               desc->dataType);
+        return false;
+    }
+    if (desc->dataType != IMG_DTYPE_FLOAT32 && desc->quantScale == 0.0f) {
+        syslog(LOG_ERR, "%s: Quantization scale must not be 0", __func__);
+        return false;
+    }
+    for (int c = 0; c < 3; c++) {
+        if (desc->std[c] == 0.0f) {
+            syslog(LOG_ERR, "%s: Standard deviation must not be 0", __func__);
+            return false;
+        }
+    }
+
+    output->layout = desc->layout;
+    output->dataType = desc->dataType;
+    output->rowPitch = desc->rowPitch ? desc->rowPitch : minRowPitch;
+    output->planePitch =
+        desc->planePitch ? desc->planePitch : output->rowPitch * height;
+
+    if (output->rowPitch < minRowPitch ||
+        (desc->layout == IMG_LAYOUT_CHW &&
+         output->planePitch < output->rowPitch * height)) {
+        syslog(LOG_ERR, "%s: Pitches too small for %u x %u output", __func__,
+               width, height);
+        return false;
+    }
+    if (desc->dataType == IMG_DTYPE_FLOAT32 &&
+        (output->rowPitch % sizeof(float) || output->planePitch % sizeof(float))) {
+        syslog(LOG_ERR, "%s: Float pitches must be a multiple of %zu", __func__,
+               sizeof(float));
+        return false;
+    }
+
+    const int qMin = desc->dataType == IMG_DTYPE_INT8 ? -128 : 0;
+    const int qMax = desc->dataType == IMG_DTYPE_INT8 ? 127 : 255;
+    bool identity = desc->dataType == IMG_DTYPE_UINT8;
+    for (int c = 0; c < 3; c++) {
+        for (int v = 0; v < 256; v++) {
+            float norm = ((float) v - desc->mean[c]) / desc->std[c];
+            output->lutF32[c][v] = norm;
+
+            long q = lroundf(norm / desc->quantScale) + desc->quantZeroPoint;
+            q = q < qMin ? qMin : (q > qMax ? qMax : q);
+            // Stored as the bit pattern of the output type.
+            output->lutU8[c][v] = (uint8_t) (int8_t) q;
+            identity = identity && q == v;
+        }
+    }
+
+    output->plainRGB = identity && desc->layout == IMG_LAYOUT_HWC;
+    output->color = getYuvLut(IMG_MATRIX_BT601, IMG_RANGE_LIMITED);
+
+    return true;
+}
+
+static void writePadSpan(const OutputFormat* output, const uint8_t* padRow,
+                         unsigned int width, unsigned int y, unsigned int x0,
+                         unsigned int x1, uint8_t* outData) {
+    size_t elemSize = output->dataType == IMG_DTYPE_FLOAT32 ? sizeof(float) : 1;
+    uint8_t* rowData = outData + (size_t) y * output->rowPitch;
+
+    if (x1 <= x0) {
+        return;
+    }
+
+    if (output->layout == IMG_LAYOUT_HWC) {
+        size_t pixelSize = 3 * elemSize;
+        memcpy(rowData + x0 * pixelSize, padRow + x0 * pixelSize,
+               (x1 - x0) * pixelSize);
+        return;
+    }
+
+    for (int c = 0; c < 3; c++) {
+        memcpy(rowData + c * output->planePitch + x0 * elemSize,
+               padRow + (c * (size_t) width + x0) * elemSize,
+               (x1 - x0) * elemSize);
+    }
+}
+
+static void cropScaleRows(const ImgConverter_t* converter,
+                          const CropGeometry* geometry, ScaleScratch* scratch,
+                          const Nv12Planes* src, uint8_t* outData,
+                          unsigned int rowStart, unsigned int rowEnd) {
+    const OutputFormat* output = &converter->output;
+    const unsigned int* content = geometry->content;
+    const unsigned int dstWidth = converter->dstWidth;
+
+    // Rows of this band that hold scaled image data, the rest is padding.
+    unsigned int contentStart = rowStart > content[1] ? rowStart : content[1];
+    unsigned int contentEnd = rowEnd < content[1] + content[3] ?
+                                  rowEnd :
+                                  content[1] + content[3];
+
+    for (unsigned int y = rowStart; y < rowEnd; y++) {
+        if (y < contentStart || y >= contentEnd) {
+            writePadSpan(output, converter->padRow, dstWidth, y, 0, dstWidth,
+                         outData);
+        } else if (content[2] < dstWidth) {
+            writePadSpan(output, converter->padRow, dstWidth, y, 0,
+                         content[0], outData);
+            writePadSpan(output, converter->padRow, dstWidth, y,
+                         content[0] + content[2], dstWidth, outData);
+        }
+    }
+
+    if (contentStart >= contentEnd) {
+        return;
+    }
+
+    // The ScaleMap covers the content rectangle only, so offset the output
+    // to its top left corner.
+    size_t elemSize = output->dataType == IMG_DTYPE_FLOAT32 ? sizeof(float) : 1;
+    size_t pixelSize = output->layout == IMG_LAYOUT_HWC ? 3 * elemSize : elemSize;
+    uint8_t* contentData =
+        outData + content[1] * output->rowPitch + content[0] * pixelSize;
+
+    if (converter->scalePath == IMG_SCALE_NV12_FIRST) {
+        cropScaleHalfChroma(&geometry->map, &geometry->halfMap, output,
+                            scratch, src, contentData,
+                            contentStart - content[1], contentEnd - content[1]);
+    } else {
+        cropScaleNv12ToRGB(&geometry->map, geometry->fixed, output, scratch,
+                           src, contentData, contentStart - content[1],
+                           contentEnd - content[1]);
+    }
+}
+
+static void cropScaleBand(void* ctx, unsigned int band, unsigned int rowStart,
+                          unsigned int rowEnd) {
+    const CropScaleJob* job = (const CropScaleJob*) ctx;
+    const ImgConverter_t* converter = job->converter;
+
+    cropScaleRows(converter, &converter->geometry, &converter->scratch[band],
+                  &job->src, job->outData, rowStart, rowEnd);
+}
+
+static void roiBand(void* ctx, unsigned int band, unsigned int rowStart,
+                    unsigned int rowEnd) {
+    const RoiJob* job = (const RoiJob*) ctx;
+    const ImgConverter_t* converter = job->converter;
+    const unsigned int dstHeight = converter->dstHeight;
+
+    // A band can span the end of one slot and the start of the next.
+    while (rowStart < rowEnd) {
+        unsigned int slot = rowStart / dstHeight;
+        unsigned int y0 = rowStart - slot * dstHeight;
+        unsigned int y1 = y0 + (rowEnd - rowStart);
+        if (y1 > dstHeight) {
+            y1 = dstHeight;
+        }
+
+        cropScaleRows(converter, &converter->roiGeometry[slot],
+                      &converter->scratch[band], &job->src,
+                      job->outData + slot * job->slotSize, y0, y1);
+        rowStart += y1 - y0;
+    }
+}
+
+static bool updateCropGeometry(const ImgConverter_t* converter,
+                               const unsigned int roi[4],
+                               CropGeometry* geometry) {
+    return fillCropGeometry(geometry, converter->cropPolicy,
+                            converter->srcWidth, converter->srcHeight, roi,
+                            converter->dstWidth, converter->dstHeight);
+}
+
+static bool initCropGeometry(CropGeometry* geometry, unsigned int dstWidth,
+                             unsigned int dstHeight) {
+    memset(geometry, 0, sizeof(*geometry));
+
+    if (!initScaleMap(&geometry->map, dstWidth, dstHeight) ||
+        !initScaleMap(&geometry->halfMap, (dstWidth + 1) / 2,
+                      (dstHeight + 1) / 2)) {
+        clearCropGeometry(geometry);
+        return false;
+    }
+
+    return true;
+}
+
+static void clearCropGeometry(CropGeometry* geometry) {
+    clearScaleMap(&geometry->map);
+    clearScaleMap(&geometry->halfMap);
+}
+
+static bool fillCropGeometry(CropGeometry* geometry, ImgCropPolicy policy,
+                             unsigned int srcWidth, unsigned int srcHeight,
+                             const unsigned int roi[4], unsigned int dstWidth,
+                             unsigned int dstHeight) {
+    computeCrop(policy, roi[2], roi[3], dstWidth, dstHeight, geometry->crop,
+                geometry->content);
+    geometry->crop[0] += roi[0];
+    geometry->crop[1] += roi[1];
 
-    ARGBtoRAW(tempARGBsmall, rgbData, dstWidth, dstHeight);
+    const unsigned int* content = geometry->content;
+    return updateScaleMap(&geometry->map, srcWidth, srcHeight, geometry->crop,
+                          content[2], content[3]) &&
+           updateScaleMap(&geometry->halfMap, srcWidth, srcHeight,
+                          geometry->crop, (content[2] + 1) / 2,
+                          (content[3] + 1) / 2);
+}
 
-    ret = true;
+static void fillPadRow(ImgConverter_t* converter) {
+    const OutputFormat* output = &converter->output;
+    const unsigned int width = converter->dstWidth;
 
-end:
-    if (tempARGBbig) {
-        free(tempARGBbig);
-        tempARGBbig = NULL;
+    for (int c = 0; c < 3; c++) {
+        uint8_t v = converter->padColor[c];
+        for (unsigned int x = 0; x < width; x++) {
+            // Element index of channel c at column x.
+            size_t i = output->layout == IMG_LAYOUT_HWC ?
+                           3 * (size_t) x + c :
+                           c * (size_t) width + x;
+            if (output->dataType == IMG_DTYPE_FLOAT32) {
+                ((float*) converter->padRow)[i] = output->lutF32[c][v];
+            } else {
+                converter->padRow[i] = output->lutU8[c][v];
+            }
+        }
     }
-    if (tempARGBsmall) {
-        free(tempARGBsmall);
-        tempARGBsmall = NULL;
+}
+
+bool convertCropScaleU8yuvToRGB(const uint8_t* nv12Data, unsigned int srcWidth,
+                                unsigned int srcHeight,
+                                const ImgNv12Layout_t* layout,
+                                uint8_t* rgbData, unsigned int dstWidth,
+                                unsigned int dstHeight) {
+    ImgConverter_t* converter = createImgConverter(
+        srcWidth, srcHeight, dstWidth, dstHeight, IMG_CROP_CENTER);
+    if (!converter) {
+        return false;
     }
 
+    bool ret = setImgConverterSourceLayout(converter, layout) &&
+               convertFrame(converter, nv12Data, rgbData);
+
+    destroyImgConverter(converter);
+
     return ret;
 }
+
+ImgConverter_t* createImgConverter(unsigned int srcWidth,
+                                   unsigned int srcHeight,
+                                   unsigned int dstWidth,
+                                   unsigned int dstHeight,
+                                   ImgCropPolicy cropPolicy) {
+    ImgConverter_t* converter = calloc(1, sizeof(ImgConverter_t));
+    if (!converter) {
+        syslog(LOG_ERR, "%s: Unable to allocate ImgConverter: %s", __func__,
+               strerror(errno));
+        return NULL;
+    }
+
+    converter->srcWidth = srcWidth;
+    converter->srcHeight = srcHeight;
+    converter->dstWidth = dstWidth;
+    converter->dstHeight = dstHeight;
+    converter->cropPolicy = cropPolicy;
+    initImgNv12Layout(&converter->srcLayout, srcWidth, srcHeight);
+
+    const unsigned int frame[4] = {0, 0, srcWidth, srcHeight};
+    if (!initCropGeometry(&converter->geometry, dstWidth, dstHeight) ||
+        !updateCropGeometry(converter, frame, &converter->geometry)) {
+        goto errorExit;
+    }
+
+    ImgTensorDesc_t desc;
+    initImgTensorDesc(&desc);
+    if (!initOutputFormat(&desc, dstWidth, dstHeight, &converter->output)) {
+        goto errorExit;
+    }
+
+    // Large enough for a row in any output format.
+    if (posix_memalign((void**) &converter->padRow, SCRATCH_ALIGN,
+                       ALIGN_UP((size_t) dstWidth * 3 * sizeof(float)))) {
+        syslog(LOG_ERR, "%s: Failed allocating pad row", __func__);
+        converter->padRow = NULL;
+        goto errorExit;
+    }
+    fillPadRow(converter);
+
+    if (!setImgConverterPool(converter, NULL)) {
+        goto errorExit;
+    }
+
+    converter->geometry.fixed = findFixedKernel(converter);
+
+    syslog(LOG_INFO, "%s: Converting %u x %u to %u x %u using crop X=%u Y=%u "
+           "(%u x %u)", __func__, srcWidth, srcHeight, dstWidth, dstHeight,
+           converter->geometry.crop[0], converter->geometry.crop[1],
+           converter->geometry.crop[2], converter->geometry.crop[3]);
+    if (cropPolicy == IMG_CROP_LETTERBOX) {
+        syslog(LOG_INFO, "%s: Letterbox image at X=%u Y=%u (%u x %u)", __func__,
+               converter->geometry.content[0], converter->geometry.content[1],
+               converter->geometry.content[2], converter->geometry.content[3]);
+    }
+    if (converter->geometry.fixed) {
+        syslog(LOG_INFO, "%s: Using horizontal filters fixed at compile time",
+               __func__);
+    }
+
+    return converter;
+
+errorExit:
+    destroyImgConverter(converter);
+
+    return NULL;
+}
+
+void destroyImgConverter(ImgConverter_t* converter) {
+    if (!converter) {
+        return;
+    }
+
+    clearCropGeometry(&converter->geometry);
+    for (unsigned int i = 0; i < converter->numRoiGeometry; i++) {
+        clearCropGeometry(&converter->roiGeometry[i]);
+    }
+    free(converter->roiGeometry);
+    free(converter->padRow);
+    destroyBandScratch(converter->scratch, converter->numScratch);
+
+    free(converter);
+}
+
+bool convertFrame(ImgConverter_t* converter, const uint8_t* nv12Data,
+                  uint8_t* outData) {
+    if (!converter || !nv12Data || !outData) {
+        syslog(LOG_ERR, "%s: Invalid arguments", __func__);
+        return false;
+    }
+
+    CropScaleJob job = {converter,
+                        getNv12Planes(nv12Data, &converter->srcLayout,
+                                      converter->srcWidth,
+                                      converter->srcHeight),
+                        outData};
+    runRowPool(converter->pool, cropScaleBand, &job, converter->dstHeight, 2);
+
+    return true;
+}
+
+/**
+ * brief Make sure the converter has a CropGeometry for every ROI.
+ *
+ * param converter Pointer to an ImgConverter.
+ * param numRois Number of ROIs.
+ * return False if any errors occur, otherwise true.
+ */
+static bool reserveRoiGeometry(ImgConverter_t* converter,
+                               unsigned int numRois) {
+    if (numRois <= converter->numRoiGeometry) {
+        return true;
+    }
+
+    CropGeometry* geometry =
+        realloc(converter->roiGeometry, numRois * sizeof(CropGeometry));
+    if (!geometry) {
+        syslog(LOG_ERR, "%s: Unable to allocate ROI geometry: %s", __func__,
+               strerror(errno));
+        return false;
+    }
+    converter->roiGeometry = geometry;
+
+    while (converter->numRoiGeometry < numRois) {
+        if (!initCropGeometry(&geometry[converter->numRoiGeometry],
+                              converter->dstWidth, converter->dstHeight)) {
+            return false;
+        }
+        converter->numRoiGeometry++;
+    }
+
+    return true;
+}
+
+bool convertFrameRois(ImgConverter_t* converter, const uint8_t* nv12Data,
+                      const ImgRoi_t* rois, unsigned int numRois,
+                      uint8_t* outData) {
+    if (!converter || !nv12Data || (numRois && (!rois || !outData))) {
+        syslog(LOG_ERR, "%s: Invalid arguments", __func__);
+        return false;
+    }
+
+    if (!reserveRoiGeometry(converter, numRois)) {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < numRois; i++) {
+        const ImgRoi_t* roi = &rois[i];
+
+        // Clip to the frame, detections often reach past the edges.
+        unsigned int x0 = roi->x < converter->srcWidth ? roi->x :
+                                                          converter->srcWidth;
+        unsigned int y0 = roi->y < converter->srcHeight ? roi->y :
+                                                           converter->srcHeight;
+        unsigned int x1 = roi->width < converter->srcWidth - x0 ?
+                              x0 + roi->width :
+                              converter->srcWidth;
+        unsigned int y1 = roi->height < converter->srcHeight - y0 ?
+                              y0 + roi->height :
+                              converter->srcHeight;
+        // Grow what is left of empty, thin or outside ROIs inside the frame
+        // rather than failing the batch. The source is at least 2x2, which
+        // createImgConverter() checked.
+        if (x1 - x0 < MIN_ROI_SIZE) {
+            x0 = x0 < converter->srcWidth - MIN_ROI_SIZE ?
+                     x0 :
+                     converter->srcWidth - MIN_ROI_SIZE;
+            x1 = x0 + MIN_ROI_SIZE;
+        }
+        if (y1 - y0 < MIN_ROI_SIZE) {
+            y0 = y0 < converter->srcHeight - MIN_ROI_SIZE ?
+                     y0 :
+                     converter->srcHeight - MIN_ROI_SIZE;
+            y1 = y0 + MIN_ROI_SIZE;
+        }
+        const unsigned int rect[4] = {x0, y0, x1 - x0, y1 - y0};
+
+        if (!updateCropGeometry(converter, rect,
+                                &converter->roiGeometry[i])) {
+            syslog(LOG_ERR, "%s: Invalid ROI %u: X=%u Y=%u (%u x %u)",
+                   __func__, i, roi->x, roi->y, roi->width, roi->height);
+            return false;
+        }
+    }
+
+    // All slots form one job, so small ROIs still spread over every band.
+    RoiJob job = {converter,
+                  getNv12Planes(nv12Data, &converter->srcLayout,
+                                converter->srcWidth, converter->srcHeight),
+                  outData, getImgConverterOutputSize(converter)};
+    runRowPool(converter->pool, roiBand, &job, numRois * converter->dstHeight,
+               2);
+
+    return true;
+}
+
+size_t getImgConverterOutputSize(const ImgConverter_t* converter) {
+    const OutputFormat* output = &converter->output;
+
+    if (output->layout == IMG_LAYOUT_CHW) {
+        return 3 * output->planePitch;
+    }
+
+    return output->rowPitch * converter->dstHeight;
+}
+
+bool setImgConverterPool(ImgConverter_t* converter, RowPool_t* pool) {
+    if (!converter) {
+        syslog(LOG_ERR, "%s: Invalid arguments", __func__);
+        return false;
+    }
+
+    unsigned int numScratch;
+    ScaleScratch* scratch = createBandScratch(pool, converter->srcWidth,
+                                              converter->dstWidth, &numScratch);
+    if (!scratch) {
+        return false;
+    }
+
+    destroyBandScratch(converter->scratch, converter->numScratch);
+    converter->scratch = scratch;
+    converter->numScratch = numScratch;
+    converter->pool = pool;
+
+    return true;
+}
+
+static ScaleScratch* createBandScratch(RowPool_t* pool, unsigned int srcWidth,
+                                       unsigned int dstWidth,
+                                       unsigned int* numScratch) {
+    // Each band needs its own scratch rows.
+    unsigned int numBands = getRowPoolBands(pool);
+    ScaleScratch* scratch = calloc(numBands, sizeof(ScaleScratch));
+    if (!scratch) {
+        syslog(LOG_ERR, "%s: Unable to allocate scratch: %s", __func__,
+               strerror(errno));
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < numBands; i++) {
+        if (!initScaleScratch(&scratch[i], srcWidth, dstWidth)) {
+            destroyBandScratch(scratch, i);
+            return NULL;
+        }
+    }
+
+    *numScratch = numBands;
+
+    return scratch;
+}
+
+static void destroyBandScratch(ScaleScratch* scratch, unsigned int numScratch) {
+    if (!scratch) {
+        return;
+    }
+
+    for (unsigned int i = 0; i < numScratch; i++) {
+        clearScaleScratch(&scratch[i]);
+    }
+    free(scratch);
+}
+
+bool setImgConverterScalePath(ImgConverter_t* converter, ImgScalePath path) {
+    if (!converter ||
+        (path != IMG_SCALE_FUSED && path != IMG_SCALE_NV12_FIRST)) {
+        syslog(LOG_ERR, "%s: Invalid arguments", __func__);
+        return false;
+    }
+
+    converter->scalePath = path;
+
+    return true;
+}
+
+bool setImgConverterFixedKernel(ImgConverter_t* converter, bool enable) {
+    if (!converter) {
+        syslog(LOG_ERR, "%s: Invalid arguments", __func__);
+        return false;
+    }
+
+    converter->geometry.fixed = enable ? findFixedKernel(converter) : NULL;
+
+    return converter->geometry.fixed != NULL;
+}
+
+bool setImgConverterSourceLayout(ImgConverter_t* converter,
+                                 const ImgNv12Layout_t* layout) {
+    if (!converter) {
+        syslog(LOG_ERR, "%s: Invalid arguments", __func__);
+        return false;
+    }
+
+    return resolveNv12Layout(layout, converter->srcWidth, converter->srcHeight,
+                             &converter->srcLayout);
+}
+
+ImgNv12Scaler_t* createImgNv12Scaler(unsigned int srcWidth,
+                                     unsigned int srcHeight,
+                                     unsigned int dstWidth,
+                                     unsigned int dstHeight,
+                                     ImgCropPolicy cropPolicy) {
+    if (dstWidth % 2 || dstHeight % 2 || cropPolicy == IMG_CROP_LETTERBOX) {
+        syslog(LOG_ERR, "%s: Destination must be of even size and the crop "
+               "policy must not pad", __func__);
+        return NULL;
+    }
+
+    ImgNv12Scaler_t* scaler = calloc(1, sizeof(ImgNv12Scaler_t));
+    if (!scaler) {
+        syslog(LOG_ERR, "%s: Unable to allocate ImgNv12Scaler: %s", __func__,
+               strerror(errno));
+        return NULL;
+    }
+
+    scaler->srcWidth = srcWidth;
+    scaler->srcHeight = srcHeight;
+    scaler->dstWidth = dstWidth;
+    scaler->dstHeight = dstHeight;
+    initImgNv12Layout(&scaler->srcLayout, srcWidth, srcHeight);
+
+    const unsigned int frame[4] = {0, 0, srcWidth, srcHeight};
+    if (!initCropGeometry(&scaler->geometry, dstWidth, dstHeight) ||
+        !fillCropGeometry(&scaler->geometry, cropPolicy, srcWidth, srcHeight,
+                          frame, dstWidth, dstHeight)) {
+        goto errorExit;
+    }
+
+    if (!setImgNv12ScalerPool(scaler, NULL)) {
+        goto errorExit;
+    }
+
+    return scaler;
+
+errorExit:
+    destroyImgNv12Scaler(scaler);
+
+    return NULL;
+}
+
+void destroyImgNv12Scaler(ImgNv12Scaler_t* scaler) {
+    if (!scaler) {
+        return;
+    }
+
+    clearCropGeometry(&scaler->geometry);
+    destroyBandScratch(scaler->scratch, scaler->numScratch);
+
+    free(scaler);
+}
+
+bool setImgNv12ScalerPool(ImgNv12Scaler_t* scaler, RowPool_t* pool) {
+    if (!scaler) {
+        syslog(LOG_ERR, "%s: Invalid arguments", __func__);
+        return false;
+    }
+
+    unsigned int numScratch;
+    ScaleScratch* scratch = createBandScratch(pool, scaler->srcWidth,
+                                              scaler->dstWidth, &numScratch);
+    if (!scratch) {
+        return false;
+    }
+
+    destroyBandScratch(scaler->scratch, scaler->numScratch);
+    scaler->scratch = scratch;
+    scaler->numScratch = numScratch;
+    scaler->pool = pool;
+
+    return true;
+}
+
+bool setImgNv12ScalerSourceLayout(ImgNv12Scaler_t* scaler,
+                                  const ImgNv12Layout_t* layout) {
+    if (!scaler) {
+        syslog(LOG_ERR, "%s: Invalid arguments", __func__);
+        return false;
+    }
+
+    return resolveNv12Layout(layout, scaler->srcWidth, scaler->srcHeight,
+                             &scaler->srcLayout);
+}
+
+bool scaleNv12Frame(ImgNv12Scaler_t* scaler, const uint8_t* srcData,
+                    uint8_t* dstData) {
+    if (!scaler || !srcData || !dstData) {
+        syslog(LOG_ERR, "%s: Invalid arguments", __func__);
+        return false;
+    }
+
+    Nv12ScaleJob job = {scaler,
+                        getNv12Planes(srcData, &scaler->srcLayout,
+                                      scaler->srcWidth, scaler->srcHeight),
+                        dstData};
+    runRowPool(scaler->pool, nv12ScaleBand, &job, scaler->dstHeight, 2);
+
+    return true;
+}
+
+void initImgNv12Layout(ImgNv12Layout_t* layout, unsigned int width,
+                       unsigned int height) {
+    layout->yOffset = 0;
+    layout->uvOffset = (size_t) width * height;
+    layout->yPitch = width;
+    layout->uvPitch = width;
+}
+
+static Nv12Planes getNv12Planes(const uint8_t* data,
+                                const ImgNv12Layout_t* layout,
+                                unsigned int width, unsigned int height) {
+    ImgNv12Layout_t packed;
+    if (!layout) {
+        initImgNv12Layout(&packed, width, height);
+        layout = &packed;
+    }
+
+    Nv12Planes planes = {data + layout->yOffset, data + layout->uvOffset,
+                         layout->yPitch, layout->uvPitch};
+
+    return planes;
+}
+
+static bool resolveNv12Layout(const ImgNv12Layout_t* layout,
+                              unsigned int width, unsigned int height,
+                              ImgNv12Layout_t* resolved) {
+    if (!layout) {
+        initImgNv12Layout(resolved, width, height);
+        return true;
+    }
+
+    if (layout->yPitch < width || layout->uvPitch < width) {
+        syslog(LOG_ERR, "%s: Pitches Y=%u UV=%u too small for width %u",
+               __func__, layout->yPitch, layout->uvPitch, width);
+        return false;
+    }
+
+    *resolved = *layout;
+
+    return true;
+}
+
+void initImgTensorDesc(ImgTensorDesc_t* desc) {
+    memset(desc, 0, sizeof(*desc));
+
+    desc->layout = IMG_LAYOUT_HWC;
+    desc->dataType = IMG_DTYPE_UINT8;
+    for (int c = 0; c < 3; c++) {
+        desc->mean[c] = 0.0f;
+        desc->std[c] = 1.0f;
+    }
+    desc->quantScale = 1.0f;
+    desc->quantZeroPoint = 0;
+}
+
+bool setImgConverterOutput(ImgConverter_t* converter,
+                           const ImgTensorDesc_t* desc) {
+    if (!converter || !desc) {
+        syslog(LOG_ERR, "%s: Invalid arguments", __func__);
+        return false;
+    }
+
+    OutputFormat output;
+    if (!initOutputFormat(desc, converter->dstWidth, converter->dstHeight,
+                          &output)) {
+        return false;
+    }
+    output.color = converter->output.color;
+    converter->output = output;
+    fillPadRow(converter);
+
+    return true;
+}
+
+bool setImgConverterColor(ImgConverter_t* converter, ImgColorMatrix matrix,
+                          ImgColorRange range) {
+    if (!converter) {
+        syslog(LOG_ERR, "%s: Invalid arguments", __func__);
+        return false;
+    }
+
+    const YuvLut* lut = getYuvLut(matrix, range);
+    if (!lut) {
+        return false;
+    }
+    converter->output.color = lut;
+
+    return true;
+}
+
+void setImgConverterPadColor(ImgConverter_t* converter, uint8_t r, uint8_t g,
+                             uint8_t b) {
+    if (!converter) {
+        return;
+    }
+
+    converter->padColor[0] = r;
+    converter->padColor[1] = g;
+    converter->padColor[2] = b;
+    fillPadRow(converter);
+}
+
+void getImgConverterGeometry(const ImgConverter_t* converter,
+                             unsigned int crop[4], unsigned int content[4]) {
+    for (int i = 0; i < 4; i++) {
+        crop[i] = converter->geometry.crop[i];
+        content[i] = converter->geometry.content[i];
+    }
+}
+
+void mapImgConverterPoint(const ImgConverter_t* converter, float dstX,
+                          float dstY, float* srcX, float* srcY) {
+    const unsigned int* crop = converter->geometry.crop;
+    const unsigned int* content = converter->geometry.content;
+
+    *srcX = crop[0] + (dstX - content[0]) * crop[2] / content[2];
+    *srcY = crop[1] + (dstY - content[1]) * crop[3] / content[3];
+}
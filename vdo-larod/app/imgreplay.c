@@ -0,0 +1,442 @@
+/**
+ * Copyright (C) 2021, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file handles recording frames to file and replaying them.
+ */
+
+#define _GNU_SOURCE
+
+#include "imgreplay.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+struct ImgReplay {
+    /// Start of each frame, in one of the mappings.
+    const uint8_t** frames;
+    unsigned int numFrames;
+    size_t frameSize;
+
+    /// Mapped files, one for a single file recording.
+    void** maps;
+    size_t* mapSizes;
+    unsigned int numMaps;
+
+    double fps;
+    bool loop;
+
+    /// Replay clock, only valid once the first frame has been handed out.
+    uint64_t startUs;
+    bool started;
+    /// Index of the next frame to hand out, counting skipped frames.
+    uint64_t nextIndex;
+};
+
+struct ImgRecorder {
+    int fd;
+    unsigned int width;
+    unsigned int height;
+    unsigned int yPitch;
+    unsigned int uvPitch;
+    size_t uvOffset;
+    /// Packed copy of a padded frame, NULL if frames are already packed.
+    uint8_t* staging;
+    size_t frameSize;
+};
+
+static uint64_t monotonicTimeUs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+/**
+ * brief Map a file of whole frames and add them to a replay.
+ *
+ * param replay Pointer to ImgReplay to add the frames to.
+ * param path File to map.
+ * param single True if the file is the whole recording, false if it is one
+ *               frame of a directory. Entries of a directory that are not
+ *               regular files are skipped.
+ * return False if any errors occur, otherwise true.
+ */
+static bool mapFrames(ImgReplay_t* replay, const char* path, bool single) {
+    bool ret = false;
+    struct stat st;
+
+    // Don't block opening a FIFO, it is rejected below.
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0) {
+        syslog(LOG_ERR, "%s: Unable to open %s: %s", __func__, path,
+               strerror(errno));
+        return false;
+    }
+    if (fstat(fd, &st) < 0) {
+        syslog(LOG_ERR, "%s: Unable to stat %s: %s", __func__, path,
+               strerror(errno));
+        goto end;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        if (single) {
+            syslog(LOG_ERR, "%s: %s is not a regular file", __func__, path);
+        } else {
+            syslog(LOG_INFO, "%s: Skipping %s, not a regular file", __func__,
+                   path);
+            ret = true;
+        }
+        goto end;
+    }
+
+    size_t numFrames = (size_t) st.st_size / replay->frameSize;
+    if (numFrames == 0 || (!single && numFrames != 1)) {
+        syslog(LOG_ERR, "%s: %s holds %lld bytes, not %s of %zu bytes",
+               __func__, path, (long long) st.st_size,
+               single ? "frames" : "one frame", replay->frameSize);
+        goto end;
+    }
+    if ((size_t) st.st_size % replay->frameSize) {
+        syslog(LOG_WARNING, "%s: Ignoring a partial frame at the end of %s",
+               __func__, path);
+    }
+
+    size_t mapSize = numFrames * replay->frameSize;
+    void* map = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        syslog(LOG_ERR, "%s: Unable to map %s: %s", __func__, path,
+               strerror(errno));
+        goto end;
+    }
+    // Start reading ahead, the frames are read in order. The advice values
+    // are not flags, so they are given one at a time.
+    madvise(map, mapSize, MADV_SEQUENTIAL);
+    madvise(map, mapSize, MADV_WILLNEED);
+
+    replay->maps[replay->numMaps] = map;
+    replay->mapSizes[replay->numMaps] = mapSize;
+    replay->numMaps++;
+    for (size_t i = 0; i < numFrames; i++) {
+        replay->frames[replay->numFrames++] =
+            (const uint8_t*) map + i * replay->frameSize;
+    }
+
+    ret = true;
+
+end:
+    close(fd);
+
+    return ret;
+}
+
+/**
+ * brief Filter out directory entries that are known not to be regular files.
+ *
+ * Some file systems don't report the type, those entries are checked by
+ * mapFrames().
+ */
+static int isRegularFile(const struct dirent* entry) {
+    return entry->d_type == DT_REG || entry->d_type == DT_UNKNOWN;
+}
+
+/**
+ * brief Map every file of a directory as one frame, in file name order.
+ *
+ * param replay Pointer to ImgReplay to add the frames to.
+ * param path Directory to map.
+ * return False if any errors occur, otherwise true.
+ */
+static bool mapDirectory(ImgReplay_t* replay, const char* path) {
+    struct dirent** entries = NULL;
+    bool ret = false;
+
+    int numEntries = scandir(path, &entries, isRegularFile, alphasort);
+    if (numEntries < 0) {
+        syslog(LOG_ERR, "%s: Unable to list %s: %s", __func__, path,
+               strerror(errno));
+        return false;
+    }
+    if (numEntries == 0) {
+        syslog(LOG_ERR, "%s: No frames in %s", __func__, path);
+        goto end;
+    }
+
+    replay->frames = calloc((size_t) numEntries, sizeof(*replay->frames));
+    replay->maps = calloc((size_t) numEntries, sizeof(*replay->maps));
+    replay->mapSizes = calloc((size_t) numEntries, sizeof(*replay->mapSizes));
+    if (!replay->frames || !replay->maps || !replay->mapSizes) {
+        syslog(LOG_ERR, "%s: Unable to allocate frame list: %s", __func__,
+               strerror(errno));
+        goto end;
+    }
+
+    for (int i = 0; i < numEntries; i++) {
+        char* filePath = NULL;
+        if (asprintf(&filePath, "%s/%s", path, entries[i]->d_name) < 0) {
+            syslog(LOG_ERR, "%s: Unable to allocate path", __func__);
+            goto end;
+        }
+        bool mapped = mapFrames(replay, filePath, false);
+        free(filePath);
+        if (!mapped) {
+            goto end;
+        }
+    }
+    if (replay->numFrames == 0) {
+        syslog(LOG_ERR, "%s: No frames in %s", __func__, path);
+        goto end;
+    }
+
+    ret = true;
+
+end:
+    for (int i = 0; i < numEntries; i++) {
+        free(entries[i]);
+    }
+    free(entries);
+
+    return ret;
+}
+
+ImgReplay_t* createImgReplay(const char* path, unsigned int width,
+                             unsigned int height, double fps, bool loop) {
+    struct stat st;
+
+    if (width == 0 || height == 0 || width % 2 || height % 2 ||
+        !(fps >= 0)) {
+        syslog(LOG_ERR, "%s: Invalid frame size %u x %u or frame rate %f",
+               __func__, width, height, fps);
+        return NULL;
+    }
+    if (stat(path, &st) < 0) {
+        syslog(LOG_ERR, "%s: Unable to stat %s: %s", __func__, path,
+               strerror(errno));
+        return NULL;
+    }
+
+    ImgReplay_t* replay = calloc(1, sizeof(ImgReplay_t));
+    if (!replay) {
+        syslog(LOG_ERR, "%s: Unable to allocate ImgReplay: %s", __func__,
+               strerror(errno));
+        return NULL;
+    }
+
+    replay->frameSize = (size_t) width * height * 3 / 2;
+    replay->fps = fps;
+    replay->loop = loop;
+
+    if (S_ISDIR(st.st_mode)) {
+        if (!mapDirectory(replay, path)) {
+            goto errorExit;
+        }
+    } else {
+        size_t maxFrames = (size_t) st.st_size / replay->frameSize;
+        replay->frames = calloc(maxFrames ? maxFrames : 1,
+                                sizeof(*replay->frames));
+        replay->maps = calloc(1, sizeof(*replay->maps));
+        replay->mapSizes = calloc(1, sizeof(*replay->mapSizes));
+        if (!replay->frames || !replay->maps || !replay->mapSizes) {
+            syslog(LOG_ERR, "%s: Unable to allocate frame list: %s", __func__,
+                   strerror(errno));
+            goto errorExit;
+        }
+        if (!mapFrames(replay, path, true)) {
+            goto errorExit;
+        }
+    }
+
+    syslog(LOG_INFO, "%s: Replaying %u frames of %u x %u from %s", __func__,
+           replay->numFrames, width, height, path);
+
+    return replay;
+
+errorExit:
+    destroyImgReplay(replay);
+
+    return NULL;
+}
+
+void destroyImgReplay(ImgReplay_t* replay) {
+    if (!replay) {
+        return;
+    }
+
+    for (unsigned int i = 0; i < replay->numMaps; i++) {
+        munmap(replay->maps[i], replay->mapSizes[i]);
+    }
+    free(replay->maps);
+    free(replay->mapSizes);
+    free(replay->frames);
+    free(replay);
+}
+
+unsigned int getReplayNumFrames(ImgReplay_t* replay) {
+    return replay->numFrames;
+}
+
+bool getReplayFrame(ImgReplay_t* replay, ImgReplayFrame_t* frame) {
+    uint64_t nowUs = monotonicTimeUs();
+    uint64_t index = replay->nextIndex;
+    uint64_t dueUs = nowUs;
+
+    if (!replay->started) {
+        replay->startUs = nowUs;
+        replay->started = true;
+    }
+
+    if (replay->fps > 0) {
+        // Newest frame due by now, or wait for the next one if the client
+        // is ahead.
+        uint64_t dueIndex =
+            (uint64_t) ((double) (nowUs - replay->startUs) * replay->fps /
+                        1000000.0);
+        if (dueIndex > index) {
+            index = dueIndex;
+        }
+        dueUs = replay->startUs +
+                (uint64_t) ((double) index * 1000000.0 / replay->fps);
+        if (dueUs > nowUs) {
+            struct timespec delay = {(time_t) ((dueUs - nowUs) / 1000000),
+                                     (long) ((dueUs - nowUs) % 1000000) *
+                                         1000};
+            while (nanosleep(&delay, &delay) < 0 && errno == EINTR) {
+            }
+        }
+    }
+
+    if (!replay->loop && index >= replay->numFrames) {
+        return false;
+    }
+
+    frame->data = replay->frames[index % replay->numFrames];
+    frame->sequenceNbr = (unsigned int) index;
+    frame->captureTimeUs = dueUs;
+    frame->framesSkipped = (unsigned int) (index - replay->nextIndex);
+    replay->nextIndex = index + 1;
+
+    return true;
+}
+
+ImgRecorder_t* createImgRecorder(const char* path, unsigned int width,
+                                 unsigned int height, unsigned int yPitch,
+                                 unsigned int uvPitch, size_t uvOffset) {
+    if (width == 0 || height == 0 || width % 2 || height % 2 ||
+        yPitch < width || uvPitch < width ||
+        uvOffset < (size_t) yPitch * (height - 1) + width) {
+        syslog(LOG_ERR,
+               "%s: Invalid frame size %u x %u or layout with pitches %u, %u "
+               "and UV plane at offset %zu",
+               __func__, width, height, yPitch, uvPitch, uvOffset);
+        return NULL;
+    }
+
+    ImgRecorder_t* recorder = calloc(1, sizeof(ImgRecorder_t));
+    if (!recorder) {
+        syslog(LOG_ERR, "%s: Unable to allocate ImgRecorder: %s", __func__,
+               strerror(errno));
+        return NULL;
+    }
+
+    recorder->width = width;
+    recorder->height = height;
+    recorder->yPitch = yPitch;
+    recorder->uvPitch = uvPitch;
+    recorder->uvOffset = uvOffset;
+    recorder->frameSize = (size_t) width * height * 3 / 2;
+
+    // Packed frames are written as they are, padded ones are packed first.
+    if (yPitch != width || uvPitch != width ||
+        uvOffset != (size_t) width * height) {
+        recorder->staging = malloc(recorder->frameSize);
+        if (!recorder->staging) {
+            syslog(LOG_ERR, "%s: Unable to allocate staging frame: %s",
+                   __func__, strerror(errno));
+            free(recorder);
+            return NULL;
+        }
+    }
+
+    recorder->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (recorder->fd < 0) {
+        syslog(LOG_ERR, "%s: Unable to create %s: %s", __func__, path,
+               strerror(errno));
+        free(recorder->staging);
+        free(recorder);
+        return NULL;
+    }
+
+    syslog(LOG_INFO, "%s: Recording %u x %u NV12 frames to %s", __func__,
+           width, height, path);
+
+    return recorder;
+}
+
+void destroyImgRecorder(ImgRecorder_t* recorder) {
+    if (!recorder) {
+        return;
+    }
+
+    close(recorder->fd);
+    free(recorder->staging);
+    free(recorder);
+}
+
+bool recordFrame(ImgRecorder_t* recorder, const uint8_t* nv12) {
+    const uint8_t* src = nv12;
+
+    if (recorder->staging) {
+        const unsigned int width = recorder->width;
+        const unsigned int height = recorder->height;
+        uint8_t* dst = recorder->staging;
+
+        for (unsigned int y = 0; y < height; y++) {
+            memcpy(dst, src + (size_t) y * recorder->yPitch, width);
+            dst += width;
+        }
+        src = nv12 + recorder->uvOffset;
+        for (unsigned int y = 0; y < height / 2; y++) {
+            memcpy(dst, src + (size_t) y * recorder->uvPitch, width);
+            dst += width;
+        }
+        src = recorder->staging;
+    }
+
+    size_t written = 0;
+    while (written < recorder->frameSize) {
+        ssize_t ret =
+            write(recorder->fd, src + written, recorder->frameSize - written);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            syslog(LOG_ERR, "%s: Unable to write frame: %s", __func__,
+                   strerror(errno));
+            return false;
+        }
+        written += (size_t) ret;
+    }
+
+    return true;
+}
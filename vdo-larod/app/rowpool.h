@@ -0,0 +1,92 @@
+/**
+ * Copyright (C) 2021, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file handles splitting image work into row bands that are
+ * processed in parallel by a pool of persistent worker threads.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * brief A type representing a pool of worker threads processing row bands.
+ *
+ * Worker threads are created once and pinned to one core each. They sleep
+ * until runRowPool() hands them a band, so no threads are created per frame.
+ */
+typedef struct RowPool RowPool_t;
+
+/**
+ * brief Function processing the rows rowStart to rowEnd - 1 of a job.
+ *
+ * param ctx Job context passed to runRowPool().
+ * param band Index of the band, 0 to getRowPoolBands() - 1. Band 0 is always
+ *            run by the calling thread. Can be used to pick per band scratch
+ *            memory.
+ * param rowStart First row of the band.
+ * param rowEnd One past the last row of the band.
+ */
+typedef void (*RowBandFunc)(void* ctx, unsigned int band,
+                            unsigned int rowStart, unsigned int rowEnd);
+
+/**
+ * brief Create a pool of worker threads.
+ *
+ * Worker n is pinned to core (n + 1) modulo the number of online cores, so
+ * with one worker less than the number of cores the caller's core is left
+ * for the caller.
+ *
+ * param numWorkers Number of worker threads, not counting the caller. If 0,
+ *                   one less than the number of online cores is used.
+ * return Pointer to new RowPool, or NULL if failed.
+ */
+RowPool_t* createRowPool(unsigned int numWorkers);
+
+/**
+ * brief Stop worker threads and deallocate pool.
+ *
+ * param pool Pointer to RowPool to be destroyed. Can be NULL.
+ */
+void destroyRowPool(RowPool_t* pool);
+
+/**
+ * brief Number of bands a job is split into, including the caller's band.
+ *
+ * param pool Pointer to a RowPool. Can be NULL.
+ * return Number of bands, 1 if pool is NULL.
+ */
+unsigned int getRowPoolBands(const RowPool_t* pool);
+
+/**
+ * brief Run a job split into row bands and wait for all bands to finish.
+ *
+ * The rows are split into getRowPoolBands() bands of roughly equal size.
+ * The calling thread processes band 0 itself and returns once every band is
+ * done, so the job output is complete when this function returns. Jobs
+ * must not be run concurrently on the same pool.
+ *
+ * param pool Pointer to a RowPool. If NULL all rows are processed by the
+ *             calling thread as a single band.
+ * param func Function processing one band.
+ * param ctx Job context passed to func.
+ * param numRows Total number of rows.
+ * param rowAlign Band boundaries are placed on multiples of rowAlign, e.g. 2
+ *                 to keep NV12 chroma rows within one band.
+ */
+void runRowPool(RowPool_t* pool, RowBandFunc func, void* ctx,
+                unsigned int numRows, unsigned int rowAlign);
@@ -0,0 +1,228 @@
+/**
+ * Copyright (C) 2021, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file handles the pool of memfd buffers backing larod tensors.
+ *
+ * Buffers are kept in a list. A buffer that is handed out is marked in use,
+ * and a released buffer stays mapped until a request of the same size reuses
+ * it or the pool is destroyed.
+ */
+
+#define _GNU_SOURCE
+
+#include "tensorpool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <syslog.h>
+#include <unistd.h>
+
+typedef struct PoolBuffer {
+    /// First member, so a handed out TensorBuffer_t is also its PoolBuffer.
+    TensorBuffer_t buffer;
+    bool inUse;
+    struct PoolBuffer* next;
+} PoolBuffer;
+
+struct TensorPool {
+    PoolBuffer* buffers;
+    unsigned int numBuffers;
+    size_t numBytes;
+};
+
+/**
+ * brief Allocate and map a new memfd buffer.
+ *
+ * The size is sealed, so the buffer can't shrink under a mapping of it.
+ *
+ * param size Size of the buffer in bytes.
+ * return Pointer to new PoolBuffer, or NULL if failed.
+ */
+static PoolBuffer* createPoolBuffer(size_t size) {
+    PoolBuffer* poolBuffer = calloc(1, sizeof(PoolBuffer));
+    if (!poolBuffer) {
+        syslog(LOG_ERR, "%s: Unable to allocate buffer: %s", __func__,
+               strerror(errno));
+        return NULL;
+    }
+    poolBuffer->buffer.fd = -1;
+    poolBuffer->buffer.addr = MAP_FAILED;
+    poolBuffer->buffer.size = size;
+
+    int fd = memfd_create("larod-tensor", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        syslog(LOG_ERR, "%s: Unable to create memfd: %s", __func__,
+               strerror(errno));
+        goto error;
+    }
+    poolBuffer->buffer.fd = fd;
+
+    if (ftruncate(fd, (off_t) size) < 0) {
+        syslog(LOG_ERR, "%s: Unable to size memfd to %zu bytes: %s", __func__,
+               size, strerror(errno));
+        goto error;
+    }
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        // Only a safety net, the buffer works without it.
+        syslog(LOG_WARNING, "%s: Unable to seal memfd: %s", __func__,
+               strerror(errno));
+    }
+
+    void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        syslog(LOG_ERR, "%s: Unable to mmap memfd: %s", __func__,
+               strerror(errno));
+        goto error;
+    }
+    poolBuffer->buffer.addr = addr;
+
+    return poolBuffer;
+
+error:
+    if (poolBuffer->buffer.fd >= 0) {
+        close(poolBuffer->buffer.fd);
+    }
+    free(poolBuffer);
+
+    return NULL;
+}
+
+static void destroyPoolBuffer(PoolBuffer* poolBuffer) {
+    munmap(poolBuffer->buffer.addr, poolBuffer->buffer.size);
+    close(poolBuffer->buffer.fd);
+    free(poolBuffer);
+}
+
+TensorPool_t* createTensorPool(void) {
+    TensorPool_t* pool = calloc(1, sizeof(TensorPool_t));
+    if (!pool) {
+        syslog(LOG_ERR, "%s: Unable to allocate TensorPool: %s", __func__,
+               strerror(errno));
+        return NULL;
+    }
+
+    return pool;
+}
+
+void destroyTensorPool(TensorPool_t* pool) {
+    if (!pool) {
+        return;
+    }
+
+    PoolBuffer* poolBuffer = pool->buffers;
+    while (poolBuffer) {
+        PoolBuffer* next = poolBuffer->next;
+        destroyPoolBuffer(poolBuffer);
+        poolBuffer = next;
+    }
+
+    free(pool);
+}
+
+TensorBuffer_t* getTensorBuffer(TensorPool_t* pool, size_t size) {
+    for (PoolBuffer* poolBuffer = pool->buffers; poolBuffer;
+         poolBuffer = poolBuffer->next) {
+        if (!poolBuffer->inUse && poolBuffer->buffer.size == size) {
+            poolBuffer->inUse = true;
+            return &poolBuffer->buffer;
+        }
+    }
+
+    PoolBuffer* poolBuffer = createPoolBuffer(size);
+    if (!poolBuffer) {
+        return NULL;
+    }
+    poolBuffer->inUse = true;
+    poolBuffer->next = pool->buffers;
+    pool->buffers = poolBuffer;
+    pool->numBuffers++;
+    pool->numBytes += size;
+
+    syslog(LOG_INFO, "%s: Allocated tensor buffer of %zu bytes, %u buffers "
+           "of %zu bytes in total", __func__, size, pool->numBuffers,
+           pool->numBytes);
+
+    return &poolBuffer->buffer;
+}
+
+void releaseTensorBuffer(TensorPool_t* pool, TensorBuffer_t* buffer) {
+    (void) pool;
+
+    if (buffer) {
+        ((PoolBuffer*) buffer)->inUse = false;
+    }
+}
+
+bool getTensorByteSize(const larodTensor* tensor, size_t* size) {
+    larodError* error = NULL;
+
+    const larodTensorPitches* pitches = larodGetTensorPitches(tensor, &error);
+    if (!pitches || pitches->len == 0) {
+        syslog(LOG_ERR, "%s: Could not get pitches of tensor: %s", __func__,
+               error ? error->msg : "no pitches");
+        larodClearError(&error);
+        return false;
+    }
+    // The outermost pitch is the size of the whole tensor.
+    *size = pitches->pitches[0];
+
+    return true;
+}
+
+bool bindTensorBuffer(larodTensor* tensor, const TensorBuffer_t* buffer) {
+    larodError* error = NULL;
+    bool ret = false;
+
+    if (!larodSetTensorFd(tensor, buffer->fd, &error)) {
+        syslog(LOG_ERR, "%s: Failed setting tensor fd: %s", __func__,
+               error->msg);
+        goto end;
+    }
+    if (!larodSetTensorFdProps(tensor, LAROD_FD_PROP_MAP, &error)) {
+        syslog(LOG_ERR, "%s: Failed setting tensor fd props: %s", __func__,
+               error->msg);
+        goto end;
+    }
+
+    ret = true;
+
+end:
+    larodClearError(&error);
+
+    return ret;
+}
+
+TensorBuffer_t* getBoundTensorBuffer(TensorPool_t* pool, larodTensor* tensor) {
+    size_t size = 0;
+    if (!getTensorByteSize(tensor, &size)) {
+        return NULL;
+    }
+
+    TensorBuffer_t* buffer = getTensorBuffer(pool, size);
+    if (!buffer) {
+        return NULL;
+    }
+    if (!bindTensorBuffer(tensor, buffer)) {
+        releaseTensorBuffer(pool, buffer);
+        return NULL;
+    }
+
+    return buffer;
+}
@@ -0,0 +1,121 @@
+/**
+ * Copyright (C) 2021, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file handles a pool of memory buffers backing larod tensors.
+ *
+ * Buffers are anonymous memfds, allocated and mapped once and reused by size,
+ * so no temp files are created on the file system and nothing is allocated
+ * per frame. Buffers are bound to tensors for larod to map, so larod never
+ * reads or writes them through the file position and no rewinding is needed
+ * between jobs.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "larod.h"
+
+/**
+ * brief A type representing a pool of tensor buffers.
+ *
+ * A pool is not thread safe, it is meant to be used by the thread setting
+ * up the tensors.
+ */
+typedef struct TensorPool TensorPool_t;
+
+/**
+ * brief A buffer handed out by a TensorPool.
+ */
+typedef struct {
+    /// memfd of the buffer.
+    int fd;
+    /// The buffer mapped for this process.
+    void* addr;
+    /// Size of the buffer in bytes.
+    size_t size;
+} TensorBuffer_t;
+
+/**
+ * brief Create an empty pool.
+ *
+ * return Pointer to new TensorPool, or NULL if failed.
+ */
+TensorPool_t* createTensorPool(void);
+
+/**
+ * brief Unmap and close all buffers and deallocate pool.
+ *
+ * Buffers still handed out are released too, so tensors bound to them must
+ * not be used after this.
+ *
+ * param pool Pointer to TensorPool to be destroyed. Can be NULL.
+ */
+void destroyTensorPool(TensorPool_t* pool);
+
+/**
+ * brief Get a buffer of a given size.
+ *
+ * A released buffer of the same size is reused, otherwise a new buffer is
+ * allocated and mapped. A new buffer is zeroed.
+ *
+ * param pool Pointer to a TensorPool.
+ * param size Size of the buffer in bytes.
+ * return Pointer to the buffer, valid until it is released or the pool is
+ *        destroyed, or NULL if failed.
+ */
+TensorBuffer_t* getTensorBuffer(TensorPool_t* pool, size_t size);
+
+/**
+ * brief Hand a buffer back to its pool for reuse.
+ *
+ * param pool Pointer to the TensorPool the buffer came from.
+ * param buffer Buffer to release. Can be NULL.
+ */
+void releaseTensorBuffer(TensorPool_t* pool, TensorBuffer_t* buffer);
+
+/**
+ * brief Get the size in bytes of a tensor from its pitches.
+ *
+ * param tensor Tensor from e.g. larodCreateModelInputs().
+ * param size Output size in bytes.
+ * return False if the tensor has no pitches, otherwise true.
+ */
+bool getTensorByteSize(const larodTensor* tensor, size_t* size);
+
+/**
+ * brief Back a tensor by a buffer.
+ *
+ * Sets the fd of the buffer on the tensor and marks it as mappable, so
+ * larod maps the buffer once instead of reading and writing it at the
+ * file position.
+ *
+ * param tensor Tensor to bind.
+ * param buffer Buffer holding the tensor data.
+ * return False if any errors occur, otherwise true.
+ */
+bool bindTensorBuffer(larodTensor* tensor, const TensorBuffer_t* buffer);
+
+/**
+ * brief Get a buffer sized from a tensor's pitches and bind it to the tensor.
+ *
+ * param pool Pointer to a TensorPool.
+ * param tensor Tensor to back.
+ * return Pointer to the buffer, or NULL if failed.
+ */
+TensorBuffer_t* getBoundTensorBuffer(TensorPool_t* pool, larodTensor* tensor);
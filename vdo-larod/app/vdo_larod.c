@@ -54,19 +54,24 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/mman.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "argparse.h"
 #include "imgconverter.h"
 #include "imgprovider.h"
 #include "larod.h"
+#include "modelsession.h"
+#include "postprocess.h"
+#include "tensorpool.h"
 #include "vdo-frame.h"
 #include "vdo-types.h"
 
@@ -78,20 +83,6 @@
  */
 static void sigintHandler(int sig);
 
-/**
- * brief Creates a temporary fd truncated to correct size and mapped.
- *
- * This convenience function creates temp files to be used for input and output.
- *
- * param fileName Pattern for how the temp file will be named in file system.
- * param fileSize How much space needed to be allocated (truncated) in fd.
- * param mappedAddr Pointer to the address of the fd mapped for this process.
- * param Pointer to the generated fd.
- * return False if any errors occur, otherwise true.
- */
-static bool createAndMapTmpFile(char* fileName, size_t fileSize,
-                                void** mappedAddr, int* convFd);
-
 /**
  * brief Sets up and configures a connection to larod, and loads a model.
  *
@@ -131,6 +122,9 @@ static void freeLabels(char** labelsArray, char* labelFileBuffer);
 static bool parseLabels(char*** labelsPtr, char** labelFileBuffer,
                         char* labelsPath, size_t* numLabelsPtr);
 
+/// Longest time to wait for a frame before checking stopRunning again.
+#define FRAME_TIMEOUT_MS (500)
+
 /// Set by signal handler if an interrupt signal sent to process.
 /// Indicates that app should stop asap and exit gracefully.
 volatile sig_atomic_t stopRunning = false;
@@ -152,55 +146,6 @@ void sigintHandler(int sig) {
     stopRunning = true;
 }
 
-static bool createAndMapTmpFile(char* fileName, size_t fileSize,
-                                void** mappedAddr, int* convFd) {
-    syslog(LOG_INFO, "%s: Setting up a temp fd with pattern %s and size %zu", __func__,
-           fileName, fileSize);
-
-    int fd = mkstemp(fileName);
-    if (fd < 0) {
-        syslog(LOG_ERR, "%s: Unable to open temp file %s: %s", __func__, fileName,
-               strerror(errno));
-        goto error;
-    }
-
-    // Allocate enough space in for the fd.
-    if (ftruncate(fd, (off_t) fileSize) < 0) {
-        syslog(LOG_ERR, "%s: Unable to truncate temp file %s: %s", __func__, fileName,
-               strerror(errno));
-        goto error;
-    }
-
-    // Remove since we don't actually care about writing to the file system.
-    if (unlink(fileName)) {
-        syslog(LOG_ERR, "%s: Unable to unlink from temp file %s: %s", __func__,
-               fileName, strerror(errno));
-        goto error;
-    }
-
-    // Get an address to fd's memory for this process's memory space.
-    void* data =
-        mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-
-    if (data == MAP_FAILED) {
-        syslog(LOG_ERR, "%s: Unable to mmap temp file %s: %s", __func__, fileName,
-               strerror(errno));
-        goto error;
-    }
-
-    *mappedAddr = data;
-    *convFd = fd;
-
-    return true;
-
-error:
-    if (fd >= 0) {
-        close(fd);
-    }
-
-    return false;
-}
-
 static bool setupLarod(const larodChip larodChip, const int larodModelFd,
                        larodConnection** larodConn, larodModel** model) {
     larodError* error = NULL;
@@ -383,30 +328,356 @@ end:
 }
 
 /**
- * brief Main function that starts a stream with different options.
+ * brief Describe the model's input tensor for the image converter.
+ *
+ * Layout, data type and pitches are read from larod, so the converter writes
+ * the model's native input format directly. larod does not report
+ * quantization parameters, int8 inputs are assumed to be uint8 RGB shifted
+ * by -128 which is what most quantized image models expect.
+ *
+ * param tensor View of the model's input tensor.
+ * param desc Output tensor descriptor.
+ * return False if the tensor format is not supported, otherwise true.
  */
-int main(int argc, char** argv) {
-    // Hardcode to use three image "color" channels (eg. RGB).
-    const unsigned int CHANNELS = 3;
+static bool getInputTensorDesc(const ModelTensorView_t* tensor,
+                               ImgTensorDesc_t* desc) {
+    initImgTensorDesc(desc);
+
+    switch (tensor->layout) {
+    case LAROD_TENSOR_LAYOUT_NHWC:
+    case LAROD_TENSOR_LAYOUT_UNSPECIFIED:
+        desc->layout = IMG_LAYOUT_HWC;
+        break;
+    case LAROD_TENSOR_LAYOUT_NCHW:
+        desc->layout = IMG_LAYOUT_CHW;
+        break;
+    default:
+        syslog(LOG_ERR, "%s: Unsupported input tensor layout %d", __func__,
+               tensor->layout);
+        return false;
+    }
+
+    switch (tensor->dataType) {
+    case LAROD_TENSOR_DATA_TYPE_UINT8:
+        desc->dataType = IMG_DTYPE_UINT8;
+        break;
+    case LAROD_TENSOR_DATA_TYPE_INT8:
+        desc->dataType = IMG_DTYPE_INT8;
+        desc->quantZeroPoint = -128;
+        break;
+    case LAROD_TENSOR_DATA_TYPE_FLOAT32:
+        // Map 0..255 to 0.0..1.0.
+        desc->dataType = IMG_DTYPE_FLOAT32;
+        desc->std[0] = desc->std[1] = desc->std[2] = 255.0f;
+        break;
+    default:
+        syslog(LOG_ERR, "%s: Unsupported input tensor data type %d", __func__,
+               tensor->dataType);
+        return false;
+    }
+
+    const larodTensorPitches* pitches = &tensor->pitches;
+    if (pitches->len != 4) {
+        syslog(LOG_ERR, "%s: Expected 4 input tensor pitches, got %zu",
+               __func__, pitches->len);
+        return false;
+    }
+
+    // NHWC: pitches are {N, H, W, C}, the row pitch is the W pitch.
+    // NCHW: pitches are {N, C, H, W}, the row pitch is the H pitch and the
+    // plane pitch the C pitch.
+    if (desc->layout == IMG_LAYOUT_HWC) {
+        desc->rowPitch = pitches->pitches[2];
+    } else {
+        desc->planePitch = pitches->pitches[1];
+        desc->rowPitch = pitches->pitches[2];
+    }
+
+    return true;
+}
+
+/**
+ * brief Get the next frame to run inference on, from VDO or a recording.
+ *
+ * param provider ImgProvider fetching frames.
+ * param buf Buffer holding the frame, to be handed back with returnFrame().
+ * param info Metadata of the frame.
+ * param haveInfo Set if info could be read.
+ * return Frame data, or NULL at the end of a recording or on interrupt.
+ */
+static const uint8_t* getNextFrame(ImgProvider_t* provider, VdoBuffer** buf,
+                                   ImgFrameInfo_t* info, bool* haveInfo) {
+    *buf = NULL;
+
+    // Wake up now and then to notice an interrupt even if no frames arrive.
+    while (!*buf && !stopRunning) {
+        *buf = getLastFrameTimeout(provider, FRAME_TIMEOUT_MS);
+        if (!*buf && isFrameFetchStopped(provider)) {
+            syslog(LOG_INFO, "End of recording");
+            return NULL;
+        }
+    }
+    if (!*buf) {
+        return NULL;
+    }
+    *haveInfo = getFrameInfo(provider, *buf, info);
+
+    const uint8_t* data = getFrameData(provider, *buf);
+    if (!data) {
+        returnFrame(provider, *buf);
+        *buf = NULL;
+    }
+
+    return data;
+}
+
+/**
+ * brief A set of input and output tensors, and the frame in them.
+ *
+ * With several slots the next frame is converted into one slot while
+ * inferences run on the frames in the others.
+ */
+typedef struct {
+    ModelSession_t* session;
+    /// The image input of the model.
+    const ModelTensorView_t* input;
+    /// The scores output of the model.
+    const ModelTensorView_t* output;
+    ScoreFormat_t scoreFormat;
+    /// Number of scores to look at.
+    size_t numScores;
+    /// Number of results to log.
+    size_t topK;
+
+    /// Set from when an inference is started until it has completed.
+    /// Guarded by slotMutex.
+    bool busy;
+    /// Set by the completion callback if the inference failed. Guarded by
+    /// slotMutex.
+    bool failed;
+    /// Set from when a frame is converted into the slot until its result
+    /// has been handled.
+    bool haveFrame;
+    bool haveFrameInfo;
+    ImgFrameInfo_t frameInfo;
+    struct timeval startTs;
+    struct timeval endTs;
+} InferenceSlot;
+
+/// Guards the busy and failed flags of all slots.
+static pthread_mutex_t slotMutex = PTHREAD_MUTEX_INITIALIZER;
+/// Signaled when an inference completes.
+static pthread_cond_t slotCond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * brief Create the tensors and the inference request of a slot.
+ *
+ * The image is converted into the first input. Models with several outputs
+ * are run as they are, the top result is taken from the first output.
+ *
+ * param slot Zeroed slot to set up.
+ * param pool Pool to take the tensor buffers from.
+ * param model Model to run.
+ * param args Parsed arguments, for the output size and how to read it.
+ * param inputDesc Output descriptor of the model's input tensor for the
+ *                 image converter.
+ * return False if any errors occur, otherwise true.
+ */
+static bool setupInferenceSlot(InferenceSlot* slot, TensorPool_t* pool,
+                               larodModel* model, const args_t* args,
+                               ImgTensorDesc_t* inputDesc) {
+    slot->session = createModelSession(model, pool);
+    if (!slot->session) {
+        return false;
+    }
+    // Only the image input is filled in, other inputs would stay zeroed.
+    if (getSessionNumInputs(slot->session) != 1) {
+        syslog(LOG_ERR, "Model has %zu inputs, app only supports 1 input tensor.",
+               getSessionNumInputs(slot->session));
+        return false;
+    }
+    slot->input = getSessionInput(slot->session, 0);
+    if (!getInputTensorDesc(slot->input, inputDesc)) {
+        return false;
+    }
+
+    slot->output = getSessionOutput(slot->session, 0);
+    if (args->outputBytes > slot->output->size) {
+        syslog(LOG_ERR, "Model output is %zu bytes, OUTPUT_SIZE %zu is too "
+               "large", slot->output->size, args->outputBytes);
+        return false;
+    }
+    if (!initScoreFormatFromLarod(&slot->scoreFormat, slot->output->dataType)) {
+        return false;
+    }
+    if (args->outputScale > 0.0f) {
+        slot->scoreFormat.scale = args->outputScale;
+        slot->scoreFormat.zeroPoint = args->outputZeroPoint;
+    }
+    slot->scoreFormat.softmax = args->softmax;
+    slot->numScores =
+        args->outputBytes / getScoreSize(slot->scoreFormat.dataType);
+    slot->topK = args->topK;
+
+    return true;
+}
+
+/**
+ * brief Free the resources of a slot. The slot must not be busy.
+ *
+ * param slot Slot set up by setupInferenceSlot(), possibly partially.
+ */
+static void releaseInferenceSlot(InferenceSlot* slot) {
+    destroyModelSession(slot->session);
+    slot->session = NULL;
+}
+
+/**
+ * brief Completion callback of larodRunInferenceAsync(), run on a larod
+ * thread.
+ *
+ * param userData The InferenceSlot the inference ran on.
+ * param error Error if the inference failed, otherwise NULL.
+ */
+static void inferenceDone(void* userData, larodError* error) {
+    InferenceSlot* slot = (InferenceSlot*) userData;
+
+    pthread_mutex_lock(&slotMutex);
+    gettimeofday(&slot->endTs, NULL);
+    if (error) {
+        syslog(LOG_ERR, "Unable to run inference: %s (%d)", error->msg,
+               error->code);
+        slot->failed = true;
+    }
+    slot->busy = false;
+    pthread_cond_broadcast(&slotCond);
+    pthread_mutex_unlock(&slotMutex);
+}
+
+/**
+ * brief Start an inference on the frame converted into a slot.
+ *
+ * param conn larod connection.
+ * param slot Slot holding the converted frame.
+ * return False if the inference could not be started, otherwise true.
+ */
+static bool startInference(larodConnection* conn, InferenceSlot* slot) {
+    pthread_mutex_lock(&slotMutex);
+    slot->busy = true;
+    slot->failed = false;
+    pthread_mutex_unlock(&slotMutex);
+
+    gettimeofday(&slot->startTs, NULL);
+    if (!startModelSession(slot->session, conn, inferenceDone, slot)) {
+        pthread_mutex_lock(&slotMutex);
+        slot->busy = false;
+        pthread_mutex_unlock(&slotMutex);
+
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * brief Wait until the inference running on a slot, if any, has completed.
+ *
+ * param slot Slot to wait for.
+ * return False if the inference failed, otherwise true.
+ */
+static bool waitForInference(InferenceSlot* slot) {
+    pthread_mutex_lock(&slotMutex);
+    while (slot->busy) {
+        pthread_cond_wait(&slotCond, &slotMutex);
+    }
+    bool ret = !slot->failed;
+    pthread_mutex_unlock(&slotMutex);
+
+    return ret;
+}
+
+/**
+ * brief Log the result of the inference on a slot.
+ *
+ * param slot Slot holding a completed inference.
+ * param labels Array of label strings, or NULL.
+ * param numLabels Number of entries in labels.
+ */
+static void handleResult(const InferenceSlot* slot, char** labels,
+                         size_t numLabels) {
+    unsigned int elapsedMs =
+        (unsigned int) (((slot->endTs.tv_sec - slot->startTs.tv_sec) * 1000) +
+                        ((slot->endTs.tv_usec - slot->startTs.tv_usec) / 1000));
+    syslog(LOG_INFO, "Ran inference for %u ms", elapsedMs);
+
+    ScoreResult_t results[MAX_TOP_K];
+    size_t numResults = getTopScores(slot->output->data, slot->numScores,
+                                     &slot->scoreFormat, results, slot->topK);
+    for (size_t i = 0; i < numResults; i++) {
+        char prefix[32] = "Top result";
+        if (slot->topK > 1) {
+            snprintf(prefix, sizeof(prefix), "Result %zu", i + 1);
+        }
+        size_t idx = results[i].index;
+        float percent = results[i].score * 100.0f;
+        if (labels) {
+            if (idx < numLabels) {
+                syslog(LOG_INFO, "%s: %s with score %.2f%%", prefix, labels[idx],
+                       percent);
+            } else {
+                syslog(LOG_INFO, "%s: index %zu with score %.2f%% (index larger "
+                       "than num items in labels file)",
+                       prefix, idx, percent);
+            }
+        } else {
+            syslog(LOG_INFO, "%s: index %zu with score %.2f%%", prefix, idx,
+                   percent);
+        }
+    }
+
+    if (slot->haveFrameInfo) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        uint64_t nowUs =
+            (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+        syslog(LOG_INFO, "Frame %u done %u ms after capture",
+               slot->frameInfo.sequenceNbr,
+               (unsigned int) ((nowUs - slot->frameInfo.captureTimeUs) / 1000));
+    }
+}
 
-    // Name patterns for the temp file we will create.
-    char CONV_INP_FILE_PATTERN[] = "/tmp/larod.in.test-XXXXXX";
-    char CONV_OUT_FILE_PATTERN[] = "/tmp/larod.out.test-XXXXXX";
+/**
+ * brief Wait for the inference on a slot and log its result.
+ *
+ * param slot Slot holding a frame.
+ * param labels Array of label strings, or NULL.
+ * param numLabels Number of entries in labels.
+ * return False if the inference failed, otherwise true.
+ */
+static bool finishSlot(InferenceSlot* slot, char** labels, size_t numLabels) {
+    bool ret = waitForInference(slot);
+    if (ret) {
+        handleResult(slot, labels, numLabels);
+    }
+    slot->haveFrame = false;
 
+    return ret;
+}
+
+/**
+ * brief Main function that starts a stream with different options.
+ */
+int main(int argc, char** argv) {
     bool ret = false;
     ImgProvider_t* provider = NULL;
-    larodError* error = NULL;
+    ImgRecorder_t* recorder = NULL;
+    ImgConverter_t* converter = NULL;
+    RowPool_t* rowPool = NULL;
     larodConnection* conn = NULL;
-    larodTensor** inputTensors = NULL;
-    size_t numInputs = 0;
-    larodTensor** outputTensors = NULL;
-    size_t numOutputs = 0;
-    larodInferenceRequest* infReq = NULL;
-    void* larodInputAddr = MAP_FAILED;
-    void* larodOutputAddr = MAP_FAILED;
+    TensorPool_t* tensorPool = NULL;
+    InferenceSlot slots[MAX_PIPELINE_DEPTH];
+    unsigned int numSlots = 0;
     int larodModelFd = -1;
-    int larodInputFd = -1;
-    int larodOutputFd = -1;
     char** labels = NULL; // This is the array of label strings. The label
                           // entries points into the large labelFileData buffer.
     size_t numLabels = 0; // Number of entries in the labels array.
@@ -435,78 +706,116 @@ int main(int argc, char** argv) {
         goto end;
     }
 
-    syslog(LOG_INFO, "Creating VDO image provider and creating stream %d x %d",
-           streamWidth, streamHeight);
-    provider = createImgProvider(streamWidth, streamHeight, 2, VDO_FORMAT_YUV);
+    if (args.replayFile) {
+        // Paced at FPS, or every frame as fast as it is analyzed.
+        syslog(LOG_INFO, "Creating image provider replaying %s at %d x %d",
+               args.replayFile, streamWidth, streamHeight);
+        provider = createImgProviderReplay(args.replayFile, streamWidth,
+                                           streamHeight, 2, args.fps, false);
+    } else {
+        syslog(LOG_INFO,
+               "Creating VDO image provider and creating stream %d x %d",
+               streamWidth, streamHeight);
+        // Without --min-buffers the pool stays at NUM_BUFFERS.
+        ImgBufferPool_t pool = {
+            args.numBuffers,
+            args.minBuffers ? args.minBuffers : args.numBuffers,
+            args.numBuffers};
+        provider = createImgProviderWithPool(streamWidth, streamHeight, 2,
+                                             VDO_FORMAT_YUV, &pool);
+    }
     if (!provider) {
         goto end;
     }
-
-    larodModelFd = open(args.modelFile, O_RDONLY);
-    if (larodModelFd < 0) {
-        syslog(LOG_ERR, "Unable to open model file %s: %s", args.modelFile,
-               strerror(errno));
+    // Frames that would not be analyzed are not delivered at all.
+    if (!setFrameDecimation(provider, args.everyNth) ||
+        !setTargetFrameRate(provider, args.fps)) {
         goto end;
     }
 
-    syslog(LOG_INFO, "Setting up larod connection with chip %d and model %s", args.chip,
-           args.modelFile);
-    larodModel* model = NULL;
-    if (!setupLarod(args.chip, larodModelFd, &conn, &model)) {
+    converter = createImgConverter(streamWidth, streamHeight, args.width,
+                                   args.height,
+                                   args.letterbox ? IMG_CROP_LETTERBOX :
+                                                    IMG_CROP_CENTER);
+    if (!converter) {
+        syslog(LOG_ERR, "%s: Failed to create ImgConverter", __func__);
         goto end;
     }
-
-    syslog(LOG_INFO, "Creating temporary files and memmaps for inference input and "
-           "output tensors");
-
-    if (!createAndMapTmpFile(CONV_INP_FILE_PATTERN,
-                             args.width * args.height * CHANNELS,
-                             &larodInputAddr, &larodInputFd)) {
+    // VDO buffers can have padded rows, convert them in place. Recorded
+    // frames are packed.
+    ImgNv12Layout_t srcLayout;
+    initImgNv12Layout(&srcLayout, streamWidth, streamHeight);
+    srcLayout.uvOffset = provider->uvOffset;
+    srcLayout.yPitch = provider->yPitch;
+    srcLayout.uvPitch = provider->uvPitch;
+    if (!setImgConverterSourceLayout(converter, &srcLayout)) {
+        syslog(LOG_ERR, "%s: Failed to set ImgConverter source layout",
+               __func__);
         goto end;
     }
-
-    if (!createAndMapTmpFile(CONV_OUT_FILE_PATTERN, args.outputBytes,
-                             &larodOutputAddr, &larodOutputFd)) {
+    if (!setImgConverterColor(converter,
+                              args.bt709 ? IMG_MATRIX_BT709 : IMG_MATRIX_BT601,
+                              args.fullRange ? IMG_RANGE_FULL :
+                                               IMG_RANGE_LIMITED)) {
+        syslog(LOG_ERR, "%s: Failed to set ImgConverter color", __func__);
         goto end;
     }
 
-    inputTensors = larodCreateModelInputs(model, &numInputs, &error);
-    if (!inputTensors) {
-        syslog(LOG_ERR, "Failed retrieving input tensors: %s", error->msg);
-        goto end;
+    if (args.recordFile) {
+        recorder = createImgRecorder(args.recordFile, streamWidth,
+                                     streamHeight, provider->yPitch,
+                                     provider->uvPitch, provider->uvOffset);
+        if (!recorder) {
+            goto end;
+        }
     }
-    // This app only supports 1 input tensor right now.
-    if (numInputs != 1) {
-        syslog(LOG_ERR, "Model has %zu inputs, app only supports 1 input tensor.",
-               numInputs);
+
+    // Split image conversion over the otherwise idle cores.
+    rowPool = createRowPool(0);
+    if (!rowPool) {
+        syslog(LOG_ERR, "%s: Failed to create RowPool", __func__);
         goto end;
     }
-    if (!larodSetTensorFd(inputTensors[0], larodInputFd, &error)) {
-        syslog(LOG_ERR, "Failed setting input tensor fd: %s", error->msg);
+    if (!setImgConverterPool(converter, rowPool)) {
+        syslog(LOG_ERR, "%s: Failed to set ImgConverter pool", __func__);
         goto end;
     }
 
-    outputTensors = larodCreateModelOutputs(model, &numOutputs, &error);
-    if (!outputTensors) {
-        syslog(LOG_ERR, "Failed retrieving output tensors: %s", error->msg);
+    larodModelFd = open(args.modelFile, O_RDONLY);
+    if (larodModelFd < 0) {
+        syslog(LOG_ERR, "Unable to open model file %s: %s", args.modelFile,
+               strerror(errno));
         goto end;
     }
-    // This app only supports 1 output tensor right now.
-    if (numOutputs != 1) {
-        syslog(LOG_ERR, "Model has %zu outputs, app only supports 1 output tensor.",
-               numOutputs);
+
+    syslog(LOG_INFO, "Setting up larod connection with chip %d and model %s", args.chip,
+           args.modelFile);
+    larodModel* model = NULL;
+    if (!setupLarod(args.chip, larodModelFd, &conn, &model)) {
         goto end;
     }
-    if (!larodSetTensorFd(outputTensors[0], larodOutputFd, &error)) {
-        syslog(LOG_ERR, "Failed setting output tensor fd: %s", error->msg);
+
+    syslog(LOG_INFO, "Creating %u sets of inference input and output tensors",
+           args.pipelineDepth);
+    tensorPool = createTensorPool();
+    if (!tensorPool) {
         goto end;
     }
 
-    // App supports only one input/output tensor.
-    infReq = larodCreateInferenceRequest(model, inputTensors, 1, outputTensors,
-                                         1, &error);
-    if (!infReq) {
-        syslog(LOG_ERR, "Failed creating inference request: %s", error->msg);
+    // Every slot gets its own tensors, so a frame can be converted into one
+    // while inferences run on the others.
+    ImgTensorDesc_t inputDesc;
+    for (; numSlots < args.pipelineDepth; numSlots++) {
+        InferenceSlot* slot = &slots[numSlots];
+        memset(slot, 0, sizeof(*slot));
+        if (!setupInferenceSlot(slot, tensorPool, model, &args, &inputDesc)) {
+            numSlots++;
+            goto end;
+        }
+    }
+    if (!setImgConverterOutput(converter, &inputDesc)) {
+        syslog(LOG_ERR, "%s: Failed to set ImgConverter output format",
+               __func__);
         goto end;
     }
 
@@ -518,32 +827,51 @@ int main(int argc, char** argv) {
         }
     }
 
-    syslog(LOG_INFO, "Start fetching video frames from VDO");
+    syslog(LOG_INFO, "Start fetching video frames");
     if (!startFrameFetch(provider)) {
         goto end;
     }
 
-    for (unsigned int i = 0; i < args.numFrames && !stopRunning; i++) {
+    // Frame i is converted into slot i % numSlots. Before a slot is reused
+    // the inference on the frame converted into it numSlots frames ago is
+    // waited for and its result handled, so up to numSlots frames are in
+    // flight and results are handled in frame order.
+    unsigned int frameIdx = 0;
+    for (; frameIdx < args.numFrames && !stopRunning; frameIdx++) {
+        InferenceSlot* slot = &slots[frameIdx % numSlots];
         struct timeval startTs, endTs;
         unsigned int elapsedMs = 0;
 
-        // Get latest frame from image pipeline.
-        VdoBuffer* buf = getLastFrameBlocking(provider);
-        if (!buf) {
+        if (slot->haveFrame && !finishSlot(slot, labels, numLabels)) {
             goto end;
         }
 
-        // Get data from latest frame.
-        uint8_t* nv12Data = (uint8_t*) vdo_buffer_get_data(buf);
+        // Get latest frame from image pipeline.
+        VdoBuffer* buf = NULL;
+        ImgFrameInfo_t frameInfo;
+        bool haveFrameInfo = false;
+        const uint8_t* nv12Data =
+            getNextFrame(provider, &buf, &frameInfo, &haveFrameInfo);
+        if (!nv12Data) {
+            break;
+        }
+        if (haveFrameInfo && frameInfo.framesSkipped) {
+            syslog(LOG_INFO, "Skipped %u frames before frame %u",
+                   frameInfo.framesSkipped, frameInfo.sequenceNbr);
+        }
 
-        // Covert image data from NV12 format to interleaved uint8_t RGB format.
-        gettimeofday(&startTs, NULL);
-        if (!convertCropScaleU8yuvToRGB(nv12Data, streamWidth, streamHeight,
-                                        (uint8_t*) larodInputAddr, args.width,
-                                        args.height)) {
-            syslog(LOG_ERR, "%s: Failed img scale/convert in "
-                   "convertCropScaleU8yuvToRGB() (continue anyway)",
+        if (recorder && !recordFrame(recorder, nv12Data)) {
+            syslog(LOG_ERR, "%s: Failed to record frame, recording stops",
                    __func__);
+            destroyImgRecorder(recorder);
+            recorder = NULL;
+        }
+
+        // Convert image data from NV12 format to the model input format.
+        gettimeofday(&startTs, NULL);
+        if (!convertFrame(converter, nv12Data, (uint8_t*) slot->input->data)) {
+            syslog(LOG_ERR, "%s: Failed img scale/convert in convertFrame() "
+                   "(continue anyway)", __func__);
         }
         gettimeofday(&endTs, NULL);
 
@@ -551,66 +879,58 @@ int main(int argc, char** argv) {
                                     ((endTs.tv_usec - startTs.tv_usec) / 1000));
         syslog(LOG_INFO, "Converted image in %u ms", elapsedMs);
 
-        // Since larodOutputAddr points to the beginning of the fd we should
-        // rewind the file position before each inference.
-        if (lseek(larodOutputFd, 0, SEEK_SET) == -1) {
-            syslog(LOG_ERR, "Unable to rewind output file position: %s",
-                   strerror(errno));
+        // The frame has been copied into the slot, release frame reference
+        // to provider so it can be refilled while the inference runs.
+        returnFrame(provider, buf);
 
+        slot->frameInfo = frameInfo;
+        slot->haveFrameInfo = haveFrameInfo;
+        if (!startInference(conn, slot)) {
             goto end;
         }
+        slot->haveFrame = true;
+    }
 
-        gettimeofday(&startTs, NULL);
-        if (!larodRunInference(conn, infReq, &error)) {
-            syslog(LOG_ERR, "Unable to run inference on model %s: %s (%d)",
-                   args.modelFile, error->msg, error->code);
+    // Handle the results still in flight, oldest first.
+    for (unsigned int i = 0; i < numSlots; i++) {
+        InferenceSlot* slot = &slots[(frameIdx + i) % numSlots];
+        if (slot->haveFrame && !finishSlot(slot, labels, numLabels)) {
             goto end;
         }
-        gettimeofday(&endTs, NULL);
-
-        elapsedMs = (unsigned int) (((endTs.tv_sec - startTs.tv_sec) * 1000) +
-                                    ((endTs.tv_usec - startTs.tv_usec) / 1000));
-        syslog(LOG_INFO, "Ran inference for %u ms", elapsedMs);
-
-        // Compute the most likely index.
-        uint8_t maxProb = 0;
-        size_t maxIdx = 0;
-        uint8_t* outputPtr = (uint8_t*) larodOutputAddr;
-        for (size_t j = 0; j < args.outputBytes; j++) {
-            if (outputPtr[j] > maxProb) {
-                maxProb = outputPtr[j];
-                maxIdx = j;
-            }
-        }
-        if (labels) {
-            if (maxIdx < numLabels) {
-                syslog(LOG_INFO, "Top result: %s with score %.2f%%", labels[maxIdx],
-                       (float) maxProb / 2.5f);
-            } else {
-                syslog(LOG_INFO, "Top result: index %zu with score %.2f%% (index larger "
-                       "than num items in labels file)",
-                       maxIdx, (float) maxProb / 2.5f);
-            }
-        } else {
-            syslog(LOG_INFO, "Top result: index %zu with score %.2f%%", maxIdx,
-                   (float) maxProb / 2.5f);
-        }
-
-        // Release frame reference to provider.
-        returnFrame(provider, buf);
     }
 
-    syslog(LOG_INFO, "Stop streaming video from VDO");
+    syslog(LOG_INFO, "Stop fetching video frames");
     if (!stopFrameFetch(provider)) {
         goto end;
     }
 
+    ImgProviderStats_t stats;
+    getProviderStats(provider, &stats);
+    syslog(LOG_INFO,
+           "Frames received %llu, fetched %llu, dropped %llu, missed by "
+           "VDO %llu, decimated %llu, fetch errors %llu, buffers %u",
+           (unsigned long long) stats.framesReceived,
+           (unsigned long long) stats.framesFetched,
+           (unsigned long long) stats.framesDropped,
+           (unsigned long long) stats.framesMissed,
+           (unsigned long long) stats.framesDecimated,
+           (unsigned long long) stats.fetchErrors, stats.numBuffers);
+
     ret = true;
 
 end:
+    // larod still writes to the tensors of inferences in flight, and calls
+    // back with the slot.
+    for (unsigned int i = 0; i < numSlots; i++) {
+        waitForInference(&slots[i]);
+    }
+
+    destroyImgRecorder(recorder);
     if (provider) {
         destroyImgProvider(provider);
     }
+    destroyImgConverter(converter);
+    destroyRowPool(rowPool);
     // Only the model handle is released here. We count on larod service to
     // release the privately loaded model when the session is disconnected in
     // larodDisconnect().
@@ -621,23 +941,10 @@ end:
     if (larodModelFd >= 0) {
         close(larodModelFd);
     }
-    if (larodInputAddr != MAP_FAILED) {
-        munmap(larodInputAddr, args.width * args.height * CHANNELS);
-    }
-    if (larodInputFd >= 0) {
-        close(larodInputFd);
+    for (unsigned int i = 0; i < numSlots; i++) {
+        releaseInferenceSlot(&slots[i]);
     }
-    if (larodOutputAddr != MAP_FAILED) {
-        munmap(larodOutputAddr, args.outputBytes);
-    }
-    if (larodOutputFd >= 0) {
-        close(larodOutputFd);
-    }
-
-    larodDestroyInferenceRequest(&infReq);
-    larodDestroyTensors(&inputTensors, numInputs);
-    larodDestroyTensors(&outputTensors, numOutputs);
-    larodClearError(&error);
+    destroyTensorPool(tensorPool);
 
     if (labels) {
         freeLabels(labels, labelFileData);
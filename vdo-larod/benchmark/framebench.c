@@ -0,0 +1,443 @@
+/**
+ * Copyright (C) 2021, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Host benchmark of the frame handoff between the VDO fetcher thread and the
+ * client in imgprovider.c.
+ *
+ * A producer thread plays the part of VDO and the fetcher thread: it owns a
+ * fixed set of frames, publishes them and takes back the ones the consumer
+ * returns or never fetched. A consumer thread fetches the latest frame and
+ * returns it, like the apps do. Both the FrameRing and the previous handoff,
+ * two queues allocating a node per push behind a mutex and a condition
+ * variable, are measured:
+ *
+ * - Paced: frames are published at a fixed interval and the time from
+ *   publishing to the consumer holding the frame is recorded.
+ * - Unpaced: frames are published as fast as possible, giving the handoff
+ *   overhead per published frame.
+ *
+ * Several producer/consumer pairs can run at the same time to show how the
+ * handoffs behave with several providers.
+ */
+
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "framering.h"
+
+/// Frames owned by each producer, as the VDO buffers of one stream.
+#define NUM_FRAMES (8)
+/// Most recent frames kept for the consumer, as the apps request.
+#define NUM_APP_FRAMES (2)
+
+#define DEFAULT_FRAMES (20000)
+#define DEFAULT_INTERVAL_US (500)
+#define MAX_PAIRS (16)
+
+typedef struct Frame {
+    double publishNs;
+} Frame;
+
+/**
+ * brief The handoff before FrameRing, as in the previous imgprovider.c.
+ *
+ * Queue nodes are allocated per push, like GQueue does with GList nodes.
+ */
+typedef struct Node {
+    Frame* frame;
+    struct Node* next;
+    struct Node* prev;
+} Node;
+
+typedef struct Queue {
+    Node* head;
+    Node* tail;
+    unsigned int length;
+} Queue;
+
+typedef struct LockedHandoff {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    Queue delivered;
+    Queue processed;
+    bool closed;
+} LockedHandoff;
+
+typedef enum { HANDOFF_LOCKED, HANDOFF_RING } HandoffType;
+
+/**
+ * brief One producer/consumer pair.
+ */
+typedef struct Pair {
+    HandoffType type;
+    LockedHandoff locked;
+    FrameRing_t* ring;
+
+    unsigned int numFrames;
+    unsigned int intervalUs;
+
+    Frame frames[NUM_FRAMES];
+    /// Frames held by the producer.
+    Frame* free[NUM_FRAMES];
+    unsigned int numFree;
+
+    /// Latency of each received frame in ns, and the number received.
+    double* latency;
+    unsigned int received;
+
+    double producerNs;
+
+    pthread_t producer;
+    pthread_t consumer;
+} Pair;
+
+static double nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compareDouble(const void* a, const void* b) {
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+static void queuePushTail(Queue* queue, Frame* frame) {
+    Node* node = malloc(sizeof(Node));
+    if (!node) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    node->frame = frame;
+    node->next = NULL;
+    node->prev = queue->tail;
+    if (queue->tail) {
+        queue->tail->next = node;
+    } else {
+        queue->head = node;
+    }
+    queue->tail = node;
+    queue->length++;
+}
+
+static Frame* queuePop(Queue* queue, bool tail) {
+    Node* node = tail ? queue->tail : queue->head;
+    if (!node) {
+        return NULL;
+    }
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        queue->head = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        queue->tail = node->prev;
+    }
+    queue->length--;
+
+    Frame* frame = node->frame;
+    free(node);
+
+    return frame;
+}
+
+static void recycle(Pair* pair, Frame* frame) {
+    pair->free[pair->numFree++] = frame;
+}
+
+/**
+ * brief Publish one frame, the body of the fetcher thread loop.
+ */
+static void publish(Pair* pair, Frame* frame) {
+    if (pair->type == HANDOFF_RING) {
+        Frame* old = pushFrameRing(pair->ring, frame);
+        if (old) {
+            recycle(pair, old);
+        }
+        while ((old = reclaimFrameRing(pair->ring))) {
+            recycle(pair, old);
+        }
+        return;
+    }
+
+    LockedHandoff* h = &pair->locked;
+    pthread_mutex_lock(&h->mutex);
+    queuePushTail(&h->delivered, frame);
+
+    Frame* old = NULL;
+    if (h->processed.length > 0) {
+        old = queuePop(&h->processed, false);
+    } else if (h->delivered.length > NUM_APP_FRAMES) {
+        old = queuePop(&h->delivered, false);
+    }
+    if (old) {
+        recycle(pair, old);
+    }
+    pthread_cond_signal(&h->cond);
+    pthread_mutex_unlock(&h->mutex);
+}
+
+static Frame* fetch(Pair* pair) {
+    if (pair->type == HANDOFF_RING) {
+        return popFrameRing(pair->ring);
+    }
+
+    LockedHandoff* h = &pair->locked;
+    pthread_mutex_lock(&h->mutex);
+    while (h->delivered.length < 1 && !h->closed) {
+        pthread_cond_wait(&h->cond, &h->mutex);
+    }
+    Frame* frame = queuePop(&h->delivered, true);
+    pthread_mutex_unlock(&h->mutex);
+
+    return frame;
+}
+
+static void giveBack(Pair* pair, Frame* frame) {
+    if (pair->type == HANDOFF_RING) {
+        returnFrameRing(pair->ring, frame);
+        return;
+    }
+
+    LockedHandoff* h = &pair->locked;
+    pthread_mutex_lock(&h->mutex);
+    queuePushTail(&h->processed, frame);
+    pthread_mutex_unlock(&h->mutex);
+}
+
+static void closeHandoff(Pair* pair) {
+    if (pair->type == HANDOFF_RING) {
+        closeFrameRing(pair->ring);
+        return;
+    }
+
+    LockedHandoff* h = &pair->locked;
+    pthread_mutex_lock(&h->mutex);
+    h->closed = true;
+    pthread_cond_broadcast(&h->cond);
+    pthread_mutex_unlock(&h->mutex);
+}
+
+static void* producerEntry(void* data) {
+    Pair* pair = (Pair*) data;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    double start = nowNs();
+    for (unsigned int i = 0; i < pair->numFrames; i++) {
+        if (pair->intervalUs) {
+            next.tv_nsec += (long) pair->intervalUs * 1000;
+            while (next.tv_nsec >= 1000000000L) {
+                next.tv_nsec -= 1000000000L;
+                next.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+
+        if (pair->numFree == 0) {
+            fprintf(stderr, "Producer ran out of frames\n");
+            exit(EXIT_FAILURE);
+        }
+        Frame* frame = pair->free[--pair->numFree];
+        frame->publishNs = nowNs();
+        publish(pair, frame);
+    }
+    pair->producerNs = nowNs() - start;
+
+    closeHandoff(pair);
+
+    return NULL;
+}
+
+static void* consumerEntry(void* data) {
+    Pair* pair = (Pair*) data;
+    Frame* frame;
+
+    while ((frame = fetch(pair))) {
+        pair->latency[pair->received++] = nowNs() - frame->publishNs;
+        giveBack(pair, frame);
+    }
+
+    return NULL;
+}
+
+static void initPair(Pair* pair, HandoffType type, unsigned int numFrames,
+                     unsigned int intervalUs) {
+    memset(pair, 0, sizeof(*pair));
+    pair->type = type;
+    pair->numFrames = numFrames;
+    pair->intervalUs = intervalUs;
+
+    for (unsigned int i = 0; i < NUM_FRAMES; i++) {
+        recycle(pair, &pair->frames[i]);
+    }
+
+    pair->latency = malloc(numFrames * sizeof(double));
+    if (type == HANDOFF_RING) {
+        pair->ring = createFrameRing(NUM_APP_FRAMES, NUM_FRAMES);
+    } else {
+        pthread_mutex_init(&pair->locked.mutex, NULL);
+        pthread_cond_init(&pair->locked.cond, NULL);
+    }
+    if (!pair->latency || (type == HANDOFF_RING && !pair->ring)) {
+        fprintf(stderr, "Failed to set up handoff\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void clearPair(Pair* pair) {
+    if (pair->type == HANDOFF_RING) {
+        destroyFrameRing(pair->ring);
+    } else {
+        while (queuePop(&pair->locked.delivered, false)) {
+        }
+        while (queuePop(&pair->locked.processed, false)) {
+        }
+        pthread_cond_destroy(&pair->locked.cond);
+        pthread_mutex_destroy(&pair->locked.mutex);
+    }
+    free(pair->latency);
+}
+
+/**
+ * brief Run all pairs with one handoff type and print the results.
+ */
+static void runHandoff(const char* name, HandoffType type,
+                       unsigned int numPairs, unsigned int numFrames,
+                       unsigned int intervalUs) {
+    Pair* pairs = calloc(numPairs, sizeof(Pair));
+    if (!pairs) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (unsigned int i = 0; i < numPairs; i++) {
+        initPair(&pairs[i], type, numFrames, intervalUs);
+    }
+    for (unsigned int i = 0; i < numPairs; i++) {
+        if (pthread_create(&pairs[i].consumer, NULL, consumerEntry,
+                           &pairs[i]) ||
+            pthread_create(&pairs[i].producer, NULL, producerEntry,
+                           &pairs[i])) {
+            fprintf(stderr, "Failed to create threads\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    unsigned int received = 0;
+    double producerNs = 0.0;
+    for (unsigned int i = 0; i < numPairs; i++) {
+        pthread_join(pairs[i].producer, NULL);
+        pthread_join(pairs[i].consumer, NULL);
+        received += pairs[i].received;
+        producerNs += pairs[i].producerNs;
+    }
+
+    // Latencies of all pairs together.
+    double* all = malloc((received ? received : 1) * sizeof(double));
+    if (!all) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    unsigned int n = 0;
+    for (unsigned int i = 0; i < numPairs; i++) {
+        memcpy(all + n, pairs[i].latency, pairs[i].received * sizeof(double));
+        n += pairs[i].received;
+    }
+    qsort(all, n, sizeof(double), compareDouble);
+
+    double published = (double) numFrames * numPairs;
+    if (intervalUs) {
+        printf("%-8s received %5.1f%%  latency p50 %7.2f p90 %7.2f p99 %7.2f "
+               "max %8.2f us\n",
+               name, 100.0 * received / published, n ? all[n / 2] / 1e3 : 0.0,
+               n ? all[(n * 9) / 10] / 1e3 : 0.0,
+               n ? all[(n * 99) / 100] / 1e3 : 0.0,
+               n ? all[n - 1] / 1e3 : 0.0);
+    } else {
+        printf("%-8s %8.3f Mframes/s published  %7.1f ns/frame  received "
+               "%5.1f%%\n",
+               name, published / producerNs * 1e3 * numPairs,
+               producerNs / published, 100.0 * received / published);
+    }
+
+    free(all);
+    for (unsigned int i = 0; i < numPairs; i++) {
+        clearPair(&pairs[i]);
+    }
+    free(pairs);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [-n FRAMES] [-i INTERVAL_US] [-p PAIRS]\n"
+            "  -n  Frames published per producer (default %d).\n"
+            "  -i  Interval between frames in the paced run (default %d).\n"
+            "  -p  Producer/consumer pairs running at once (default 1).\n",
+            prog, DEFAULT_FRAMES, DEFAULT_INTERVAL_US);
+}
+
+int main(int argc, char** argv) {
+    unsigned int numFrames = DEFAULT_FRAMES;
+    unsigned int intervalUs = DEFAULT_INTERVAL_US;
+    unsigned int numPairs = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:i:p:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            numFrames = (unsigned int) strtoul(optarg, NULL, 10);
+            break;
+        case 'i':
+            intervalUs = (unsigned int) strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            numPairs = (unsigned int) strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (numFrames == 0 || intervalUs == 0 || numPairs == 0 ||
+        numPairs > MAX_PAIRS) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%u pair(s), %u frames each\n", numPairs, numFrames);
+
+    printf("\nPaced, one frame every %u us\n", intervalUs);
+    runHandoff("locked", HANDOFF_LOCKED, numPairs, numFrames, intervalUs);
+    runHandoff("ring", HANDOFF_RING, numPairs, numFrames, intervalUs);
+
+    printf("\nUnpaced\n");
+    runHandoff("locked", HANDOFF_LOCKED, numPairs, numFrames, 0);
+    runHandoff("ring", HANDOFF_RING, numPairs, numFrames, 0);
+
+    return EXIT_SUCCESS;
+}
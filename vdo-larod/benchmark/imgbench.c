@@ -0,0 +1,901 @@
+/**
+ * Copyright (C) 2021, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Host benchmark of the conversion paths in imgconverter.c.
+ *
+ * Synthetic NV12 frames are generated for a range of common stream sizes.
+ * Every conversion path is timed over a number of iterations and the output
+ * of the last iteration is compared with a double precision golden
+ * reference. The process exits with a failure if any path is outside its
+ * tolerance, so it can be used to validate SIMD changes.
+ *
+ * Throughput (MPix/s and ns/px) is given per source frame pixel, so paths
+ * producing different output sizes from the same frame can be compared.
+ */
+
+#include <getopt.h>
+#include <libyuv.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "imgconverter.h"
+#include "rowpool.h"
+
+#define DEFAULT_ITERATIONS (30)
+#define WARMUP_ITERATIONS (2)
+#define MAX_SIZES (16)
+
+/// Default model input size used for the crop/scale paths.
+#define MODEL_WIDTH (224)
+#define MODEL_HEIGHT (224)
+
+/// Number of ROIs in the batch path, the last one is the whole frame.
+#define NUM_ROIS (8)
+
+/// Row padding and rows between the planes of the padded frame copy.
+#define PAD_BYTES (64)
+#define PAD_ROWS (8)
+
+typedef enum { MATRIX_ANALOG_FULL, MATRIX_BT601_LIMITED } Matrix;
+
+/**
+ * brief Frame and buffers shared by all paths for one stream size.
+ */
+typedef struct Bench {
+    unsigned int width;
+    unsigned int height;
+    uint8_t* nv12;
+    /// Copy of nv12 with padded rows and a gap between the planes, used
+    /// instead of nv12 by the converter paths when usePadded is set.
+    uint8_t* padded;
+    ImgNv12Layout_t paddedLayout;
+    bool usePadded;
+
+    uint8_t* rgb;
+    float* rgbFloat;
+    /// Golden reference at full size for each matrix.
+    double* golden[2];
+
+    RowPool_t* pool;
+    ImgConverter_t* converter;
+    ImgScalePath scalePath;
+    /// Use the generic horizontal filters even if there is a fixed kernel
+    /// for the stream and model size.
+    bool genericFilters;
+    ImgNv12Scaler_t* scaler;
+    unsigned int dstWidth;
+    unsigned int dstHeight;
+
+    /// ROIs and batched output for convertFrameRois().
+    ImgRoi_t rois[NUM_ROIS];
+    uint8_t* batch;
+} Bench;
+
+typedef void (*BenchFunc)(Bench* bench);
+
+typedef struct Tolerance {
+    double maxDiff;
+    double meanDiff;
+} Tolerance;
+
+/// Scaling in 8-bit YUV and rounding the fixed-point color conversion each
+/// add up to about one step compared with the golden reference.
+#define CROP_SCALE_TOLERANCE ((Tolerance){4.0, 1.0})
+
+/// libyuv's NV12ToARGB uses 6-bit coefficients and ARGBScale rounds in ARGB,
+/// which biases the legacy path by about 1.4 steps on average and 3.5 at most.
+#define LEGACY_TOLERANCE ((Tolerance){6.0, 2.0})
+
+static bool allPassed = true;
+
+static double nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compareDouble(const void* a, const void* b) {
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * brief Fill an NV12 frame with smooth gradients and a little noise.
+ *
+ * Values are kept well inside the RGB gamut so that the naive path, which
+ * does not clamp, can be checked too.
+ *
+ * param nv12 Output frame.
+ * param width Frame width.
+ * param height Frame height.
+ */
+static void generateFrame(uint8_t* nv12, unsigned int width,
+                          unsigned int height) {
+    uint32_t seed = 0x12345678u ^ (width * 31u + height);
+    uint8_t* uv = nv12 + (size_t) width * height;
+
+    for (unsigned int y = 0; y < height; y++) {
+        for (unsigned int x = 0; x < width; x++) {
+            // xorshift32
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            double ramp = (double) (x + y) / (width + height);
+            nv12[(size_t) y * width + x] =
+                (uint8_t) (40 + 140 * ramp + (seed & 7));
+        }
+    }
+    for (unsigned int y = 0; y < height / 2; y++) {
+        for (unsigned int x = 0; x < width / 2; x++) {
+            uint8_t* p = uv + (size_t) y * width + 2 * x;
+            p[0] = (uint8_t) lround(128 + 20 * sin(6.2832 * x / (width / 2)));
+            p[1] = (uint8_t) lround(128 + 40 * cos(6.2832 * y / (height / 2)));
+        }
+    }
+}
+
+/**
+ * brief Copy a packed NV12 frame into a buffer with padded rows.
+ *
+ * The padding is filled with a value far from the frame content, so reading
+ * it shows up as a large difference from the golden reference.
+ *
+ * param bench Benchmark state with nv12 filled in.
+ */
+static void makePaddedFrame(Bench* bench) {
+    const unsigned int w = bench->width;
+    const unsigned int h = bench->height;
+    ImgNv12Layout_t* layout = &bench->paddedLayout;
+
+    layout->yPitch = w + PAD_BYTES;
+    layout->uvPitch = w + PAD_BYTES;
+    layout->yOffset = 0;
+    layout->uvOffset = (size_t) layout->yPitch * (h + PAD_ROWS);
+
+    size_t size = layout->uvOffset + (size_t) layout->uvPitch * (h / 2);
+    bench->padded = malloc(size);
+    if (!bench->padded) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(bench->padded, 0xff, size);
+
+    for (unsigned int y = 0; y < h; y++) {
+        memcpy(bench->padded + (size_t) y * layout->yPitch,
+               bench->nv12 + (size_t) y * w, w);
+    }
+    for (unsigned int y = 0; y < h / 2; y++) {
+        memcpy(bench->padded + layout->uvOffset + (size_t) y * layout->uvPitch,
+               bench->nv12 + (size_t) w * h + (size_t) y * w, w);
+    }
+}
+
+static double clamp255(double v) {
+    return v < 0.0 ? 0.0 : (v > 255.0 ? 255.0 : v);
+}
+
+static void goldenPixel(double yVal, double uVal, double vVal, Matrix matrix,
+                        double rgb[3]) {
+    if (matrix == MATRIX_ANALOG_FULL) {
+        double y = yVal / 255.0;
+        double u = uVal / 255.0 - 0.5;
+        double v = vVal / 255.0 - 0.5;
+        rgb[0] = (y + 1.13983 * v) * 255.0;
+        rgb[1] = (y - 0.39465 * u - 0.58060 * v) * 255.0;
+        rgb[2] = (y + 2.03211 * u) * 255.0;
+    } else {
+        double y = 1.164 * (yVal - 16.0);
+        rgb[0] = y + 1.596 * (vVal - 128.0);
+        rgb[1] = y - 0.391 * (uVal - 128.0) - 0.813 * (vVal - 128.0);
+        rgb[2] = y + 2.018 * (uVal - 128.0);
+    }
+    for (int c = 0; c < 3; c++) {
+        rgb[c] = clamp255(rgb[c]);
+    }
+}
+
+/**
+ * brief Golden full size conversion, chroma is upsampled by repetition.
+ */
+static void goldenConvert(const uint8_t* nv12, unsigned int width,
+                          unsigned int height, Matrix matrix, double* out) {
+    const uint8_t* uv = nv12 + (size_t) width * height;
+
+    for (unsigned int y = 0; y < height; y++) {
+        for (unsigned int x = 0; x < width; x++) {
+            const uint8_t* c = uv + (size_t) (y / 2) * width + (x & ~1u);
+            goldenPixel(nv12[(size_t) y * width + x], c[0], c[1], matrix,
+                        out + 3 * ((size_t) y * width + x));
+        }
+    }
+}
+
+/// Luma weights of red and blue for each ImgColorMatrix.
+static const double kLumaWeights[2][2] = {
+    [IMG_MATRIX_BT601] = {0.299, 0.114},
+    [IMG_MATRIX_BT709] = {0.2126, 0.0722},
+};
+
+/**
+ * brief Correctly rounded full size conversion for any matrix and range,
+ * chroma is upsampled by repetition.
+ *
+ * This is what the lookup tables of convertU8yuvToRGBlut() compute.
+ */
+static void roundedConvert(const uint8_t* nv12, unsigned int width,
+                           unsigned int height, ImgColorMatrix matrix,
+                           ImgColorRange range, double* out) {
+    const uint8_t* uv = nv12 + (size_t) width * height;
+    const double kr = kLumaWeights[matrix][0];
+    const double kb = kLumaWeights[matrix][1];
+    const double kg = 1.0 - kr - kb;
+    const bool limited = range == IMG_RANGE_LIMITED;
+    const double yScale = limited ? 255.0 / 219.0 : 1.0;
+    const double cScale = limited ? 255.0 / 224.0 : 1.0;
+    const double yOffset = limited ? 16.0 : 0.0;
+
+    for (unsigned int y = 0; y < height; y++) {
+        for (unsigned int x = 0; x < width; x++) {
+            const uint8_t* c = uv + (size_t) (y / 2) * width + (x & ~1u);
+            double luma = yScale * (nv12[(size_t) y * width + x] - yOffset);
+            double u = cScale * (c[0] - 128.0);
+            double v = cScale * (c[1] - 128.0);
+            double* rgb = out + 3 * ((size_t) y * width + x);
+
+            rgb[0] = luma + 2.0 * (1.0 - kr) * v;
+            rgb[1] = luma - 2.0 * kb * (1.0 - kb) / kg * u -
+                     2.0 * kr * (1.0 - kr) / kg * v;
+            rgb[2] = luma + 2.0 * (1.0 - kb) * u;
+            for (int i = 0; i < 3; i++) {
+                rgb[i] = round(clamp255(rgb[i]));
+            }
+        }
+    }
+}
+
+/**
+ * brief Pixel center aligned bilinear sample position, clamped to the plane.
+ */
+static double samplePos(double start, double len, unsigned int dstLen,
+                        unsigned int i, unsigned int limit) {
+    double pos = start + (i + 0.5) * len / dstLen - 0.5;
+    return pos < 0.0 ? 0.0 : (pos > limit - 1 ? limit - 1 : pos);
+}
+
+static double bilinear(const uint8_t* plane, size_t stride, unsigned int step,
+                       unsigned int w, unsigned int h, double fx, double fy) {
+    unsigned int x0 = (unsigned int) fx;
+    unsigned int y0 = (unsigned int) fy;
+    unsigned int x1 = x0 + 1 < w ? x0 + 1 : x0;
+    unsigned int y1 = y0 + 1 < h ? y0 + 1 : y0;
+    double wx = fx - x0;
+    double wy = fy - y0;
+    double top = plane[y0 * stride + x0 * step] * (1 - wx) +
+                 plane[y0 * stride + x1 * step] * wx;
+    double bottom = plane[y1 * stride + x0 * step] * (1 - wx) +
+                    plane[y1 * stride + x1 * step] * wx;
+    return top * (1 - wy) + bottom * wy;
+}
+
+/**
+ * brief Golden crop, bilinear scale and BT.601 conversion of a converter.
+ *
+ * Uses the converter's crop and content rectangles, pixels outside the
+ * content rectangle are expected to be black padding.
+ */
+static void goldenCropScale(const Bench* bench,
+                            const ImgConverter_t* converter, double* out) {
+    const unsigned int w = bench->width;
+    const unsigned int h = bench->height;
+    const uint8_t* uv = bench->nv12 + (size_t) w * h;
+    unsigned int crop[4];
+    unsigned int content[4];
+
+    getImgConverterGeometry(converter, crop, content);
+
+    for (unsigned int y = 0; y < bench->dstHeight; y++) {
+        for (unsigned int x = 0; x < bench->dstWidth; x++) {
+            double* rgb = out + 3 * ((size_t) y * bench->dstWidth + x);
+            if (x < content[0] || x >= content[0] + content[2] ||
+                y < content[1] || y >= content[1] + content[3]) {
+                rgb[0] = rgb[1] = rgb[2] = 0.0;
+                continue;
+            }
+            unsigned int cx = x - content[0];
+            unsigned int cy = y - content[1];
+            double yVal = bilinear(
+                bench->nv12, w, 1, w, h,
+                samplePos(crop[0], crop[2], content[2], cx, w),
+                samplePos(crop[1], crop[3], content[3], cy, h));
+            double fx = samplePos(crop[0] / 2.0, crop[2] / 2.0, content[2], cx,
+                                  w / 2);
+            double fy = samplePos(crop[1] / 2.0, crop[3] / 2.0, content[3], cy,
+                                  h / 2);
+            double uVal = bilinear(uv, w, 2, w / 2, h / 2, fx, fy);
+            double vVal = bilinear(uv + 1, w, 2, w / 2, h / 2, fx, fy);
+            goldenPixel(yVal, uVal, vVal, MATRIX_BT601_LIMITED, rgb);
+        }
+    }
+}
+
+/**
+ * brief Compare output with the golden reference and print the result.
+ *
+ * param u8 Output as uint8, or NULL.
+ * param f32 Output as float already mapped to 0..255, or NULL.
+ * param golden Golden reference.
+ * param count Number of values.
+ * param tol Allowed difference.
+ */
+static void checkGolden(const uint8_t* u8, const float* f32,
+                        const double* golden, size_t count, Tolerance tol) {
+    double maxDiff = 0.0;
+    double sumDiff = 0.0;
+
+    for (size_t i = 0; i < count; i++) {
+        double v = u8 ? u8[i] : f32[i];
+        double d = fabs(v - golden[i]);
+        maxDiff = d > maxDiff ? d : maxDiff;
+        sumDiff += d;
+    }
+
+    double meanDiff = sumDiff / count;
+    bool ok = maxDiff <= tol.maxDiff && meanDiff <= tol.meanDiff;
+    allPassed = allPassed && ok;
+
+    printf("  max %5.2f mean %5.3f %s\n", maxDiff, meanDiff, ok ? "ok" : "FAIL");
+}
+
+/**
+ * brief Check the 8-bit conversion of every matrix and range, untimed.
+ *
+ * With NEON or SSE2 this compares the vector path with the lookup tables,
+ * which must agree within one step. Without them the tables are checked on
+ * their own.
+ */
+static void checkColors(Bench* bench) {
+    static const char* matrixNames[2] = {"bt601", "bt709"};
+    static const char* rangeNames[2] = {"limited", "full"};
+    const size_t count = (size_t) bench->width * bench->height * 3;
+
+    double* rounded = malloc(count * sizeof(double));
+    if (!rounded) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int m = IMG_MATRIX_BT601; m <= IMG_MATRIX_BT709; m++) {
+        for (int r = IMG_RANGE_LIMITED; r <= IMG_RANGE_FULL; r++) {
+            char name[32];
+            snprintf(name, sizeof(name), "lut %s %s", matrixNames[m],
+                     rangeNames[r]);
+
+            convertU8yuvToRGBlut(bench->width, bench->height, bench->nv12,
+                                 NULL, bench->rgb, m, r, bench->pool);
+            roundedConvert(bench->nv12, bench->width, bench->height, m, r,
+                           rounded);
+            printf("%-24s", name);
+            checkGolden(bench->rgb, NULL, rounded, count,
+                        (Tolerance){1.0, 0.1});
+        }
+    }
+
+    free(rounded);
+}
+
+/**
+ * brief Time a path and print throughput and latency percentiles.
+ */
+static void timePath(const char* name, BenchFunc func, Bench* bench,
+                     unsigned int iterations) {
+    double* samples = malloc(iterations * sizeof(double));
+    if (!samples) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (unsigned int i = 0; i < WARMUP_ITERATIONS; i++) {
+        func(bench);
+    }
+    for (unsigned int i = 0; i < iterations; i++) {
+        double start = nowNs();
+        func(bench);
+        samples[i] = nowNs() - start;
+    }
+    qsort(samples, iterations, sizeof(double), compareDouble);
+
+    double pixels = (double) bench->width * bench->height;
+    double p50 = samples[iterations / 2];
+    double p90 = samples[(iterations * 9) / 10];
+    double p99 = samples[(iterations * 99) / 100];
+
+    printf("%-24s %8.1f MPix/s %7.3f ns/px  p50 %8.3f p90 %8.3f p99 %8.3f ms",
+           name, pixels / p50 * 1e3, p50 / pixels, p50 / 1e6, p90 / 1e6,
+           p99 / 1e6);
+    fflush(stdout);
+
+    free(samples);
+}
+
+static void runNaive(Bench* b) {
+    convertU8yuvToRGBnaive(b->width, b->height, b->nv12, NULL, b->rgb);
+}
+
+static void runLibYuv(Bench* b) {
+    convertU8yuvToRGBlibYuv(b->width, b->height, b->nv12, NULL, b->rgb, NULL);
+}
+
+static void runLibYuvPool(Bench* b) {
+    convertU8yuvToRGBlibYuv(b->width, b->height, b->nv12, NULL, b->rgb,
+                            b->pool);
+}
+
+static void runLut(Bench* b) {
+    convertU8yuvToRGBlut(b->width, b->height, b->nv12, NULL, b->rgb,
+                         IMG_MATRIX_BT601, IMG_RANGE_LIMITED, NULL);
+}
+
+static void runLutPool(Bench* b) {
+    convertU8yuvToRGBlut(b->width, b->height, b->nv12, NULL, b->rgb,
+                         IMG_MATRIX_BT601, IMG_RANGE_LIMITED, b->pool);
+}
+
+static void runLutPaddedPool(Bench* b) {
+    convertU8yuvToRGBlut(b->width, b->height, b->padded, &b->paddedLayout,
+                         b->rgb, IMG_MATRIX_BT601, IMG_RANGE_LIMITED, b->pool);
+}
+
+static void runFloat(Bench* b) {
+    // 0..255 output to compare directly with the golden reference.
+    convertU8yuvToFloat32RGB(b->width, b->height, b->nv12, NULL, b->rgbFloat,
+                             255.0f, 127.5f, NULL);
+}
+
+static void runFloatPool(Bench* b) {
+    convertU8yuvToFloat32RGB(b->width, b->height, b->nv12, NULL, b->rgbFloat,
+                             255.0f, 127.5f, b->pool);
+}
+
+/**
+ * brief The crop/scale path before it was fused: full size ARGB conversion,
+ * ARGB scaling and repacking, with buffers allocated per frame.
+ */
+static void runLegacyCropScale(Bench* b) {
+    const unsigned int w = b->width;
+    const unsigned int h = b->height;
+    uint8_t* big = malloc((size_t) w * h * 4);
+    uint8_t* small = malloc((size_t) b->dstWidth * b->dstHeight * 4);
+
+    if (!big || !small) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    NV12ToARGB(b->nv12, (int) w, b->nv12 + (size_t) w * h, (int) w, big,
+               (int) w * 4, (int) w, (int) h);
+
+    float ratio = (float) b->dstWidth / (float) b->dstHeight;
+    float clipW = (float) w;
+    float clipH = clipW / ratio;
+    if (clipH > (float) h) {
+        clipH = (float) h;
+        clipW = clipH * ratio;
+    }
+    unsigned int clipX = (w - (unsigned int) clipW) / 2;
+    unsigned int clipY = (h - (unsigned int) clipH) / 2;
+
+    ARGBScale(big + (size_t) w * 4 * clipY + 4 * clipX, (int) w * 4,
+              (int) clipW, (int) clipH, small, (int) b->dstWidth * 4,
+              (int) b->dstWidth, (int) b->dstHeight, kFilterBilinear);
+
+    for (size_t i = 0; i < (size_t) b->dstWidth * b->dstHeight; i++) {
+        b->rgb[3 * i] = small[4 * i + 2];
+        b->rgb[3 * i + 1] = small[4 * i + 1];
+        b->rgb[3 * i + 2] = small[4 * i];
+    }
+
+    free(big);
+    free(small);
+}
+
+static void runCropScaleOneShot(Bench* b) {
+    convertCropScaleU8yuvToRGB(b->nv12, b->width, b->height, NULL, b->rgb,
+                               b->dstWidth, b->dstHeight);
+}
+
+static void runConverter(Bench* b) {
+    convertFrame(b->converter, b->usePadded ? b->padded : b->nv12, b->rgb);
+}
+
+static void runNv12Scaler(Bench* b) {
+    scaleNv12Frame(b->scaler, b->nv12, b->rgb);
+}
+
+/**
+ * brief Time scaling to NV12 of the destination size.
+ *
+ * The output is checked through the nv12-first converter path, which
+ * produces the same samples.
+ *
+ * param bench Benchmark state.
+ * param pool Worker pool or NULL.
+ * param iterations Number of timed iterations.
+ */
+static void benchNv12Scaler(Bench* bench, RowPool_t* pool,
+                            unsigned int iterations) {
+    bench->scaler = createImgNv12Scaler(bench->width, bench->height,
+                                        bench->dstWidth, bench->dstHeight,
+                                        IMG_CROP_CENTER);
+    if (!bench->scaler || !setImgNv12ScalerPool(bench->scaler, pool)) {
+        fprintf(stderr, "Failed to set up NV12 scaler\n");
+        exit(EXIT_FAILURE);
+    }
+
+    timePath(pool ? "nv12 scale pool" : "nv12 scale", runNv12Scaler, bench,
+             iterations);
+    printf("\n");
+
+    destroyImgNv12Scaler(bench->scaler);
+    bench->scaler = NULL;
+}
+
+static void runConverterRois(Bench* b) {
+    convertFrameRois(b->converter, b->nv12, b->rois, NUM_ROIS, b->batch);
+}
+
+/**
+ * brief Time a batch of ROIs and compare the whole frame slot with the
+ * golden reference.
+ *
+ * Objects of different sizes spread over the frame, as from a detector.
+ *
+ * param bench Benchmark state.
+ * param pool Worker pool or NULL.
+ * param iterations Number of timed iterations.
+ * param golden Scratch for the golden reference.
+ */
+static void benchRois(Bench* bench, RowPool_t* pool, unsigned int iterations,
+                      double* golden) {
+    const size_t count = (size_t) bench->dstWidth * bench->dstHeight * 3;
+
+    for (unsigned int i = 0; i < NUM_ROIS - 1; i++) {
+        ImgRoi_t* roi = &bench->rois[i];
+        roi->width = bench->width / (2 + i % 4);
+        roi->height = bench->height / (2 + (i + 1) % 4);
+        roi->x = (bench->width - roi->width) * i / (NUM_ROIS - 1);
+        roi->y = (bench->height - roi->height) * (NUM_ROIS - 1 - i) /
+                 (NUM_ROIS - 1);
+    }
+    bench->rois[NUM_ROIS - 1] = (ImgRoi_t){0, 0, bench->width, bench->height};
+
+    bench->converter = createImgConverter(bench->width, bench->height,
+                                          bench->dstWidth, bench->dstHeight,
+                                          IMG_CROP_CENTER);
+    bench->batch = malloc(count * NUM_ROIS);
+    if (!bench->converter || !bench->batch ||
+        !setImgConverterPool(bench->converter, pool)) {
+        fprintf(stderr, "Failed to set up batch converter\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "converter %d rois%s", NUM_ROIS,
+             pool ? " pool" : "");
+    timePath(name, runConverterRois, bench, iterations);
+    // The converter's own geometry is that of the whole frame ROI.
+    goldenCropScale(bench, bench->converter, golden);
+    checkGolden(bench->batch + (NUM_ROIS - 1) * count, NULL, golden, count,
+                CROP_SCALE_TOLERANCE);
+
+    destroyImgConverter(bench->converter);
+    bench->converter = NULL;
+    free(bench->batch);
+    bench->batch = NULL;
+}
+
+/**
+ * brief Create a converter, time it and compare with the golden reference.
+ *
+ * param name Path name.
+ * param bench Benchmark state.
+ * param policy Crop policy.
+ * param pool Worker pool or NULL.
+ * param desc Output tensor format or NULL for interleaved uint8 RGB.
+ * param iterations Number of timed iterations.
+ * param golden Scratch for the golden reference.
+ */
+static void benchConverter(const char* name, Bench* bench,
+                           ImgCropPolicy policy, RowPool_t* pool,
+                           const ImgTensorDesc_t* desc,
+                           unsigned int iterations, double* golden) {
+    const size_t count = (size_t) bench->dstWidth * bench->dstHeight * 3;
+
+    bench->converter = createImgConverter(bench->width, bench->height,
+                                          bench->dstWidth, bench->dstHeight,
+                                          policy);
+    if (!bench->converter || !setImgConverterPool(bench->converter, pool) ||
+        !setImgConverterScalePath(bench->converter, bench->scalePath) ||
+        (bench->genericFilters &&
+         setImgConverterFixedKernel(bench->converter, false)) ||
+        (bench->usePadded &&
+         !setImgConverterSourceLayout(bench->converter,
+                                      &bench->paddedLayout)) ||
+        (desc && !setImgConverterOutput(bench->converter, desc))) {
+        fprintf(stderr, "Failed to set up converter for %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    timePath(name, runConverter, bench, iterations);
+    goldenCropScale(bench, bench->converter, golden);
+
+    if (desc && desc->layout == IMG_LAYOUT_CHW) {
+        // Planar int8 with zero point -128, convert back to interleaved RGB.
+        const size_t plane = (size_t) bench->dstWidth * bench->dstHeight;
+        uint8_t* rgb = malloc(count);
+        if (!rgb) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < plane; i++) {
+            for (int c = 0; c < 3; c++) {
+                rgb[3 * i + c] = (uint8_t) ((int8_t) bench->rgb[c * plane + i] + 128);
+            }
+        }
+        checkGolden(rgb, NULL, golden, count, CROP_SCALE_TOLERANCE);
+        free(rgb);
+    } else {
+        checkGolden(bench->rgb, NULL, golden, count, CROP_SCALE_TOLERANCE);
+    }
+
+    destroyImgConverter(bench->converter);
+    bench->converter = NULL;
+}
+
+static void benchSize(unsigned int width, unsigned int height,
+                      unsigned int modelWidth, unsigned int modelHeight,
+                      unsigned int iterations, RowPool_t* pool) {
+    const size_t pixels = (size_t) width * height;
+    Bench bench = {.width = width, .height = height, .pool = pool};
+
+    bench.nv12 = malloc(pixels * 3 / 2);
+    bench.rgb = malloc(pixels * 3);
+    bench.rgbFloat = malloc(pixels * 3 * sizeof(float));
+    bench.golden[MATRIX_ANALOG_FULL] = malloc(pixels * 3 * sizeof(double));
+    bench.golden[MATRIX_BT601_LIMITED] = malloc(pixels * 3 * sizeof(double));
+    if (!bench.nv12 || !bench.rgb || !bench.rgbFloat ||
+        !bench.golden[MATRIX_ANALOG_FULL] ||
+        !bench.golden[MATRIX_BT601_LIMITED]) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    generateFrame(bench.nv12, width, height);
+    makePaddedFrame(&bench);
+    goldenConvert(bench.nv12, width, height, MATRIX_ANALOG_FULL,
+                  bench.golden[MATRIX_ANALOG_FULL]);
+    goldenConvert(bench.nv12, width, height, MATRIX_BT601_LIMITED,
+                  bench.golden[MATRIX_BT601_LIMITED]);
+
+    printf("\n%u x %u NV12, %u bands\n", width, height, getRowPoolBands(pool));
+
+    // The naive path truncates instead of rounding.
+    timePath("naive", runNaive, &bench, iterations);
+    checkGolden(bench.rgb, NULL, bench.golden[MATRIX_ANALOG_FULL], pixels * 3,
+                (Tolerance){2.0, 1.0});
+
+    timePath("libyuv", runLibYuv, &bench, iterations);
+    checkGolden(bench.rgb, NULL, bench.golden[MATRIX_BT601_LIMITED],
+                pixels * 3, (Tolerance){3.0, 1.0});
+
+    timePath("libyuv pool", runLibYuvPool, &bench, iterations);
+    checkGolden(bench.rgb, NULL, bench.golden[MATRIX_BT601_LIMITED],
+                pixels * 3, (Tolerance){3.0, 1.0});
+
+    // Rounds correctly, the golden reference has rounded coefficients.
+    timePath("lut", runLut, &bench, iterations);
+    checkGolden(bench.rgb, NULL, bench.golden[MATRIX_BT601_LIMITED],
+                pixels * 3, (Tolerance){1.0, 0.5});
+
+    timePath("lut pool", runLutPool, &bench, iterations);
+    checkGolden(bench.rgb, NULL, bench.golden[MATRIX_BT601_LIMITED],
+                pixels * 3, (Tolerance){1.0, 0.5});
+
+    timePath("lut padded pool", runLutPaddedPool, &bench, iterations);
+    checkGolden(bench.rgb, NULL, bench.golden[MATRIX_BT601_LIMITED],
+                pixels * 3, (Tolerance){1.0, 0.5});
+
+    checkColors(&bench);
+
+    timePath("float", runFloat, &bench, iterations);
+    checkGolden(NULL, bench.rgbFloat, bench.golden[MATRIX_ANALOG_FULL],
+                pixels * 3, (Tolerance){2.0, 0.75});
+
+    timePath("float pool", runFloatPool, &bench, iterations);
+    checkGolden(NULL, bench.rgbFloat, bench.golden[MATRIX_ANALOG_FULL],
+                pixels * 3, (Tolerance){2.0, 0.75});
+
+    bench.dstWidth = modelWidth;
+    bench.dstHeight = modelHeight;
+    const size_t dstCount = (size_t) modelWidth * modelHeight * 3;
+    double* golden = malloc(dstCount * sizeof(double));
+    if (!golden) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    ImgConverter_t* center = createImgConverter(width, height, modelWidth,
+                                                modelHeight, IMG_CROP_CENTER);
+    if (!center) {
+        fprintf(stderr, "Failed to create converter\n");
+        exit(EXIT_FAILURE);
+    }
+    goldenCropScale(&bench, center, golden);
+    bool fixed = setImgConverterFixedKernel(center, true);
+    destroyImgConverter(center);
+
+    printf("\n%u x %u model input, %s horizontal filters\n", modelWidth,
+           modelHeight, fixed ? "fixed" : "generic");
+
+    timePath("legacy argb crop/scale", runLegacyCropScale, &bench, iterations);
+    checkGolden(bench.rgb, NULL, golden, dstCount, LEGACY_TOLERANCE);
+
+    timePath("crop/scale one-shot", runCropScaleOneShot, &bench, iterations);
+    checkGolden(bench.rgb, NULL, golden, dstCount, CROP_SCALE_TOLERANCE);
+
+    benchConverter("converter center", &bench, IMG_CROP_CENTER, NULL, NULL,
+                   iterations, golden);
+    benchConverter("converter center pool", &bench, IMG_CROP_CENTER, pool,
+                   NULL, iterations, golden);
+    if (fixed) {
+        bench.genericFilters = true;
+        benchConverter("generic center", &bench, IMG_CROP_CENTER, NULL, NULL,
+                       iterations, golden);
+        benchConverter("generic center pool", &bench, IMG_CROP_CENTER, pool,
+                       NULL, iterations, golden);
+        bench.genericFilters = false;
+    }
+    benchConverter("converter letterbox pool", &bench, IMG_CROP_LETTERBOX,
+                   pool, NULL, iterations, golden);
+
+    // Chroma at half the output resolution, compared with the same golden
+    // reference since the test frame has smooth colors.
+    bench.scalePath = IMG_SCALE_NV12_FIRST;
+    benchConverter("nv12-first center", &bench, IMG_CROP_CENTER, NULL, NULL,
+                   iterations, golden);
+    benchConverter("nv12-first center pool", &bench, IMG_CROP_CENTER, pool,
+                   NULL, iterations, golden);
+    bench.scalePath = IMG_SCALE_FUSED;
+
+    bench.usePadded = true;
+    benchConverter("converter padded pool", &bench, IMG_CROP_CENTER, pool,
+                   NULL, iterations, golden);
+    bench.usePadded = false;
+
+    benchNv12Scaler(&bench, NULL, iterations);
+    benchNv12Scaler(&bench, pool, iterations);
+
+    benchRois(&bench, NULL, iterations, golden);
+    benchRois(&bench, pool, iterations, golden);
+
+    ImgTensorDesc_t desc;
+    initImgTensorDesc(&desc);
+    desc.layout = IMG_LAYOUT_CHW;
+    desc.dataType = IMG_DTYPE_INT8;
+    desc.quantZeroPoint = -128;
+    benchConverter("converter chw int8 pool", &bench, IMG_CROP_CENTER, pool,
+                   &desc, iterations, golden);
+
+    free(golden);
+    free(bench.nv12);
+    free(bench.padded);
+    free(bench.rgb);
+    free(bench.rgbFloat);
+    free(bench.golden[MATRIX_ANALOG_FULL]);
+    free(bench.golden[MATRIX_BT601_LIMITED]);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [-n ITERATIONS] [-t WORKERS] [-m WIDTHxHEIGHT] "
+            "[-s WIDTHxHEIGHT]...\n"
+            "  -n  Timed iterations per path (default %d).\n"
+            "  -t  Worker threads for the pool paths, 0 = one per extra core.\n"
+            "  -m  Model input size for the crop/scale paths (default "
+            "%dx%d).\n"
+            "  -s  Stream size, can be repeated. Default is 640x360 up to "
+            "3840x2160.\n",
+            prog, DEFAULT_ITERATIONS, MODEL_WIDTH, MODEL_HEIGHT);
+}
+
+int main(int argc, char** argv) {
+    unsigned int sizes[MAX_SIZES][2];
+    unsigned int numSizes = 0;
+    unsigned int iterations = DEFAULT_ITERATIONS;
+    unsigned int workers = 0;
+    unsigned int modelWidth = MODEL_WIDTH;
+    unsigned int modelHeight = MODEL_HEIGHT;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:m:s:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = (unsigned int) strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            workers = (unsigned int) strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            if (sscanf(optarg, "%ux%u", &modelWidth, &modelHeight) != 2 ||
+                modelWidth == 0 || modelHeight == 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's':
+            if (numSizes == MAX_SIZES ||
+                sscanf(optarg, "%ux%u", &sizes[numSizes][0],
+                       &sizes[numSizes][1]) != 2 ||
+                sizes[numSizes][0] < 2 || sizes[numSizes][1] < 2 ||
+                sizes[numSizes][0] % 2 || sizes[numSizes][1] % 2) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            numSizes++;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (iterations == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (numSizes == 0) {
+        static const unsigned int defaults[][2] = {
+            {640, 360}, {1280, 720}, {1920, 1080}, {2560, 1440}, {3840, 2160}};
+        for (; numSizes < sizeof(defaults) / sizeof(defaults[0]); numSizes++) {
+            sizes[numSizes][0] = defaults[numSizes][0];
+            sizes[numSizes][1] = defaults[numSizes][1];
+        }
+    }
+
+    RowPool_t* pool = createRowPool(workers);
+    if (!pool) {
+        fprintf(stderr, "Failed to create worker pool\n");
+        return EXIT_FAILURE;
+    }
+
+    for (unsigned int i = 0; i < numSizes; i++) {
+        benchSize(sizes[i][0], sizes[i][1], modelWidth, modelHeight,
+                  iterations, pool);
+    }
+
+    destroyRowPool(pool);
+
+    printf("\n%s\n", allPassed ? "All paths within tolerance" :
+                                 "Some paths are outside tolerance");
+
+    return allPassed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,240 @@
+/**
+ * Copyright (C) 2021, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Host benchmark of the preprocessing pipeline on recorded frames.
+ *
+ * Frames are replayed from a recording made with vdo_larod --record, or
+ * from a synthetic recording written with -g, and converted to the model
+ * input the same way vdo_larod does. Unpaced, every frame is converted in
+ * order, so two runs on the same recording do the same work. Paced with -r,
+ * frames the pipeline is too slow for are skipped like on a camera, and the
+ * latency from the frame being due to it being converted is reported too.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "imgconverter.h"
+#include "imgreplay.h"
+#include "rowpool.h"
+
+/// Model input size, as in imgbench.
+#define MODEL_WIDTH (224)
+#define MODEL_HEIGHT (224)
+
+static double nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compareDouble(const void* a, const void* b) {
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * brief Write a synthetic recording of a gradient moving across the frame.
+ *
+ * param path Recording file to write.
+ * param width Frame width.
+ * param height Frame height.
+ * param numFrames Number of frames to write.
+ * return False if any errors occur, otherwise true.
+ */
+static bool writeSyntheticRecording(const char* path, unsigned int width,
+                                    unsigned int height,
+                                    unsigned int numFrames) {
+    bool ret = false;
+    uint8_t* nv12 = malloc((size_t) width * height * 3 / 2);
+    ImgRecorder_t* recorder = createImgRecorder(path, width, height, width,
+                                                width, (size_t) width * height);
+    if (!nv12 || !recorder) {
+        fprintf(stderr, "Failed to set up recording %s\n", path);
+        goto end;
+    }
+
+    uint8_t* uv = nv12 + (size_t) width * height;
+    for (unsigned int f = 0; f < numFrames; f++) {
+        for (unsigned int y = 0; y < height; y++) {
+            for (unsigned int x = 0; x < width; x++) {
+                nv12[(size_t) y * width + x] =
+                    (uint8_t) (40 + (x + y + 4 * f) % 140);
+            }
+        }
+        for (unsigned int y = 0; y < height / 2; y++) {
+            for (unsigned int x = 0; x < width / 2; x++) {
+                uint8_t* p = uv + (size_t) y * width + 2 * x;
+                p[0] = (uint8_t) lround(128 + 20 * sin(6.2832 * (x + f) /
+                                                       (width / 2)));
+                p[1] = (uint8_t) lround(128 + 40 * cos(6.2832 * y /
+                                                       (height / 2)));
+            }
+        }
+        if (!recordFrame(recorder, nv12)) {
+            fprintf(stderr, "Failed to write %s\n", path);
+            goto end;
+        }
+    }
+
+    ret = true;
+
+end:
+    destroyImgRecorder(recorder);
+    free(nv12);
+
+    return ret;
+}
+
+static void printPercentiles(const char* name, double* samples,
+                             unsigned int count) {
+    qsort(samples, count, sizeof(double), compareDouble);
+    printf("%-12s p50 %8.3f p90 %8.3f p99 %8.3f max %8.3f ms\n", name,
+           samples[count / 2] / 1e6, samples[(count * 9) / 10] / 1e6,
+           samples[(count * 99) / 100] / 1e6, samples[count - 1] / 1e6);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s -s WIDTHxHEIGHT [-r FPS] [-n FRAMES] [-t WORKERS] "
+            "[-g FRAMES] RECORDING\n"
+            "  -s  Frame size of the recording.\n"
+            "  -r  Replay at FPS frames per second, default is as fast as "
+            "possible.\n"
+            "  -n  Frames to convert, default is one pass over the "
+            "recording.\n"
+            "  -t  Worker threads for the conversion, 0 = one per extra "
+            "core.\n"
+            "  -g  First write a synthetic recording of FRAMES frames to "
+            "RECORDING.\n",
+            prog);
+}
+
+int main(int argc, char** argv) {
+    unsigned int width = 0;
+    unsigned int height = 0;
+    double fps = 0;
+    unsigned int numFrames = 0;
+    unsigned int workers = 0;
+    unsigned int generate = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:r:n:t:g:h")) != -1) {
+        switch (opt) {
+        case 's':
+            if (sscanf(optarg, "%ux%u", &width, &height) != 2) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'r':
+            fps = strtod(optarg, NULL);
+            break;
+        case 'n':
+            numFrames = (unsigned int) strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            workers = (unsigned int) strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            generate = (unsigned int) strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || width == 0 || height == 0 || fps < 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char* path = argv[optind];
+
+    // The replay reports its errors to syslog, show them here too.
+    openlog("replaybench", LOG_PERROR, LOG_USER);
+    setlogmask(LOG_UPTO(LOG_WARNING));
+
+    if (generate && !writeSyntheticRecording(path, width, height, generate)) {
+        return EXIT_FAILURE;
+    }
+
+    RowPool_t* pool = createRowPool(workers);
+    ImgReplay_t* replay = createImgReplay(path, width, height, fps, true);
+    ImgConverter_t* converter = createImgConverter(
+        width, height, MODEL_WIDTH, MODEL_HEIGHT, IMG_CROP_CENTER);
+    uint8_t* rgb = malloc((size_t) MODEL_WIDTH * MODEL_HEIGHT * 3);
+    if (!pool || !replay || !converter || !rgb ||
+        !setImgConverterPool(converter, pool)) {
+        fprintf(stderr, "Failed to set up replay of %s\n", path);
+        return EXIT_FAILURE;
+    }
+    if (numFrames == 0) {
+        numFrames = getReplayNumFrames(replay);
+    }
+
+    double* convertNs = malloc(numFrames * sizeof(double));
+    double* latencyNs = malloc(numFrames * sizeof(double));
+    if (!convertNs || !latencyNs) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    unsigned int skipped = 0;
+    double start = nowNs();
+    for (unsigned int i = 0; i < numFrames; i++) {
+        ImgReplayFrame_t frame;
+        getReplayFrame(replay, &frame);
+        skipped += frame.framesSkipped;
+
+        double convertStart = nowNs();
+        if (!convertFrame(converter, frame.data, rgb)) {
+            fprintf(stderr, "Failed to convert frame %u\n", frame.sequenceNbr);
+            return EXIT_FAILURE;
+        }
+        double done = nowNs();
+        convertNs[i] = done - convertStart;
+        latencyNs[i] = done - (double) frame.captureTimeUs * 1e3;
+    }
+    double elapsed = nowNs() - start;
+
+    printf("%u x %u to %u x %u, %u bands, %s\n", width, height, MODEL_WIDTH,
+           MODEL_HEIGHT, getRowPoolBands(pool),
+           fps > 0 ? "paced" : "unpaced");
+    printf("Converted %u frames in %.1f ms, %.1f fps, %u frames skipped\n",
+           numFrames, elapsed / 1e6, numFrames / elapsed * 1e9, skipped);
+    printPercentiles("convert", convertNs, numFrames);
+    if (fps > 0) {
+        printPercentiles("latency", latencyNs, numFrames);
+    }
+
+    free(convertNs);
+    free(latencyNs);
+    free(rgb);
+    destroyImgConverter(converter);
+    destroyImgReplay(replay);
+    destroyRowPool(pool);
+
+    return EXIT_SUCCESS;
+}